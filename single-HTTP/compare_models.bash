@@ -0,0 +1,47 @@
+#!/bin/bash
+
+# Replays one capture against single-HTTP and each of its siblings in turn,
+# every server started with the same configuration. The siblings lack much of
+# what single-HTTP serves (ranges, compression, the caches, HTTP/2, TLS, rate
+# limits and admission control, see the README), so the work only matches for
+# a capture that keeps to what they share; compare the status classes replay
+# prints for each. Servers that were not built are skipped. Options after the
+# capture go to replay, -s 0 by default.
+#
+# Usage: ./compare_models.bash configuration capture_file [replay options]
+
+if [[ $# -lt 2 ]]; then
+	echo "Usage: $0 configuration capture_file [replay options]" >&2
+	exit 1
+fi
+
+conf=$1
+capture=$2
+shift 2
+options=${@:-"-s 0"}
+port=$(grep -m 1 '^port=' "$conf" | cut -d '=' -f 2)
+port=${port:-8888}
+
+if [[ ! -x ./replay ]]; then
+	echo "$0: build the load generator first, make replay" >&2
+	exit 1
+fi
+
+for server in single-HTTP threaded-HTTP select-HTTP fork-HTTP; do
+	[[ -x ./$server ]] || continue
+
+	./$server -s "$conf" > /dev/null 2>&1 &
+	pid=$!
+
+	# Listening once it answers
+	for _ in $(seq 50); do
+		(exec 3<> /dev/tcp/127.0.0.1/$port) 2> /dev/null && break
+		sleep 0.1
+	done
+
+	echo "== $server"
+	./replay -p "$port" $options "$capture"
+
+	kill -INT $pid
+	wait $pid
+done
@@ -11,7 +11,8 @@
 
 #define NT_LEN 1
 
-bool verbose_flag;
-char _log_root[PATH_MAX + NT_LEN], _db_path[PATH_MAX + NT_LEN];
+// Defined by the program, main.c or the sibling in servers/
+extern bool verbose_flag;
+extern char _log_root[PATH_MAX + NT_LEN], _db_path[PATH_MAX + NT_LEN];
 
 #endif /* End GLOBALS_H */
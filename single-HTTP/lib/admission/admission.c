@@ -0,0 +1,119 @@
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+
+#include "admission.h"
+
+// Admission control on queue delay, after CoDel: the time a request waited
+// between reaching the host and the server starting on it. A busy moment makes
+// some requests wait, but while even the least delayed request of an interval
+// waited longer than the target, the queue is standing and only grows with
+// more work. In that state requests that waited past the target are shed with
+// a fast refusal, so those admitted are answered in time instead of every
+// client timing out. Each route class keeps its own budget and state, so slow
+// PHP pages shedding does not touch static files and the other way around.
+//
+// Arrival is the kernel receive time of the request's first segment, reported
+// with SO_TIMESTAMP, which covers the accept queue and the event loop alike.
+
+#define US_PER_MS 1000ULL
+#define US_PER_S 1000000ULL
+
+Admission ad_create(const ad_budget_t *const restrict budgets) {
+	const Admission admission = (Admission) calloc(1, sizeof(admission_t));
+	if (!admission)
+		exit(EXIT_FAILURE);
+
+	memcpy(admission->budgets, budgets, sizeof(admission->budgets));
+
+	return admission;
+}
+
+void ad_destroy(Admission admission) {
+	free(admission);
+	admission = NULL;
+}
+
+// "target/interval" in milliseconds, a bare target uses an interval of 100 ms
+bool ad_parse_budget(const String restrict value, ad_budget_t *const restrict budget) {
+	unsigned int target, interval = 100;
+	const int fields = sscanf(value, "%u/%u", &target, &interval);
+
+	if ((fields < 1) || (interval == 0))
+		return false;
+
+	budget->target_us = target * US_PER_MS;
+	budget->interval_ms = interval;
+
+	return true;
+}
+
+bool ad_admit(Admission const restrict admission, const rl_class_t class, const uint64_t delay_us, const uint64_t now_ms) {
+	const ad_budget_t *const budget = &admission->budgets[class];
+	ad_state_t *const state = &admission->states[class];
+
+	if (!budget->target_us)
+		return true;
+
+	if (now_ms >= state->interval_end_ms) {
+		state->overloaded = state->min_delay_us > budget->target_us;
+		state->min_delay_us = delay_us;
+		state->interval_end_ms = now_ms + budget->interval_ms;
+	} else if (delay_us < state->min_delay_us)
+		state->min_delay_us = delay_us;
+
+	return !state->overloaded || (delay_us <= budget->target_us);
+}
+
+// Accepted sockets inherit the option from their listener
+bool ad_stamp_arrivals(const int listener) {
+	const int enable = 1;
+
+	return setsockopt(listener, SOL_SOCKET, SO_TIMESTAMP, &enable, sizeof(enable)) == 0;
+}
+
+uint64_t ad_now_us(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts); // The clock of the kernel's receive times
+
+	return ts.tv_sec * US_PER_S + ts.tv_nsec / 1000;
+}
+
+// recv() that also reports when the received data reached the host, the
+// current time when the kernel did not stamp it
+ssize_t ad_recv(const int sock, void *const restrict buffer, const size_t len, uint64_t *const restrict arrival_us) {
+	union {
+		char buffer[CMSG_SPACE(sizeof(struct timeval))];
+		struct cmsghdr align;
+	} control;
+	struct iovec iov = {buffer, len};
+	struct msghdr msg;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buffer;
+	msg.msg_controllen = sizeof(control.buffer);
+
+	const ssize_t nbytes = recvmsg(sock, &msg, MSG_DONTWAIT);
+
+	*arrival_us = 0;
+
+	if (nbytes > 0)
+		for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+			if ((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_TIMESTAMP)) {
+				struct timeval tv;
+
+				memcpy(&tv, CMSG_DATA(cmsg), sizeof(tv));
+				*arrival_us = tv.tv_sec * US_PER_S + tv.tv_usec;
+			}
+
+	if (!*arrival_us)
+		*arrival_us = ad_now_us();
+
+	return nbytes;
+}
@@ -0,0 +1,38 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "../types/types.h"
+#include "../rate_limit/rate_limit.h"
+
+typedef struct ad_budget_s {
+	uint64_t target_us; // Queue delay tolerated as the minimum of an interval, 0 disables shedding
+	uint64_t interval_ms;
+} ad_budget_t;
+
+typedef struct ad_state_s {
+	uint64_t min_delay_us; // Lowest queue delay seen in the current interval
+	uint64_t interval_end_ms;
+	bool overloaded; // The minimum of the last complete interval stayed above the target
+} ad_state_t;
+
+typedef struct admission_s {
+	ad_budget_t budgets[RL_CLASSES];
+	ad_state_t states[RL_CLASSES];
+} admission_t;
+
+typedef admission_t *Admission;
+
+extern Admission ad_create(const ad_budget_t *const);
+extern void ad_destroy(Admission);
+extern bool ad_parse_budget(const String, ad_budget_t *const);
+extern bool ad_admit(Admission const, const rl_class_t, const uint64_t, const uint64_t);
+extern bool ad_stamp_arrivals(const int);
+extern ssize_t ad_recv(const int, void *const, const size_t, uint64_t *const);
+extern uint64_t ad_now_us(void);
+
+#endif /* End ADMISSION_H */
@@ -0,0 +1,26 @@
+#include <string.h>
+
+#include "assets.h"
+
+// Files of static/ and partials/ compiled into the binary by embed_assets. The
+// table is generated sorted by path.
+
+#define STR_MAX 2048
+
+Asset asset_find(const String restrict path) {
+	unsigned int low = 0, high = _asset_cnt;
+
+	while (low < high) {
+		const unsigned int middle = low + (high - low) / 2;
+		const int order = strncmp(path, _assets[middle].path, STR_MAX);
+
+		if (order == 0)
+			return &_assets[middle];
+		if (order < 0)
+			high = middle;
+		else
+			low = middle + 1;
+	}
+
+	return NULL;
+}
@@ -0,0 +1,27 @@
+#ifndef ASSETS_H
+#define ASSETS_H
+
+#include <time.h>
+#include <stddef.h>
+
+#include "../types/types.h"
+
+typedef struct asset_s {
+	String path; // Relative to the source tree, as the server looks it up
+	const Byte *data, *gz_data; // gz_data is NULL when gzip would not pay off
+	size_t len, gz_len;
+	time_t mtime;
+	String etag, gz_etag;
+	// Content-Type, Content-Length and validators of each encoding, ready to
+	// follow the status line and Connection header
+	String headers, gz_headers;
+} asset_t;
+
+typedef const asset_t *Asset;
+
+extern const asset_t _assets[];
+extern const unsigned int _asset_cnt;
+
+extern Asset asset_find(const String);
+
+#endif /* End ASSETS_H */
@@ -0,0 +1,89 @@
+#include <stdlib.h>
+
+#include "../stats/stats.h"
+#include "buffer_pool.h"
+
+// Size-classed buffers shared by all connections of the event loop, for
+// receive buffers and queued output. A connection only holds one while data
+// is in flight, so an idle keep-alive connection costs its struct alone.
+// Released buffers are kept on a free list of their class, linked through
+// their first word, up to a byte budget; the rest go back to malloc. The pool
+// belongs to the thread of the event loop and takes no locks.
+
+typedef struct bp_free_s {
+	struct bp_free_s *next;
+} bp_free_t;
+
+static const size_t _class_len[BP_CLASSES] = {1024, 4096, 16384, 65536};
+
+static struct buffer_pool_s {
+	bp_free_t *free[BP_CLASSES];
+	size_t max_free_bytes;
+} _pool;
+
+static int class_of(const size_t cap) {
+	for (int i = 0; i < BP_CLASSES; i++)
+		if (_class_len[i] + BP_SLACK >= cap)
+			return i;
+
+	return -1;
+}
+
+// max_free_bytes bounds what released buffers keep allocated for reuse
+void bp_init(const size_t max_free_bytes) {
+	_pool.max_free_bytes = max_free_bytes;
+}
+
+// A buffer of at least len octets, *cap is how many it has. NULL when len is
+// beyond the largest class.
+Byte *bp_acquire(const size_t len, size_t *const restrict cap) {
+	const int i = class_of(len);
+
+	if (i == -1)
+		return NULL;
+	*cap = _class_len[i] + BP_SLACK;
+	_stats.buffer_bytes += *cap;
+
+	if (_pool.free[i]) {
+		bp_free_t *const buffer = _pool.free[i];
+
+		_pool.free[i] = buffer->next;
+		_stats.pooled_bytes -= *cap;
+		return (Byte*) buffer;
+	}
+
+	Byte *const buffer = (Byte*) malloc(*cap);
+	if (!buffer)
+		exit(EXIT_FAILURE);
+
+	return buffer;
+}
+
+// cap is the one bp_acquire() reported for the buffer
+void bp_release(Byte *buffer, const size_t cap) {
+	const int i = class_of(cap);
+
+	_stats.buffer_bytes -= cap;
+
+	if (_stats.pooled_bytes + cap > _pool.max_free_bytes) {
+		free(buffer);
+		return;
+	}
+
+	((bp_free_t*) buffer)->next = _pool.free[i];
+	_pool.free[i] = (bp_free_t*) buffer;
+	_stats.pooled_bytes += cap;
+	buffer = NULL;
+}
+
+// Frees every pooled buffer
+void bp_trim(void) {
+	for (int i = 0; i < BP_CLASSES; i++)
+		while (_pool.free[i]) {
+			bp_free_t *const buffer = _pool.free[i];
+
+			_pool.free[i] = buffer->next;
+			_stats.pooled_bytes -= _class_len[i] + BP_SLACK;
+			free(buffer);
+		}
+}
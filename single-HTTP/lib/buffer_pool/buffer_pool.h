@@ -0,0 +1,16 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <stddef.h>
+
+#include "../types/types.h"
+
+#define BP_CLASSES 4
+#define BP_SLACK 64 // Room past the power of two for a frame header and a terminator
+
+extern void bp_init(const size_t);
+extern Byte *bp_acquire(const size_t, size_t *const);
+extern void bp_release(Byte *, const size_t);
+extern void bp_trim(void);
+
+#endif /* End BUFFER_POOL_H */
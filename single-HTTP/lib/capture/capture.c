@@ -0,0 +1,109 @@
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "capture.h"
+
+// Request capture for tools/replay. Sampling is decided per connection, so a
+// sampled connection is recorded with every request it carries and the replay
+// sees the same reuse. A request is held in memory, header block and body
+// read back from its spool file, until its response ends, then appended to a
+// fully buffered file with the latency the server took.
+
+#define BUFFER_LEN (1024 * 1024)
+#define SAMPLE_SCALE (1ULL << 32)
+
+static uint64_t now_us(const clockid_t clock) {
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Truncates path. rate is the share of connections sampled, from 0 to 1.
+Capture cap_open(const String restrict path, const double rate) {
+	const uint64_t wall_us = now_us(CLOCK_REALTIME);
+	FILE *const file = fopen(path, "we");
+
+	if (!file)
+		return NULL;
+
+	const Capture capture = (Capture) calloc(1, sizeof(capture_t));
+	if (!capture)
+		exit(EXIT_FAILURE);
+
+	setvbuf(file, NULL, _IOFBF, BUFFER_LEN);
+	fwrite(CAP_MAGIC, CAP_MAGIC_LEN, 1, file);
+	fwrite(&wall_us, sizeof(wall_us), 1, file);
+
+	capture->file = file;
+	capture->start_us = now_us(CLOCK_MONOTONIC);
+	capture->salt = wall_us;
+	capture->threshold = (rate >= 1.0) ? SAMPLE_SCALE : (rate <= 0.0) ? 0 : (uint64_t) (rate * SAMPLE_SCALE);
+
+	return capture;
+}
+
+void cap_close(Capture capture) {
+	fclose(capture->file);
+	free(capture);
+	capture = NULL;
+}
+
+// Serials are consecutive, they are mixed so every rate samples evenly
+bool cap_sampled(Capture const restrict capture, const uint32_t conn) {
+	uint64_t x = conn ^ capture->salt;
+
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+
+	return (x & (SAMPLE_SCALE - 1)) < capture->threshold;
+}
+
+// Copies a request that just arrived. body_fd is its spool file, read from the
+// start. Returns NULL when the body can not be read back.
+Cap_Pending cap_begin(Capture const restrict capture, const uint32_t conn, const Byte *const restrict header,
+                      const size_t header_len, const int body_fd, const uint64_t body_len, const bool chunked) {
+	const Cap_Pending pending = (Cap_Pending) malloc(sizeof(cap_pending_t) + header_len + body_len);
+	if (!pending)
+		exit(EXIT_FAILURE);
+
+	memcpy(pending->data, header, header_len);
+
+	for (uint64_t done = 0; done < body_len; ) {
+		const ssize_t nbytes = pread(body_fd, pending->data + header_len + done, body_len - done, done);
+
+		if (nbytes <= 0) {
+			free(pending);
+			return NULL;
+		}
+		done += nbytes;
+	}
+
+	pending->head.offset_us = now_us(CLOCK_MONOTONIC) - capture->start_us;
+	pending->head.body_len = body_len;
+	pending->head.conn = conn;
+	pending->head.latency_us = 0;
+	pending->head.header_len = header_len;
+	pending->head.flags = chunked ? CAP_CHUNKED : 0;
+
+	return pending;
+}
+
+// Appends the request once its response ended, or the connection closed first
+void cap_end(Capture const restrict capture, Cap_Pending pending, const bool complete) {
+	const uint64_t latency_us = now_us(CLOCK_MONOTONIC) - capture->start_us - pending->head.offset_us;
+
+	pending->head.latency_us = (latency_us > UINT32_MAX) ? UINT32_MAX : latency_us;
+	if (!complete)
+		pending->head.flags |= CAP_ABORTED;
+
+	fwrite(pending, sizeof(cap_pending_t) + pending->head.header_len + pending->head.body_len, 1, capture->file);
+	capture->records++;
+	free(pending);
+	pending = NULL;
+}
@@ -0,0 +1,55 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "../types/types.h"
+
+#define CAP_MAGIC "SHCAP001"
+#define CAP_MAGIC_LEN 8
+
+typedef enum cap_flag_e {
+	CAP_CHUNKED = 1, // The body arrived chunked, it is stored decoded
+	CAP_ABORTED = 2 // The connection closed before the response was sent
+} cap_flag_t;
+
+// A capture file is the magic and the wall clock start of the capture in
+// microseconds, then one record per request in the order the responses
+// ended: this head, the header block as received and the body
+typedef struct cap_record_s {
+	uint64_t offset_us; // Arrival of the whole request after the start
+	uint64_t body_len;
+	uint32_t conn; // Serial of the connection, shared by its requests
+	uint32_t latency_us; // Until the last octet of the response left the server
+	uint32_t header_len;
+	uint32_t flags;
+} cap_record_t;
+
+typedef struct capture_s {
+	FILE *file;
+	uint64_t start_us; // Monotonic clock
+	uint64_t salt, threshold; // Connections hashing below the threshold are sampled
+	uint64_t records;
+} capture_t;
+
+typedef capture_t *Capture;
+
+// A request whose response is in progress
+typedef struct cap_pending_s {
+	cap_record_t head;
+	Byte data[]; // Header block then body
+} cap_pending_t;
+
+typedef cap_pending_t *Cap_Pending;
+
+extern Capture cap_open(const String, const double);
+extern void cap_close(Capture);
+extern bool cap_sampled(Capture const, const uint32_t);
+extern Cap_Pending cap_begin(Capture const, const uint32_t, const Byte *const, const size_t, const int, const uint64_t,
+                             const bool);
+extern void cap_end(Capture const, Cap_Pending, const bool);
+
+#endif /* End CAPTURE_H */
@@ -0,0 +1,285 @@
+#include <zlib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <strings.h>
+
+#include "compress.h"
+#include "../http_headers/http_headers.h"
+
+// Bounded cache of gzip encoded file bodies. Entries are keyed by path and
+// validated against the size and mtime of the file on every lookup, so an
+// edited file is compressed again exactly once. A file whose gzip body is
+// larger than the whole budget is remembered without it, and not compressed
+// again until it changes. The least recently used entries are dropped when
+// the byte budget is exceeded.
+
+#define NT_LEN 1
+#define STR_MAX 2048
+#define GZIP_WINDOW (15 + 16)
+#define GZIP_MEM_LEVEL 8
+#define GZIP_LEVEL 6 // Compressed on the event loop, a fast level
+#define HEADER_VALUE_LEN 256
+#define CONF_EXT_LEN 5
+
+// D. J. Bernstein Hash, Modified
+static unsigned int get_hash(const Gz_Cache restrict cache, String restrict key) {
+	unsigned int result = 5381;
+
+	while (*key)
+		result = (33 * result) ^ (unsigned char) *key++;
+
+	return result % cache->bin_cnt;
+}
+
+static void lru_unlink(const Gz_Cache restrict cache, const Gz_Entry restrict entry) {
+	if (entry->lru_prev)
+		entry->lru_prev->lru_next = entry->lru_next;
+	else
+		cache->lru_head = entry->lru_next;
+
+	if (entry->lru_next)
+		entry->lru_next->lru_prev = entry->lru_prev;
+	else
+		cache->lru_tail = entry->lru_prev;
+	entry->lru_prev = entry->lru_next = NULL;
+}
+
+static void lru_push(const Gz_Cache restrict cache, const Gz_Entry restrict entry) {
+	entry->lru_prev = NULL;
+	entry->lru_next = cache->lru_head;
+
+	if (cache->lru_head)
+		cache->lru_head->lru_prev = entry;
+	cache->lru_head = entry;
+
+	if (!cache->lru_tail)
+		cache->lru_tail = entry;
+}
+
+static void remove_entry(const Gz_Cache restrict cache, Gz_Entry entry) {
+	Gz_Entry *link = &cache->bins[get_hash(cache, entry->path)];
+
+	while (*link && *link != entry)
+		link = &(*link)->next;
+	if (*link)
+		*link = entry->next;
+
+	lru_unlink(cache, entry);
+	cache->cur_bytes -= entry->data_len;
+	cache->entry_cnt--;
+
+	free(entry->path);
+	entry->path = NULL;
+
+	free(entry->data);
+	entry->data = NULL;
+
+	free(entry);
+	entry = NULL;
+}
+
+static Byte *read_file(const int fd, const size_t size) {
+	Byte *const contents = (Byte*) malloc(size ? size : 1);
+	size_t offset = 0;
+
+	if (!contents)
+		exit(EXIT_FAILURE);
+
+	while (offset < size) {
+		const ssize_t nbytes = pread(fd, contents + offset, size - offset, offset);
+
+		if (nbytes <= 0) {
+			free(contents);
+			return NULL;
+		}
+		offset += nbytes;
+	}
+
+	return contents;
+}
+
+// Returns a heap copy of input in the gzip format at the zlib level given,
+// NULL if zlib fails
+Byte *gz_compress(const Byte *const restrict input, const size_t input_len, const int level, size_t *const restrict output_len) {
+	z_stream stream;
+
+	memset(&stream, 0, sizeof(stream));
+
+	if (deflateInit2(&stream, level, Z_DEFLATED, GZIP_WINDOW, GZIP_MEM_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK)
+		return NULL;
+
+	const uLong bound = deflateBound(&stream, input_len);
+	Byte *const output = (Byte*) malloc(bound);
+
+	if (!output)
+		exit(EXIT_FAILURE);
+
+	stream.next_in = (Bytef*) input;
+	stream.avail_in = input_len;
+	stream.next_out = output;
+	stream.avail_out = bound;
+
+	if (deflate(&stream, Z_FINISH) != Z_STREAM_END) {
+		deflateEnd(&stream);
+		free(output);
+		return NULL;
+	}
+	*output_len = stream.total_out;
+	deflateEnd(&stream);
+
+	return output;
+}
+
+Gz_Cache gz_cache_create(const unsigned int bin_cnt, const size_t max_bytes) {
+	if (bin_cnt < 1)
+		return NULL;
+
+	const Gz_Cache cache = (Gz_Cache) calloc(1, sizeof(gz_cache_t));
+	if (!cache)
+		exit(EXIT_FAILURE);
+
+	cache->bins = (Gz_Entry*) calloc(bin_cnt, sizeof(Gz_Entry));
+	if (!cache->bins)
+		exit(EXIT_FAILURE);
+
+	cache->bin_cnt = bin_cnt;
+	cache->max_bytes = max_bytes;
+
+	return cache;
+}
+
+void gz_cache_destroy(Gz_Cache cache) {
+	while (cache->lru_head)
+		remove_entry(cache, cache->lru_head);
+
+	free(cache->bins);
+	cache->bins = NULL;
+
+	free(cache);
+	cache = NULL;
+}
+
+// Returns the gzip body of the file open on fd, compressing and caching it on
+// a miss. NULL when the file could not be read or its compressed form does not
+// fit in the cache at all; the caller then sends the identity encoding. The
+// file is read whole, callers bound its size.
+Gz_Entry gz_cache_get(const Gz_Cache restrict cache, const String restrict path, const int fd, const struct stat *const restrict file) {
+	const unsigned int bin = get_hash(cache, path);
+	Gz_Entry entry;
+
+	for (entry = cache->bins[bin]; entry; entry = entry->next)
+		if (strncmp(path, entry->path, STR_MAX) == 0)
+			break;
+
+	if (entry) {
+		if ((entry->mtime == file->st_mtime) && (entry->size == file->st_size)) {
+			lru_unlink(cache, entry);
+			lru_push(cache, entry);
+			return entry->data ? entry : NULL;
+		}
+		remove_entry(cache, entry);
+	}
+
+	Byte *const contents = read_file(fd, file->st_size);
+	size_t data_len = 0;
+
+	if (!contents)
+		return NULL;
+
+	Byte *const data = gz_compress(contents, file->st_size, GZIP_LEVEL, &data_len);
+
+	free(contents);
+
+	if (!data)
+		return NULL;
+
+	if (data_len > cache->max_bytes) {
+		free(data);
+		gz_cache_put(cache, path, file->st_mtime, file->st_size, NULL, 0);
+		return NULL;
+	}
+
+	return gz_cache_put(cache, path, file->st_mtime, file->st_size, data, data_len);
+}
+
+// Stores data, the gzip body of the file at path with the given mtime and
+// size, taking ownership of it, or with NULL data that the file's body does
+// not fit. The path must not be cached yet. NULL when the body does not fit in
+// the cache at all.
+Gz_Entry gz_cache_put(const Gz_Cache restrict cache, const String restrict path, const time_t mtime, const off_t size, Byte *const data, const size_t data_len) {
+	const unsigned int bin = get_hash(cache, path);
+
+	if (data_len > cache->max_bytes) {
+		free(data);
+		return NULL;
+	}
+
+	while (cache->cur_bytes + data_len > cache->max_bytes)
+		remove_entry(cache, cache->lru_tail);
+
+	const Gz_Entry entry = (Gz_Entry) calloc(1, sizeof(gz_entry_t));
+	if (!entry)
+		exit(EXIT_FAILURE);
+
+	const size_t path_len = strnlen(path, STR_MAX);
+
+	entry->path = (String) calloc(path_len + NT_LEN, sizeof(char));
+	if (!entry->path)
+		exit(EXIT_FAILURE);
+
+	strncpy(entry->path, path, path_len);
+	entry->mtime = mtime;
+	entry->size = size;
+	entry->data = data;
+	entry->data_len = data_len;
+	entry->next = cache->bins[bin];
+	cache->bins[bin] = entry;
+	cache->cur_bytes += data_len;
+	cache->entry_cnt++;
+	lru_push(cache, entry);
+
+	return entry;
+}
+
+// True when Accept-Encoding lists gzip (or *) without a zero quality value
+bool gz_accepted(const String restrict headers) {
+	char value[HEADER_VALUE_LEN];
+
+	if (!http_header_get(headers, "Accept-Encoding", value, HEADER_VALUE_LEN))
+		return false;
+
+	for (String coding = strtok(value, ","); coding; coding = strtok(NULL, ",")) {
+		while (*coding == ' ' || *coding == '\t')
+			coding++;
+
+		const size_t name_len = strcspn(coding, " \t;");
+		const String params = strchr(coding, ';');
+		const String quality = params ? strstr(params, "q=") : NULL;
+
+		if (!(((name_len == 4) && (strncasecmp(coding, "gzip", 4) == 0))
+		      || ((name_len == 6) && (strncasecmp(coding, "x-gzip", 6) == 0))
+		      || ((name_len == 1) && (coding[0] == '*'))))
+			continue;
+
+		return !quality || (strtod(quality + 2, NULL) > 0);
+	}
+
+	return false;
+}
+
+bool gz_is_compressible(const String restrict path) {
+	const String text_ext[] = {".html", ".css", ".js", ".svg", ".txt", ".json", ".xml", ".ico"};
+	const size_t text_ext_len = sizeof(text_ext) / sizeof(String);
+	const String extension = strrchr(path, '.');
+
+	if (!extension)
+		return false;
+
+	for (unsigned int i = 0; i < text_ext_len; i++)
+		if (strncmp(extension, text_ext[i], CONF_EXT_LEN + NT_LEN) == 0)
+			return true;
+	return false;
+}
@@ -0,0 +1,40 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <time.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "../types/types.h"
+
+typedef struct gz_entry_s {
+	String path;
+	time_t mtime;
+	off_t size;
+	Byte *data; // NULL for a file whose gzip body does not fit in the cache
+	size_t data_len;
+	struct gz_entry_s *next, *lru_prev, *lru_next;
+} gz_entry_t;
+
+typedef gz_entry_t *Gz_Entry;
+
+typedef struct gz_cache_s {
+	Gz_Entry *bins;
+	Gz_Entry lru_head, lru_tail;
+	unsigned int bin_cnt, entry_cnt;
+	size_t max_bytes, cur_bytes;
+} gz_cache_t;
+
+typedef gz_cache_t *Gz_Cache;
+
+extern Gz_Cache gz_cache_create(const unsigned int, const size_t);
+extern void gz_cache_destroy(Gz_Cache);
+extern Gz_Entry gz_cache_get(Gz_Cache const, const String, const int, const struct stat *const);
+extern Gz_Entry gz_cache_put(Gz_Cache const, const String, const time_t, const off_t, Byte *const, const size_t);
+extern Byte *gz_compress(const Byte *const, const size_t, const int, size_t *const);
+extern bool gz_accepted(const String);
+extern bool gz_is_compressible(const String);
+
+#endif /* End COMPRESS_H */
@@ -0,0 +1,456 @@
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "concurrent_hashtable.h"
+
+// A hashtable threads can share, for state such as sessions, rate-limit
+// buckets or cache indexes. Keys are spread over CHT_SHARDS shards, each with
+// its own bins and lock. Writers of a shard serialize on its lock; readers
+// take no lock and write nothing shared, so they never wait for a writer and
+// scale with the cores. A writer links a node in with a release store, and a
+// shard grows by building new bins with copies of its nodes and publishing
+// them at once, so a reader walks either the old bins or the new ones.
+//
+// What a writer unlinks is freed by epoch-based reclamation. Every thread
+// joins the table for a record of its own and pins it around its reads; a
+// pinned thread announces the global epoch it saw. The epoch advances once
+// every pinned thread saw the current one, and something retired in an
+// epoch is freed two advances later, when no reader can still hold it.
+//
+// The announcement, the loads of readers, the stores that unlink or replace
+// and the epoch reads are all sequentially consistent instead of relying on
+// fences: a reader that still found something unlinked announced its epoch
+// before the unlink, so the advances that would free it wait for the reader.
+// On x86 this costs what a fence would, and ThreadSanitizer, which does not
+// model fences, checks the same code that ships.
+
+#define CHT_ACTIVE 1 // Low bit of a pinned record, epochs count in steps of two
+#define EPOCH_STEP 2
+#define INITIAL_BINS 8
+#define PERCENT_CUTOFF 80
+#define RETIRE_THRESHOLD 64 // Retired items a thread gathers before it frees what it can
+#define HASH_SEED 5381
+
+static uint64_t mix(uint64_t x) { // splitmix64 finalizer
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+
+	return x ^ (x >> 31);
+}
+
+// D. J. Bernstein Hash, Modified; mixed, as the shard comes from the upper bits
+static uint64_t get_hash(String restrict key) {
+	uint64_t result = HASH_SEED;
+
+	while (*key)
+		result = (33 * result) ^ (unsigned char) *key++;
+
+	return mix(result);
+}
+
+static cht_shard_t *shard_of(Concurrent_HashTable const restrict table, const uint64_t hash) {
+	return &table->shards[(hash >> 32) & (CHT_SHARDS - 1)];
+}
+
+static uint64_t round_up_pow2(const uint64_t value) {
+	uint64_t result = INITIAL_BINS;
+
+	while (result < value)
+		result <<= 1;
+
+	return result;
+}
+
+static cht_bins_t *create_bins(const uint64_t size) {
+	cht_bins_t *const bins = (cht_bins_t*) calloc(1, sizeof(cht_bins_t) + size * sizeof(Cht_Node));
+	if (!bins)
+		exit(EXIT_FAILURE);
+
+	bins->mask = size - 1;
+
+	return bins;
+}
+
+static void free_node(void *const ptr) { // A node unlinked from the current bins, with its key
+	const Cht_Node node = (Cht_Node) ptr;
+
+	free(node->key);
+	free(node);
+}
+
+static void free_bins(void *const ptr) { // Bins a resize replaced, their keys moved on to the copies
+	cht_bins_t *const bins = (cht_bins_t*) ptr;
+
+	for (uint64_t i = 0; i <= bins->mask; i++) {
+		Cht_Node node = bins->heads[i];
+
+		while (node) {
+			const Cht_Node next = node->next;
+
+			free(node);
+			node = next;
+		}
+	}
+	free(bins);
+}
+
+// The node of key in the current bins of shard
+static Cht_Node lookup(cht_shard_t *const restrict shard, const uint64_t hash, const String restrict key) {
+	const cht_bins_t *const bins = __atomic_load_n(&shard->bins, __ATOMIC_SEQ_CST);
+
+	for (Cht_Node node = __atomic_load_n(&bins->heads[hash & bins->mask], __ATOMIC_SEQ_CST); node;
+	     node = __atomic_load_n(&node->next, __ATOMIC_SEQ_CST))
+		if ((node->hash == hash) && (strcmp(node->key, key) == 0))
+			return node;
+
+	return NULL;
+}
+
+// Moves the epoch on when every pinned thread saw it. Returns the epoch.
+static uint64_t try_advance(Concurrent_HashTable const restrict table) {
+	uint64_t epoch = __atomic_load_n(&table->epoch, __ATOMIC_SEQ_CST);
+
+	for (Cht_Thread thread = __atomic_load_n(&table->threads, __ATOMIC_ACQUIRE); thread; thread = thread->next) {
+		const uint64_t local = __atomic_load_n(&thread->local, __ATOMIC_SEQ_CST);
+
+		if ((local & CHT_ACTIVE) && ((local & ~(uint64_t) CHT_ACTIVE) != epoch))
+			return epoch;
+	}
+
+	if (__atomic_compare_exchange_n(&table->epoch, &epoch, epoch + EPOCH_STEP, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+		return epoch + EPOCH_STEP;
+
+	return epoch; // Another thread advanced it
+}
+
+// Frees the items of a list retired two advances before epoch. Returns how
+// many it freed.
+static unsigned int reclaim(cht_retired_t **const restrict head, cht_retired_t **const restrict tail, const uint64_t epoch) {
+	cht_retired_t **link = head, *last = NULL;
+	unsigned int freed = 0;
+
+	while (*link) {
+		cht_retired_t *const item = *link;
+
+		if (item->epoch + 2 * EPOCH_STEP <= epoch) {
+			__atomic_store_n(link, item->next, __ATOMIC_RELAXED); // collect peeks at the orphans unlocked
+			item->free(item->ptr);
+			free(item);
+			freed++;
+		} else {
+			last = item;
+			link = &item->next;
+		}
+	}
+	*tail = last;
+
+	return freed;
+}
+
+static void collect(Cht_Thread const restrict thread) {
+	Concurrent_HashTable const table = thread->table;
+	const uint64_t epoch = try_advance(table);
+
+	thread->retired -= reclaim(&thread->limbo, &thread->limbo_tail, epoch);
+
+	// What threads that left behind, by whoever comes by first
+	if (__atomic_load_n(&table->orphans, __ATOMIC_RELAXED) && (pthread_mutex_trylock(&table->orphans_lock) == 0)) {
+		reclaim(&table->orphans, &table->orphans_tail, epoch);
+		pthread_mutex_unlock(&table->orphans_lock);
+	}
+}
+
+// Frees ptr once no thread can still be reading it. Called pinned, after ptr
+// was unlinked.
+static void retire(Cht_Thread const restrict thread, const cht_free_t free_ptr, void *const ptr) {
+	cht_retired_t *const item = (cht_retired_t*) malloc(sizeof(cht_retired_t));
+	if (!item)
+		exit(EXIT_FAILURE);
+
+	item->free = free_ptr;
+	item->ptr = ptr;
+	item->next = NULL;
+
+	item->epoch = __atomic_load_n(&thread->table->epoch, __ATOMIC_SEQ_CST); // Ordered after the unlink
+
+	if (thread->limbo_tail)
+		thread->limbo_tail->next = item;
+	else
+		thread->limbo = item;
+	thread->limbo_tail = item;
+
+	if (++thread->retired >= RETIRE_THRESHOLD)
+		collect(thread);
+}
+
+// Doubles the bins of shard, with its lock held. Returns the old bins, for
+// the caller to retire: readers still walking them keep what they held.
+static cht_bins_t *resize(cht_shard_t *const restrict shard) {
+	cht_bins_t *const old = shard->bins, *const bins = create_bins((old->mask + 1) * 2);
+
+	for (uint64_t i = 0; i <= old->mask; i++) {
+		for (Cht_Node node = old->heads[i]; node; node = node->next) {
+			const Cht_Node copy = (Cht_Node) malloc(sizeof(cht_node_t));
+			if (!copy)
+				exit(EXIT_FAILURE);
+
+			memcpy(copy, node, sizeof(cht_node_t));
+			copy->next = bins->heads[copy->hash & bins->mask];
+			bins->heads[copy->hash & bins->mask] = copy;
+		}
+	}
+
+	__atomic_store_n(&shard->bins, bins, __ATOMIC_SEQ_CST);
+
+	return old;
+}
+
+// expected_size is the number of keys the table should hold before a shard
+// resizes. free_value, NULL when the caller keeps ownership, frees a value
+// that was replaced or removed.
+Concurrent_HashTable cht_create(const unsigned int expected_size, const cht_free_t free_value) {
+	Concurrent_HashTable table;
+
+	// The shards and the epoch are aligned to cache lines
+	if (posix_memalign((void**) &table, CHT_CACHE_LINE, sizeof(concurrent_hashtable_t)) != 0)
+		exit(EXIT_FAILURE);
+	memset(table, 0, sizeof(concurrent_hashtable_t));
+
+	const uint64_t size = round_up_pow2(((uint64_t) expected_size * 100 / PERCENT_CUTOFF + CHT_SHARDS - 1) / CHT_SHARDS);
+
+	for (unsigned int i = 0; i < CHT_SHARDS; i++) {
+		pthread_mutex_init(&table->shards[i].lock, NULL);
+		table->shards[i].bins = create_bins(size);
+	}
+
+	table->free_value = free_value;
+	table->epoch = EPOCH_STEP;
+	pthread_mutex_init(&table->orphans_lock, NULL);
+
+	return table;
+}
+
+// Once no thread uses the table any more
+void cht_destroy(Concurrent_HashTable table) {
+	Cht_Thread thread = table->threads;
+
+	while (thread) {
+		const Cht_Thread next = thread->next;
+
+		reclaim(&thread->limbo, &thread->limbo_tail, UINT64_MAX);
+		free(thread);
+		thread = next;
+	}
+	reclaim(&table->orphans, &table->orphans_tail, UINT64_MAX);
+
+	for (unsigned int i = 0; i < CHT_SHARDS; i++) {
+		cht_bins_t *const bins = table->shards[i].bins;
+
+		for (uint64_t j = 0; j <= bins->mask; j++) {
+			Cht_Node node = bins->heads[j];
+
+			while (node) {
+				const Cht_Node next = node->next;
+
+				if (table->free_value)
+					table->free_value(node->value);
+				free_node(node);
+				node = next;
+			}
+		}
+		free(bins);
+		pthread_mutex_destroy(&table->shards[i].lock);
+	}
+	pthread_mutex_destroy(&table->orphans_lock);
+
+	free(table);
+	table = NULL;
+}
+
+// The record of the calling thread, every other call takes it. A record a
+// thread left is reused.
+Cht_Thread cht_join(Concurrent_HashTable const restrict table) {
+	Cht_Thread thread;
+
+	for (thread = __atomic_load_n(&table->threads, __ATOMIC_ACQUIRE); thread; thread = thread->next) {
+		bool in_use = false;
+
+		if (!__atomic_load_n(&thread->in_use, __ATOMIC_RELAXED)
+		    && __atomic_compare_exchange_n(&thread->in_use, &in_use, true, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			return thread;
+	}
+
+	if (posix_memalign((void**) &thread, CHT_CACHE_LINE, sizeof(cht_thread_t)) != 0)
+		exit(EXIT_FAILURE);
+	memset(thread, 0, sizeof(cht_thread_t));
+
+	thread->table = table;
+	thread->in_use = true;
+	thread->next = __atomic_load_n(&table->threads, __ATOMIC_RELAXED);
+
+	while (!__atomic_compare_exchange_n(&table->threads, &thread->next, thread, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+		;
+
+	return thread;
+}
+
+// Gives the record up, unpinned. What it retired is left to the threads
+// that stay.
+void cht_leave(Cht_Thread const restrict thread) {
+	Concurrent_HashTable const table = thread->table;
+
+	if (thread->limbo) {
+		pthread_mutex_lock(&table->orphans_lock);
+		if (table->orphans_tail)
+			table->orphans_tail->next = thread->limbo;
+		else
+			__atomic_store_n(&table->orphans, thread->limbo, __ATOMIC_RELAXED);
+		table->orphans_tail = thread->limbo_tail;
+		pthread_mutex_unlock(&table->orphans_lock);
+	}
+
+	thread->limbo = thread->limbo_tail = NULL;
+	thread->retired = 0;
+	__atomic_store_n(&thread->in_use, false, __ATOMIC_RELEASE);
+}
+
+void cht_pin(Cht_Thread const restrict thread) {
+	if (thread->nesting++)
+		return;
+
+	// Announced before anything of the table is read
+	__atomic_store_n(&thread->local, __atomic_load_n(&thread->table->epoch, __ATOMIC_RELAXED) | CHT_ACTIVE, __ATOMIC_SEQ_CST);
+}
+
+void cht_unpin(Cht_Thread const restrict thread) {
+	if (--thread->nesting)
+		return;
+
+	__atomic_store_n(&thread->local, 0, __ATOMIC_RELEASE);
+}
+
+// NULL when key is absent
+void *cht_get(Cht_Thread const restrict thread, const String restrict key) {
+	const uint64_t hash = get_hash(key);
+
+	assert(thread->nesting);
+
+	const Cht_Node node = lookup(shard_of(thread->table, hash), hash, key);
+
+	return node ? __atomic_load_n(&node->value, __ATOMIC_SEQ_CST) : NULL;
+}
+
+// Inserts value unless key is present. Returns NULL when it did, otherwise
+// the value present, and value stays with the caller.
+void *cht_insert(Cht_Thread const restrict thread, const String restrict key, void *const value) {
+	const uint64_t hash = get_hash(key);
+	cht_shard_t *const shard = shard_of(thread->table, hash);
+	cht_bins_t *replaced = NULL;
+	void *present = NULL;
+
+	assert(thread->nesting);
+	pthread_mutex_lock(&shard->lock);
+
+	const Cht_Node found = lookup(shard, hash, key);
+
+	if (found)
+		present = found->value;
+	else {
+		const Cht_Node node = (Cht_Node) malloc(sizeof(cht_node_t));
+		const size_t key_len = strlen(key);
+		cht_bins_t *const bins = shard->bins;
+
+		if (!node || !(node->key = (String) malloc(key_len + 1)))
+			exit(EXIT_FAILURE);
+
+		memcpy(node->key, key, key_len + 1);
+		node->hash = hash;
+		node->value = value;
+		node->next = bins->heads[hash & bins->mask];
+		__atomic_store_n(&bins->heads[hash & bins->mask], node, __ATOMIC_RELEASE); // Filled in before it is reachable
+
+		if (++shard->count * 100 > (bins->mask + 1) * PERCENT_CUTOFF)
+			replaced = resize(shard);
+	}
+
+	pthread_mutex_unlock(&shard->lock);
+
+	if (replaced) // Retired out of the lock, freeing may run free_value
+		retire(thread, free_bins, replaced);
+
+	return present;
+}
+
+// Replaces the value of key with desired when it still is expected, the
+// compare-and-swap of read-modify-write loops. False when it is not, or key
+// is absent.
+bool cht_update(Cht_Thread const restrict thread, const String restrict key, void *const expected, void *const desired) {
+	const uint64_t hash = get_hash(key);
+	cht_shard_t *const shard = shard_of(thread->table, hash);
+
+	assert(thread->nesting);
+	pthread_mutex_lock(&shard->lock);
+
+	const Cht_Node node = lookup(shard, hash, key);
+	const bool swapped = node && (node->value == expected);
+
+	if (swapped)
+		__atomic_store_n(&node->value, desired, __ATOMIC_SEQ_CST);
+
+	pthread_mutex_unlock(&shard->lock);
+
+	if (swapped && thread->table->free_value && (expected != desired))
+		retire(thread, thread->table->free_value, expected);
+
+	return swapped;
+}
+
+// False when key is absent
+bool cht_remove(Cht_Thread const restrict thread, const String restrict key) {
+	const uint64_t hash = get_hash(key);
+	cht_shard_t *const shard = shard_of(thread->table, hash);
+	Cht_Node node;
+
+	assert(thread->nesting);
+	pthread_mutex_lock(&shard->lock);
+
+	cht_bins_t *const bins = shard->bins;
+	Cht_Node *link = &bins->heads[hash & bins->mask];
+
+	while ((node = *link) && ((node->hash != hash) || (strcmp(node->key, key) != 0)))
+		link = &node->next;
+
+	if (node) { // A reader on the node goes on to the rest of the chain
+		__atomic_store_n(link, node->next, __ATOMIC_SEQ_CST);
+		shard->count--;
+	}
+
+	pthread_mutex_unlock(&shard->lock);
+
+	if (node) {
+		if (thread->table->free_value)
+			retire(thread, thread->table->free_value, node->value);
+		retire(thread, free_node, node);
+	}
+
+	return node != NULL;
+}
+
+// Calls visit with every key and value until it returns false. Keys inserted
+// or removed meanwhile may or may not be visited; none is visited twice.
+void cht_iterate(Cht_Thread const restrict thread, const cht_visit_t visit, void *const arg) {
+	bool going = true;
+
+	assert(thread->nesting);
+
+	for (unsigned int i = 0; going && (i < CHT_SHARDS); i++) {
+		const cht_bins_t *const bins = __atomic_load_n(&thread->table->shards[i].bins, __ATOMIC_SEQ_CST);
+
+		for (uint64_t j = 0; going && (j <= bins->mask); j++)
+			for (Cht_Node node = __atomic_load_n(&bins->heads[j], __ATOMIC_SEQ_CST); going && node;
+			     node = __atomic_load_n(&node->next, __ATOMIC_SEQ_CST))
+				going = visit(node->key, __atomic_load_n(&node->value, __ATOMIC_SEQ_CST), arg);
+	}
+}
@@ -0,0 +1,87 @@
+#ifndef CONCURRENT_HASHTABLE_H
+#define CONCURRENT_HASHTABLE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "../types/types.h"
+
+#define CHT_SHARDS 64 // Power of two
+#define CHT_CACHE_LINE 64
+
+typedef void (*cht_free_t)(void *);
+typedef bool (*cht_visit_t)(const String, void *const, void *const); // key, value, argument; false stops the walk
+
+typedef struct cht_node_s {
+	uint64_t hash;
+	String key; // Owned by the node in the bins, the copies a resize left behind borrow it
+	void *value;
+	struct cht_node_s *next;
+} cht_node_t;
+
+typedef cht_node_t *Cht_Node;
+
+typedef struct cht_bins_s {
+	uint64_t mask;
+	Cht_Node heads[];
+} cht_bins_t;
+
+// Writers of a shard take its lock, readers only follow bins
+typedef struct cht_shard_s {
+	pthread_mutex_t lock;
+	cht_bins_t *bins;
+	uint64_t count;
+} __attribute__((aligned(CHT_CACHE_LINE))) cht_shard_t;
+
+// Something unlinked, freed once no thread can still be reading it
+typedef struct cht_retired_s {
+	cht_free_t free;
+	void *ptr;
+	uint64_t epoch;
+	struct cht_retired_s *next;
+} cht_retired_t;
+
+typedef struct cht_thread_s {
+	struct concurrent_hashtable_s *table;
+	uint64_t local; // Epoch the thread is pinned in, with CHT_ACTIVE set; 0 while unpinned
+	unsigned int nesting;
+	bool in_use;
+	cht_retired_t *limbo, *limbo_tail; // Oldest first
+	unsigned int retired;
+	struct cht_thread_s *next;
+} __attribute__((aligned(CHT_CACHE_LINE))) cht_thread_t;
+
+typedef cht_thread_t *Cht_Thread;
+
+typedef struct concurrent_hashtable_s {
+	cht_shard_t shards[CHT_SHARDS];
+	cht_free_t free_value; // NULL when the table does not own its values
+	uint64_t epoch __attribute__((aligned(CHT_CACHE_LINE)));
+	cht_thread_t *threads; // Never shrinks, records of threads that left are reused
+	pthread_mutex_t orphans_lock;
+	cht_retired_t *orphans; // Left behind by threads that left, oldest first
+	cht_retired_t *orphans_tail;
+} concurrent_hashtable_t;
+
+typedef concurrent_hashtable_t *Concurrent_HashTable;
+
+// A thread joins the table once for its record. cht_get(), cht_insert(),
+// cht_update(), cht_remove() and cht_iterate() must be called pinned, between
+// cht_pin() and cht_unpin(), which debug builds assert; pins nest. Values are
+// pointers, never NULL, owned by the table when it was given a free_value,
+// and what the calls return or pass to visit stays valid until the thread
+// unpins.
+extern Concurrent_HashTable cht_create(const unsigned int, const cht_free_t);
+extern void cht_destroy(Concurrent_HashTable);
+extern Cht_Thread cht_join(Concurrent_HashTable const);
+extern void cht_leave(Cht_Thread const);
+extern void cht_pin(Cht_Thread const);
+extern void cht_unpin(Cht_Thread const);
+extern void *cht_get(Cht_Thread const, const String);
+extern void *cht_insert(Cht_Thread const, const String, void *const);
+extern bool cht_update(Cht_Thread const, const String, void *const, void *const);
+extern bool cht_remove(Cht_Thread const, const String);
+extern void cht_iterate(Cht_Thread const, const cht_visit_t, void *const);
+
+#endif /* End CONCURRENT_HASHTABLE_H */
@@ -0,0 +1,63 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "../buffer_pool/buffer_pool.h"
+#include "connection.h"
+
+#define NT_LEN 1
+
+// The receive buffer is taken from the pool once input arrives
+Connection conn_create(const int fd, const String restrict address) {
+	const Connection conn = (Connection) calloc(1, sizeof(connection_t));
+	if (!conn)
+		exit(EXIT_FAILURE);
+
+	conn->fd = fd;
+	conn->state = CONN_ACCEPTED;
+	strncpy(conn->address, address, INET6_ADDRSTRLEN - NT_LEN);
+
+	return conn;
+}
+
+// Takes a receive buffer of at least len octets from the pool, the contents of
+// the one held are kept
+void conn_hold_buffer(Connection const restrict conn, const size_t len) {
+	size_t cap;
+
+	if (conn->buffer && (conn->buffer_size >= len))
+		return;
+
+	const String buffer = (String) bp_acquire(len + NT_LEN, &cap);
+
+	if (conn->buffer)
+		memcpy(buffer, conn->buffer, conn->buffer_len + NT_LEN);
+	else
+		buffer[0] = '\0';
+	conn_drop_buffer(conn);
+	conn->buffer = buffer;
+	conn->buffer_size = cap - NT_LEN;
+}
+
+// Returns the receive buffer to the pool
+void conn_drop_buffer(Connection const restrict conn) {
+	if (!conn->buffer)
+		return;
+	bp_release((Byte*) conn->buffer, conn->buffer_size + NT_LEN);
+	conn->buffer = NULL;
+	conn->buffer_size = 0;
+}
+
+void conn_destroy(Connection conn) {
+	if (conn->body)
+		rb_destroy(conn->body);
+	if (conn->h2)
+		h2_destroy(conn->h2);
+	if (conn->tls)
+		tls_close(conn->tls, false);
+	oq_clear(&conn->output);
+	oq_close_pipe(&conn->output);
+	conn_drop_buffer(conn);
+
+	free(conn);
+	conn = NULL;
+}
@@ -0,0 +1,72 @@
+#ifndef CONNECTION_H
+#define CONNECTION_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <arpa/inet.h>
+
+#include "../types/types.h"
+#include "../h2/h2.h"
+#include "../tls/tls.h"
+#include "../capture/capture.h"
+#include "../out_queue/out_queue.h"
+#include "../request_body/request_body.h"
+#include "../timer_wheel/timer_wheel.h"
+
+#define CONN_STRUCT_MAX 256
+
+typedef enum conn_state_e {
+	CONN_ACCEPTED,
+	CONN_HEADERS,
+	CONN_BODY,
+	CONN_DETACHED,
+	CONN_IDLE,
+	CONN_CLOSING, // The response is complete, the queued output is draining
+	CONN_H2 // Speaks HTTP/2, requests arrive as streams of the session
+} conn_state_t;
+
+typedef enum conn_op_e { // io_uring requests in flight for a connection
+	CONN_OP_RECV = 1, // Multishot receive
+	CONN_OP_CANCEL = 2, // Cancellation of the receive requested
+	CONN_OP_POLL = 4, // Writability poll
+	CONN_OP_READY = 8, // Readability poll, TLS connections read through OpenSSL
+	CONN_OP_SEND = 16, // Sends and splices of queued output
+	CONN_OP_SENT = 32, // Some of them wrote output
+	CONN_OP_BLOCKED = 64, // Some of them found the socket full
+	CONN_OP_FAILED = 128 // Some of them failed, the connection is closed
+} conn_op_t;
+
+// Kept small, an idle keep-alive connection holds nothing else
+typedef struct connection_s {
+	int fd;
+	conn_state_t state;
+	String buffer; // From the buffer pool while input is being parsed, NULL when idle
+	size_t buffer_len, buffer_size, header_len;
+	tw_timer_t timer;
+	out_queue_t output;
+	Request_Body body; // Set while the request has a body, until it is handled
+	H2_Session h2; // Set once the connection switched to HTTP/2
+	Tls_Session tls; // Set on connections accepted by a TLS listener
+	Cap_Pending capture; // Set while a sampled request is being answered
+	uint32_t events; // Registered epoll events, 0 when not registered
+	uint32_t id; // Tells completions of an earlier connection on the same descriptor apart
+	unsigned int uring_ops;
+	uint64_t client; // Rate limiting key of the peer's address prefix
+	uint64_t arrival_us; // Wall clock time the current request reached the host
+	bool paused; // Reading stopped until the output drains below the low watermark
+	bool responding; // The current response queued output already
+	char address[INET6_ADDRSTRLEN];
+} connection_t;
+
+typedef connection_t *Connection;
+
+// Fails to compile when the struct outgrows its budget
+typedef char conn_size_check_t[(sizeof(connection_t) <= CONN_STRUCT_MAX) ? 1 : -1];
+
+extern Connection conn_create(const int, const String);
+extern void conn_hold_buffer(Connection const, const size_t);
+extern void conn_drop_buffer(Connection const);
+extern void conn_destroy(Connection);
+
+#endif /* End CONNECTION_H */
@@ -0,0 +1,840 @@
+#include <poll.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <libgen.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+
+#include "../../globals.h"
+#include "../logging/log.h"
+#include "../colors/colors.h"
+#include "../assets/assets.h"
+#include "../file_cache/file_cache.h"
+#include "../static_file/static_file.h"
+#include "../http_headers/http_headers.h"
+#include "core.h"
+
+// Request handling shared by single-HTTP and the servers built on other
+// concurrency models: the configuration file, the request line, routing and
+// framing, and for threaded-HTTP, select-HTTP and fork-HTTP the responses
+// themselves. Nothing is written to shared memory once core_create()
+// returned, so any number of threads or processes serve through one Core.
+// Responses of the siblings are HTTP/1.0 with keep-alive: static files with
+// their validators, built-in assets and PHP, whose interpreter writes to the
+// client socket itself. single-HTTP answers through a response path of its own
+// in main.c, which adds ranges, compression, the caches and HTTP/2; the
+// constants both use live in core.h.
+
+#define DEFAULT_HT_S 10
+#define DEFAULT_MAX_WORKERS 1024
+#define HTTP_VER_AMT 3
+#define HTTP_REQ_AMT 8
+#define IMPLEMENTED_HTTP_METHODS_LEN 2
+#define ENV_NAME_LEN 16
+#define USAGE_MSG "Usage: %s [-h] [-V] [-v] [-s <configuration file>]\n"
+
+extern char **environ;
+
+static String clean_config_line(String string) {
+	while (*string < 'a' || *string > 'z')
+		string++;
+
+	String offset = strpbrk(string, " #\n");
+
+	if (!offset)
+		return string;
+	*offset = '\0';
+
+	return string;
+}
+
+void core_default_options(core_options_t *const restrict options) {
+	memset(options, 0, sizeof(core_options_t));
+	strncpy(options->port, DEFAULT_PORT, CORE_PORT_LEN);
+	strncpy(options->doc_root, DEFAULT_ROOT, PATH_MAX - NT_LEN);
+	strncpy(options->spool_dir, "/tmp", PATH_MAX - NT_LEN);
+	strncpy(_log_root, DEFAULT_LOG_ROOT, PATH_MAX);
+	options->read_ms = DEFAULT_HEADER_MS;
+	options->write_ms = DEFAULT_WRITE_MS;
+	options->keepalive_ms = DEFAULT_KEEPALIVE_MS;
+	options->body_max_bytes = DEFAULT_BODY_MAX_BYTES;
+	options->max_workers = DEFAULT_MAX_WORKERS;
+	options->backlog = DEFAULT_BACKLOG;
+}
+
+// The key=value lines of a .conf file, NULL when it can not be read. Lines
+// without a value are skipped.
+HashTable core_read_configuration(const String path) {
+	const String extension = strrchr(path, '.');
+
+	if (!extension) {
+		if (verbose_flag)
+			puts(YELLOW "File Warning: -s option was not supplied a file" RESET);
+		return NULL;
+	}
+
+	if (strncmp(extension, ".conf", CONF_EXT_LEN) != 0) {
+		if (verbose_flag)
+			puts(YELLOW "File Warning: -s option takes a configuration file as an argument\n"
+			       "Using default parameter values" RESET);
+		return NULL;
+	}
+
+	char buffer[KBYTE_S] = "";
+	String line, defn, value, save;
+	FILE *const conf_f = fopen(path, "r");
+
+	if (!conf_f) {
+		if (verbose_flag)
+			printf(YELLOW "File Error: %s\nUsing default parameter values\n" RESET, strerror(errno));
+		return NULL;
+	}
+
+	HashTable hashtable = ht_create(DEFAULT_HT_S);
+
+	while (fgets(buffer, KBYTE_S, conf_f)) {
+		if (buffer[0] == '#' || buffer[0] == '\n' || buffer[0] == '\t')
+			continue;
+		line = clean_config_line(buffer);
+		defn = strtok_r(line, "=", &save);
+		value = strtok_r(NULL, "=", &save);
+
+		if (defn && value)
+			ht_insert(&hashtable, defn, value);
+	}
+
+	if ((fclose(conf_f) != 0) && (verbose_flag))
+		printf(YELLOW "Configuration File Descriptor Error: %s\n" RESET, strerror(errno));
+
+	return hashtable;
+}
+
+// The keys the siblings of single-HTTP understand, others are ignored
+void core_load_configuration(const String path, core_options_t *const restrict options) {
+	const HashTable hashtable = core_read_configuration(path);
+	String option;
+
+	if (!hashtable)
+		return;
+
+	if ((option = ht_get_value(hashtable, "port")))
+		strncpy(options->port, option, CORE_PORT_LEN);
+	if ((option = ht_get_value(hashtable, "document_root")))
+		strncpy(options->doc_root, option, PATH_MAX - NT_LEN);
+	if ((option = ht_get_value(hashtable, "log_root")))
+		strncpy(_log_root, option, PATH_MAX);
+	if ((option = ht_get_value(hashtable, "request_body_spool_dir")))
+		strncpy(options->spool_dir, option, PATH_MAX - NT_LEN);
+	if ((option = ht_get_value(hashtable, "request_body_max_bytes")))
+		options->body_max_bytes = strtoull(option, NULL, 10);
+	if ((option = ht_get_value(hashtable, "timeout_header_ms")))
+		options->read_ms = strtoull(option, NULL, 10);
+	if ((option = ht_get_value(hashtable, "timeout_write_ms")))
+		options->write_ms = strtoull(option, NULL, 10);
+	if ((option = ht_get_value(hashtable, "timeout_keepalive_ms")))
+		options->keepalive_ms = strtoull(option, NULL, 10);
+	if ((option = ht_get_value(hashtable, "max_workers")))
+		options->max_workers = strtoul(option, NULL, 10);
+	if ((option = ht_get_value(hashtable, "listen_backlog")))
+		options->backlog = atoi(option);
+	if ((option = ht_get_value(hashtable, "etag_type")))
+		options->weak_etag = (strncmp(option, "weak", 5) == 0);
+	if ((option = ht_get_value(hashtable, "asset_override")))
+		options->asset_override = (strncmp(option, "on", 3) == 0);
+	ht_destroy(hashtable);
+}
+
+void core_compute_flags(const int argc, String *const argv, core_options_t *const restrict options) {
+	int c;
+
+	while ((c = getopt(argc, argv, "hVvs:")) != -1) {
+		switch (c) {
+		case 'h':
+			printf(USAGE_MSG
+			       "-h\tHelp menu\n"
+			       "-V\tVersion\n"
+			       "-v\tVerbose\n"
+			       "-s\tLoad a configuration file\n", basename(argv[0]));
+			exit(EXIT_SUCCESS);
+		case 'V':
+			puts("Version 0.6");
+			exit(EXIT_SUCCESS);
+		case 'v':
+			verbose_flag = true;
+			break;
+		case 's':
+			core_load_configuration(optarg, options);
+			break;
+		default:
+			fprintf(stderr, RED "Getopt Option Error: Unrecognized option: -%c\n" RESET, optopt);
+			exit(EXIT_FAILURE);
+		}
+	}
+}
+
+// NULL when the document root can not be opened
+Core core_create(const core_options_t *const restrict options) {
+	const int root_fd = open(options->doc_root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+	if (root_fd == -1)
+		return NULL;
+
+	const Core core = (Core) calloc(1, sizeof(core_t));
+	if (!core)
+		exit(EXIT_FAILURE);
+
+	memcpy(&core->options, options, sizeof(core_options_t));
+	core->root_fd = root_fd;
+	core->routes = s_ll_create();
+	core_default_routes(core->routes);
+
+	// Probed once, so serving never has to update it
+	core->beneath = true;
+	const int fd = fc_open_beneath(root_fd, ".", &core->beneath);
+
+	if (fd != -1)
+		close(fd);
+
+	return core;
+}
+
+void core_destroy(Core core) {
+	s_ll_destroy(core->routes);
+	close(core->root_fd);
+
+	free(core);
+	core = NULL;
+}
+
+void core_default_routes(S_Ll const routes) { // Last argument is the micro-cache TTL in seconds, 0 disables it
+	s_ll_insert(routes, "/", "static/html/index.html", 0);
+	s_ll_insert(routes, "/index", "static/html/index.html", 0);
+	s_ll_insert(routes, "/login", "views/login.php", 5);
+	s_ll_insert(routes, "/contact", "static/html/contact.html", 0);
+	s_ll_insert(routes, "/forbidden", "static/html/forbidden.html", 0);
+}
+
+// Splits the request line at the start of msg in place into the method,
+// target and version of reqline. Returns false when one of them is missing.
+bool core_request_line(String msg, String *const reqline) {
+	String save;
+
+	reqline[0] = strtok_r(msg, " \t\n", &save);
+	reqline[1] = reqline[0] ? strtok_r(NULL, " \t", &save) : NULL;
+	reqline[2] = reqline[1] ? strtok_r(NULL, " \t\n", &save) : NULL;
+
+	if (!reqline[2])
+		return false;
+	reqline[2][strcspn(reqline[2], "\r")] = '\0';
+
+	return true;
+}
+
+bool core_valid_request(String *const reqline) {
+	const String restrict http_methods[HTTP_REQ_AMT] = {
+		"GET", "HEAD", "POST", "PUT", "DELETE", "CONNECT", "OPTIONS", "TRACE"
+	};
+
+	for (int i = 0; i < HTTP_REQ_AMT; i++) // Double check
+		if (strncmp(reqline[0], http_methods[i], strnlen(http_methods[i], STR_MAX)) == 0)
+			return true;
+
+	const String restrict http_ver[HTTP_VER_AMT] = {"HTTP/1.0", "HTTP/1.1", "HTTP/2.0"};
+
+	for (int i = 0; i < HTTP_VER_AMT; i++)
+		if (strncmp(reqline[2], http_ver[i], strnlen(http_ver[i], STR_MAX)) == 0)
+			return true;
+
+	return false;
+}
+
+bool core_implemented(const String method) {
+	const String restrict implemented_http_methods[IMPLEMENTED_HTTP_METHODS_LEN] = {"GET", "POST"};
+
+	for (unsigned int i = 0; i < IMPLEMENTED_HTTP_METHODS_LEN; i++)
+		if (strncmp(method, implemented_http_methods[i], HTTP_METHOD_LEN) == 0)
+			return true;
+
+	return false;
+}
+
+static bool is_image(const String restrict extension) {
+	const String img_ext[] = {".png", ".jpg", ".jpeg", ".tiff", ".gif", ".bmp", ".svg", ".ico"};
+	const size_t img_ext_len = sizeof(img_ext) / sizeof(String);
+
+	for (unsigned int i = 0; i < img_ext_len; i++)
+		if (strncmp(extension, img_ext[i], CONF_EXT_LEN) == 0)
+			return true;
+	return false;
+}
+
+static bool is_audio(const String restrict extension) {
+	const String img_ext[] = {".wav", ".flac", ".opus", ".mp3", ".aac", ".ogg", ".pcm", ".aiff", ".wma", ".alac"};
+	const size_t img_ext_len = sizeof(img_ext) / sizeof(String);
+
+	for (unsigned int i = 0; i < img_ext_len; i++)
+		if (strncmp(extension, img_ext[i], CONF_EXT_LEN) == 0)
+			return true;
+	return false;
+}
+
+static bool is_video(const String restrict extension) {
+	const String img_ext[] = {".mp4", ".mov", ".avi", ".flv", ".wmv"};
+	const size_t img_ext_len = sizeof(img_ext) / sizeof(String);
+
+	for (unsigned int i = 0; i < img_ext_len; i++)
+		if (strncmp(extension, img_ext[i], CONF_EXT_LEN) == 0)
+			return true;
+	return false;
+}
+
+static bool is_binary(const String restrict extension) {
+	const String img_ext[] = {".exe", ".img", ".bin"};
+	const size_t img_ext_len = sizeof(img_ext) / sizeof(String);
+
+	for (unsigned int i = 0; i < img_ext_len; i++)
+		if (strncmp(extension, img_ext[i], CONF_EXT_LEN) == 0)
+			return true;
+	return false;
+}
+
+// Writes the path of target, relative to the document root, to path (of
+// PATH_MAX). Files with an extension live in the static directory of their
+// kind, other targets go through the routes. Returns the route taken, if any.
+S_Ll_Node core_route(S_Ll const routes, const String restrict target, String restrict path) {
+	S_Ll_Node route = NULL;
+	const String restrict extension = strrchr(target, '.');
+	const String relative = target + (target[0] == '/'); // Resolved beneath the document root
+	String directory = "";
+
+	if (extension) {
+		if (strncmp(extension, ".css", CONF_EXT_LEN) == 0)
+			directory = "static/css/";
+		else if (strncmp(extension, ".js", CONF_EXT_LEN) == 0)
+			directory = "static/javascript/";
+		else if (is_image(extension))
+			directory = "static/images/";
+		else if (is_video(extension))
+			directory = "static/video/";
+		else if (is_binary(extension))
+			directory = "static/binary/";
+		else if (is_audio(extension))
+			directory = "static/audio/";
+		snprintf(path, PATH_MAX, "%s%s", directory, relative);
+	}
+	else if ((route = s_ll_find(routes, target)))
+		snprintf(path, PATH_MAX, "%s", route->path);
+	else
+		snprintf(path, PATH_MAX, "%s", relative);
+
+	return route;
+}
+
+// Whether the NUL terminated buffer holds a whole header block, *header_len
+// is its length with the blank line that ends it
+bool core_header_end(const String buffer, size_t *const restrict header_len) {
+	const String crlf_end = strstr(buffer, "\r\n\r\n"), lf_end = strstr(buffer, "\n\n");
+	String end = crlf_end;
+
+	if (!end || (lf_end && (lf_end < end)))
+		end = lf_end;
+
+	if (!end)
+		return false;
+	*header_len = (end - buffer) + ((end == crlf_end) ? 4 : 2);
+
+	return true;
+}
+
+// Whether a body follows the header block of msg, and how it is framed
+bool core_request_framing(const String msg, bool *const restrict chunked, uint64_t *const restrict content_len) {
+	char value[HEADER_VALUE_LEN];
+	const String line_end = strchr(msg, '\n');
+
+	*chunked = false;
+	*content_len = 0;
+
+	if (!line_end)
+		return false;
+
+	// Transfer-Encoding takes precedence over Content-Length
+	if (http_header_get(line_end + 1, "Transfer-Encoding", value, HEADER_VALUE_LEN))
+		*chunked = (strcasestr(value, "chunked") != NULL);
+	if (!*chunked && http_header_get(line_end + 1, "Content-Length", value, HEADER_VALUE_LEN))
+		*content_len = strtoull(value, NULL, 10);
+
+	return *chunked || *content_len;
+}
+
+// What the client asked for, persistence is the default from HTTP/1.1 on
+bool core_wants_keep_alive(const String msg) {
+	char value[HEADER_VALUE_LEN];
+	const String line_end = strchr(msg, '\n');
+
+	if (!line_end)
+		return false;
+
+	if (http_header_get(line_end + 1, "Connection", value, HEADER_VALUE_LEN)) {
+		if (strcasestr(value, "close"))
+			return false;
+		if (strcasestr(value, "keep-alive"))
+			return true;
+	}
+
+	return memmem(msg, line_end - msg, "HTTP/1.1", HTTP_VER_LEN) != NULL;
+}
+
+static bool write_all(const int sock, const Byte *data, size_t len) {
+	while (len > 0) {
+		const ssize_t nbytes = send(sock, data, len, MSG_NOSIGNAL);
+
+		if (nbytes == -1) {
+			if (errno == EINTR)
+				continue;
+			return false; // EAGAIN once the write deadline passed
+		}
+		data += nbytes;
+		len -= nbytes;
+	}
+
+	return true;
+}
+
+// A false return means the client is gone
+bool core_send_buffer(core_output_t *const restrict out, const Byte *const data, const size_t len) {
+	if (out->queue)
+		return oq_send_buffer(out->queue, out->sock, data, len);
+	return write_all(out->sock, data, len);
+}
+
+static bool send_static(core_output_t *const restrict out, const Byte *const data, const size_t len) { // Never copied
+	if (out->queue)
+		return oq_send_static(out->queue, out->sock, data, len);
+	return write_all(out->sock, data, len);
+}
+
+bool core_send_file(core_output_t *const restrict out, const int fd, const off_t offset, size_t len) { // Zero-copy
+	off_t position = offset;
+
+	if (out->queue)
+		return oq_send_file(out->queue, out->sock, fd, offset, len);
+
+	while (len > 0) {
+		const ssize_t nbytes = sendfile(out->sock, fd, &position, len);
+
+		if ((nbytes == -1) && (errno == EINTR))
+			continue;
+		if (nbytes <= 0) // A file that shrank under the response ends it as well
+			return false;
+		len -= nbytes;
+	}
+
+	return true;
+}
+
+// Sends a partial, from the built-in copy unless asset_override lets a file
+// on disk replace it
+void core_send_page(Core const core, core_output_t *const restrict out, const String path) {
+	struct stat file;
+	const Asset asset = asset_find(path);
+
+	if (asset && !core->options.asset_override) {
+		send_static(out, asset->data, asset->len);
+		return;
+	}
+
+	const int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+	if (asset && (fd == -1)) {
+		send_static(out, asset->data, asset->len);
+		return;
+	}
+
+	if ((fd == -1) || (fstat(fd, &file) == -1)) {
+		const String err_msg = strerror(errno);
+
+		if (verbose_flag)
+			printf(YELLOW "Serve File Error: %s\n" RESET, err_msg);
+		server_log(err_msg);
+	} else
+		core_send_file(out, fd, 0, file.st_size);
+
+	if ((fd != -1) && (close(fd) == -1) && (verbose_flag))
+		printf(YELLOW "Copy File Descriptor Error: %s\n" RESET, strerror(errno));
+}
+
+// Starts the body of the request whose header block is the first header_len
+// of the len octets in msg: refuses a length announced beyond the limit,
+// answers Expect: 100-continue and spools what already arrived, *used octets
+// past the header block. RB_COMPLETE without a body when the request has
+// none. *body is set whenever a spool file was created, for the caller to
+// destroy.
+rb_status_t core_begin_body(Core const core, core_output_t *const restrict out, const String msg, const size_t header_len,
+                            const size_t len, Request_Body *const restrict body, size_t *const restrict used) {
+	char value[HEADER_VALUE_LEN];
+	const String line_end = strchr(msg, '\n');
+	uint64_t content_len;
+	bool chunked;
+
+	*body = NULL;
+	*used = 0;
+
+	if (!core_request_framing(msg, &chunked, &content_len))
+		return RB_COMPLETE;
+
+	if (content_len > core->options.body_max_bytes)
+		return RB_TOO_LARGE;
+
+	if (!(*body = rb_create(core->options.spool_dir, chunked, content_len, core->options.body_max_bytes))) {
+		if (verbose_flag)
+			printf(YELLOW "Spool File Error: %s\n" RESET, strerror(errno));
+		return RB_FAILED;
+	}
+
+	if (http_header_get(line_end + 1, "Content-Type", value, HEADER_VALUE_LEN))
+		snprintf((*body)->type, RB_TYPE_LEN, "%.*s", RB_TYPE_LEN - NT_LEN, value);
+
+	if ((len == header_len) && http_header_get(line_end + 1, "Expect", value, HEADER_VALUE_LEN)
+	    && (strcasecmp(value, "100-continue") == 0))
+		core_send_buffer(out, (Byte*) CONTINUE, CODE_100_LEN); // Not the response itself
+
+	return rb_feed(*body, (Byte*) msg + header_len, len - header_len, used);
+}
+
+// Answers a request whose body could not be received, the connection closes
+void core_reject_body(Core const core, core_output_t *const restrict out, const String address, const rb_status_t status) {
+	if (status == RB_CLOSED)
+		return;
+
+	if (verbose_flag)
+		printf(YELLOW "Connection from %s; Request body %s\n" RESET, address,
+		       (status == RB_TOO_LARGE) ? "too large" : (status == RB_INVALID) ? "malformed" : "not spooled");
+
+	if (status == RB_TOO_LARGE)
+		core_send_buffer(out, (Byte*) PAYLOAD_TOO_LARGE, CODE_413_LEN);
+	else if (status == RB_INVALID) {
+		core_send_buffer(out, (Byte*) BAD_REQUEST, CODE_400_LEN);
+		core_send_page(core, out, "partials/code-responses/400.html");
+	} else {
+		core_send_buffer(out, (Byte*) SERVER_ERROR, CODE_500_LEN);
+		core_send_page(core, out, "partials/code-responses/500.html");
+	}
+}
+
+// The interpreter writes to the client socket itself, after the status line,
+// and the response ends when it exits. Its environment is built before the
+// fork, a child of a threaded server may only make async-signal-safe calls.
+static core_result_t run_php(Core const core, core_output_t *const restrict out, const String path, Request_Body const body) {
+	char script[PATH_MAX * 2], length[ENV_NAME_LEN + HEADER_VALUE_LEN], type[ENV_NAME_LEN + RB_TYPE_LEN];
+	size_t env_cnt = 0;
+
+	// The interpreter opens the script itself, by its absolute path
+	snprintf(script, sizeof(script), "%s%s", core->options.doc_root, path);
+
+	// Nothing of ours may follow the output of the interpreter
+	if (!core_send_buffer(out, (Byte*) OK, CODE_200_LEN) || (out->queue && out->queue->bytes))
+		return CORE_CLOSE;
+
+	while (environ[env_cnt])
+		env_cnt++;
+
+	String *const env = (String*) calloc(env_cnt + 3, sizeof(String));
+	if (!env)
+		exit(EXIT_FAILURE);
+
+	memcpy(env, environ, env_cnt * sizeof(String));
+
+	if (body) {
+		snprintf(length, sizeof(length), "CONTENT_LENGTH=%llu", (unsigned long long) body->len);
+		env[env_cnt++] = length;
+
+		if (body->type[0]) {
+			snprintf(type, sizeof(type), "CONTENT_TYPE=%s", body->type);
+			env[env_cnt++] = type;
+		}
+	}
+
+	const int input = body ? rb_rewind(body) : -1;
+	const pid_t c_pid = fork();
+
+	if (c_pid == 0) {
+		if (input != -1)
+			dup2(input, STDIN_FILENO);
+		dup2(out->sock, STDOUT_FILENO);
+		fcntl(STDOUT_FILENO, F_SETFL, 0); // The socket select-HTTP left non-blocking, it closes its own copy
+		execle("/usr/bin/php", "php", script, (String) NULL, env);
+		_exit(EXIT_FAILURE);
+	}
+	free(env);
+
+	if (c_pid == -1) {
+		const String err_msg = strerror(errno);
+
+		if (verbose_flag)
+			printf(YELLOW "Process Forking Error: %s\n" RESET, err_msg);
+		server_log(err_msg);
+	}
+
+	return CORE_CLOSE;
+}
+
+static core_result_t serve_asset(core_output_t *const restrict out, String *const reqline, const String headers, const Asset asset,
+                                 const bool keep_alive) {
+	char header[HEADER_BLOCK_LEN];
+	int len;
+
+	if (sf_is_not_modified(headers, asset->etag, asset->mtime)) {
+		if (verbose_flag)
+			printf(GREEN "GET %s [304 Not Modified, built-in]\n" RESET, reqline[1]);
+		len = snprintf(header, HEADER_BLOCK_LEN, NOT_MODIFIED_LINE "%sETag: %s\r\n\r\n", CONNECTION_HEADER(keep_alive), asset->etag);
+
+		return core_send_buffer(out, (Byte*) header, len) ? CORE_KEEP : CORE_CLOSE;
+	}
+
+	if (verbose_flag)
+		printf(GREEN "GET %s [200 OK, built-in]\n" RESET, reqline[1]);
+	len = snprintf(header, HEADER_BLOCK_LEN, OK_LINE "%s%s\r\n", CONNECTION_HEADER(keep_alive), asset->headers);
+
+	return (core_send_buffer(out, (Byte*) header, len) && send_static(out, asset->data, asset->len)) ? CORE_KEEP : CORE_CLOSE;
+}
+
+// The whole file or 304 when the validators match, byte ranges are left to
+// single-HTTP
+static core_result_t serve_file(Core const core, core_output_t *const restrict out, String *const reqline, const String headers,
+                                const String path, const int fd, const struct stat *const restrict file, const bool keep_alive) {
+	char etag[SF_ETAG_LEN], last_modified[SF_HTTP_DATE_LEN], header[HEADER_BLOCK_LEN];
+	int len;
+
+	sf_make_etag(file, etag, core->options.weak_etag);
+	sf_http_date(file->st_mtime, last_modified);
+
+	if (sf_is_not_modified(headers, etag, file->st_mtime)) {
+		if (verbose_flag)
+			printf(GREEN "GET %s [304 Not Modified]\n" RESET, reqline[1]);
+		len = snprintf(header, HEADER_BLOCK_LEN, NOT_MODIFIED_LINE "%sETag: %s\r\nLast-Modified: %s\r\n\r\n",
+		               CONNECTION_HEADER(keep_alive), etag, last_modified);
+
+		return core_send_buffer(out, (Byte*) header, len) ? CORE_KEEP : CORE_CLOSE;
+	}
+
+	if (verbose_flag)
+		printf(GREEN "GET %s [200 OK]\n" RESET, reqline[1]);
+	len = snprintf(header, HEADER_BLOCK_LEN, OK_LINE "%sContent-Type: %s\r\nContent-Length: %lld\r\nLast-Modified: %s\r\n"
+	               "ETag: %s\r\n\r\n", CONNECTION_HEADER(keep_alive), fc_mime_type(path), (long long) file->st_size,
+	               last_modified, etag);
+
+	return (core_send_buffer(out, (Byte*) header, len) && core_send_file(out, fd, 0, file->st_size)) ? CORE_KEEP : CORE_CLOSE;
+}
+
+// Answers the request in msg, its header block NUL terminated. The request
+// line is split in place. body is the spooled request body, if any.
+core_result_t core_respond(Core const core, core_output_t *const restrict out, String msg, const String address,
+                           Request_Body const body, const bool keep_alive) {
+	const String line_end = strchr(msg, '\n');
+	const String headers = line_end ? line_end + 1 : NULL;
+	char con_msg[CONNECTION_TEMPLATE_LEN + PATH_MAX], path[PATH_MAX];
+	String reqline[CORE_REQLINE_TOKENS];
+	struct stat file;
+	int error = 0;
+	bool beneath = core->beneath;
+
+	if (!core_request_line(msg, reqline)) {
+		snprintf(con_msg, CONNECTION_TEMPLATE_LEN + PATH_MAX, "Connection from %s; BAD REQUEST", address);
+
+		if (verbose_flag)
+			printf(YELLOW "%s\n" RESET, con_msg);
+		server_log(con_msg);
+		core_send_buffer(out, (Byte*) BAD_REQUEST, CODE_400_LEN);
+		core_send_page(core, out, "partials/code-responses/400.html");
+		return CORE_CLOSE;
+	}
+
+	core_route(core->routes, reqline[1], path);
+	snprintf(con_msg, CONNECTION_TEMPLATE_LEN + PATH_MAX, CONNECTION_TEMPLATE, address, reqline[1]);
+
+	if (verbose_flag)
+		printf("%s\n", con_msg);
+	server_log(con_msg);
+
+	if (!core_valid_request(reqline)) {
+		if (verbose_flag)
+			printf("%s %s [400 Bad Request]\n", reqline[0], reqline[1]);
+		core_send_buffer(out, (Byte*) BAD_REQUEST, CODE_400_LEN);
+		core_send_page(core, out, "partials/code-responses/400.html");
+		return CORE_CLOSE;
+	}
+
+	if (strncmp(reqline[2], "HTTP/2.0", HTTP_VER_LEN) == 0) {
+		if (verbose_flag)
+			printf("GET %s %s [505 Http Version Not Supported]\n", reqline[1], reqline[2]);
+		core_send_buffer(out, (Byte*) NOT_SUPPORTED, CODE_505_LEN);
+		core_send_page(core, out, "partials/code-responses/505.html");
+		return CORE_CLOSE;
+	}
+
+	if (!core_implemented(reqline[0])) {
+		if (verbose_flag)
+			printf("%s %s [501 Not Implemented]\n", reqline[0], reqline[1]);
+		core_send_buffer(out, (Byte*) NOT_IMPLEMENTED, CODE_501_LEN);
+		core_send_page(core, out, "partials/code-responses/501.html");
+		return CORE_CLOSE;
+	}
+
+	const Asset asset = asset_find(path);
+
+	if (asset && !core->options.asset_override)
+		return serve_asset(out, reqline, headers, asset, keep_alive);
+
+	// EXDEV when the path leads outside the root, EISDIR for anything but a regular file
+	const int fd = fc_open_beneath(core->root_fd, path, &beneath);
+
+	if ((fd == -1) || (fstat(fd, &file) == -1))
+		error = errno;
+	else if (!S_ISREG(file.st_mode))
+		error = EISDIR;
+
+	if (!error) {
+		const String extension = strrchr(path, '.');
+		core_result_t result;
+
+		if (extension && (strncmp(extension, ".php", PHP_EXT_LEN) == 0)) {
+			if (verbose_flag)
+				printf(GREEN "%s %s [200 OK]\n" RESET, reqline[0], reqline[1]);
+			result = run_php(core, out, path, body);
+		} else
+			result = serve_file(core, out, reqline, headers, path, fd, &file, keep_alive);
+		close(fd);
+
+		return result;
+	}
+
+	if (fd != -1)
+		close(fd);
+
+	if (asset) // Nothing on disk overrides it
+		return serve_asset(out, reqline, headers, asset, keep_alive);
+
+	if ((error == ENOENT) || (error == ENOTDIR) || (error == EISDIR)) {
+		if (verbose_flag)
+			printf("GET %s [404 Not Found]\n", reqline[1]);
+		core_send_buffer(out, (Byte*) NOT_FOUND, CODE_404_LEN);
+		core_send_page(core, out, "partials/code-responses/404.html");
+	}
+	else if ((error == EACCES) || (error == EXDEV) || (error == ELOOP)) {
+		if (verbose_flag)
+			printf(YELLOW "GET %s [403 Access Denied]\n" RESET, reqline[1]);
+		core_send_buffer(out, (Byte*) FORBIDDEN, CODE_403_LEN);
+		core_send_page(core, out, "partials/code-responses/403.html");
+	}
+	else {
+		if (verbose_flag)
+			printf(RED "GET %s [500 Internal Server Error]\n" RESET, reqline[1]);
+		core_send_buffer(out, (Byte*) SERVER_ERROR, CODE_500_LEN);
+		core_send_page(core, out, "partials/code-responses/500.html");
+	}
+
+	return CORE_CLOSE;
+}
+
+// Waits up to ms for sock to become readable
+static bool wait_input(const int sock, const uint64_t ms) {
+	struct pollfd pfd = {sock, POLLIN, 0};
+	int result;
+
+	while (((result = poll(&pfd, 1, (int) ms)) == -1) && (errno == EINTR))
+		;
+
+	return result > 0;
+}
+
+// Reads until buffer holds a whole header block, which has ms to begin
+// arriving and read_ms once it did. False when the connection is to close.
+static bool read_header(Core const core, core_output_t *const restrict out, String buffer, size_t *const restrict len,
+                        size_t *const restrict header_len, const uint64_t ms) {
+	while (!core_header_end(buffer, header_len)) {
+		if (*len == CORE_REQUEST_LEN) {
+			if (verbose_flag)
+				puts(YELLOW "Connection Error: Request header too large" RESET);
+			core_send_buffer(out, (Byte*) BAD_REQUEST, CODE_400_LEN);
+			core_send_page(core, out, "partials/code-responses/400.html");
+			return false;
+		}
+
+		if (!wait_input(out->sock, *len ? core->options.read_ms : ms))
+			return false;
+
+		const ssize_t nbytes = recv(out->sock, buffer + *len, CORE_REQUEST_LEN - *len, 0);
+
+		if (nbytes <= 0)
+			return false;
+		*len += nbytes;
+		buffer[*len] = '\0';
+	}
+
+	return true;
+}
+
+// Serves the requests of a blocking socket one after the other, for servers
+// with a thread or a process per connection. A request has read_ms to arrive,
+// the connection is kept keepalive_ms between requests and writes give up
+// after write_ms. The caller closes sock.
+void core_serve_connection(Core const core, const int sock, const String address) {
+	const String buffer = (String) malloc(CORE_REQUEST_LEN + NT_LEN);
+	const struct timeval write_timeout = {core->options.write_ms / 1000, (core->options.write_ms % 1000) * 1000};
+	core_output_t out = {sock, NULL};
+	size_t len = 0;
+	bool keep_alive = true;
+
+	if (!buffer) {
+		fprintf(stderr, RED "Memory Error: %s\n" RESET, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	buffer[0] = '\0';
+	setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &write_timeout, sizeof(write_timeout));
+
+	for (uint64_t wait_ms = core->options.read_ms; keep_alive; wait_ms = core->options.keepalive_ms) {
+		Request_Body body = NULL;
+		size_t header_len, used;
+
+		if (!read_header(core, &out, buffer, &len, &header_len, wait_ms))
+			break;
+
+		rb_status_t status = core_begin_body(core, &out, buffer, header_len, len, &body, &used);
+
+		// The rest of the body is spliced from the socket, nothing past it is read
+		while ((status == RB_MORE) && wait_input(sock, core->options.read_ms))
+			status = rb_splice(body, sock);
+
+		if (status != RB_COMPLETE) {
+			core_reject_body(core, &out, address, (status == RB_MORE) ? RB_CLOSED : status);
+			if (body)
+				rb_destroy(body);
+			break;
+		}
+
+		const char next = buffer[header_len];
+
+		keep_alive = core->options.keepalive_ms && core_wants_keep_alive(buffer);
+		buffer[header_len] = '\0';
+
+		if (core_respond(core, &out, buffer, address, body, keep_alive) == CORE_CLOSE)
+			keep_alive = false;
+		if (body) // A PHP run holds its own descriptor of the spool file
+			rb_destroy(body);
+
+		// A pipelined request may follow in the buffer
+		buffer[header_len] = next;
+		len -= header_len + used;
+		memmove(buffer, buffer + header_len + used, len);
+		buffer[len] = '\0';
+	}
+
+	free(buffer);
+}
@@ -0,0 +1,124 @@
+#ifndef CORE_H
+#define CORE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <linux/limits.h>
+
+#include "../types/types.h"
+#include "../hashtable/hashtable.h"
+#include "../out_queue/out_queue.h"
+#include "../request_body/request_body.h"
+#include "../s_linked_list/s_linked_list.h"
+
+#define OK "HTTP/1.0 200 OK\n\n"
+#define CREATED "HTTP/1.0 201 CREATED\n\n"
+#define NOT_FOUND "HTTP/1.0 404 NOT FOUND\n\n"
+#define FORBIDDEN "HTTP/1.0 403 FORBIDDEN\n\n"
+#define BAD_REQUEST "HTTP/1.0 400 BAD REQUEST\n\n"
+#define SERVER_ERROR "HTTP/1.0 500 INTERNAL SERVER ERROR\n\n"
+#define NOT_SUPPORTED "HTTP/1.0 505 HTTP VERSION NOT SUPPORTED\n\n"
+#define NOT_IMPLEMENTED "HTTP/1.0 501 NOT IMPLEMENTED\n\n"
+#define PAYLOAD_TOO_LARGE "HTTP/1.0 413 PAYLOAD TOO LARGE\r\nContent-Length: 0\r\nConnection: close\r\n\r\n"
+#define CONTINUE "HTTP/1.1 100 CONTINUE\r\n\r\n"
+
+#define OK_LINE "HTTP/1.0 200 OK\r\n"
+#define NOT_MODIFIED_LINE "HTTP/1.0 304 NOT MODIFIED\r\n"
+#define KEEP_ALIVE_HEADER "Connection: keep-alive\r\n"
+#define CLOSE_HEADER "Connection: close\r\n"
+#define CONNECTION_HEADER(keep_alive) ((keep_alive) ? KEEP_ALIVE_HEADER : CLOSE_HEADER)
+
+#define CODE_200_LEN 17
+#define CODE_400_LEN 26
+#define CODE_403_LEN 24
+#define CODE_404_LEN 24
+#define CODE_500_LEN 36
+#define	CODE_501_LEN 30
+#define CODE_505_LEN 41
+#define CODE_413_LEN 72
+#define CODE_100_LEN 25
+
+#define DEFAULT_ROOT "/home/elliott/Github/C-Server-Collection/single-HTTP/"
+#define DEFAULT_LOG_ROOT "/home/elliott/Github/C-Server-Collection/single-HTTP/logs/"
+#define DEFAULT_PORT "8888"
+
+// Shared by single-HTTP and the siblings, which read the same configuration
+#define DEFAULT_HEADER_MS 10000
+#define DEFAULT_WRITE_MS 30000
+#define DEFAULT_KEEPALIVE_MS 5000
+#define DEFAULT_BODY_MAX_BYTES (16 * MBYTE_S)
+#define DEFAULT_BACKLOG 511
+
+#define STR_MAX 2048
+#define HTTP_VER_LEN 8
+#define HTTP_METHOD_LEN 7
+#define CONF_EXT_LEN 5
+#define PHP_EXT_LEN 4
+#define HEADER_VALUE_LEN 256
+#define HEADER_BLOCK_LEN 512
+#define CONNECTION_TEMPLATE "Connection from %s for file %s"
+#define CONNECTION_TEMPLATE_LEN 28
+
+#define CORE_REQUEST_LEN 4096 // Longest header block of a request
+#define CORE_PORT_LEN 5
+#define CORE_REQLINE_TOKENS 3
+
+typedef enum core_result_e {
+	CORE_CLOSE, // Unframed or failed response, the connection is closed once its output is sent
+	CORE_KEEP // Framed response, the connection may be kept alive
+} core_result_t;
+
+// Settings of the servers built on the core, from the same configuration
+// file as single-HTTP
+typedef struct core_options_s {
+	char port[CORE_PORT_LEN + 1], doc_root[PATH_MAX], spool_dir[PATH_MAX];
+	uint64_t read_ms, write_ms, keepalive_ms; // Deadlines of a request, of a write and of an idle connection
+	uint64_t body_max_bytes;
+	unsigned int max_workers; // Connections threaded-HTTP and fork-HTTP serve at once, a thread or process each
+	int backlog;
+	bool weak_etag, asset_override;
+} core_options_t;
+
+// Read-only once created, shared by every thread or process that serves
+typedef struct core_s {
+	core_options_t options;
+	S_Ll routes;
+	int root_fd;
+	bool beneath; // openat2() with RESOLVE_BENEATH is available
+} core_t;
+
+typedef core_t *Core;
+
+// Where a response goes: queued for a non-blocking socket, or written to a
+// blocking one before the call returns
+typedef struct core_output_s {
+	int sock;
+	Out_Queue queue; // NULL for a blocking socket
+} core_output_t;
+
+extern void core_default_options(core_options_t *const);
+extern HashTable core_read_configuration(const String);
+extern void core_load_configuration(const String, core_options_t *const);
+extern void core_compute_flags(const int, String *const, core_options_t *const);
+extern Core core_create(const core_options_t *const);
+extern void core_destroy(Core);
+extern void core_default_routes(S_Ll const);
+extern bool core_request_line(String, String *const);
+extern bool core_valid_request(String *const);
+extern bool core_implemented(const String);
+extern S_Ll_Node core_route(S_Ll const, const String, String);
+extern bool core_header_end(const String, size_t *const);
+extern bool core_request_framing(const String, bool *const, uint64_t *const);
+extern bool core_wants_keep_alive(const String);
+extern bool core_send_buffer(core_output_t *const, const Byte *, const size_t);
+extern bool core_send_file(core_output_t *const, const int, const off_t, const size_t);
+extern void core_send_page(Core const, core_output_t *const, const String);
+extern rb_status_t core_begin_body(Core const, core_output_t *const, const String, const size_t, const size_t,
+                                   Request_Body *const, size_t *const);
+extern void core_reject_body(Core const, core_output_t *const, const String, const rb_status_t);
+extern core_result_t core_respond(Core const, core_output_t *const, String, const String, Request_Body const, const bool);
+extern void core_serve_connection(Core const, const int, const String);
+
+#endif /* End CORE_H */
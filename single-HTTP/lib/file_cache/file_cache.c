@@ -0,0 +1,269 @@
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <strings.h>
+#include <sys/syscall.h>
+#include <linux/openat2.h>
+
+#include "file_cache.h"
+
+// Open files of the document root keyed by their relative path, together with
+// their stat data and MIME type. Paths are resolved relative to one descriptor
+// of the root with openat2() and RESOLVE_BENEATH, so ".." or a symbolic link
+// can never lead outside of it. Failed lookups are cached as well, so a hot
+// path costs no open at all until its entry is older than the TTL. The least
+// recently used entry is closed when the cache is full. Failures are kept in
+// a list of their own with a smaller cap, so a scan of missing paths only
+// ever evicts other failures and never the hot files.
+
+#define NT_LEN 1
+#define STR_MAX 2048
+#define DEFAULT_MIME "application/octet-stream"
+#define FAILED_SHARE 4 // Cached failures are capped at this fraction of the entries
+
+static const struct mime_type_s {
+	String extension, type;
+} mime_types[] = {
+	{".html", "text/html; charset=utf-8"}, {".htm", "text/html; charset=utf-8"},
+	{".css", "text/css; charset=utf-8"}, {".js", "text/javascript; charset=utf-8"},
+	{".json", "application/json"}, {".xml", "application/xml"}, {".txt", "text/plain; charset=utf-8"},
+	{".svg", "image/svg+xml"}, {".png", "image/png"}, {".jpg", "image/jpeg"}, {".jpeg", "image/jpeg"},
+	{".gif", "image/gif"}, {".bmp", "image/bmp"}, {".tiff", "image/tiff"}, {".ico", "image/x-icon"},
+	{".webp", "image/webp"}, {".wav", "audio/wav"}, {".flac", "audio/flac"}, {".opus", "audio/opus"},
+	{".mp3", "audio/mpeg"}, {".aac", "audio/aac"}, {".ogg", "audio/ogg"}, {".aiff", "audio/aiff"},
+	{".mp4", "video/mp4"}, {".mov", "video/quicktime"}, {".avi", "video/x-msvideo"}, {".flv", "video/x-flv"},
+	{".wmv", "video/x-ms-wmv"}, {".pdf", "application/pdf"}, {".gz", "application/gzip"}
+};
+
+static uint64_t fc_now_ms(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// D. J. Bernstein Hash, Modified
+static unsigned int get_hash(const File_Cache restrict cache, String restrict key) {
+	unsigned int result = 5381;
+
+	while (*key)
+		result = (33 * result) ^ (unsigned char) *key++;
+
+	return result % cache->bin_cnt;
+}
+
+// An entry stays in the list it was pushed to, failures never gain an fd
+static void lru_unlink(const File_Cache restrict cache, const Fc_Entry restrict entry) {
+	Fc_Entry *const head = (entry->fd == -1) ? &cache->failed_head : &cache->lru_head;
+	Fc_Entry *const tail = (entry->fd == -1) ? &cache->failed_tail : &cache->lru_tail;
+
+	if (entry->lru_prev)
+		entry->lru_prev->lru_next = entry->lru_next;
+	else
+		*head = entry->lru_next;
+
+	if (entry->lru_next)
+		entry->lru_next->lru_prev = entry->lru_prev;
+	else
+		*tail = entry->lru_prev;
+	entry->lru_prev = entry->lru_next = NULL;
+}
+
+static void lru_push(const File_Cache restrict cache, const Fc_Entry restrict entry) {
+	Fc_Entry *const head = (entry->fd == -1) ? &cache->failed_head : &cache->lru_head;
+	Fc_Entry *const tail = (entry->fd == -1) ? &cache->failed_tail : &cache->lru_tail;
+
+	entry->lru_prev = NULL;
+	entry->lru_next = *head;
+
+	if (*head)
+		(*head)->lru_prev = entry;
+	*head = entry;
+
+	if (!*tail)
+		*tail = entry;
+}
+
+// Queued responses hold their own duplicate of the descriptor, so closing it
+// here never cuts a transfer short
+static void remove_entry(const File_Cache restrict cache, Fc_Entry entry) {
+	Fc_Entry *link = &cache->bins[get_hash(cache, entry->path)];
+
+	while (*link && *link != entry)
+		link = &(*link)->next;
+	if (*link)
+		*link = entry->next;
+
+	lru_unlink(cache, entry);
+
+	if (entry->fd != -1) {
+		close(entry->fd);
+		cache->entry_cnt--;
+	} else
+		cache->failed_cnt--;
+
+	free(entry->path);
+	entry->path = NULL;
+
+	free(entry);
+	entry = NULL;
+}
+
+// Kernels before 5.6 lack openat2(). Without it the path is resolved by
+// openat() and rejected if one of its components is "..", which keeps the
+// lookup beneath the root except through symbolic links placed inside it.
+// *beneath is cleared the first time the kernel turns out to lack openat2().
+// O_NONBLOCK keeps a FIFO from blocking the open until a writer shows up, it
+// has no effect on the regular files that are served.
+int fc_open_beneath(const int root_fd, const String restrict path, bool *const restrict beneath) {
+	if (*beneath) {
+		struct open_how how;
+
+		memset(&how, 0, sizeof(how));
+		how.flags = O_RDONLY | O_CLOEXEC | O_NONBLOCK;
+		how.resolve = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS;
+
+		const int fd = syscall(SYS_openat2, root_fd, path, &how, sizeof(how));
+
+		if ((fd != -1) || (errno != ENOSYS))
+			return fd;
+		*beneath = false;
+	}
+
+	for (const char *component = path; component; component = strchr(component, '/')) {
+		component += (*component == '/');
+
+		if ((strncmp(component, "..", 2) == 0) && ((component[2] == '/') || (component[2] == '\0'))) {
+			errno = EXDEV;
+			return -1;
+		}
+	}
+
+	return openat(root_fd, path, O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+}
+
+// Two entries at least, so a lookup never evicts the entry returned by the one
+// before it (a file and its .gz sidecar are used together)
+File_Cache fc_create(const String restrict root, const unsigned int bin_cnt, const unsigned int max_entries,
+                     const uint64_t ttl_ms) {
+	if ((bin_cnt < 1) || (max_entries < 2))
+		return NULL;
+
+	const int root_fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (root_fd == -1)
+		return NULL;
+
+	const File_Cache cache = (File_Cache) calloc(1, sizeof(file_cache_t));
+	if (!cache)
+		exit(EXIT_FAILURE);
+
+	cache->bins = (Fc_Entry*) calloc(bin_cnt, sizeof(Fc_Entry));
+	if (!cache->bins)
+		exit(EXIT_FAILURE);
+
+	cache->root_fd = root_fd;
+	cache->beneath = true;
+	cache->bin_cnt = bin_cnt;
+	cache->max_entries = max_entries;
+	cache->max_failed = (max_entries / FAILED_SHARE > 2) ? max_entries / FAILED_SHARE : 2;
+	cache->ttl_ms = ttl_ms;
+
+	return cache;
+}
+
+void fc_destroy(File_Cache cache) {
+	while (cache->lru_head)
+		remove_entry(cache, cache->lru_head);
+	while (cache->failed_head)
+		remove_entry(cache, cache->failed_head);
+	close(cache->root_fd);
+
+	free(cache->bins);
+	cache->bins = NULL;
+
+	free(cache);
+	cache = NULL;
+}
+
+// Returns the entry for path, relative to the document root, opening it on a
+// miss or once the cached entry expired. An entry whose fd is -1 records why
+// the path can not be served in error: EXDEV when it leads outside the root,
+// EISDIR for anything but a regular file, otherwise the errno of the open.
+Fc_Entry fc_open(const File_Cache restrict cache, const String restrict path) {
+	const unsigned int bin = get_hash(cache, path);
+	const uint64_t now = fc_now_ms();
+	Fc_Entry entry;
+
+	for (entry = cache->bins[bin]; entry; entry = entry->next)
+		if (strncmp(path, entry->path, STR_MAX) == 0)
+			break;
+
+	if (entry) {
+		if (entry->expires_ms > now) {
+			lru_unlink(cache, entry);
+			lru_push(cache, entry);
+			return entry;
+		}
+		remove_entry(cache, entry);
+	}
+
+	entry = (Fc_Entry) calloc(1, sizeof(fc_entry_t));
+	if (!entry)
+		exit(EXIT_FAILURE);
+
+	const size_t path_len = strnlen(path, STR_MAX);
+
+	entry->path = (String) calloc(path_len + NT_LEN, sizeof(char));
+	if (!entry->path)
+		exit(EXIT_FAILURE);
+
+	strncpy(entry->path, path, path_len);
+	entry->fd = fc_open_beneath(cache->root_fd, path, &cache->beneath);
+
+	if ((entry->fd == -1) || (fstat(entry->fd, &entry->file) == -1))
+		entry->error = errno;
+	else if (!S_ISREG(entry->file.st_mode))
+		entry->error = EISDIR;
+
+	if (entry->error && (entry->fd != -1)) {
+		close(entry->fd);
+		entry->fd = -1;
+	}
+
+	// Evicts from the list the new entry joins, after the open that decides it
+	if ((entry->fd != -1) && (cache->entry_cnt == cache->max_entries))
+		remove_entry(cache, cache->lru_tail);
+	else if ((entry->fd == -1) && (cache->failed_cnt == cache->max_failed))
+		remove_entry(cache, cache->failed_tail);
+
+	entry->mime = fc_mime_type(path);
+	entry->expires_ms = now + cache->ttl_ms;
+	entry->next = cache->bins[bin];
+	cache->bins[bin] = entry;
+	if (entry->fd != -1)
+		cache->entry_cnt++;
+	else
+		cache->failed_cnt++;
+	lru_push(cache, entry);
+
+	return entry;
+}
+
+String fc_mime_type(const String restrict path) {
+	const String extension = strrchr(path, '.');
+	const size_t mime_type_len = sizeof(mime_types) / sizeof(mime_types[0]);
+
+	if (!extension || strchr(extension, '/'))
+		return DEFAULT_MIME;
+
+	for (unsigned int i = 0; i < mime_type_len; i++)
+		if (strcasecmp(extension, mime_types[i].extension) == 0)
+			return mime_types[i].type;
+
+	return DEFAULT_MIME;
+}
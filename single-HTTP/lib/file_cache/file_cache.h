@@ -0,0 +1,39 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "../types/types.h"
+
+typedef struct fc_entry_s {
+	String path; // Relative to the document root
+	int fd, error; // fd is -1 for a cached failure, error holds its errno
+	struct stat file;
+	String mime;
+	uint64_t expires_ms;
+	struct fc_entry_s *next, *lru_prev, *lru_next;
+} fc_entry_t;
+
+typedef fc_entry_t *Fc_Entry;
+
+typedef struct file_cache_s {
+	int root_fd;
+	bool beneath; // openat2() with RESOLVE_BENEATH is available
+	Fc_Entry *bins;
+	Fc_Entry lru_head, lru_tail, failed_head, failed_tail; // Open files and cached failures
+	unsigned int bin_cnt, entry_cnt, failed_cnt, max_entries, max_failed;
+	uint64_t ttl_ms;
+} file_cache_t;
+
+typedef file_cache_t *File_Cache;
+
+extern File_Cache fc_create(const String, const unsigned int, const unsigned int, const uint64_t);
+extern void fc_destroy(File_Cache);
+extern Fc_Entry fc_open(File_Cache const, const String);
+extern String fc_mime_type(const String);
+extern int fc_open_beneath(const int, const String, bool *const);
+
+#endif /* End FILE_CACHE_H */
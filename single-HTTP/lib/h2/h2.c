@@ -0,0 +1,1075 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "h2.h"
+
+// Cleartext HTTP/2 (RFC 9113) on top of a connection's output queue. The
+// session turns frames into requests rendered as HTTP/1 text, so the server
+// routes and answers them like any other, and turns the HTTP/1 response it
+// writes back into HEADERS and DATA frames: the status line and headers are
+// re-encoded with HPACK, the body is queued per stream. File ranges stay file
+// ranges, their DATA frames are sent with sendfile() like HTTP/1 bodies.
+//
+// DATA is scheduled by flow control and priority. A stream waits while a
+// stream it depends on has something to send; among the others each frame
+// goes to the stream furthest behind in a round robin weighted by priority
+// weight, so a large download does not hold up a page's small assets. The
+// exclusive flag of a priority is not kept, the dependency itself is.
+// Request bodies are spooled per stream and credited back as they arrive. A
+// request is taken for admission once its header block is complete and
+// dispatched once its stream ends.
+
+#define FRAME_DATA 0x0
+#define FRAME_HEADERS 0x1
+#define FRAME_PRIORITY 0x2
+#define FRAME_RST_STREAM 0x3
+#define FRAME_SETTINGS 0x4
+#define FRAME_PUSH_PROMISE 0x5
+#define FRAME_PING 0x6
+#define FRAME_GOAWAY 0x7
+#define FRAME_WINDOW_UPDATE 0x8
+#define FRAME_CONTINUATION 0x9
+
+#define FLAG_END_STREAM 0x1
+#define FLAG_ACK 0x1
+#define FLAG_END_HEADERS 0x4
+#define FLAG_PADDED 0x8
+#define FLAG_PRIORITY 0x20
+
+#define SETTINGS_HEADER_TABLE_SIZE 0x1
+#define SETTINGS_ENABLE_PUSH 0x2
+#define SETTINGS_MAX_CONCURRENT_STREAMS 0x3
+#define SETTINGS_INITIAL_WINDOW_SIZE 0x4
+#define SETTINGS_MAX_FRAME_SIZE 0x5
+#define SETTING_LEN 6
+
+#define ERROR_NO_ERROR 0x0
+#define ERROR_PROTOCOL 0x1
+#define ERROR_FLOW_CONTROL 0x3
+#define ERROR_STREAM_CLOSED 0x5
+#define ERROR_FRAME_SIZE 0x6
+#define ERROR_REFUSED_STREAM 0x7
+#define ERROR_COMPRESSION 0x9
+
+#define NT_LEN 1
+#define DEFAULT_WINDOW 65535
+#define DEFAULT_WEIGHT 16
+#define MAX_WEIGHT 256
+#define WINDOW_MAX 0x7fffffffLL
+#define FRAME_LEN_MAX 16777215
+#define STREAM_MASK 0x7fffffffU
+#define MAX_DEPTH 8 // Dependency chains are followed this far
+#define MAX_FIELDS 128
+#define BLOCK_MAX (64 * 1024) // Largest header block accepted from a client
+#define HEAD_MAX 8192 // Largest response head, status line and headers
+#define REQUEST_MAX 8192
+#define SMALL_DATA 1024 // Borrowed bodies below this are copied into the frame buffer
+#define STATUS_CODE_OFFSET 9 // "HTTP/1.x " precedes the status code
+
+// Response headers whose values repeat from one response to the next and are
+// worth a place in the client's dynamic table
+static const String _indexed_headers[] = {
+	"content-type", "vary", "accept-ranges", "content-encoding", "cache-control", "retry-after", NULL
+};
+
+// Headers of the HTTP/1 connection, not allowed in HTTP/2
+static const String _connection_headers[] = {
+	"connection", "keep-alive", "proxy-connection", "transfer-encoding", "upgrade", NULL
+};
+
+static bool in_list(const String *restrict list, const String restrict name) {
+	for (; *list; list++)
+		if (strcmp(*list, name) == 0)
+			return true;
+
+	return false;
+}
+
+static uint32_t read_u32(const Byte *const restrict data) {
+	return ((uint32_t) data[0] << 24) | ((uint32_t) data[1] << 16) | ((uint32_t) data[2] << 8) | data[3];
+}
+
+static void write_u32(Byte *const restrict data, const uint32_t value) {
+	data[0] = value >> 24;
+	data[1] = value >> 16;
+	data[2] = value >> 8;
+	data[3] = value;
+}
+
+static void flush_out(H2_Session const restrict session) {
+	if (!session->out_len)
+		return;
+
+	if (!session->failed && !oq_send_buffer(session->output, session->sock, session->out, session->out_len))
+		session->failed = true;
+	session->out_len = 0;
+}
+
+static void emit(H2_Session const restrict session, const Byte *const restrict data, const size_t len) {
+	if (session->out_len + len > H2_OUT_LEN)
+		flush_out(session);
+	memcpy(session->out + session->out_len, data, len);
+	session->out_len += len;
+}
+
+static void emit_frame(H2_Session const restrict session, const Byte type, const Byte flags, const uint32_t stream,
+                       const Byte *const restrict payload, const size_t len) {
+	Byte header[H2_FRAME_HEADER_LEN];
+
+	header[0] = len >> 16;
+	header[1] = len >> 8;
+	header[2] = len;
+	header[3] = type;
+	header[4] = flags;
+	write_u32(header + 5, stream & STREAM_MASK);
+	emit(session, header, H2_FRAME_HEADER_LEN);
+
+	if (len)
+		emit(session, payload, len);
+}
+
+static void emit_u32_frame(H2_Session const restrict session, const Byte type, const uint32_t stream, const uint32_t value) {
+	Byte payload[4];
+
+	write_u32(payload, value);
+	emit_frame(session, type, 0, stream, payload, sizeof(payload));
+}
+
+static h2_stream_t *find_stream(const H2_Session restrict session, const uint32_t id) {
+	for (unsigned int i = 0; i < H2_MAX_STREAMS; i++)
+		if ((session->streams[i].state != H2_FREE) && (session->streams[i].id == id))
+			return (h2_stream_t*) &session->streams[i];
+
+	return NULL;
+}
+
+static void free_stream(h2_stream_t *const restrict stream) {
+	while (stream->first) {
+		const Oq_Segment segment = stream->first;
+
+		stream->first = segment->next;
+		if (segment->kind == OQ_FILE)
+			close(segment->fd);
+		else if (segment->kind == OQ_BUFFER)
+			free(segment->data);
+		free(segment);
+	}
+	if (stream->body)
+		rb_destroy(stream->body);
+	free(stream->request);
+	free(stream->head);
+	memset(stream, 0, sizeof(h2_stream_t));
+}
+
+static void reset_stream(H2_Session const restrict session, const uint32_t id, const uint32_t code) {
+	h2_stream_t *const stream = find_stream(session, id);
+
+	emit_u32_frame(session, FRAME_RST_STREAM, id, code);
+
+	if (stream)
+		free_stream(stream);
+}
+
+// Answers a connection error with GOAWAY, the caller closes the connection
+// once it is written
+static bool connection_error(H2_Session const restrict session, const uint32_t code) {
+	Byte payload[8];
+
+	write_u32(payload, session->last_stream_id);
+	write_u32(payload + 4, code);
+	emit_frame(session, FRAME_GOAWAY, 0, 0, payload, sizeof(payload));
+	session->goaway = true;
+	flush_out(session);
+
+	return false;
+}
+
+H2_Session h2_create(const int sock, Out_Queue const restrict output, const size_t high_watermark, const String restrict spool_dir,
+                     const uint64_t body_max) {
+	Byte settings[SETTING_LEN];
+	const H2_Session session = (H2_Session) calloc(1, sizeof(h2_session_t));
+	if (!session)
+		exit(EXIT_FAILURE);
+
+	session->sock = sock;
+	session->output = output;
+	session->high_watermark = high_watermark;
+	session->spool_dir = spool_dir;
+	session->body_max = body_max;
+	session->window = DEFAULT_WINDOW;
+	session->initial_window = DEFAULT_WINDOW;
+	session->max_frame = H2_FRAME_LEN;
+	hpack_init(&session->decoder, HPACK_DEFAULT_TABLE_SIZE);
+	hpack_init(&session->encoder, HPACK_DEFAULT_TABLE_SIZE);
+
+	// The server's connection preface
+	settings[0] = 0;
+	settings[1] = SETTINGS_MAX_CONCURRENT_STREAMS;
+	write_u32(settings + 2, H2_MAX_STREAMS);
+	emit_frame(session, FRAME_SETTINGS, 0, 0, settings, SETTING_LEN);
+
+	return session;
+}
+
+void h2_destroy(H2_Session session) {
+	for (unsigned int i = 0; i < H2_MAX_STREAMS; i++)
+		if (session->streams[i].state != H2_FREE)
+			free_stream(&session->streams[i]);
+	hpack_free(&session->decoder);
+	hpack_free(&session->encoder);
+
+	free(session->block);
+	session->block = NULL;
+
+	free(session);
+	session = NULL;
+}
+
+static bool apply_settings(H2_Session const restrict session, const Byte *const restrict payload, const size_t len) {
+	for (size_t i = 0; i + SETTING_LEN <= len; i += SETTING_LEN) {
+		const unsigned int id = (payload[i] << 8) | payload[i + 1];
+		const uint32_t value = read_u32(payload + i + 2);
+
+		if (id == SETTINGS_HEADER_TABLE_SIZE)
+			hpack_set_limit(&session->encoder, value);
+		else if ((id == SETTINGS_ENABLE_PUSH) && (value > 1))
+			return connection_error(session, ERROR_PROTOCOL);
+		else if (id == SETTINGS_INITIAL_WINDOW_SIZE) {
+			if (value > WINDOW_MAX)
+				return connection_error(session, ERROR_FLOW_CONTROL);
+
+			// Applies to the open streams as well, their windows can go negative
+			for (unsigned int j = 0; j < H2_MAX_STREAMS; j++)
+				if (session->streams[j].state != H2_FREE)
+					session->streams[j].window += (int64_t) value - session->initial_window;
+			session->initial_window = value;
+		} else if (id == SETTINGS_MAX_FRAME_SIZE) {
+			if ((value < H2_FRAME_LEN) || (value > FRAME_LEN_MAX))
+				return connection_error(session, ERROR_PROTOCOL);
+			session->max_frame = value;
+		}
+	}
+
+	return true;
+}
+
+static int base64url_value(const char c) {
+	if ((c >= 'A') && (c <= 'Z'))
+		return c - 'A';
+	if ((c >= 'a') && (c <= 'z'))
+		return c - 'a' + 26;
+	if ((c >= '0') && (c <= '9'))
+		return c - '0' + 52;
+	if ((c == '-') || (c == '+'))
+		return 62;
+	if ((c == '_') || (c == '/'))
+		return 63;
+
+	return -1;
+}
+
+// Takes a connection over from HTTP/1 after a 101 response. settings is the
+// client's HTTP2-Settings header, request the HTTP/1 request that asked for the
+// upgrade, which becomes stream 1 and is answered over HTTP/2.
+bool h2_upgrade(H2_Session const restrict session, const String restrict settings, const String restrict request, const size_t len) {
+	Byte payload[HEAD_MAX];
+	size_t payload_len = 0;
+	uint32_t bits = 0;
+	int bit_cnt = 0;
+
+	for (const char *c = settings; *c && (*c != '='); c++) {
+		const int value = base64url_value(*c);
+
+		if ((value == -1) || (payload_len == HEAD_MAX))
+			return false;
+		bits = (bits << 6) | value;
+		bit_cnt += 6;
+
+		if (bit_cnt >= 8) {
+			bit_cnt -= 8;
+			payload[payload_len++] = (Byte) (bits >> bit_cnt);
+		}
+	}
+
+	if ((payload_len % SETTING_LEN) || !apply_settings(session, payload, payload_len))
+		return false;
+
+	h2_stream_t *const stream = &session->streams[0];
+
+	stream->request = (String) malloc(len + NT_LEN);
+	if (!stream->request)
+		exit(EXIT_FAILURE);
+
+	memcpy(stream->request, request, len);
+	stream->request[len] = '\0';
+	stream->id = 1;
+	stream->state = H2_HALF_CLOSED;
+	stream->body_status = RB_COMPLETE;
+	stream->window = session->initial_window;
+	stream->weight = DEFAULT_WEIGHT;
+	session->last_stream_id = 1;
+	session->upgraded = true;
+
+	return true;
+}
+
+static bool append_text(String restrict text, size_t *const restrict len, const String restrict string, const size_t string_len) {
+	if (*len + string_len + NT_LEN > REQUEST_MAX)
+		return false;
+
+	memcpy(text + *len, string, string_len);
+	*len += string_len;
+	text[*len] = '\0';
+
+	return true;
+}
+
+// Renders decoded fields as an HTTP/1 request. Returns NULL for a malformed
+// request: a missing pseudo-header, one after the regular headers, an uppercase
+// name or a request too large to render.
+static String render_request(const hpack_field_t *const restrict fields, const int field_cnt) {
+	String method = NULL, path = NULL, authority = NULL;
+	size_t len = 0, cookie_len = 0;
+	bool regular = false, valid = true;
+	char cookies[REQUEST_MAX];
+
+	for (int i = 0; i < field_cnt; i++) {
+		const hpack_field_t *const field = &fields[i];
+
+		for (size_t j = 0; j < field->name_len; j++)
+			if (isupper((unsigned char) field->name[j]))
+				return NULL;
+
+		if (field->name[0] != ':') {
+			regular = true;
+			continue;
+		}
+
+		if (regular)
+			return NULL;
+
+		if (strcmp(field->name, ":method") == 0)
+			method = field->value;
+		else if (strcmp(field->name, ":path") == 0)
+			path = field->value;
+		else if (strcmp(field->name, ":authority") == 0)
+			authority = field->value;
+	}
+
+	if (!method || !path || !path[0])
+		return NULL;
+
+	const String request = (String) malloc(REQUEST_MAX);
+	if (!request)
+		exit(EXIT_FAILURE);
+
+	len = snprintf(request, REQUEST_MAX, "%s %s HTTP/2.0\r\n", method, path);
+	valid = len < REQUEST_MAX;
+
+	if (valid && authority)
+		valid = append_text(request, &len, "host: ", 6) && append_text(request, &len, authority, strlen(authority))
+		        && append_text(request, &len, "\r\n", 2);
+
+	// Cookies may arrive split into one field per pair, HTTP/1 has them on one line
+	for (int i = 0; valid && (i < field_cnt); i++) {
+		const hpack_field_t *const field = &fields[i];
+
+		if ((field->name[0] == ':') || in_list(_connection_headers, field->name))
+			continue;
+
+		if (strcmp(field->name, "cookie") == 0) {
+			if (cookie_len + field->value_len + 2 < REQUEST_MAX) {
+				if (cookie_len)
+					cookies[cookie_len++] = ';', cookies[cookie_len++] = ' ';
+				memcpy(cookies + cookie_len, field->value, field->value_len);
+				cookie_len += field->value_len;
+			}
+			continue;
+		}
+
+		valid = append_text(request, &len, field->name, field->name_len) && append_text(request, &len, ": ", 2)
+		        && append_text(request, &len, field->value, field->value_len) && append_text(request, &len, "\r\n", 2);
+	}
+
+	if (valid && cookie_len)
+		valid = append_text(request, &len, "cookie: ", 8) && append_text(request, &len, cookies, cookie_len)
+		        && append_text(request, &len, "\r\n", 2);
+
+	if (!valid || !append_text(request, &len, "\r\n", 2)) {
+		free(request);
+		return NULL;
+	}
+
+	return request;
+}
+
+static bool complete_headers(H2_Session const restrict session) {
+	hpack_field_t fields[MAX_FIELDS];
+	char scratch[BLOCK_MAX];
+	const uint32_t id = session->block_stream;
+	const bool end_stream = session->block_end_stream;
+	const int field_cnt = hpack_decode(&session->decoder, session->block, session->block_len, fields, MAX_FIELDS, scratch, BLOCK_MAX);
+	h2_stream_t *stream = find_stream(session, id);
+
+	session->block_stream = 0;
+	session->block_len = 0;
+
+	// The table is out of step with the client's after a failed decode
+	if (field_cnt == -1)
+		return connection_error(session, ERROR_COMPRESSION);
+
+	if (stream) { // Trailers, dropped
+		if (end_stream && (stream->state == H2_OPEN)) {
+			stream->state = H2_HALF_CLOSED;
+			if (stream->body_status == RB_MORE)
+				stream->body_status = RB_COMPLETE;
+		}
+		return true;
+	}
+
+	if (id <= session->last_stream_id)
+		return connection_error(session, ERROR_STREAM_CLOSED);
+	session->last_stream_id = id;
+
+	if (session->goaway)
+		return true;
+
+	for (unsigned int i = 0; !stream && (i < H2_MAX_STREAMS); i++)
+		if (session->streams[i].state == H2_FREE)
+			stream = &session->streams[i];
+
+	if (!stream) {
+		reset_stream(session, id, ERROR_REFUSED_STREAM);
+		return true;
+	}
+
+	if (!(stream->request = render_request(fields, field_cnt))) {
+		reset_stream(session, id, ERROR_PROTOCOL);
+		return true;
+	}
+
+	stream->id = id;
+	stream->state = end_stream ? H2_HALF_CLOSED : H2_OPEN;
+	stream->body_status = end_stream ? RB_COMPLETE : RB_MORE;
+	stream->window = session->initial_window;
+	stream->dependency = (session->block_dependency == id) ? 0 : session->block_dependency;
+	stream->weight = session->block_weight;
+	stream->pass = session->virtual_time;
+
+	return true;
+}
+
+static bool append_block(H2_Session const restrict session, const Byte *const restrict fragment, const size_t len) {
+	if (session->block_len + len > BLOCK_MAX)
+		return connection_error(session, ERROR_COMPRESSION);
+
+	if (!session->block && !(session->block = (Byte*) malloc(BLOCK_MAX)))
+		exit(EXIT_FAILURE);
+
+	memcpy(session->block + session->block_len, fragment, len);
+	session->block_len += len;
+
+	return true;
+}
+
+static bool receive_headers(H2_Session const restrict session, const Byte flags, const uint32_t id, const Byte *const restrict payload,
+                            const size_t len) {
+	size_t offset = 0, padding = 0;
+
+	if ((id == 0) || !(id & 1))
+		return connection_error(session, ERROR_PROTOCOL);
+
+	if (flags & FLAG_PADDED) {
+		if (len < 1)
+			return connection_error(session, ERROR_FRAME_SIZE);
+		padding = payload[offset++];
+	}
+
+	session->block_dependency = 0;
+	session->block_weight = DEFAULT_WEIGHT;
+
+	if (flags & FLAG_PRIORITY) {
+		if (offset + 5 > len)
+			return connection_error(session, ERROR_FRAME_SIZE);
+		session->block_dependency = read_u32(payload + offset) & STREAM_MASK;
+		session->block_weight = payload[offset + 4] + 1;
+		offset += 5;
+	}
+
+	if (offset + padding > len)
+		return connection_error(session, ERROR_PROTOCOL);
+
+	session->block_stream = id;
+	session->block_end_stream = flags & FLAG_END_STREAM;
+
+	if (!append_block(session, payload + offset, len - offset - padding))
+		return false;
+
+	return (flags & FLAG_END_HEADERS) ? complete_headers(session) : true;
+}
+
+static bool receive_data(H2_Session const restrict session, const Byte flags, const uint32_t id, const Byte *const restrict payload,
+                         const size_t len) {
+	h2_stream_t *const stream = find_stream(session, id);
+
+	if ((id == 0) || (id > session->last_stream_id))
+		return connection_error(session, ERROR_PROTOCOL);
+
+	if ((flags & FLAG_PADDED) && ((len < 1) || (payload[0] >= len)))
+		return connection_error(session, ERROR_PROTOCOL);
+
+	// Spooled octets are credited back at once, the spool file is the buffer
+	if (len) {
+		emit_u32_frame(session, FRAME_WINDOW_UPDATE, 0, len);
+
+		if (stream && (stream->state == H2_OPEN) && !(flags & FLAG_END_STREAM))
+			emit_u32_frame(session, FRAME_WINDOW_UPDATE, id, len);
+	}
+
+	if (stream && (stream->state != H2_OPEN)) {
+		reset_stream(session, id, ERROR_STREAM_CLOSED);
+		return true;
+	}
+
+	const size_t padding = (flags & FLAG_PADDED) ? payload[0] + 1 : 0;
+
+	// Nothing more is kept of a body that was dropped or a stream already answered
+	if (stream && (stream->body_status == RB_MORE) && !stream->ended && (len > padding)) {
+		if (!stream->body && !(stream->body = rb_create(session->spool_dir, false, 0, session->body_max)))
+			stream->body_status = RB_FAILED;
+		else
+			stream->body_status = rb_append(stream->body, payload + ((flags & FLAG_PADDED) ? 1 : 0), len - padding);
+
+		if ((stream->body_status != RB_MORE) && stream->body) {
+			rb_destroy(stream->body);
+			stream->body = NULL;
+		}
+	}
+
+	if (stream && (flags & FLAG_END_STREAM)) {
+		stream->state = H2_HALF_CLOSED;
+		if (stream->body_status == RB_MORE)
+			stream->body_status = RB_COMPLETE;
+	}
+
+	return true;
+}
+
+static bool receive_window_update(H2_Session const restrict session, const uint32_t id, const Byte *const restrict payload,
+                                  const size_t len) {
+	if (len != 4)
+		return connection_error(session, ERROR_FRAME_SIZE);
+
+	const uint32_t increment = read_u32(payload) & STREAM_MASK;
+
+	if (id == 0) {
+		if (!increment || (session->window + increment > WINDOW_MAX))
+			return connection_error(session, increment ? ERROR_FLOW_CONTROL : ERROR_PROTOCOL);
+		session->window += increment;
+		return true;
+	}
+
+	h2_stream_t *const stream = find_stream(session, id);
+
+	if (!stream)
+		return true;
+
+	if (!increment || (stream->window + increment > WINDOW_MAX))
+		reset_stream(session, id, increment ? ERROR_FLOW_CONTROL : ERROR_PROTOCOL);
+	else
+		stream->window += increment;
+
+	return true;
+}
+
+static bool receive_frame(H2_Session const restrict session, const Byte type, const Byte flags, const uint32_t id,
+                          const Byte *const restrict payload, const size_t len) {
+	// A header block is not interrupted by other frames
+	if (session->block_stream && ((type != FRAME_CONTINUATION) || (id != session->block_stream)))
+		return connection_error(session, ERROR_PROTOCOL);
+
+	switch (type) {
+		case FRAME_DATA:
+			return receive_data(session, flags, id, payload, len);
+		case FRAME_HEADERS:
+			return receive_headers(session, flags, id, payload, len);
+		case FRAME_CONTINUATION:
+			if (!session->block_stream)
+				return connection_error(session, ERROR_PROTOCOL);
+			if (!append_block(session, payload, len))
+				return false;
+			return (flags & FLAG_END_HEADERS) ? complete_headers(session) : true;
+		case FRAME_PRIORITY: {
+			h2_stream_t *const stream = find_stream(session, id);
+
+			if (id == 0)
+				return connection_error(session, ERROR_PROTOCOL);
+			if (len != 5)
+				reset_stream(session, id, ERROR_FRAME_SIZE);
+			else if (stream) {
+				const uint32_t dependency = read_u32(payload) & STREAM_MASK;
+
+				stream->dependency = (dependency == id) ? 0 : dependency;
+				stream->weight = payload[4] + 1;
+			}
+			return true;
+		}
+		case FRAME_RST_STREAM: {
+			h2_stream_t *const stream = find_stream(session, id);
+
+			if (len != 4)
+				return connection_error(session, ERROR_FRAME_SIZE);
+			if ((id == 0) || (id > session->last_stream_id))
+				return connection_error(session, ERROR_PROTOCOL);
+			if (stream)
+				free_stream(stream);
+			return true;
+		}
+		case FRAME_SETTINGS:
+			if (id != 0)
+				return connection_error(session, ERROR_PROTOCOL);
+			if (flags & FLAG_ACK)
+				return len ? connection_error(session, ERROR_FRAME_SIZE) : true;
+			if (len % SETTING_LEN)
+				return connection_error(session, ERROR_FRAME_SIZE);
+			if (!apply_settings(session, payload, len))
+				return false;
+			emit_frame(session, FRAME_SETTINGS, FLAG_ACK, 0, NULL, 0);
+			return true;
+		case FRAME_PUSH_PROMISE: // Only servers push
+			return connection_error(session, ERROR_PROTOCOL);
+		case FRAME_PING:
+			if (id != 0)
+				return connection_error(session, ERROR_PROTOCOL);
+			if (len != 8)
+				return connection_error(session, ERROR_FRAME_SIZE);
+			if (!(flags & FLAG_ACK))
+				emit_frame(session, FRAME_PING, FLAG_ACK, 0, payload, len);
+			return true;
+		case FRAME_GOAWAY:
+			if (id != 0)
+				return connection_error(session, ERROR_PROTOCOL);
+			session->peer_goaway = true;
+			return true;
+		case FRAME_WINDOW_UPDATE:
+			return receive_window_update(session, id, payload, len);
+		default: // Unknown frame types are ignored
+			return true;
+	}
+}
+
+// Processes the complete frames at the start of data. Returns the octets
+// consumed, -1 after a connection error.
+ssize_t h2_input(H2_Session const restrict session, const Byte *const restrict data, const size_t len) {
+	size_t used = 0;
+
+	if (session->goaway && !session->preface)
+		return -1;
+
+	if (!session->preface) {
+		if (memcmp(data, H2_PREFACE, (len < H2_PREFACE_LEN) ? len : H2_PREFACE_LEN) != 0) {
+			connection_error(session, ERROR_PROTOCOL);
+			return -1;
+		}
+		if (len < H2_PREFACE_LEN)
+			return 0;
+		session->preface = true;
+		used = H2_PREFACE_LEN;
+	}
+
+	while (len - used >= H2_FRAME_HEADER_LEN) {
+		const Byte *const header = data + used;
+		const size_t frame_len = ((size_t) header[0] << 16) | (header[1] << 8) | header[2];
+
+		if (frame_len > H2_FRAME_LEN) {
+			connection_error(session, ERROR_FRAME_SIZE);
+			return -1;
+		}
+
+		if (len - used < H2_FRAME_HEADER_LEN + frame_len)
+			break;
+
+		if (!receive_frame(session, header[3], header[4], read_u32(header + 5) & STREAM_MASK, header + H2_FRAME_HEADER_LEN, frame_len))
+			return -1;
+		used += H2_FRAME_HEADER_LEN + frame_len;
+	}
+
+	return used;
+}
+
+// Returns the stream of the next request whose header block arrived and that
+// was not taken yet, 0 when there is none. Its body may still be on the way,
+// the request is taken to be admitted or refused. It stays valid until the
+// stream is closed.
+uint32_t h2_next_request(H2_Session const restrict session, String *const restrict request) {
+	h2_stream_t *next = NULL;
+
+	for (unsigned int i = 0; i < H2_MAX_STREAMS; i++) {
+		h2_stream_t *const stream = &session->streams[i];
+
+		if ((stream->state != H2_FREE) && !stream->taken && (!next || (stream->id < next->id)))
+			next = stream;
+	}
+
+	if (!next)
+		return 0;
+	next->taken = true;
+	*request = next->request;
+
+	return next->id;
+}
+
+// Returns the stream of the next taken request that is ready to be answered,
+// 0 when there is none: its stream ended, or its body was dropped. The spool
+// file of its body passes to the caller, *body is NULL without one. *status is
+// RB_COMPLETE, or RB_TOO_LARGE or RB_FAILED when the body was dropped.
+uint32_t h2_next_complete(H2_Session const restrict session, String *const restrict request, Request_Body *const restrict body,
+                          rb_status_t *const restrict status) {
+	h2_stream_t *next = NULL;
+
+	for (unsigned int i = 0; i < H2_MAX_STREAMS; i++) {
+		h2_stream_t *const stream = &session->streams[i];
+
+		if ((stream->state != H2_FREE) && stream->taken && !stream->dispatched && !stream->ended
+		    && (stream->body_status != RB_MORE) && (!next || (stream->id < next->id)))
+			next = stream;
+	}
+
+	if (!next)
+		return 0;
+	next->dispatched = true;
+	*request = next->request;
+	*body = next->body;
+	*status = next->body_status;
+	next->body = NULL;
+
+	return next->id;
+}
+
+static void queue_body(H2_Session const restrict session, h2_stream_t *const restrict stream, const Oq_Segment restrict segment) {
+	// A stream that had nothing to send rejoins the round robin where it stands
+	if (!stream->pending && (stream->pass < session->virtual_time))
+		stream->pass = session->virtual_time;
+
+	if (stream->last)
+		stream->last->next = segment;
+	else
+		stream->first = segment;
+	stream->last = segment;
+	stream->pending += segment->len;
+}
+
+static Oq_Segment new_segment(const oq_kind_t kind, const size_t len) {
+	const Oq_Segment segment = (Oq_Segment) calloc(1, sizeof(oq_segment_t));
+	if (!segment)
+		exit(EXIT_FAILURE);
+
+	segment->kind = kind;
+	segment->fd = -1;
+	segment->len = len;
+
+	return segment;
+}
+
+static void queue_buffer(H2_Session const restrict session, h2_stream_t *const restrict stream, const Byte *const restrict data,
+                         const size_t len, const bool copy) {
+	if (!len)
+		return;
+
+	const Oq_Segment segment = new_segment(copy ? OQ_BUFFER : OQ_STATIC, len);
+
+	if (copy) {
+		if (!(segment->data = (Byte*) malloc(len)))
+			exit(EXIT_FAILURE);
+		memcpy(segment->data, data, len);
+	} else
+		segment->data = (Byte*) data;
+	queue_body(session, stream, segment);
+}
+
+// Takes the HTTP/1 response of a stream: the head is collected until its empty
+// line, what follows is the body. Borrowed data (copy unset) has to outlive the
+// stream. Returns false when the stream is gone.
+bool h2_write(H2_Session const restrict session, const uint32_t id, const Byte *const restrict data, const size_t len, const bool copy) {
+	h2_stream_t *const stream = find_stream(session, id);
+
+	if (!stream || session->failed)
+		return false;
+
+	if (stream->head_done) {
+		queue_buffer(session, stream, data, len, copy);
+		return true;
+	}
+
+	const size_t take = (stream->head_len + len > HEAD_MAX) ? HEAD_MAX - stream->head_len : len;
+
+	if (!stream->head && !(stream->head = (String) malloc(HEAD_MAX + NT_LEN)))
+		exit(EXIT_FAILURE);
+
+	memcpy(stream->head + stream->head_len, data, take);
+	stream->head_len += take;
+	stream->head[stream->head_len] = '\0';
+
+	const String crlf_end = strstr(stream->head, "\r\n\r\n"), lf_end = strstr(stream->head, "\n\n");
+	String end = crlf_end;
+
+	if (!end || (lf_end && (lf_end < end)))
+		end = lf_end;
+
+	if (!end) {
+		if (stream->head_len == HEAD_MAX) // Sent as far as it goes
+			stream->head_done = true;
+		return true;
+	}
+
+	const size_t head_len = end - stream->head + ((end == crlf_end) ? 4 : 2);
+	const size_t body_start = take - (stream->head_len - head_len);
+
+	stream->head_len = head_len;
+	stream->head[head_len] = '\0';
+	stream->head_done = true;
+	queue_buffer(session, stream, data + body_start, len - body_start, true);
+
+	return true;
+}
+
+// The caller keeps ownership of fd, the stream holds a duplicate
+bool h2_write_file(H2_Session const restrict session, const uint32_t id, const int fd, const off_t offset, const size_t len) {
+	h2_stream_t *const stream = find_stream(session, id);
+
+	if (!stream || session->failed || !stream->head_done)
+		return false;
+
+	if (!len)
+		return true;
+
+	const int dup_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+
+	if (dup_fd == -1)
+		return false;
+
+	const Oq_Segment segment = new_segment(OQ_FILE, len);
+
+	segment->fd = dup_fd;
+	segment->offset = offset;
+	queue_body(session, stream, segment);
+
+	return true;
+}
+
+// The response of a stream is complete. One that never got a complete head is
+// answered with a 500.
+void h2_end(H2_Session const restrict session, const uint32_t id) {
+	h2_stream_t *const stream = find_stream(session, id);
+
+	if (stream)
+		stream->ended = stream->head_done = true;
+}
+
+static unsigned int parse_status(const String restrict head) {
+	const unsigned int status = (head && (strncmp(head, "HTTP/", 5) == 0)) ? strtoul(head + STATUS_CODE_OFFSET, NULL, 10) : 0;
+
+	return ((status >= 100) && (status < 600)) ? status : 500;
+}
+
+// Sends the response head as a HEADERS frame, END_STREAM included when there is
+// no body. Headers are encoded as they are sent, which keeps the encoder's
+// table in the order the client's decoder sees the blocks.
+static void send_headers(H2_Session const restrict session, h2_stream_t *const restrict stream) {
+	Byte block[HEAD_MAX * 2];
+	char name[HEAD_MAX];
+	size_t len = hpack_encode_status(&session->encoder, parse_status(stream->head), block, sizeof(block));
+	const String line_end = stream->head ? strchr(stream->head, '\n') : NULL;
+
+	for (String line = line_end ? line_end + 1 : NULL; line && *line; ) {
+		const String next = strchr(line, '\n');
+		const size_t line_len = next ? (size_t) (next - line) : strlen(line);
+		const String colon = memchr(line, ':', line_len);
+
+		if (colon && (colon > line)) {
+			size_t name_len = colon - line, value_len;
+			String value = colon + 1;
+
+			for (size_t i = 0; i < name_len; i++)
+				name[i] = tolower((unsigned char) line[i]);
+			name[name_len] = '\0';
+
+			while ((*value == ' ') || (*value == '\t'))
+				value++;
+			value_len = line + line_len - value;
+			while (value_len && ((value[value_len - 1] == '\r') || (value[value_len - 1] == ' ')))
+				value_len--;
+
+			if (!in_list(_connection_headers, name))
+				len += hpack_encode_field(&session->encoder, name, name_len, value, value_len, in_list(_indexed_headers, name),
+				                          block + len, sizeof(block) - len);
+		}
+		line = next ? next + 1 : NULL;
+	}
+
+	stream->headers_sent = true;
+	free(stream->head);
+	stream->head = NULL;
+	emit_frame(session, FRAME_HEADERS, FLAG_END_HEADERS | ((stream->ended && !stream->pending) ? FLAG_END_STREAM : 0), stream->id,
+	           block, len);
+}
+
+// Finishes a stream whose last frame went out. A client still sending its
+// request body is told to stop.
+static void close_stream(H2_Session const restrict session, h2_stream_t *const restrict stream) {
+	if (stream->state == H2_OPEN)
+		emit_u32_frame(session, FRAME_RST_STREAM, stream->id, ERROR_NO_ERROR);
+	free_stream(stream);
+}
+
+static void send_data(H2_Session const restrict session, h2_stream_t *const restrict stream) {
+	const Oq_Segment segment = stream->first;
+	int64_t len = segment ? (int64_t) segment->len : 0;
+	Byte header[H2_FRAME_HEADER_LEN];
+
+	if (len > stream->window)
+		len = stream->window;
+	if (len > session->window)
+		len = session->window;
+	if (len > H2_FRAME_LEN)
+		len = H2_FRAME_LEN;
+
+	const bool end = stream->ended && ((size_t) len == stream->pending);
+
+	header[0] = len >> 16;
+	header[1] = len >> 8;
+	header[2] = len;
+	header[3] = FRAME_DATA;
+	header[4] = end ? FLAG_END_STREAM : 0;
+	write_u32(header + 5, stream->id);
+	emit(session, header, H2_FRAME_HEADER_LEN);
+
+	if (len) {
+		if (segment->kind == OQ_FILE) {
+			flush_out(session);
+			if (!session->failed && !oq_send_file(session->output, session->sock, segment->fd, segment->offset, len))
+				session->failed = true;
+		} else if ((segment->kind == OQ_STATIC) && (len >= SMALL_DATA)) {
+			flush_out(session);
+			if (!session->failed && !oq_send_static(session->output, session->sock, segment->data + segment->offset, len))
+				session->failed = true;
+		} else
+			emit(session, segment->data + segment->offset, len);
+
+		segment->offset += len;
+		segment->len -= len;
+		stream->pending -= len;
+		stream->window -= len;
+		session->window -= len;
+
+		if (!segment->len) {
+			stream->first = segment->next;
+			if (!stream->first)
+				stream->last = NULL;
+			if (segment->kind == OQ_FILE)
+				close(segment->fd);
+			else if (segment->kind == OQ_BUFFER)
+				free(segment->data);
+			free(segment);
+		}
+	}
+
+	stream->pass += ((uint64_t) len + H2_FRAME_HEADER_LEN) * MAX_WEIGHT / stream->weight;
+	session->virtual_time = stream->pass;
+
+	if (end)
+		close_stream(session, stream);
+}
+
+static bool has_data(const H2_Session restrict session, const h2_stream_t *const restrict stream) {
+	if (!stream->headers_sent)
+		return false;
+	if (!stream->pending)
+		return stream->ended;
+
+	return (stream->window > 0) && (session->window > 0);
+}
+
+// A stream waits while one it depends on can send
+static bool is_blocked(const H2_Session restrict session, const h2_stream_t *const restrict stream) {
+	uint32_t parent = stream->dependency;
+
+	for (unsigned int depth = 0; parent && (depth < MAX_DEPTH); depth++) {
+		const h2_stream_t *const ancestor = find_stream(session, parent);
+
+		if (!ancestor)
+			return false;
+		if (has_data(session, ancestor) || (ancestor->head_done && !ancestor->headers_sent))
+			return true;
+		parent = ancestor->dependency;
+	}
+
+	return false;
+}
+
+// Sends what flow control and the output watermark allow: every complete
+// response head, then DATA frames one at a time to the stream with the lowest
+// pass among those not waiting on their dependency. Returns false once the
+// client is gone.
+bool h2_flush(H2_Session const restrict session) {
+	while (!session->failed && (session->output->bytes + session->out_len < session->high_watermark)) {
+		h2_stream_t *next = NULL;
+
+		for (unsigned int i = 0; i < H2_MAX_STREAMS; i++) {
+			h2_stream_t *const stream = &session->streams[i];
+
+			if ((stream->state == H2_FREE) || !stream->taken)
+				continue;
+
+			if (stream->head_done && !stream->headers_sent) {
+				send_headers(session, stream);
+
+				if (stream->ended && !stream->pending) {
+					close_stream(session, stream);
+					continue;
+				}
+			}
+
+			if (has_data(session, stream) && (!next || (stream->pass < next->pass)) && !is_blocked(session, stream))
+				next = stream;
+		}
+
+		if (!next)
+			break;
+		send_data(session, next);
+	}
+	flush_out(session);
+
+	return !session->failed;
+}
+
+// Stops taking new streams, the connection ends with the open ones
+void h2_shutdown(H2_Session const restrict session) {
+	Byte payload[8];
+
+	if (session->goaway)
+		return;
+
+	write_u32(payload, session->last_stream_id);
+	write_u32(payload + 4, ERROR_NO_ERROR);
+	emit_frame(session, FRAME_GOAWAY, 0, 0, payload, sizeof(payload));
+	session->goaway = true;
+	flush_out(session);
+}
+
+unsigned int h2_active_streams(const H2_Session restrict session) {
+	unsigned int active = 0;
+
+	for (unsigned int i = 0; i < H2_MAX_STREAMS; i++)
+		active += (session->streams[i].state != H2_FREE);
+
+	return active;
+}
+
+bool h2_finished(const H2_Session restrict session) {
+	return session->failed || ((session->goaway || session->peer_goaway) && !h2_active_streams(session));
+}
@@ -0,0 +1,84 @@
+#ifndef H2_H
+#define H2_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "../types/types.h"
+#include "../hpack/hpack.h"
+#include "../out_queue/out_queue.h"
+#include "../request_body/request_body.h"
+
+#define H2_PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define H2_PREFACE_LEN 24
+#define H2_FRAME_HEADER_LEN 9
+#define H2_FRAME_LEN 16384 // Largest frame either side sends, the protocol's default
+#define H2_INPUT_LEN (H2_FRAME_HEADER_LEN + H2_FRAME_LEN) // Input buffer that always fits one complete frame
+#define H2_MAX_STREAMS 100 // Concurrent streams a client may open
+#define H2_OUT_LEN (2 * H2_INPUT_LEN)
+
+typedef enum h2_stream_state_e {
+	H2_FREE,
+	H2_OPEN,
+	H2_HALF_CLOSED // The client sent its whole request
+} h2_stream_state_t;
+
+typedef struct h2_stream_s {
+	uint32_t id;
+	h2_stream_state_t state;
+	int64_t window; // Octets of DATA the client accepts on this stream
+	uint32_t dependency; // Stream this one depends on, 0 for the root
+	unsigned int weight; // 1 to 256
+	uint64_t pass; // Position in the weighted round robin between streams
+	String request; // HTTP/1 rendition of the request, until it is taken
+	Request_Body body; // DATA of the request, until it is dispatched
+	rb_status_t body_status; // RB_MORE until END_STREAM, RB_TOO_LARGE or RB_FAILED once the body was dropped
+	String head; // HTTP/1 status line and headers of the response, until sent as HEADERS
+	size_t head_len;
+	Oq_Segment first, last; // Response body waiting for DATA frames
+	size_t pending;
+	bool taken, dispatched, head_done, headers_sent, ended;
+} h2_stream_t;
+
+typedef struct h2_session_s {
+	int sock;
+	Out_Queue output;
+	size_t high_watermark; // Frames are held back while the output queue is above it
+	String spool_dir; // Where request bodies are spooled, at most body_max octets each
+	uint64_t body_max;
+	h2_stream_t streams[H2_MAX_STREAMS];
+	hpack_table_t decoder, encoder;
+	Byte *block; // Header block being received, HEADERS plus CONTINUATION frames
+	size_t block_len;
+	uint32_t block_stream, block_dependency;
+	unsigned int block_weight;
+	bool block_end_stream;
+	uint32_t last_stream_id;
+	int64_t window; // Connection send window
+	uint32_t initial_window, max_frame; // Settings of the client
+	uint64_t virtual_time;
+	Byte out[H2_OUT_LEN]; // Frames gathered into one write
+	size_t out_len;
+	bool preface, goaway, peer_goaway, failed;
+	bool upgraded; // Stream 1 is the HTTP/1 request the session was upgraded from
+} h2_session_t;
+
+typedef h2_session_t *H2_Session;
+
+extern H2_Session h2_create(const int, Out_Queue const, const size_t, const String, const uint64_t);
+extern void h2_destroy(H2_Session);
+extern bool h2_upgrade(H2_Session const, const String, const String, const size_t);
+extern ssize_t h2_input(H2_Session const, const Byte *, const size_t);
+extern uint32_t h2_next_request(H2_Session const, String *const);
+extern uint32_t h2_next_complete(H2_Session const, String *const, Request_Body *const, rb_status_t *const);
+extern bool h2_write(H2_Session const, const uint32_t, const Byte *, const size_t, const bool);
+extern bool h2_write_file(H2_Session const, const uint32_t, const int, const off_t, const size_t);
+extern void h2_end(H2_Session const, const uint32_t);
+extern bool h2_flush(H2_Session const);
+extern void h2_shutdown(H2_Session const);
+extern unsigned int h2_active_streams(const H2_Session);
+extern bool h2_finished(const H2_Session);
+
+#endif /* End H2_H */
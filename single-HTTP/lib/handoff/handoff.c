@@ -0,0 +1,175 @@
+#include <stdio.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+
+#include "handoff.h"
+
+// Listening socket handoff for graceful upgrades. The running server waits on
+// a Unix socket; a new server started in upgrade mode connects to it and
+// receives the listening sockets as SCM_RIGHTS ancillary data, so the kernel
+// keeps queueing connections while the two processes trade places.
+
+#define HANDOFF_MAGIC 0x53484f46 // "SHOF"
+#define HANDOFF_TIMEOUT_S 5
+
+typedef struct handoff_msg_s {
+	uint32_t magic, fd_cnt;
+} handoff_msg_t;
+
+static bool set_path(struct sockaddr_un *const restrict addr, const String restrict path) {
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+
+	if (strnlen(path, sizeof(addr->sun_path)) == sizeof(addr->sun_path))
+		return false;
+	strncpy(addr->sun_path, path, sizeof(addr->sun_path) - 1);
+
+	return true;
+}
+
+static int fail(const int fd, String restrict error, const size_t error_len, const String restrict step) {
+	snprintf(error, error_len, "%s: %s", step, strerror(errno));
+	if (fd != -1)
+		close(fd);
+
+	return -1;
+}
+
+// Binds the upgrade socket at path, replacing the one a previous server left
+// behind. Only the owner may connect to it.
+int handoff_listen(const String restrict path, String restrict error, const size_t error_len) {
+	struct sockaddr_un addr;
+
+	if (!set_path(&addr, path)) {
+		errno = ENAMETOOLONG;
+		return fail(-1, error, error_len, "Upgrade Socket Error");
+	}
+
+	const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+	if (fd == -1)
+		return fail(fd, error, error_len, "Upgrade Socket Error");
+
+	if ((unlink(path) == -1) && (errno != ENOENT))
+		return fail(fd, error, error_len, "Upgrade Unlink Error");
+
+	if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) == -1)
+		return fail(fd, error, error_len, "Upgrade Bind Error");
+
+	if ((chmod(path, S_IRUSR | S_IWUSR) == -1) || (listen(fd, 1) == -1))
+		return fail(fd, error, error_len, "Upgrade Listen Error");
+
+	return fd;
+}
+
+// Accepts the waiting upgrade peer on the upgrade socket and passes it the
+// fds. Peers running under another user are turned away.
+bool handoff_send(const int upgrade_fd, const int *const restrict fds, const unsigned int fd_cnt, String restrict error, const size_t error_len) {
+	const handoff_msg_t msg = {HANDOFF_MAGIC, fd_cnt};
+	union {
+		char buffer[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)];
+		struct cmsghdr align;
+	} control;
+	struct iovec iov = {(void*) &msg, sizeof(msg)};
+	struct msghdr header;
+	struct ucred peer;
+	socklen_t peer_len = sizeof(peer);
+
+	const int fd = accept4(upgrade_fd, NULL, NULL, SOCK_CLOEXEC);
+
+	if (fd == -1) {
+		fail(fd, error, error_len, "Upgrade Accept Error");
+		return false;
+	}
+
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &peer, &peer_len) == -1) {
+		fail(fd, error, error_len, "Upgrade Credentials Error");
+		return false;
+	}
+
+	if ((peer.uid != geteuid()) || (fd_cnt > HANDOFF_MAX_FDS)) {
+		errno = EPERM;
+		fail(fd, error, error_len, "Upgrade Peer Error");
+		return false;
+	}
+
+	memset(&header, 0, sizeof(header));
+	memset(&control, 0, sizeof(control));
+	header.msg_iov = &iov;
+	header.msg_iovlen = 1;
+	header.msg_control = control.buffer;
+	header.msg_controllen = CMSG_SPACE(sizeof(int) * fd_cnt);
+
+	struct cmsghdr *const cmsg = CMSG_FIRSTHDR(&header);
+
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fd_cnt);
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * fd_cnt);
+
+	if (sendmsg(fd, &header, MSG_NOSIGNAL) != sizeof(msg)) {
+		fail(fd, error, error_len, "Upgrade Send Error");
+		return false;
+	}
+	close(fd);
+
+	return true;
+}
+
+// Connects to the running server's upgrade socket at path and stores the
+// listening sockets it hands over in fds. Returns their count or -1.
+int handoff_receive(const String restrict path, int *const restrict fds, const unsigned int max_fds, String restrict error, const size_t error_len) {
+	handoff_msg_t msg;
+	union {
+		char buffer[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)];
+		struct cmsghdr align;
+	} control;
+	struct iovec iov = {&msg, sizeof(msg)};
+	struct msghdr header;
+	struct sockaddr_un addr;
+	const struct timeval timeout = {HANDOFF_TIMEOUT_S, 0};
+
+	if (!set_path(&addr, path)) {
+		errno = ENAMETOOLONG;
+		return fail(-1, error, error_len, "Upgrade Socket Error");
+	}
+
+	const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+	if (fd == -1)
+		return fail(fd, error, error_len, "Upgrade Socket Error");
+
+	if ((setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == -1)
+	    || (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) == -1))
+		return fail(fd, error, error_len, "Upgrade Connect Error");
+
+	memset(&header, 0, sizeof(header));
+	header.msg_iov = &iov;
+	header.msg_iovlen = 1;
+	header.msg_control = control.buffer;
+	header.msg_controllen = sizeof(control.buffer);
+
+	const ssize_t nbytes = recvmsg(fd, &header, MSG_CMSG_CLOEXEC);
+
+	if (nbytes == -1)
+		return fail(fd, error, error_len, "Upgrade Receive Error");
+	close(fd);
+
+	const struct cmsghdr *const cmsg = CMSG_FIRSTHDR(&header);
+
+	if ((nbytes != sizeof(msg)) || (msg.magic != HANDOFF_MAGIC) || (header.msg_flags & MSG_CTRUNC) || !cmsg
+	    || (cmsg->cmsg_level != SOL_SOCKET) || (cmsg->cmsg_type != SCM_RIGHTS)
+	    || (cmsg->cmsg_len != CMSG_LEN(sizeof(int) * msg.fd_cnt)) || (msg.fd_cnt > max_fds)) {
+		snprintf(error, error_len, "Upgrade Receive Error: Malformed handoff");
+		return -1;
+	}
+	memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * msg.fd_cnt);
+
+	return msg.fd_cnt;
+}
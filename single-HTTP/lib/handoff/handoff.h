@@ -0,0 +1,15 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "../types/types.h"
+
+#define HANDOFF_MAX_FDS 16
+
+extern int handoff_listen(const String, String, const size_t);
+extern bool handoff_send(const int, const int *const, const unsigned int, String, const size_t);
+extern int handoff_receive(const String, int *const, const unsigned int, String, const size_t);
+
+#endif /* End HANDOFF_H */
@@ -0,0 +1,564 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hpack.h"
+
+// Header compression of HTTP/2 (RFC 7541). Both directions share the dynamic
+// table type: the decoder's table follows the peer's encoder, the encoder's the
+// peer's decoder. Strings are decoded from and, when that is shorter, encoded
+// to the static Huffman code. Indices count from 1: the 61 entries of the static
+// table first, then the dynamic table from its newest entry.
+
+#define NT_LEN 1
+#define STATIC_ENTRIES 61
+#define ENTRY_OVERHEAD 32
+#define HUFFMAN_SYMBOLS 257
+#define HUFFMAN_EOS 256
+#define STATUS_INDEX 8 // ":status: 200", the first of the status entries
+#define STATUS_LAST 14
+#define INT_MAX_SHIFT 28 // Integers beyond 2^28 are not valid anywhere in HTTP/2
+#define INT_MAX_LEN 6
+#define STATUS_LEN 3
+
+typedef struct static_entry_s {
+	const String name, value;
+} static_entry_t;
+
+static const static_entry_t _static_table[STATIC_ENTRIES] = {
+	{":authority", ""},
+	{":method", "GET"},
+	{":method", "POST"},
+	{":path", "/"},
+	{":path", "/index.html"},
+	{":scheme", "http"},
+	{":scheme", "https"},
+	{":status", "200"},
+	{":status", "204"},
+	{":status", "206"},
+	{":status", "304"},
+	{":status", "400"},
+	{":status", "404"},
+	{":status", "500"},
+	{"accept-charset", ""},
+	{"accept-encoding", "gzip, deflate"},
+	{"accept-language", ""},
+	{"accept-ranges", ""},
+	{"accept", ""},
+	{"access-control-allow-origin", ""},
+	{"age", ""},
+	{"allow", ""},
+	{"authorization", ""},
+	{"cache-control", ""},
+	{"content-disposition", ""},
+	{"content-encoding", ""},
+	{"content-language", ""},
+	{"content-length", ""},
+	{"content-location", ""},
+	{"content-range", ""},
+	{"content-type", ""},
+	{"cookie", ""},
+	{"date", ""},
+	{"etag", ""},
+	{"expect", ""},
+	{"expires", ""},
+	{"from", ""},
+	{"host", ""},
+	{"if-match", ""},
+	{"if-modified-since", ""},
+	{"if-none-match", ""},
+	{"if-range", ""},
+	{"if-unmodified-since", ""},
+	{"last-modified", ""},
+	{"link", ""},
+	{"location", ""},
+	{"max-forwards", ""},
+	{"proxy-authenticate", ""},
+	{"proxy-authorization", ""},
+	{"range", ""},
+	{"referer", ""},
+	{"refresh", ""},
+	{"retry-after", ""},
+	{"server", ""},
+	{"set-cookie", ""},
+	{"strict-transport-security", ""},
+	{"transfer-encoding", ""},
+	{"user-agent", ""},
+	{"vary", ""},
+	{"via", ""},
+	{"www-authenticate", ""}
+};
+
+static const uint32_t _huffman_codes[HUFFMAN_SYMBOLS] = {
+	0x1ff8, 0x7fffd8, 0xfffffe2, 0xfffffe3, 0xfffffe4, 0xfffffe5, 0xfffffe6, 0xfffffe7,
+	0xfffffe8, 0xffffea, 0x3ffffffc, 0xfffffe9, 0xfffffea, 0x3ffffffd, 0xfffffeb, 0xfffffec,
+	0xfffffed, 0xfffffee, 0xfffffef, 0xffffff0, 0xffffff1, 0xffffff2, 0x3ffffffe, 0xffffff3,
+	0xffffff4, 0xffffff5, 0xffffff6, 0xffffff7, 0xffffff8, 0xffffff9, 0xffffffa, 0xffffffb,
+	0x14, 0x3f8, 0x3f9, 0xffa, 0x1ff9, 0x15, 0xf8, 0x7fa,
+	0x3fa, 0x3fb, 0xf9, 0x7fb, 0xfa, 0x16, 0x17, 0x18,
+	0x0, 0x1, 0x2, 0x19, 0x1a, 0x1b, 0x1c, 0x1d,
+	0x1e, 0x1f, 0x5c, 0xfb, 0x7ffc, 0x20, 0xffb, 0x3fc,
+	0x1ffa, 0x21, 0x5d, 0x5e, 0x5f, 0x60, 0x61, 0x62,
+	0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a,
+	0x6b, 0x6c, 0x6d, 0x6e, 0x6f, 0x70, 0x71, 0x72,
+	0xfc, 0x73, 0xfd, 0x1ffb, 0x7fff0, 0x1ffc, 0x3ffc, 0x22,
+	0x7ffd, 0x3, 0x23, 0x4, 0x24, 0x5, 0x25, 0x26,
+	0x27, 0x6, 0x74, 0x75, 0x28, 0x29, 0x2a, 0x7,
+	0x2b, 0x76, 0x2c, 0x8, 0x9, 0x2d, 0x77, 0x78,
+	0x79, 0x7a, 0x7b, 0x7ffe, 0x7fc, 0x3ffd, 0x1ffd, 0xffffffc,
+	0xfffe6, 0x3fffd2, 0xfffe7, 0xfffe8, 0x3fffd3, 0x3fffd4, 0x3fffd5, 0x7fffd9,
+	0x3fffd6, 0x7fffda, 0x7fffdb, 0x7fffdc, 0x7fffdd, 0x7fffde, 0xffffeb, 0x7fffdf,
+	0xffffec, 0xffffed, 0x3fffd7, 0x7fffe0, 0xffffee, 0x7fffe1, 0x7fffe2, 0x7fffe3,
+	0x7fffe4, 0x1fffdc, 0x3fffd8, 0x7fffe5, 0x3fffd9, 0x7fffe6, 0x7fffe7, 0xffffef,
+	0x3fffda, 0x1fffdd, 0xfffe9, 0x3fffdb, 0x3fffdc, 0x7fffe8, 0x7fffe9, 0x1fffde,
+	0x7fffea, 0x3fffdd, 0x3fffde, 0xfffff0, 0x1fffdf, 0x3fffdf, 0x7fffeb, 0x7fffec,
+	0x1fffe0, 0x1fffe1, 0x3fffe0, 0x1fffe2, 0x7fffed, 0x3fffe1, 0x7fffee, 0x7fffef,
+	0xfffea, 0x3fffe2, 0x3fffe3, 0x3fffe4, 0x7ffff0, 0x3fffe5, 0x3fffe6, 0x7ffff1,
+	0x3ffffe0, 0x3ffffe1, 0xfffeb, 0x7fff1, 0x3fffe7, 0x7ffff2, 0x3fffe8, 0x1ffffec,
+	0x3ffffe2, 0x3ffffe3, 0x3ffffe4, 0x7ffffde, 0x7ffffdf, 0x3ffffe5, 0xfffff1, 0x1ffffed,
+	0x7fff2, 0x1fffe3, 0x3ffffe6, 0x7ffffe0, 0x7ffffe1, 0x3ffffe7, 0x7ffffe2, 0xfffff2,
+	0x1fffe4, 0x1fffe5, 0x3ffffe8, 0x3ffffe9, 0xffffffd, 0x7ffffe3, 0x7ffffe4, 0x7ffffe5,
+	0xfffec, 0xfffff3, 0xfffed, 0x1fffe6, 0x3fffe9, 0x1fffe7, 0x1fffe8, 0x7ffff3,
+	0x3fffea, 0x3fffeb, 0x1ffffee, 0x1ffffef, 0xfffff4, 0xfffff5, 0x3ffffea, 0x7ffff4,
+	0x3ffffeb, 0x7ffffe6, 0x3ffffec, 0x3ffffed, 0x7ffffe7, 0x7ffffe8, 0x7ffffe9, 0x7ffffea,
+	0x7ffffeb, 0xffffffe, 0x7ffffec, 0x7ffffed, 0x7ffffee, 0x7ffffef, 0x7fffff0, 0x3ffffee,
+	0x3fffffff
+};
+
+static const uint8_t _huffman_lens[HUFFMAN_SYMBOLS] = {
+	13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+	28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+	6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+	5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+	13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+	7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+	15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+	6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+	20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+	24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+	22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+	21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+	26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+	19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+	20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+	26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+	30
+};
+
+// Decoding tree, built on first use. A child of 0 is absent (the root is node 0
+// and nobody's child), a positive one an inner node and a negative one the leaf
+// of symbol -child - 1.
+static int16_t _tree[HUFFMAN_SYMBOLS][2];
+static bool _tree_built = false;
+
+static void build_tree(void) {
+	int16_t nodes = 1;
+
+	for (int symbol = 0; symbol < HUFFMAN_SYMBOLS; symbol++) {
+		const uint32_t code = _huffman_codes[symbol];
+		int node = 0;
+
+		for (int bit = _huffman_lens[symbol] - 1; bit > 0; bit--) {
+			const int branch = (code >> bit) & 1;
+
+			if (!_tree[node][branch])
+				_tree[node][branch] = nodes++;
+			node = _tree[node][branch];
+		}
+		_tree[node][code & 1] = -(symbol + 1);
+	}
+	_tree_built = true;
+}
+
+// Returns the decoded length, -1 for an invalid code, an EOS symbol, padding
+// longer than 7 bits or padding that is not the prefix of EOS
+static int huffman_decode(const Byte *const restrict in, const size_t len, String out, const size_t out_len) {
+	int node = 0, depth = 0;
+	bool ones = true;
+	size_t written = 0;
+
+	if (!_tree_built)
+		build_tree();
+
+	for (size_t i = 0; i < len; i++)
+		for (int bit = 7; bit >= 0; bit--) {
+			const int branch = (in[i] >> bit) & 1;
+			const int child = _tree[node][branch];
+
+			depth++;
+			ones = ones && branch;
+
+			if (child > 0) {
+				node = child;
+				continue;
+			}
+
+			if ((child == 0) || (-child - 1 == HUFFMAN_EOS) || (written == out_len))
+				return -1;
+			out[written++] = (char) (-child - 1);
+			node = depth = 0;
+			ones = true;
+		}
+
+	return ((depth > 7) || !ones) ? -1 : (int) written;
+}
+
+static size_t huffman_len(const String restrict string, const size_t len) {
+	uint64_t bits = 0;
+
+	for (size_t i = 0; i < len; i++)
+		bits += _huffman_lens[(uint8_t) string[i]];
+
+	return (bits + 7) / 8;
+}
+
+static void huffman_encode(const String restrict string, const size_t len, Byte *out) {
+	uint64_t pending = 0;
+	int bits = 0;
+
+	for (size_t i = 0; i < len; i++) {
+		const uint8_t symbol = (uint8_t) string[i];
+
+		pending = (pending << _huffman_lens[symbol]) | _huffman_codes[symbol];
+		bits += _huffman_lens[symbol];
+
+		while (bits >= 8) {
+			bits -= 8;
+			*out++ = (Byte) (pending >> bits);
+		}
+		pending &= (1ULL << bits) - 1;
+	}
+
+	if (bits) // Padded with the most significant bits of EOS
+		*out = (Byte) ((pending << (8 - bits)) | (0xff >> bits));
+}
+
+static bool decode_int(const Byte **const restrict in, const Byte *const restrict end, const int prefix, uint64_t *const restrict value) {
+	const uint64_t mask = (1U << prefix) - 1;
+	int shift = 0;
+
+	if (*in == end)
+		return false;
+
+	*value = *(*in)++ & mask;
+
+	if (*value < mask)
+		return true;
+
+	while (*in < end) {
+		const Byte byte = *(*in)++;
+
+		*value += (uint64_t) (byte & 0x7f) << shift;
+		shift += 7;
+
+		if (!(byte & 0x80))
+			return true;
+		if (shift > INT_MAX_SHIFT)
+			return false;
+	}
+
+	return false;
+}
+
+static size_t encode_int(Byte *const restrict out, const Byte flags, const int prefix, uint64_t value) {
+	const uint64_t mask = (1U << prefix) - 1;
+	size_t len = 1;
+
+	if (value < mask) {
+		out[0] = flags | (Byte) value;
+		return len;
+	}
+	out[0] = flags | (Byte) mask;
+	value -= mask;
+
+	while (value >= 0x80) {
+		out[len++] = (Byte) ((value & 0x7f) | 0x80);
+		value >>= 7;
+	}
+	out[len++] = (Byte) value;
+
+	return len;
+}
+
+// Copies a string literal to the scratch buffer, NUL terminated
+static bool decode_string(const Byte **const restrict in, const Byte *const restrict end, String *const restrict scratch,
+                          size_t *const restrict scratch_len, String *const restrict out, size_t *const restrict out_len) {
+	const bool huffman = (*in < end) && (**in & 0x80);
+	uint64_t len;
+
+	if (!decode_int(in, end, 7, &len) || (len > (uint64_t) (end - *in)) || (*scratch_len < NT_LEN))
+		return false;
+
+	if (huffman) {
+		const int written = huffman_decode(*in, len, *scratch, *scratch_len - NT_LEN);
+
+		if (written == -1)
+			return false;
+		*out_len = written;
+	} else {
+		if (len + NT_LEN > *scratch_len)
+			return false;
+		memcpy(*scratch, *in, len);
+		*out_len = len;
+	}
+	*in += len;
+	*out = *scratch;
+	(*out)[*out_len] = '\0';
+	*scratch += *out_len + NT_LEN;
+	*scratch_len -= *out_len + NT_LEN;
+
+	return true;
+}
+
+void hpack_init(Hpack_Table const restrict table, const size_t max_size) {
+	memset(table, 0, sizeof(hpack_table_t));
+	table->capacity = max_size / ENTRY_OVERHEAD + 1;
+	table->entries = (hpack_entry_t*) calloc(table->capacity, sizeof(hpack_entry_t));
+	if (!table->entries)
+		exit(EXIT_FAILURE);
+
+	table->max_size = table->limit = max_size;
+}
+
+static void evict(Hpack_Table const restrict table, const size_t max_size) {
+	while (table->cnt && (table->size > max_size)) {
+		hpack_entry_t *const oldest = &table->entries[(table->head + table->capacity - table->cnt) % table->capacity];
+
+		table->size -= ENTRY_OVERHEAD + oldest->name_len + oldest->value_len;
+		free(oldest->name);
+		oldest->name = oldest->value = NULL;
+		table->cnt--;
+	}
+}
+
+void hpack_free(Hpack_Table const restrict table) {
+	evict(table, 0);
+	free(table->entries);
+	table->entries = NULL;
+}
+
+// The peer's decoder allows a table of limit octets. Shrinking evicts at once
+// and is announced at the start of the next header block.
+void hpack_set_limit(Hpack_Table const restrict table, const size_t limit) {
+	if (limit >= table->max_size)
+		return;
+
+	table->max_size = limit;
+	evict(table, limit);
+	table->size_update = true;
+}
+
+static void add_entry(Hpack_Table const restrict table, const String restrict name, const size_t name_len,
+                      const String restrict value, const size_t value_len) {
+	const size_t size = ENTRY_OVERHEAD + name_len + value_len;
+
+	// An entry larger than the table empties it and is not added
+	evict(table, (size > table->max_size) ? 0 : table->max_size - size);
+
+	if ((size > table->max_size) || (table->cnt == table->capacity))
+		return;
+
+	hpack_entry_t *const entry = &table->entries[table->head];
+
+	entry->name = (String) malloc(name_len + value_len + 2 * NT_LEN);
+	if (!entry->name)
+		exit(EXIT_FAILURE);
+
+	memcpy(entry->name, name, name_len);
+	entry->name[name_len] = '\0';
+	entry->value = entry->name + name_len + NT_LEN;
+	memcpy(entry->value, value, value_len);
+	entry->value[value_len] = '\0';
+	entry->name_len = name_len;
+	entry->value_len = value_len;
+
+	table->head = (table->head + 1) % table->capacity;
+	table->cnt++;
+	table->size += size;
+}
+
+static bool lookup(const Hpack_Table restrict table, const uint64_t index, String *const restrict name, size_t *const restrict name_len,
+                   String *const restrict value, size_t *const restrict value_len) {
+	if ((index == 0) || (index > STATIC_ENTRIES + table->cnt))
+		return false;
+
+	if (index <= STATIC_ENTRIES) {
+		*name = _static_table[index - 1].name;
+		*value = _static_table[index - 1].value;
+		*name_len = strlen(*name);
+		*value_len = strlen(*value);
+	} else {
+		const hpack_entry_t *const entry = &table->entries[(table->head + table->capacity - (index - STATIC_ENTRIES)) % table->capacity];
+
+		*name = entry->name;
+		*value = entry->value;
+		*name_len = entry->name_len;
+		*value_len = entry->value_len;
+	}
+
+	return true;
+}
+
+static bool copy_string(const String restrict string, const size_t len, String *const restrict scratch,
+                        size_t *const restrict scratch_len, String *const restrict out) {
+	if (len + NT_LEN > *scratch_len)
+		return false;
+
+	memcpy(*scratch, string, len);
+	(*scratch)[len] = '\0';
+	*out = *scratch;
+	*scratch += len + NT_LEN;
+	*scratch_len -= len + NT_LEN;
+
+	return true;
+}
+
+// Decodes a complete header block into at most max_fields fields whose strings
+// are copied to scratch. Returns the field count, -1 for a compression error,
+// after which the table no longer matches the peer's and the connection has to
+// be closed.
+int hpack_decode(Hpack_Table const restrict table, const Byte *block, const size_t len, hpack_field_t *const restrict fields,
+                 const unsigned int max_fields, String scratch, size_t scratch_len) {
+	const Byte *const end = block + len;
+	unsigned int field_cnt = 0;
+
+	while (block < end) {
+		const Byte first = *block;
+		hpack_field_t *const field = &fields[field_cnt];
+		String name, value;
+		size_t name_len, value_len;
+		uint64_t index;
+
+		if ((first & 0xe0) == 0x20) { // Dynamic table size update
+			if (!decode_int(&block, end, 5, &index) || (index > table->limit))
+				return -1;
+			table->max_size = index;
+			evict(table, index);
+			continue;
+		}
+
+		if (field_cnt == max_fields)
+			return -1;
+
+		if (first & 0x80) { // Indexed field
+			if (!decode_int(&block, end, 7, &index) || !lookup(table, index, &name, &name_len, &value, &value_len)
+			    || !copy_string(name, name_len, &scratch, &scratch_len, &field->name)
+			    || !copy_string(value, value_len, &scratch, &scratch_len, &field->value))
+				return -1;
+			field->name_len = name_len;
+			field->value_len = value_len;
+			field_cnt++;
+			continue;
+		}
+
+		// Literal, with incremental indexing (01), without (0000) or never indexed (0001)
+		const bool indexing = (first & 0xc0) == 0x40;
+
+		if (!decode_int(&block, end, indexing ? 6 : 4, &index))
+			return -1;
+
+		if (index) {
+			if (!lookup(table, index, &name, &name_len, &value, &value_len)
+			    || !copy_string(name, name_len, &scratch, &scratch_len, &field->name))
+				return -1;
+			field->name_len = name_len;
+		} else if (!decode_string(&block, end, &scratch, &scratch_len, &field->name, &field->name_len))
+			return -1;
+
+		if (!decode_string(&block, end, &scratch, &scratch_len, &field->value, &field->value_len))
+			return -1;
+
+		if (indexing)
+			add_entry(table, field->name, field->name_len, field->value, field->value_len);
+		field_cnt++;
+	}
+
+	return field_cnt;
+}
+
+static size_t encode_string(Byte *const restrict out, const String restrict string, const size_t len) {
+	const size_t huffman = huffman_len(string, len);
+
+	if (huffman < len) {
+		const size_t prefix = encode_int(out, 0x80, 7, huffman);
+
+		huffman_encode(string, len, out + prefix);
+		return prefix + huffman;
+	}
+
+	const size_t prefix = encode_int(out, 0x00, 7, len);
+
+	memcpy(out + prefix, string, len);
+
+	return prefix + len;
+}
+
+static size_t encode_size_update(Hpack_Table const restrict table, Byte *const restrict out) {
+	if (!table->size_update)
+		return 0;
+	table->size_update = false;
+
+	return encode_int(out, 0x20, 5, table->max_size);
+}
+
+// Begins a response header block. Returns the octets written, 0 when out_len
+// is too small.
+size_t hpack_encode_status(Hpack_Table const restrict table, const unsigned int status, Byte *const restrict out,
+                           const size_t out_len) {
+	char value[STATUS_LEN + NT_LEN];
+
+	if (out_len < 2 * INT_MAX_LEN + STATUS_LEN)
+		return 0;
+
+	const size_t len = encode_size_update(table, out);
+
+	snprintf(value, sizeof(value), "%03u", status % 1000);
+
+	for (unsigned int i = STATUS_INDEX; i <= STATUS_LAST; i++)
+		if (strcmp(_static_table[i - 1].value, value) == 0)
+			return len + encode_int(out + len, 0x80, 7, i);
+
+	return len + hpack_encode_field(table, ":status", sizeof(":status") - NT_LEN, value, STATUS_LEN, false, out + len,
+	                                out_len - len);
+}
+
+// Encodes one field with a lowercase name, as an index when the table has it,
+// otherwise as a literal that is added to the dynamic table when index is set.
+// Returns the octets written, 0 when out_len is too small.
+size_t hpack_encode_field(Hpack_Table const restrict table, const String restrict name, const size_t name_len,
+                          const String restrict value, const size_t value_len, const bool index, Byte *const restrict out,
+                          const size_t out_len) {
+	uint64_t name_index = 0;
+	size_t len;
+
+	if (out_len < 3 * INT_MAX_LEN + name_len + value_len)
+		return 0;
+
+	for (unsigned int i = 1; i <= STATIC_ENTRIES + table->cnt; i++) {
+		String entry_name, entry_value;
+		size_t entry_name_len, entry_value_len;
+
+		if (!lookup(table, i, &entry_name, &entry_name_len, &entry_value, &entry_value_len))
+			continue;
+
+		if ((entry_name_len != name_len) || (memcmp(entry_name, name, name_len) != 0))
+			continue;
+
+		if ((entry_value_len == value_len) && (memcmp(entry_value, value, value_len) == 0))
+			return encode_int(out, 0x80, 7, i);
+
+		if (!name_index)
+			name_index = i;
+	}
+
+	len = encode_int(out, index ? 0x40 : 0x00, index ? 6 : 4, name_index);
+
+	if (!name_index)
+		len += encode_string(out + len, name, name_len);
+	len += encode_string(out + len, value, value_len);
+
+	if (index)
+		add_entry(table, name, name_len, value, value_len);
+
+	return len;
+}
@@ -0,0 +1,41 @@
+#ifndef HPACK_H
+#define HPACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "../types/types.h"
+
+#define HPACK_DEFAULT_TABLE_SIZE 4096
+
+typedef struct hpack_entry_s {
+	String name, value; // One allocation, the value follows the name
+	size_t name_len, value_len;
+} hpack_entry_t;
+
+typedef struct hpack_table_s { // Dynamic table, a ring with the newest entry at head
+	hpack_entry_t *entries;
+	unsigned int head, cnt, capacity;
+	size_t size, max_size; // Octets as RFC 7541 counts them, 32 per entry on top of name and value
+	size_t limit; // Largest max_size the peer may choose (decoder) or allows (encoder)
+	bool size_update; // Encoder only: a size change not yet announced to the peer
+} hpack_table_t;
+
+typedef hpack_table_t *Hpack_Table;
+
+typedef struct hpack_field_s {
+	String name, value; // Both copied to the caller's scratch buffer and NUL terminated
+	size_t name_len, value_len;
+} hpack_field_t;
+
+extern void hpack_init(Hpack_Table const, const size_t);
+extern void hpack_free(Hpack_Table const);
+extern void hpack_set_limit(Hpack_Table const, const size_t);
+extern int hpack_decode(Hpack_Table const, const Byte *, const size_t, hpack_field_t *const, const unsigned int, String,
+                        const size_t);
+extern size_t hpack_encode_status(Hpack_Table const, const unsigned int, Byte *const, const size_t);
+extern size_t hpack_encode_field(Hpack_Table const, const String, const size_t, const String, const size_t, const bool,
+                                 Byte *const, const size_t);
+
+#endif /* End HPACK_H */
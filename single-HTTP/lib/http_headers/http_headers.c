@@ -0,0 +1,45 @@
+#include <string.h>
+#include <strings.h>
+
+#include "http_headers.h"
+
+#define STR_MAX 2048
+
+// Copies the value of the first header field called name into value. headers
+// points at the first header line, the scan stops at the blank line ending the
+// header block. Field names are case insensitive (RFC 7230, 3.2).
+String http_header_get(const String restrict headers, const String restrict name, String restrict value, const size_t value_len) {
+	const size_t name_len = strnlen(name, STR_MAX);
+	String line = headers;
+
+	if (!line || value_len < 1)
+		return NULL;
+
+	while (*line && *line != '\r' && *line != '\n') {
+		const String end = strpbrk(line, "\r\n");
+
+		if ((strncasecmp(line, name, name_len) == 0) && (line[name_len] == ':')) {
+			String start = line + name_len + 1;
+			size_t len;
+
+			while (*start == ' ' || *start == '\t')
+				start++;
+			len = end ? (size_t) (end - start) : strnlen(start, STR_MAX);
+
+			while (len > 0 && (start[len - 1] == ' ' || start[len - 1] == '\t'))
+				len--;
+			if (len >= value_len)
+				len = value_len - 1;
+			memcpy(value, start, len);
+			value[len] = '\0';
+
+			return value;
+		}
+
+		if (!end)
+			break;
+		line = end + ((end[0] == '\r' && end[1] == '\n') ? 2 : 1);
+	}
+
+	return NULL;
+}
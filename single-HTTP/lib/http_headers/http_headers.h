@@ -0,0 +1,10 @@
+#ifndef HTTP_HEADERS_H
+#define HTTP_HEADERS_H
+
+#include <stddef.h>
+
+#include "../types/types.h"
+
+extern String http_header_get(const String, const String, String, const size_t);
+
+#endif /* End HTTP_HEADERS_H */
@@ -0,0 +1,143 @@
+#include <stdio.h>
+#include <errno.h>
+#include <netdb.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "listener.h"
+
+// Listening sockets. Everything an accepted socket inherits from its listener
+// (buffer sizes, TCP_NODELAY) is set here once instead of on every connection.
+
+// Splits "host:port", "[v6 host]:port" or a bare port. An empty host or "*"
+// means every local address.
+static bool split_address(const String restrict address, String restrict host, const size_t host_len, String *const port) {
+	const String colon = strrchr(address, ':');
+	const char *start = address, *end = colon;
+
+	if (!colon) {
+		host[0] = '\0';
+		*port = address;
+		return true;
+	}
+
+	if (address[0] == '[') {
+		const String bracket = strchr(address, ']');
+
+		if (!bracket || (bracket + 1 != colon))
+			return false;
+		start = address + 1;
+		end = bracket;
+	}
+
+	if ((size_t) (end - start) >= host_len)
+		return false;
+
+	memcpy(host, start, end - start);
+	host[end - start] = '\0';
+	*port = colon + 1;
+
+	if (strncmp(host, "*", 2) == 0)
+		host[0] = '\0';
+
+	return true;
+}
+
+static int set_option(const int fd, const int level, const int name, const int value) {
+	return setsockopt(fd, level, name, &value, sizeof(value));
+}
+
+static int fail(const int fd, String restrict error, const size_t error_len, const String restrict step) {
+	snprintf(error, error_len, "%s: %s", step, strerror(errno));
+	if (fd != -1)
+		close(fd);
+
+	return -1;
+}
+
+// Returns a non-blocking listening socket bound to address, -1 with a
+// description of the failing step in error otherwise
+int listener_open(const String address, const listener_options_t *const options, String error, const size_t error_len) {
+	char host[NI_MAXHOST];
+	String port;
+	struct addrinfo hints, *serviceinfo;
+
+	if (!split_address(address, host, NI_MAXHOST, &port)) {
+		snprintf(error, error_len, "Address Error: Malformed address %s", address);
+		return -1;
+	}
+
+	const long port_num = strtol(port, NULL, 10);
+
+	if ((port_num < 1) || (port_num > 65535)) {
+		snprintf(error, error_len, "Port Error: Invalid port %s", port);
+		return -1;
+	}
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = host[0] ? AF_UNSPEC : AF_INET6; // The wildcard is dual stack
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE | AI_NUMERICSERV;
+
+	const int gai_err = getaddrinfo(host[0] ? host : NULL, port, &hints, &serviceinfo);
+
+	if (gai_err != 0) {
+		snprintf(error, error_len, "Get Address Info Error: %s", gai_strerror(gai_err));
+		return -1;
+	}
+
+	const int fd = socket(serviceinfo->ai_family, serviceinfo->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+	                      serviceinfo->ai_protocol);
+
+	if (fd == -1) {
+		freeaddrinfo(serviceinfo);
+		return fail(fd, error, error_len, "Socket Init Error");
+	}
+
+	if ((set_option(fd, SOL_SOCKET, SO_REUSEADDR, 1) == -1)
+	    || ((serviceinfo->ai_family == AF_INET6) && (set_option(fd, IPPROTO_IPV6, IPV6_V6ONLY, !!host[0]) == -1))
+	    || (options->send_buffer && (set_option(fd, SOL_SOCKET, SO_SNDBUF, options->send_buffer) == -1))
+	    // Before listen() so the window scale offered in the handshake fits the buffer
+	    || (options->receive_buffer && (set_option(fd, SOL_SOCKET, SO_RCVBUF, options->receive_buffer) == -1))
+	    || ((options->push == PUSH_NODELAY) && (set_option(fd, IPPROTO_TCP, TCP_NODELAY, 1) == -1))) {
+		freeaddrinfo(serviceinfo);
+		return fail(fd, error, error_len, "Setsocket Error");
+	}
+
+	if (bind(fd, serviceinfo->ai_addr, serviceinfo->ai_addrlen) == -1) {
+		freeaddrinfo(serviceinfo);
+		return fail(fd, error, error_len, "Bind Error");
+	}
+	freeaddrinfo(serviceinfo);
+
+	if ((options->fastopen && (set_option(fd, IPPROTO_TCP, TCP_FASTOPEN, options->fastopen) == -1))
+	    || (options->defer_accept && (set_option(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, options->defer_accept) == -1)))
+		return fail(fd, error, error_len, "Setsocket Error");
+
+	if (listen(fd, options->backlog) == -1)
+		return fail(fd, error, error_len, "Listen Error");
+
+	return fd;
+}
+
+bool listener_parse_push(const String restrict value, tcp_push_t *const push) {
+	if (strncmp(value, "nodelay", 8) == 0)
+		*push = PUSH_NODELAY;
+	else if (strncmp(value, "cork", 5) == 0)
+		*push = PUSH_CORK;
+	else if (strncmp(value, "default", 8) == 0)
+		*push = PUSH_DEFAULT;
+	else
+		return false;
+
+	return true;
+}
+
+// Holds partial frames back while a response is written, uncorking sends them
+void listener_cork(const int fd, const bool cork) {
+	set_option(fd, IPPROTO_TCP, TCP_CORK, cork);
+}
@@ -0,0 +1,27 @@
+#ifndef LISTENER_H
+#define LISTENER_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "../types/types.h"
+
+typedef enum tcp_push_e {
+	PUSH_DEFAULT, // Nagle's algorithm as the kernel configures it
+	PUSH_NODELAY, // Every write is sent at once
+	PUSH_CORK // Writes of one response are held back until it is complete
+} tcp_push_t;
+
+typedef struct listener_options_s {
+	int backlog;
+	int defer_accept; // Seconds the kernel waits for request data before the accept, 0 disables it
+	int fastopen; // Pending TCP Fast Open requests, 0 disables it
+	int send_buffer, receive_buffer; // Bytes, 0 keeps the kernel default
+	tcp_push_t push;
+} listener_options_t;
+
+extern int listener_open(const String, const listener_options_t *const, String, const size_t);
+extern bool listener_parse_push(const String, tcp_push_t *const);
+extern void listener_cork(const int, const bool);
+
+#endif /* End LISTENER_H */
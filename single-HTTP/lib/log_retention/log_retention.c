@@ -0,0 +1,331 @@
+#include <ftw.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <zlib.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <linux/limits.h>
+
+#include "log_retention.h"
+
+// Housekeeping of the day logs server_log() leaves behind, run by a thread of
+// its own at idle CPU and I/O priority so it only uses what requests leave
+// over. Once an hour it gzips every day log whose day has rolled over, then
+// deletes the oldest logs past the age limit or beyond the byte budget of the
+// tree and removes the directories that emptied. Compression reads at most
+// bytes_per_s and drops what it read from the page cache.
+
+#define NT_LEN 1
+#define NICE_MIN 19
+#define INTERVAL_S 3600
+#define GRACE_S 60 // Writes of the previous day that are still in flight
+#define STALE_TMP_S 3600
+#define DAY_S 86400
+#define CHUNK_LEN (64 * 1024)
+#define NFTW_FDS 16
+#define FILES_MIN 64
+#define DAY_PATH_LEN 20
+#define LOG_EXT ".log"
+#define GZ_EXT ".gz"
+#define TMP_EXT ".tmp"
+
+// ioprio_set() has no glibc wrapper
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_CLASS_SHIFT 13
+
+typedef struct lr_file_s {
+	char path[PATH_MAX];
+	time_t mtime;
+	uint64_t size;
+	bool compressed;
+} lr_file_t;
+
+static struct lr_state_s {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	bool running, stopping;
+	char root[PATH_MAX];
+	lr_policy_t policy;
+	lr_file_t *files; // Found by the walk, which passes no context to its callback
+	size_t file_cnt, file_cap;
+} _lr = {.lock = PTHREAD_MUTEX_INITIALIZER, .wake = PTHREAD_COND_INITIALIZER};
+
+static bool has_suffix(const char *restrict path, const String restrict suffix) {
+	const size_t len = strlen(path), suffix_len = strlen(suffix);
+
+	return (len >= suffix_len) && (strcmp(path + len - suffix_len, suffix) == 0);
+}
+
+// Sleeps until deadline or lr_stop(). Returns false once stopping.
+static bool wait_until(const struct timespec *const restrict deadline) {
+	bool stopping;
+
+	pthread_mutex_lock(&_lr.lock);
+	while (!_lr.stopping && (pthread_cond_timedwait(&_lr.wake, &_lr.lock, deadline) != ETIMEDOUT))
+		;
+	stopping = _lr.stopping;
+	pthread_mutex_unlock(&_lr.lock);
+
+	return !stopping;
+}
+
+// Holds compression to bytes_per_s: done octets may not be read before
+// start + done / bytes_per_s
+static bool throttle(const struct timespec *const restrict start, const uint64_t done) {
+	if (!_lr.policy.bytes_per_s)
+		return true;
+
+	const uint64_t ns = done * 1000000000ULL / _lr.policy.bytes_per_s;
+	struct timespec deadline = {start->tv_sec + ns / 1000000000ULL, start->tv_nsec + ns % 1000000000ULL};
+
+	if (deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+
+	return wait_until(&deadline);
+}
+
+static int collect_file(const char *path, const struct stat *file, const int type, struct FTW *ftw) {
+	if (type != FTW_F)
+		return 0;
+
+	if (has_suffix(path, TMP_EXT)) { // Left by an interrupted compression
+		if (file->st_mtime + STALE_TMP_S < time(NULL))
+			unlink(path);
+		return 0;
+	}
+
+	const bool compressed = has_suffix(path, LOG_EXT GZ_EXT);
+
+	if (!compressed && !has_suffix(path, LOG_EXT))
+		return 0;
+
+	if (_lr.file_cnt == _lr.file_cap) {
+		_lr.file_cap = _lr.file_cap ? _lr.file_cap * 2 : FILES_MIN;
+		_lr.files = (lr_file_t*) realloc(_lr.files, _lr.file_cap * sizeof(lr_file_t));
+		if (!_lr.files)
+			exit(EXIT_FAILURE);
+	}
+
+	lr_file_t *const entry = &_lr.files[_lr.file_cnt++];
+
+	strncpy(entry->path, path, PATH_MAX - NT_LEN);
+	entry->path[PATH_MAX - NT_LEN] = '\0';
+	entry->mtime = file->st_mtime;
+	entry->size = file->st_size;
+	entry->compressed = compressed;
+
+	return 0;
+}
+
+static int prune_directory(const char *path, const struct stat *file, const int type, struct FTW *ftw) {
+	if ((type == FTW_DP) && (ftw->level > 0))
+		rmdir(path); // Fails while the directory holds anything
+	return 0;
+}
+
+// Writes path.gz beside the day log and removes the log. The log is locked so
+// a second server, the old one during an upgrade, leaves it alone.
+static bool compress_file(lr_file_t *const restrict entry) {
+	char gz_path[PATH_MAX], tmp_path[PATH_MAX + sizeof(GZ_EXT TMP_EXT)];
+	Byte buffer[CHUNK_LEN];
+	struct timespec start;
+	uint64_t done = 0;
+	ssize_t nbytes;
+	bool complete = false;
+
+	// The entry goes on under the compressed name, which has to fit it
+	if (snprintf(gz_path, PATH_MAX, "%s" GZ_EXT, entry->path) >= PATH_MAX)
+		return false;
+	snprintf(tmp_path, sizeof(tmp_path), "%s" GZ_EXT TMP_EXT, entry->path);
+
+	const int fd = open(entry->path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return false;
+
+	if (flock(fd, LOCK_EX | LOCK_NB) == -1) {
+		close(fd);
+		return false;
+	}
+
+	const int out_fd = open(tmp_path, O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC, 0660);
+	gzFile gz = (out_fd != -1) ? gzdopen(dup(out_fd), "wb9") : NULL;
+
+	if (!gz) {
+		if (out_fd != -1) {
+			close(out_fd);
+			unlink(tmp_path);
+		}
+		close(fd);
+		return false;
+	}
+
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	clock_gettime(CLOCK_REALTIME, &start); // The clock pthread_cond_timedwait() waits on
+
+	while ((nbytes = read(fd, buffer, CHUNK_LEN)) > 0) {
+		if (gzwrite(gz, buffer, nbytes) != nbytes)
+			break;
+		done += nbytes;
+
+		if (!throttle(&start, done))
+			break;
+	}
+	complete = (nbytes == 0) && (gzclose(gz) == Z_OK);
+
+	if (!complete && (nbytes != 0))
+		gzclose(gz);
+
+	// Durable before the original goes
+	if (complete && (fdatasync(out_fd) == 0)) {
+		const struct timespec times[2] = {{entry->mtime, 0}, {entry->mtime, 0}};
+
+		futimens(out_fd, times); // Retention goes by the day of the log, not of its compression
+		complete = (rename(tmp_path, gz_path) == 0) && (unlink(entry->path) == 0);
+	} else {
+		complete = false;
+		unlink(tmp_path);
+	}
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	posix_fadvise(out_fd, 0, 0, POSIX_FADV_DONTNEED);
+	close(out_fd);
+	close(fd);
+
+	if (complete) {
+		struct stat file;
+
+		snprintf(entry->path, PATH_MAX, "%s", gz_path);
+		entry->compressed = true;
+		entry->size = (stat(gz_path, &file) == 0) ? (uint64_t) file.st_size : 0;
+	}
+
+	return complete;
+}
+
+static int compare_age(const void *const a, const void *const b) {
+	const time_t x = ((const lr_file_t*) a)->mtime, y = ((const lr_file_t*) b)->mtime;
+
+	return (x > y) - (x < y);
+}
+
+static bool expired(const lr_file_t *const restrict entry, const time_t now) {
+	return _lr.policy.max_age_days && (entry->mtime + (time_t) _lr.policy.max_age_days * DAY_S < now);
+}
+
+static void run_pass(void) {
+	char today[PATH_MAX + DAY_PATH_LEN], day_path[DAY_PATH_LEN + NT_LEN];
+	const time_t now = time(NULL);
+	struct tm local;
+	uint64_t total = 0;
+	unsigned int compressed = 0, removed = 0;
+
+	localtime_r(&now, &local);
+	strftime(day_path, sizeof(day_path), "%Y/%b/%U/%a" LOG_EXT, &local);
+	snprintf(today, sizeof(today), "%s%s", _lr.root, day_path);
+
+	_lr.file_cnt = 0;
+	if (nftw(_lr.root, collect_file, NFTW_FDS, FTW_PHYS) == -1)
+		return;
+	qsort(_lr.files, _lr.file_cnt, sizeof(lr_file_t), compare_age);
+
+	for (size_t i = 0; i < _lr.file_cnt; i++) {
+		lr_file_t *const entry = &_lr.files[i];
+		const bool current = (strcmp(entry->path, today) == 0);
+
+		if (_lr.policy.compress && !current && !entry->compressed && (entry->mtime + GRACE_S < now)
+		    && !expired(entry, now)) {
+			if (compress_file(entry))
+				compressed++;
+			else if (__atomic_load_n(&_lr.stopping, __ATOMIC_RELAXED))
+				return;
+		}
+		total += entry->size;
+	}
+
+	// Oldest first, the log being written is never removed
+	for (size_t i = 0; i < _lr.file_cnt; i++) {
+		lr_file_t *const entry = &_lr.files[i];
+		const bool over = _lr.policy.max_bytes && (total > _lr.policy.max_bytes);
+
+		if ((!expired(entry, now) && !over) || (strcmp(entry->path, today) == 0))
+			continue;
+
+		if (unlink(entry->path) == 0) {
+			total -= entry->size;
+			removed++;
+		}
+	}
+	nftw(_lr.root, prune_directory, NFTW_FDS, FTW_PHYS | FTW_DEPTH);
+
+	if (compressed || removed)
+		printf("Log Retention: %u logs compressed, %u removed, %llu bytes kept\n", compressed, removed,
+		       (unsigned long long) total);
+}
+
+static void *run_housekeeping(void *const arg) {
+	const struct sched_param param = {0};
+
+	// Only this thread, both calls take the calling thread's id for 0
+	if (sched_setscheduler(0, SCHED_IDLE, &param) == -1)
+		setpriority(PRIO_PROCESS, syscall(SYS_gettid), NICE_MIN);
+	syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+
+	do {
+		struct timespec deadline;
+
+		run_pass();
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += INTERVAL_S;
+
+		if (!wait_until(&deadline))
+			break;
+	} while (true);
+
+	return NULL;
+}
+
+bool lr_enabled(const lr_policy_t *const restrict policy) {
+	return policy->compress || policy->max_age_days || policy->max_bytes;
+}
+
+bool lr_start(const String restrict root, const lr_policy_t *const restrict policy) {
+	if (_lr.running || !lr_enabled(policy))
+		return false;
+
+	strncpy(_lr.root, root, PATH_MAX - NT_LEN);
+	_lr.policy = *policy;
+	_lr.stopping = false;
+	_lr.running = (pthread_create(&_lr.thread, NULL, run_housekeeping, NULL) == 0);
+
+	return _lr.running;
+}
+
+// Interrupts a compression in progress, which is picked up again next time
+void lr_stop(void) {
+	if (!_lr.running)
+		return;
+
+	pthread_mutex_lock(&_lr.lock);
+	__atomic_store_n(&_lr.stopping, true, __ATOMIC_RELAXED);
+	pthread_cond_signal(&_lr.wake);
+	pthread_mutex_unlock(&_lr.lock);
+
+	pthread_join(_lr.thread, NULL);
+	_lr.running = false;
+	free(_lr.files);
+	_lr.files = NULL;
+	_lr.file_cnt = _lr.file_cap = 0;
+}
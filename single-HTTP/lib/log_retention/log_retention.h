@@ -0,0 +1,20 @@
+#ifndef LOG_RETENTION_H
+#define LOG_RETENTION_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "../types/types.h"
+
+typedef struct lr_policy_s {
+	bool compress; // gzip day logs once their day has rolled over
+	unsigned int max_age_days; // 0 keeps logs regardless of age
+	uint64_t max_bytes; // Bound on the whole log tree, 0 for none
+	uint64_t bytes_per_s; // I/O budget of compression, 0 for none
+} lr_policy_t;
+
+extern bool lr_enabled(const lr_policy_t *const);
+extern bool lr_start(const String, const lr_policy_t *const);
+extern void lr_stop(void);
+
+#endif /* End LOG_RETENTION_H */
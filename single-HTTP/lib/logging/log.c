@@ -22,7 +22,8 @@ void server_log(const String restrict msg) {
 	String log_dir = (String) calloc(PATH_MAX + NT_LEN, sizeof(char)),
 		f_time = (String) malloc((FTIME_MLEN + NT_LEN) * sizeof(char));
 	char ff_time_path[FF_TIME_PATH_MLEN + NT_LEN];
-	const struct tm *const t_data = localtime(&cur_time);
+	struct tm t_buffer;
+	const struct tm *const t_data = localtime_r(&cur_time, &t_buffer); // Called from the threads of threaded-HTTP
 
 	if (!log_dir || !f_time) {
 		fprintf(stderr, RED "Memory Error: %s\n" RESET, strerror(errno));
@@ -40,9 +41,12 @@ void server_log(const String restrict msg) {
 	mkdir(ff_time_path, mode_d);
 
 	strftime(ff_time_path, 20, "%Y/%b/%U/%a.log", t_data);
-	snprintf(log_dir, PATH_MAX, "%s%s", _log_root, ff_time_path);
+	int fd = -1;
 
-	const int fd = open(log_dir, O_CREAT | O_WRONLY | O_APPEND, mode_f);
+	if (snprintf(log_dir, PATH_MAX, "%s%s", _log_root, ff_time_path) >= PATH_MAX)
+		errno = ENAMETOOLONG;
+	else
+		fd = open(log_dir, O_CREAT | O_WRONLY | O_APPEND, mode_f);
 
 	if ((fd == -1) && (verbose_flag))
 		printf(YELLOW "Logging File Error: %s\n" RESET, strerror(errno));
@@ -0,0 +1,222 @@
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "microcache.h"
+
+// Short-TTL response cache for dynamic routes. An entry is created in the
+// MC_FILLING state by the first request that misses; every request for the
+// same key that arrives while the backend runs is parked on the entry's waiter
+// list and served from the single result once the fill completes.
+
+#define NT_LEN 1
+#define STR_MAX 2048
+#define BODY_MIN 4096
+#define WAITERS_MIN 4
+
+static time_t mc_now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec;
+}
+
+// D. J. Bernstein Hash, Modified
+static unsigned int get_hash(const Micro_Cache restrict cache, String restrict key) {
+	unsigned int result = 5381;
+
+	while (*key)
+		result = (33 * result) ^ (unsigned char) *key++;
+
+	return result % cache->bin_cnt;
+}
+
+static void destroy_entry(Mc_Entry entry) {
+	free(entry->key);
+	entry->key = NULL;
+
+	free(entry->body);
+	entry->body = NULL;
+
+	free(entry->waiters);
+	entry->waiters = NULL;
+
+	free(entry);
+	entry = NULL;
+}
+
+static void unlink_entry(const Micro_Cache restrict cache, const Mc_Entry restrict entry) {
+	const unsigned int bin = get_hash(cache, entry->key);
+	Mc_Entry *link = &cache->bins[bin];
+
+	while (*link && *link != entry)
+		link = &(*link)->next;
+	if (!*link)
+		return;
+	*link = entry->next;
+
+	if (entry->state == MC_READY)
+		cache->cur_bytes -= entry->body_len;
+	cache->entry_cnt--;
+	destroy_entry(entry);
+}
+
+// Drops expired entries first and then, if that was not enough, the remaining
+// ready entries until needed bytes fit inside the budget. Entries still being
+// filled are never evicted since requests are waiting on them.
+static void evict(const Micro_Cache restrict cache, const size_t needed) {
+	const time_t now = mc_now();
+	Mc_Entry entry, next;
+
+	for (int pass = 0; pass < 2; pass++)
+		for (unsigned int bin = 0; bin < cache->bin_cnt; bin++)
+			for (entry = cache->bins[bin]; entry; entry = next) {
+				next = entry->next;
+
+				if (cache->cur_bytes + needed <= cache->max_bytes)
+					return;
+				if (entry->state != MC_READY || (pass == 0 && entry->expires > now))
+					continue;
+				unlink_entry(cache, entry);
+			}
+}
+
+Micro_Cache mc_create(const unsigned int bin_cnt, const size_t max_bytes) {
+	if (bin_cnt < 1)
+		return NULL;
+
+	const Micro_Cache cache = (Micro_Cache) malloc(sizeof(micro_cache_t));
+	if (!cache)
+		exit(EXIT_FAILURE);
+
+	cache->bins = (Mc_Entry*) calloc(bin_cnt, sizeof(Mc_Entry));
+	if (!cache->bins)
+		exit(EXIT_FAILURE);
+
+	cache->bin_cnt = bin_cnt;
+	cache->entry_cnt = 0;
+	cache->max_bytes = max_bytes;
+	cache->cur_bytes = 0;
+
+	return cache;
+}
+
+void mc_destroy(Micro_Cache cache) {
+	Mc_Entry entry, next;
+
+	for (unsigned int bin = 0; bin < cache->bin_cnt; bin++)
+		for (entry = cache->bins[bin]; entry; entry = next) {
+			next = entry->next;
+			destroy_entry(entry);
+		}
+
+	free(cache->bins);
+	cache->bins = NULL;
+
+	free(cache);
+	cache = NULL;
+}
+
+// Returns the entry stored under key if it is still being filled or has not
+// expired yet. Expired entries are released on the way.
+Mc_Entry mc_find(const Micro_Cache restrict cache, const String restrict key) {
+	const unsigned int bin = get_hash(cache, key);
+
+	for (Mc_Entry entry = cache->bins[bin]; entry; entry = entry->next) {
+		if (strncmp(key, entry->key, STR_MAX) != 0)
+			continue;
+		if (entry->state == MC_READY && entry->expires <= mc_now()) {
+			unlink_entry(cache, entry);
+			return NULL;
+		}
+		return entry;
+	}
+
+	return NULL;
+}
+
+// The first waiter, the request that missed, is added by the caller
+Mc_Entry mc_begin_fill(const Micro_Cache restrict cache, const String restrict key) {
+	const unsigned int bin = get_hash(cache, key);
+	const Mc_Entry entry = (Mc_Entry) calloc(1, sizeof(mc_entry_t));
+	if (!entry)
+		exit(EXIT_FAILURE);
+
+	const size_t key_len = strnlen(key, STR_MAX);
+
+	entry->key = (String) calloc(key_len + NT_LEN, sizeof(char));
+	if (!entry->key)
+		exit(EXIT_FAILURE);
+
+	strncpy(entry->key, key, key_len);
+	entry->state = MC_FILLING;
+	entry->next = cache->bins[bin];
+	cache->bins[bin] = entry;
+	cache->entry_cnt++;
+
+	return entry;
+}
+
+void mc_add_waiter(const Mc_Entry restrict entry, const int client_fd, const uint32_t id) {
+	if (entry->waiter_cnt == entry->waiter_cap) {
+		const unsigned int cap = entry->waiter_cap ? entry->waiter_cap * 2 : WAITERS_MIN;
+		mc_waiter_t *const waiters = (mc_waiter_t*) realloc(entry->waiters, cap * sizeof(mc_waiter_t));
+
+		if (!waiters)
+			exit(EXIT_FAILURE);
+		entry->waiters = waiters;
+		entry->waiter_cap = cap;
+	}
+	entry->waiters[entry->waiter_cnt].fd = client_fd;
+	entry->waiters[entry->waiter_cnt++].id = id;
+}
+
+// Drops the waiter on client_fd, its connection closed before the fill ended
+void mc_remove_waiter(const Mc_Entry restrict entry, const int client_fd) {
+	for (unsigned int i = 0; i < entry->waiter_cnt; i++)
+		if (entry->waiters[i].fd == client_fd) {
+			entry->waiters[i] = entry->waiters[--entry->waiter_cnt];
+			return;
+		}
+}
+
+void mc_append(const Mc_Entry restrict entry, const Byte *const restrict data, const size_t len) {
+	if (entry->body_len + len > entry->body_cap) {
+		size_t cap = entry->body_cap ? entry->body_cap : BODY_MIN;
+
+		while (cap < entry->body_len + len)
+			cap *= 2;
+
+		Byte *const body = (Byte*) realloc(entry->body, cap);
+
+		if (!body)
+			exit(EXIT_FAILURE);
+		entry->body = body;
+		entry->body_cap = cap;
+	}
+	memcpy(entry->body + entry->body_len, data, len);
+	entry->body_len += len;
+}
+
+// Publishes a completed fill. The caller has already answered the waiters, so
+// the list is cleared here. Bodies larger than the whole budget are not kept.
+void mc_finish_fill(const Micro_Cache restrict cache, Mc_Entry entry, const unsigned int ttl) {
+	entry->waiter_cnt = 0;
+
+	if (entry->body_len > cache->max_bytes || ttl == 0) {
+		unlink_entry(cache, entry);
+		return;
+	}
+
+	evict(cache, entry->body_len);
+	entry->state = MC_READY;
+	entry->expires = mc_now() + ttl;
+	cache->cur_bytes += entry->body_len;
+}
+
+void mc_abort_fill(const Micro_Cache restrict cache, Mc_Entry entry) {
+	unlink_entry(cache, entry);
+}
@@ -0,0 +1,52 @@
+#ifndef MICROCACHE_H
+#define MICROCACHE_H
+
+#include <time.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "../types/types.h"
+
+typedef enum mc_state_e {
+	MC_FILLING,
+	MC_READY
+} mc_state_t;
+
+// A connection parked on a fill, id tells it from a later one on the same fd
+typedef struct mc_waiter_s {
+	int fd;
+	uint32_t id;
+} mc_waiter_t;
+
+typedef struct mc_entry_s {
+	String key;
+	Byte *body;
+	size_t body_len, body_cap;
+	time_t expires;
+	mc_state_t state;
+	mc_waiter_t *waiters;
+	unsigned int waiter_cnt, waiter_cap;
+	struct mc_entry_s *next;
+} mc_entry_t;
+
+typedef mc_entry_t *Mc_Entry;
+
+typedef struct micro_cache_s {
+	Mc_Entry *bins;
+	unsigned int bin_cnt, entry_cnt;
+	size_t max_bytes, cur_bytes;
+} micro_cache_t;
+
+typedef micro_cache_t *Micro_Cache;
+
+extern Micro_Cache mc_create(const unsigned int, const size_t);
+extern void mc_destroy(Micro_Cache);
+extern Mc_Entry mc_find(Micro_Cache const, const String);
+extern Mc_Entry mc_begin_fill(Micro_Cache const, const String);
+extern void mc_add_waiter(Mc_Entry const, const int, const uint32_t);
+extern void mc_remove_waiter(Mc_Entry const, const int);
+extern void mc_append(Mc_Entry const, const Byte *const, const size_t);
+extern void mc_finish_fill(Micro_Cache const, Mc_Entry, const unsigned int);
+extern void mc_abort_fill(Micro_Cache const, Mc_Entry);
+
+#endif /* End MICROCACHE_H */
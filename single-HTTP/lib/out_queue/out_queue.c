@@ -0,0 +1,311 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+
+#include "../buffer_pool/buffer_pool.h"
+#include "out_queue.h"
+
+// Ordered output of a non-blocking socket. Writes go straight to the socket
+// while nothing is queued ahead of them and only the part the kernel did not
+// take is kept: memory is copied, file ranges keep a duplicate of the file
+// descriptor. oq_flush() resumes where the socket last returned EAGAIN.
+// Output encrypted by OpenSSL goes through tls_write(), file ranges in chunks.
+// A deferred queue only collects the output: io_uring sends it, reporting
+// back through oq_sent(), oq_piped() and oq_unpiped().
+
+#define TLS_CHUNK_LEN 16384 // The largest record
+#define PIPE_LEN (1 << 18) // Asked for, the pipe may be smaller
+
+typedef enum io_result_e {
+	IO_DONE,
+	IO_AGAIN,
+	IO_ERROR
+} io_result_t;
+
+static io_result_t write_buffer(Out_Queue const restrict queue, const int sock, const Byte **const data, size_t *const len) {
+	while (*len > 0) {
+		const ssize_t nbytes = queue->tls ? tls_write(queue->tls, *data, *len) : send(sock, *data, *len, MSG_NOSIGNAL);
+
+		if (nbytes == -1) {
+			if (errno == EINTR)
+				continue;
+			return ((errno == EAGAIN) || (errno == EWOULDBLOCK)) ? IO_AGAIN : IO_ERROR;
+		}
+		*data += nbytes;
+		*len -= nbytes;
+	}
+
+	return IO_DONE;
+}
+
+// A chunk left behind by EAGAIN is read again from the same offset, the
+// retry OpenSSL expects
+static io_result_t write_file_tls(Out_Queue const restrict queue, const int fd, off_t *const offset, size_t *const len) {
+	Byte chunk[TLS_CHUNK_LEN];
+
+	while (*len > 0) {
+		const ssize_t nbytes = pread(fd, chunk, (*len < TLS_CHUNK_LEN) ? *len : TLS_CHUNK_LEN, *offset);
+
+		if ((nbytes == -1) && (errno == EINTR))
+			continue;
+		if (nbytes <= 0) // The file shrank under the response
+			return IO_ERROR;
+
+		const Byte *data = chunk;
+		size_t left = nbytes;
+		const io_result_t result = write_buffer(queue, -1, &data, &left);
+
+		*offset += nbytes - left;
+		*len -= nbytes - left;
+
+		if (result != IO_DONE)
+			return result;
+	}
+
+	return IO_DONE;
+}
+
+static io_result_t write_file(Out_Queue const restrict queue, const int sock, const int fd, off_t *const offset, size_t *const len) {
+	if (queue->tls)
+		return write_file_tls(queue, fd, offset, len);
+
+	while (*len > 0) {
+		const ssize_t nbytes = sendfile(sock, fd, offset, *len);
+
+		if (nbytes == -1) {
+			if (errno == EINTR)
+				continue;
+			return ((errno == EAGAIN) || (errno == EWOULDBLOCK)) ? IO_AGAIN : IO_ERROR;
+		}
+		if (nbytes == 0) // The file shrank under the response
+			return IO_ERROR;
+		*len -= nbytes;
+	}
+
+	return IO_DONE;
+}
+
+static void append(Out_Queue const restrict queue, const Oq_Segment restrict segment) {
+	if (queue->tail)
+		queue->tail->next = segment;
+	else
+		queue->head = segment;
+	queue->tail = segment;
+	queue->bytes += segment->len;
+}
+
+static void release(const Oq_Segment restrict segment) {
+	if (segment->kind == OQ_FILE)
+		close(segment->fd);
+	else if ((segment->kind == OQ_BUFFER) && segment->cap)
+		bp_release(segment->data, segment->cap);
+	else if (segment->kind == OQ_BUFFER)
+		free(segment->data);
+	free(segment);
+}
+
+static Oq_Segment new_segment(const oq_kind_t kind, const size_t len) {
+	const Oq_Segment segment = (Oq_Segment) calloc(1, sizeof(oq_segment_t));
+	if (!segment)
+		exit(EXIT_FAILURE);
+
+	segment->kind = kind;
+	segment->fd = -1;
+	segment->len = len;
+
+	return segment;
+}
+
+// Returns false once the peer is gone, the response can not be completed then
+bool oq_send_buffer(Out_Queue const restrict queue, const int sock, const Byte *data, size_t len) {
+	if (!queue->head && !queue->deferred) {
+		const io_result_t result = write_buffer(queue, sock, &data, &len);
+
+		if (result != IO_AGAIN)
+			return result == IO_DONE;
+	}
+
+	if (len == 0)
+		return true;
+
+	const Oq_Segment segment = new_segment(OQ_BUFFER, len);
+
+	if (!(segment->data = bp_acquire(len, &segment->cap)) && !(segment->data = (Byte*) malloc(len)))
+		exit(EXIT_FAILURE);
+	memcpy(segment->data, data, len);
+	append(queue, segment);
+
+	return true;
+}
+
+// For data that lives as long as the process, such as the embedded assets:
+// the unsent part is referenced instead of copied
+bool oq_send_static(Out_Queue const restrict queue, const int sock, const Byte *data, size_t len) {
+	if (!queue->head && !queue->deferred) {
+		const io_result_t result = write_buffer(queue, sock, &data, &len);
+
+		if (result != IO_AGAIN)
+			return result == IO_DONE;
+	}
+
+	if (len == 0)
+		return true;
+
+	const Oq_Segment segment = new_segment(OQ_STATIC, len);
+
+	segment->data = (Byte*) data;
+	append(queue, segment);
+
+	return true;
+}
+
+// The caller keeps ownership of fd, a queued range holds its own duplicate
+bool oq_send_file(Out_Queue const restrict queue, const int sock, const int fd, off_t offset, size_t len) {
+	if (!queue->head && !queue->deferred) {
+		const io_result_t result = write_file(queue, sock, fd, &offset, &len);
+
+		if (result != IO_AGAIN)
+			return result == IO_DONE;
+	}
+
+	if (len == 0)
+		return true;
+
+	const int dup_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+
+	if (dup_fd == -1)
+		return false;
+
+	const Oq_Segment segment = new_segment(OQ_FILE, len);
+
+	segment->fd = dup_fd;
+	segment->offset = offset;
+	append(queue, segment);
+
+	return true;
+}
+
+// Writes queued segments until the socket would block or the queue is empty
+bool oq_flush(Out_Queue const restrict queue, const int sock) {
+	while (queue->head) {
+		const Oq_Segment segment = queue->head;
+		const size_t before = segment->len;
+		io_result_t result;
+
+		if (segment->kind == OQ_FILE)
+			result = write_file(queue, sock, segment->fd, &segment->offset, &segment->len);
+		else {
+			const Byte *data = segment->data + segment->offset;
+
+			result = write_buffer(queue, sock, &data, &segment->len);
+			segment->offset = data - segment->data;
+		}
+		queue->bytes -= before - segment->len;
+
+		if (result == IO_ERROR)
+			return false;
+		if (result == IO_AGAIN)
+			return true;
+
+		queue->head = segment->next;
+		if (!queue->head)
+			queue->tail = NULL;
+		release(segment);
+	}
+
+	return true;
+}
+
+// Drops what is queued, except the head segments a send of the ring still
+// reads and what already sits in the pipe
+void oq_clear(Out_Queue const restrict queue) {
+	Oq_Segment *link = &queue->head;
+
+	queue->tail = NULL;
+	queue->bytes = queue->piped;
+
+	for (unsigned int kept = 0; *link && (kept < queue->in_flight); kept++) {
+		queue->tail = *link;
+		queue->bytes += (*link)->len;
+		link = &(*link)->next;
+	}
+
+	while (*link) {
+		const Oq_Segment segment = *link;
+
+		*link = segment->next;
+		release(segment);
+	}
+}
+
+// The pipe file ranges are spliced through on their way to the socket
+bool oq_open_pipe(Out_Queue const restrict queue) {
+	if (pipe2(queue->pipe, O_CLOEXEC) == -1)
+		return false;
+
+	const int size = fcntl(queue->pipe[1], F_SETPIPE_SZ, PIPE_LEN);
+
+	queue->pipe_size = (size > 0) ? (unsigned int) size : (unsigned int) fcntl(queue->pipe[1], F_GETPIPE_SZ);
+
+	return true;
+}
+
+// Once nothing the ring was given refers to it
+void oq_close_pipe(Out_Queue const restrict queue) {
+	if (!queue->pipe_size)
+		return;
+	close(queue->pipe[0]);
+	close(queue->pipe[1]);
+	queue->pipe_size = queue->piped = 0;
+}
+
+// A send of the ring that read the head segment completed, having written len
+// octets of it
+void oq_sent(Out_Queue const restrict queue, const size_t len) {
+	const Oq_Segment segment = queue->head;
+
+	if (queue->in_flight)
+		queue->in_flight--;
+	if (!segment || !len)
+		return;
+
+	segment->offset += len;
+	segment->len -= len;
+	queue->bytes -= len;
+
+	if (!segment->len) {
+		queue->head = segment->next;
+		if (!queue->head)
+			queue->tail = NULL;
+		release(segment);
+	}
+}
+
+// len octets of the file range at the head moved into the pipe
+void oq_piped(Out_Queue const restrict queue, const size_t len) {
+	queue->head->offset += len;
+	queue->head->len -= len;
+	queue->piped += len;
+}
+
+// len octets left the pipe for the socket. Ends the splice of the file range
+// at the head, which is released once all of it went into the pipe.
+void oq_unpiped(Out_Queue const restrict queue, const size_t len) {
+	const Oq_Segment segment = queue->head;
+
+	queue->piped -= len;
+	queue->bytes -= len;
+
+	if (queue->in_flight)
+		queue->in_flight--;
+	if (segment && (segment->kind == OQ_FILE) && !segment->len && !queue->in_flight) {
+		queue->head = segment->next;
+		if (!queue->head)
+			queue->tail = NULL;
+		release(segment);
+	}
+}
@@ -0,0 +1,52 @@
+#ifndef OUT_QUEUE_H
+#define OUT_QUEUE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "../types/types.h"
+#include "../tls/tls.h"
+
+typedef enum oq_kind_e {
+	OQ_BUFFER,
+	OQ_STATIC,
+	OQ_FILE
+} oq_kind_t;
+
+typedef struct oq_segment_s {
+	oq_kind_t kind;
+	Byte *data; // OQ_BUFFER: owned copy of the unsent bytes, OQ_STATIC: borrowed read-only bytes
+	size_t cap; // OQ_BUFFER: size of the pool buffer holding the copy, 0 when it was too large for one
+	int fd; // OQ_FILE: owned duplicate of the source descriptor
+	off_t offset;
+	size_t len;
+	struct oq_segment_s *next;
+} oq_segment_t;
+
+typedef oq_segment_t *Oq_Segment;
+
+typedef struct out_queue_s {
+	Oq_Segment head, tail;
+	size_t bytes; // Queued, what sits in the pipe included
+	Tls_Session tls; // Set while OpenSSL encrypts the output, a socket with kTLS takes plain writes
+	bool deferred; // Nothing is written on the caller's behalf, io_uring sends the queue
+	unsigned int in_flight; // Head segments a send of the ring still reads, kept by oq_clear()
+	unsigned int piped, pipe_size; // File data spliced into the pipe and not sent yet, pipe_size is 0 without a pipe
+	int pipe[2];
+} out_queue_t;
+
+typedef out_queue_t *Out_Queue;
+
+extern bool oq_send_buffer(Out_Queue const, const int, const Byte *, size_t);
+extern bool oq_send_static(Out_Queue const, const int, const Byte *, size_t);
+extern bool oq_send_file(Out_Queue const, const int, const int, off_t, size_t);
+extern bool oq_flush(Out_Queue const, const int);
+extern void oq_clear(Out_Queue const);
+extern bool oq_open_pipe(Out_Queue const);
+extern void oq_close_pipe(Out_Queue const);
+extern void oq_sent(Out_Queue const, const size_t);
+extern void oq_piped(Out_Queue const, const size_t);
+extern void oq_unpiped(Out_Queue const, const size_t);
+
+#endif /* End OUT_QUEUE_H */
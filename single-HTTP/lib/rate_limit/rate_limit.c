@@ -0,0 +1,178 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rate_limit.h"
+
+// Token buckets per client address prefix: the /64 of an IPv6 client and the
+// whole address of an IPv4 one. Buckets live in a fixed open-addressed table
+// that never allocates after creation. A key is probed for in a short window
+// of slots; when the window is full the CLOCK sweep evicts a bucket that was
+// not used since the last sweep. Tokens are refilled lazily from the time
+// passed since the last request, so idle buckets cost nothing.
+//
+// Slots are claimed and updated with compare-and-swap, so threads can share a
+// table without a lock. An eviction racing with an update can hand a fresh
+// bucket to a client once, which only ever errs on the side of allowing.
+
+#define PROBE_WINDOW 8
+#define MILLI 1000
+#define BURST_MAX (UINT32_MAX / MILLI) // Milli-tokens have to fit the upper half of the state
+#define MIX_PRIME 0x9e3779b97f4a7c15ULL
+#define V4_MAPPED_TAG 0xffffULL
+
+static uint64_t mix(uint64_t x) { // splitmix64 finalizer
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+
+	return x ^ (x >> 31);
+}
+
+static uint64_t full_bucket(const rl_limit_t *const restrict limit, const uint64_t now_ms) {
+	return ((uint64_t) limit->burst * MILLI << 32) | (uint32_t) now_ms;
+}
+
+static unsigned int round_up_pow2(const unsigned int value) {
+	unsigned int result = PROBE_WINDOW;
+
+	while (result < value)
+		result <<= 1;
+
+	return result;
+}
+
+Rate_Limiter rl_create(const unsigned int slot_cnt, const rl_limit_t *const restrict limits) {
+	const unsigned int size = round_up_pow2(slot_cnt);
+	const Rate_Limiter limiter = (Rate_Limiter) calloc(1, sizeof(rate_limiter_t));
+	if (!limiter)
+		exit(EXIT_FAILURE);
+
+	// Slots come in whole cache lines, so a probe window spans two of them
+	if (posix_memalign((void**) &limiter->slots, 64, size * sizeof(rl_slot_t)) != 0)
+		exit(EXIT_FAILURE);
+	memset(limiter->slots, 0, size * sizeof(rl_slot_t));
+
+	limiter->referenced = (uint8_t*) calloc(size, sizeof(uint8_t));
+	if (!limiter->referenced)
+		exit(EXIT_FAILURE);
+
+	limiter->mask = size - 1;
+	memcpy(limiter->limits, limits, sizeof(limiter->limits));
+
+	return limiter;
+}
+
+void rl_destroy(Rate_Limiter limiter) {
+	free(limiter->slots);
+	limiter->slots = NULL;
+
+	free(limiter->referenced);
+	limiter->referenced = NULL;
+
+	free(limiter);
+	limiter = NULL;
+}
+
+// "rate/burst" in requests per second, a bare rate allows a burst of one
+// second worth of requests
+bool rl_parse_limit(const String restrict value, rl_limit_t *const restrict limit) {
+	unsigned int rate, burst;
+	const int fields = sscanf(value, "%u/%u", &rate, &burst);
+
+	if ((fields < 1) || ((fields == 2) && (burst > BURST_MAX)) || ((fields == 1) && (rate > BURST_MAX)))
+		return false;
+
+	limit->rate = rate;
+	limit->burst = (fields == 2) ? burst : rate;
+
+	return limit->burst > 0 || rate == 0;
+}
+
+uint64_t rl_client_key(const struct in6_addr *const restrict address) {
+	uint64_t prefix = 0;
+
+	if (IN6_IS_ADDR_V4MAPPED(address)) {
+		for (int i = 12; i < 16; i++)
+			prefix = (prefix << 8) | address->s6_addr[i];
+
+		return (V4_MAPPED_TAG << 32) | prefix;
+	}
+
+	for (int i = 0; i < 8; i++)
+		prefix = (prefix << 8) | address->s6_addr[i];
+
+	return prefix;
+}
+
+// Returns the slot of key, claiming a free one or evicting by CLOCK within the
+// probe window when the key is not present
+static rl_slot_t *find_slot(const Rate_Limiter restrict limiter, const uint64_t key, const rl_limit_t *const restrict limit,
+                            const uint64_t now_ms) {
+	const unsigned int start = (unsigned int) key & limiter->mask;
+	unsigned int index;
+
+	for (unsigned int i = 0; i < PROBE_WINDOW; i++) {
+		rl_slot_t *const slot = &limiter->slots[(start + i) & limiter->mask];
+		uint64_t current = __atomic_load_n(&slot->key, __ATOMIC_ACQUIRE);
+
+		if (current == key)
+			return slot;
+
+		if ((current == 0) && __atomic_compare_exchange_n(&slot->key, &current, key, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			__atomic_store_n(&slot->state, full_bucket(limit, now_ms), __ATOMIC_RELEASE);
+			return slot;
+		}
+
+		if (current == key) // Claimed by another thread for the same client
+			return slot;
+	}
+
+	// Second chance: skip and clear recently used slots, the first one not used
+	// since the last sweep goes. After a full turn the start slot is taken.
+	for (index = 0; index < PROBE_WINDOW; index++) {
+		uint8_t *const referenced = &limiter->referenced[(start + index) & limiter->mask];
+
+		if (!__atomic_load_n(referenced, __ATOMIC_RELAXED))
+			break;
+		__atomic_store_n(referenced, 0, __ATOMIC_RELAXED);
+	}
+
+	rl_slot_t *const victim = &limiter->slots[(start + index % PROBE_WINDOW) & limiter->mask];
+
+	__atomic_store_n(&victim->key, key, __ATOMIC_RELEASE);
+	__atomic_store_n(&victim->state, full_bucket(limit, now_ms), __ATOMIC_RELEASE);
+
+	return victim;
+}
+
+// Takes one token from the bucket of client for the route class, false when
+// the bucket is empty and the request has to be refused
+bool rl_allow(const Rate_Limiter restrict limiter, const uint64_t client, const rl_class_t class, const uint64_t now_ms) {
+	const rl_limit_t *const limit = &limiter->limits[class];
+
+	if (limit->rate == 0)
+		return true;
+
+	const uint64_t key = mix(client * MIX_PRIME + class) | 1; // Never 0, the free marker
+	rl_slot_t *const slot = find_slot(limiter, key, limit, now_ms);
+	uint8_t *const referenced = &limiter->referenced[slot - limiter->slots];
+	const uint64_t capacity = (uint64_t) limit->burst * MILLI;
+	uint64_t state = __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE), next;
+	bool allowed;
+
+	if (!__atomic_load_n(referenced, __ATOMIC_RELAXED)) // Spares the cache line when already set
+		__atomic_store_n(referenced, 1, __ATOMIC_RELAXED);
+
+	do {
+		const uint32_t elapsed = (uint32_t) now_ms - (uint32_t) state;
+		uint64_t tokens = (state >> 32) + (uint64_t) elapsed * limit->rate;
+
+		if (tokens > capacity)
+			tokens = capacity;
+
+		allowed = tokens >= MILLI;
+		next = ((allowed ? tokens - MILLI : tokens) << 32) | (uint32_t) now_ms;
+	} while (!__atomic_compare_exchange_n(&slot->state, &state, next, true, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+	return allowed;
+}
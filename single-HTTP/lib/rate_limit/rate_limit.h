@@ -0,0 +1,40 @@
+#ifndef RATE_LIMIT_H
+#define RATE_LIMIT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <netinet/in.h>
+
+#include "../types/types.h"
+
+typedef enum rl_class_e { // Route classes, each with its own limit and buckets
+	RL_STATIC,
+	RL_DYNAMIC,
+	RL_CLASSES
+} rl_class_t;
+
+typedef struct rl_limit_s {
+	uint32_t rate, burst; // Requests per second and bucket size, a rate of 0 disables the limit
+} rl_limit_t;
+
+typedef struct rl_slot_s {
+	uint64_t key; // 0 while the slot is free
+	uint64_t state; // Milli-tokens in the upper half, millisecond clock of the last refill in the lower
+} rl_slot_t;
+
+typedef struct rate_limiter_s {
+	rl_slot_t *slots;
+	uint8_t *referenced; // CLOCK bits, set on use and cleared by the eviction sweep
+	unsigned int mask;
+	rl_limit_t limits[RL_CLASSES];
+} rate_limiter_t;
+
+typedef rate_limiter_t *Rate_Limiter;
+
+extern Rate_Limiter rl_create(const unsigned int, const rl_limit_t *const);
+extern void rl_destroy(Rate_Limiter);
+extern bool rl_parse_limit(const String, rl_limit_t *const);
+extern uint64_t rl_client_key(const struct in6_addr *const);
+extern bool rl_allow(Rate_Limiter const, const uint64_t, const rl_class_t, const uint64_t);
+
+#endif /* End RATE_LIMIT_H */
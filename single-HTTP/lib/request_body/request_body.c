@@ -0,0 +1,244 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <linux/limits.h>
+
+#include "request_body.h"
+
+// Request bodies, Content-Length, chunked and the DATA of HTTP/2 streams,
+// spooled to an anonymous file that the handler reads as a stream. Body octets
+// still in the socket are moved with splice(), socket to pipe to file, and
+// never enter user space; only the chunk framing is read, a line at a time,
+// with recv(). Octets that already arrived in the request buffer are written
+// out as they are. Memory per body is fixed whatever its length, the spool
+// file lives in the page cache.
+
+#define PIPE_LEN (64 * 1024) // Default pipe capacity, the most one splice() moves
+#define HEX 16
+#define HEX_DIGITS "0123456789abcdefABCDEF"
+
+Request_Body rb_create(const String restrict spool_dir, const bool chunked, const uint64_t len, const uint64_t limit) {
+	int fd = open(spool_dir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+
+	if (fd == -1) { // File systems without O_TMPFILE
+		char path[PATH_MAX];
+
+		snprintf(path, PATH_MAX, "%s/single-HTTP.body.XXXXXX", spool_dir);
+
+		if ((fd = mkostemp(path, O_CLOEXEC)) == -1)
+			return NULL;
+		unlink(path);
+	}
+
+	const Request_Body body = (Request_Body) calloc(1, sizeof(request_body_t));
+	if (!body)
+		exit(EXIT_FAILURE);
+
+	body->fd = fd;
+	body->pipe[0] = body->pipe[1] = -1;
+	body->chunked = chunked;
+	body->state = chunked ? RB_CHUNK_SIZE : (len ? RB_DATA : RB_DONE);
+	body->remaining = chunked ? 0 : len;
+	body->limit = limit;
+
+	return body;
+}
+
+void rb_destroy(Request_Body body) {
+	close(body->fd);
+
+	if (body->pipe[0] != -1) {
+		close(body->pipe[0]);
+		close(body->pipe[1]);
+	}
+
+	free(body);
+	body = NULL;
+}
+
+// Takes framing octets up to the end of a line, which is complete when its
+// newline was among them. Returns the octets used.
+static size_t take_line(Request_Body const restrict body, const Byte *const restrict data, const size_t len, bool *const restrict complete) {
+	const Byte *const newline = memchr(data, '\n', len);
+	const size_t used = newline ? (size_t) (newline - data) + 1 : len;
+	const size_t space = RB_LINE_LEN - body->line_len;
+
+	// An overlong line keeps the buffer full, which is rejected at its end
+	memcpy(body->line + body->line_len, data, (used < space) ? used : space);
+	body->line_len += (used < space) ? used : space;
+	*complete = newline != NULL;
+
+	return used;
+}
+
+static rb_status_t end_line(Request_Body const restrict body) {
+	size_t len = body->line_len;
+	char *end;
+
+	body->line_len = 0;
+
+	if (len == RB_LINE_LEN)
+		return RB_INVALID;
+
+	while (len && ((body->line[len - 1] == '\n') || (body->line[len - 1] == '\r')))
+		len--;
+	body->line[len] = '\0';
+
+	switch (body->state) {
+		case RB_CHUNK_SIZE: {
+			const uint64_t size = strtoull(body->line, &end, HEX);
+
+			// Only hex digits, strtoull() would take a sign, blanks or 0x before them.
+			// Chunk extensions after the size are ignored.
+			if ((end == body->line) || (end != body->line + strspn(body->line, HEX_DIGITS))
+			    || ((*end != '\0') && (*end != ';') && (*end != ' ') && (*end != '\t')))
+				return RB_INVALID;
+
+			if (size == 0) {
+				body->state = RB_TRAILERS;
+				return RB_MORE;
+			}
+
+			if ((size > body->limit) || (body->len + size > body->limit))
+				return RB_TOO_LARGE;
+			body->remaining = size;
+			body->state = RB_DATA;
+			return RB_MORE;
+		}
+		case RB_CHUNK_END:
+			if (len)
+				return RB_INVALID;
+			body->state = RB_CHUNK_SIZE;
+			return RB_MORE;
+		case RB_TRAILERS: // Trailer fields are dropped
+			if (!len)
+				body->state = RB_DONE;
+			return RB_MORE;
+		default:
+			return RB_INVALID;
+	}
+}
+
+static void end_data(Request_Body const restrict body, const size_t len) {
+	body->remaining -= len;
+	body->len += len;
+
+	if (!body->remaining)
+		body->state = body->chunked ? RB_CHUNK_END : RB_DONE;
+}
+
+// Decodes body octets that are already in memory, the request buffer or an
+// io_uring receive. Stops at the end of the body, *used tells where that was.
+rb_status_t rb_feed(Request_Body const restrict body, const Byte *const restrict data, const size_t len, size_t *const restrict used) {
+	size_t pos = 0;
+	bool complete;
+
+	while ((pos < len) && (body->state != RB_DONE)) {
+		if (body->state == RB_DATA) {
+			const size_t take = (body->remaining < len - pos) ? body->remaining : len - pos;
+			const ssize_t nbytes = write(body->fd, data + pos, take);
+
+			if (nbytes <= 0)
+				return RB_FAILED;
+			pos += nbytes;
+			end_data(body, nbytes);
+			continue;
+		}
+
+		pos += take_line(body, data + pos, len - pos, &complete);
+
+		if (complete) {
+			const rb_status_t status = end_line(body);
+
+			if (status != RB_MORE)
+				return status;
+		}
+	}
+	*used = pos;
+
+	return (body->state == RB_DONE) ? RB_COMPLETE : RB_MORE;
+}
+
+// Writes body octets whose end the protocol marks, the DATA frames of an
+// HTTP/2 stream, so there is no framing to decode
+rb_status_t rb_append(Request_Body const restrict body, const Byte *restrict data, size_t len) {
+	if (body->len + len > body->limit)
+		return RB_TOO_LARGE;
+
+	while (len > 0) {
+		const ssize_t nbytes = write(body->fd, data, len);
+
+		if (nbytes <= 0)
+			return RB_FAILED;
+		data += nbytes;
+		len -= nbytes;
+		body->len += nbytes;
+	}
+
+	return RB_MORE;
+}
+
+// Moves what the socket has of the body into the spool file. Reads nothing
+// past the end of the body, a pipelined request stays in the socket.
+rb_status_t rb_splice(Request_Body const restrict body, const int sock) {
+	Byte line[RB_LINE_LEN];
+	bool complete;
+
+	while (body->state != RB_DONE) {
+		if (body->state == RB_DATA) {
+			if ((body->pipe[0] == -1) && (pipe2(body->pipe, O_NONBLOCK | O_CLOEXEC) == -1))
+				return RB_FAILED;
+
+			const size_t want = (body->remaining < PIPE_LEN) ? body->remaining : PIPE_LEN;
+			const ssize_t nbytes = splice(sock, NULL, body->pipe[1], NULL, want, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+			if (nbytes == 0)
+				return RB_CLOSED;
+			if (nbytes == -1)
+				return ((errno == EAGAIN) || (errno == EINTR)) ? RB_MORE : RB_CLOSED;
+
+			for (ssize_t moved = 0; moved < nbytes; ) {
+				const ssize_t written = splice(body->pipe[0], NULL, body->fd, NULL, nbytes - moved, SPLICE_F_MOVE);
+
+				if (written <= 0)
+					return RB_FAILED;
+				moved += written;
+			}
+			end_data(body, nbytes);
+			continue;
+		}
+
+		// Framing is peeked at and only the octets of the current line taken
+		const ssize_t nbytes = recv(sock, line, RB_LINE_LEN, MSG_PEEK | MSG_DONTWAIT);
+
+		if (nbytes == 0)
+			return RB_CLOSED;
+		if (nbytes == -1)
+			return ((errno == EAGAIN) || (errno == EINTR)) ? RB_MORE : RB_CLOSED;
+
+		const size_t used = take_line(body, line, nbytes, &complete);
+
+		if (recv(sock, line, used, MSG_DONTWAIT) != (ssize_t) used)
+			return RB_CLOSED;
+
+		if (complete) {
+			const rb_status_t status = end_line(body);
+
+			if (status != RB_MORE)
+				return status;
+		}
+	}
+
+	return RB_COMPLETE;
+}
+
+// The spool file from the start of the body, for the handler to read
+int rb_rewind(Request_Body const restrict body) {
+	lseek(body->fd, 0, SEEK_SET);
+
+	return body->fd;
+}
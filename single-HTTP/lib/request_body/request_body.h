@@ -0,0 +1,52 @@
+#ifndef REQUEST_BODY_H
+#define REQUEST_BODY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "../types/types.h"
+
+#define RB_LINE_LEN 256 // Longest chunk size line or trailer field accepted
+#define RB_TYPE_LEN 128
+
+typedef enum rb_state_e {
+	RB_DATA, // Inside the body of a Content-Length request or a chunk
+	RB_CHUNK_SIZE,
+	RB_CHUNK_END, // The CRLF closing a chunk
+	RB_TRAILERS,
+	RB_DONE
+} rb_state_t;
+
+typedef enum rb_status_e {
+	RB_MORE, // Waiting for the client
+	RB_COMPLETE,
+	RB_TOO_LARGE,
+	RB_INVALID, // Malformed chunked encoding
+	RB_CLOSED, // The client closed the connection before the end of the body
+	RB_FAILED // The spool file could not be written
+} rb_status_t;
+
+typedef struct request_body_s {
+	int fd; // Anonymous spool file, the body from its start
+	int pipe[2]; // Stages spliced data between the socket and the spool file
+	bool chunked;
+	rb_state_t state;
+	uint64_t remaining; // Octets left of the body or the current chunk
+	uint64_t len, limit;
+	char type[RB_TYPE_LEN]; // Content-Type of the request, the header block is gone by the time the handler runs
+	char line[RB_LINE_LEN];
+	size_t line_len;
+} request_body_t;
+
+typedef request_body_t *Request_Body;
+
+extern Request_Body rb_create(const String, const bool, const uint64_t, const uint64_t);
+extern void rb_destroy(Request_Body);
+extern rb_status_t rb_feed(Request_Body const, const Byte *, const size_t, size_t *const);
+extern rb_status_t rb_append(Request_Body const, const Byte *, size_t);
+extern rb_status_t rb_splice(Request_Body const, const int);
+extern int rb_rewind(Request_Body const);
+
+#endif /* End REQUEST_BODY_H */
@@ -10,7 +10,7 @@
 #define NT_LEN 1
 #define STR_MAX 2048
 
-static S_Ll_Node create_node(const String restrict regex, const String restrict path) {
+static S_Ll_Node create_node(const String restrict regex, const String restrict path, const unsigned int cache_ttl) {
 	const S_Ll_Node restrict node = (S_Ll_Node) malloc(sizeof(s_ll_node_t));
 	if (!node)
 		exit(EXIT_FAILURE);
@@ -31,6 +31,7 @@ static S_Ll_Node create_node(const String restrict regex, const String restrict
 
 	strncpy(node->path, path, path_len);
 
+	node->cache_ttl = cache_ttl;
 	node->next = NULL;
 
 	return node;
@@ -64,8 +65,8 @@ S_Ll_Node s_ll_find(const S_Ll restrict list, const String restrict regex) {
 	return NULL;
 }
 
-void s_ll_insert(const S_Ll restrict list, const String restrict regex, const String restrict path) {
-	const S_Ll_Node new_node = create_node(regex, path);
+void s_ll_insert(const S_Ll restrict list, const String restrict regex, const String restrict path, const unsigned int cache_ttl) {
+	const S_Ll_Node new_node = create_node(regex, path, cache_ttl);
 	S_Ll_Node node = list->root;
 
 	if (!node) {
@@ -5,6 +5,7 @@
 
 typedef struct s_ll_node_s {
 	String regex, path;
+	unsigned int cache_ttl;
 	struct s_ll_node_s *next;
 } s_ll_node_t;
 
@@ -18,7 +19,7 @@ typedef s_ll_t *S_Ll;
 
 extern S_Ll s_ll_create(void);
 extern void s_ll_destroy(S_Ll);
-extern void s_ll_insert(S_Ll, const String, const String);
+extern void s_ll_insert(S_Ll, const String, const String, const unsigned int);
 extern S_Ll_Node s_ll_find(S_Ll const, const String);
 extern void s_ll_print(S_Ll);
 
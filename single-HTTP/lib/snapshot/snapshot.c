@@ -0,0 +1,199 @@
+#include <time.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/limits.h>
+
+#include "snapshot.h"
+
+// Cache snapshot handed from a server to the one replacing it, so the new
+// process starts with the old one's hot responses instead of a cold cache.
+// Records are written in host byte order since both processes run on the same
+// machine. Micro-cache expiry times are stored as wall clock times so a stale
+// snapshot can not revive expired entries, and gzip entries keep the mtime and
+// size of their file so edited files are compressed again on first use.
+
+#define SNAPSHOT_MAGIC 0x53485350 // "SHSP"
+#define SNAPSHOT_VERSION 1
+#define RECORD_END 0
+#define RECORD_MICROCACHE 1
+#define RECORD_GZIP 2
+#define NT_LEN 1
+#define STR_MAX 2048
+#define BLOCK_MAX ((uint64_t) 256 << 20) // Bound on a record body, guards against a damaged length
+#define TMP_EXT ".tmp"
+
+typedef struct snapshot_header_s {
+	uint32_t magic, version;
+} snapshot_header_t;
+
+static time_t monotonic_now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec;
+}
+
+static bool write_block(FILE *const restrict file, const void *const restrict data, const uint64_t len) {
+	return (fwrite(&len, sizeof(len), 1, file) == 1) && (!len || (fwrite(data, len, 1, file) == 1));
+}
+
+// Returns a heap copy of the next block with a terminating NUL, NULL when the
+// file ends early or the block is larger than max_len
+static Byte *read_block(FILE *const restrict file, uint64_t *const restrict len, const uint64_t max_len) {
+	if ((fread(len, sizeof(*len), 1, file) != 1) || (*len > max_len))
+		return NULL;
+
+	Byte *const data = (Byte*) malloc(*len + NT_LEN);
+	if (!data)
+		exit(EXIT_FAILURE);
+
+	if (*len && (fread(data, *len, 1, file) != 1)) {
+		free(data);
+		return NULL;
+	}
+	data[*len] = '\0';
+
+	return data;
+}
+
+static bool save_microcache(FILE *const restrict file, const Micro_Cache restrict cache) {
+	const time_t now = monotonic_now(), wall_now = time(NULL);
+	const uint8_t kind = RECORD_MICROCACHE;
+
+	for (unsigned int bin = 0; bin < cache->bin_cnt; bin++)
+		for (Mc_Entry entry = cache->bins[bin]; entry; entry = entry->next) {
+			const int64_t expires = wall_now + (entry->expires - now);
+
+			if ((entry->state != MC_READY) || (entry->expires <= now))
+				continue;
+
+			if ((fwrite(&kind, sizeof(kind), 1, file) != 1) || (fwrite(&expires, sizeof(expires), 1, file) != 1)
+			    || !write_block(file, entry->key, strnlen(entry->key, STR_MAX))
+			    || !write_block(file, entry->body, entry->body_len))
+				return false;
+		}
+
+	return true;
+}
+
+// Least recently used first, so loading in file order restores the LRU order
+static bool save_gzip(FILE *const restrict file, const Gz_Cache restrict cache) {
+	const uint8_t kind = RECORD_GZIP;
+
+	for (Gz_Entry entry = cache->lru_tail; entry; entry = entry->lru_prev) {
+		const int64_t mtime = entry->mtime, size = entry->size;
+
+		if (!entry->data) // Nothing to revive, the file is looked at again
+			continue;
+
+		if ((fwrite(&kind, sizeof(kind), 1, file) != 1) || (fwrite(&mtime, sizeof(mtime), 1, file) != 1)
+		    || (fwrite(&size, sizeof(size), 1, file) != 1) || !write_block(file, entry->path, strnlen(entry->path, STR_MAX))
+		    || !write_block(file, entry->data, entry->data_len))
+			return false;
+	}
+
+	return true;
+}
+
+// Writes the ready micro-cache entries and the gzip cache to path. The file
+// is written next to it and renamed into place, so a reader never sees a
+// partial snapshot. Either cache may be NULL.
+bool snapshot_save(const String restrict path, const Micro_Cache restrict microcache, const Gz_Cache restrict gz_cache) {
+	const snapshot_header_t header = {SNAPSHOT_MAGIC, SNAPSHOT_VERSION};
+	const uint8_t end = RECORD_END;
+	char tmp_path[PATH_MAX + NT_LEN];
+
+	if (snprintf(tmp_path, sizeof(tmp_path), "%s" TMP_EXT, path) >= (int) sizeof(tmp_path))
+		return false;
+
+	FILE *const file = fopen(tmp_path, "wbe");
+
+	if (!file)
+		return false;
+
+	const bool written = (fwrite(&header, sizeof(header), 1, file) == 1)
+			     && (!microcache || save_microcache(file, microcache))
+			     && (!gz_cache || save_gzip(file, gz_cache))
+			     && (fwrite(&end, sizeof(end), 1, file) == 1);
+
+	if ((fclose(file) != 0) || !written || (rename(tmp_path, path) == -1)) {
+		remove(tmp_path);
+		return false;
+	}
+
+	return true;
+}
+
+static bool load_microcache(FILE *const restrict file, const Micro_Cache restrict cache) {
+	int64_t expires;
+	uint64_t key_len, body_len;
+
+	if (fread(&expires, sizeof(expires), 1, file) != 1)
+		return false;
+
+	Byte *const key = read_block(file, &key_len, STR_MAX);
+	Byte *const body = key ? read_block(file, &body_len, BLOCK_MAX) : NULL;
+	const time_t ttl = expires - time(NULL);
+
+	if (body && cache && (ttl > 0) && !mc_find(cache, (String) key)) {
+		const Mc_Entry entry = mc_begin_fill(cache, (String) key);
+
+		mc_append(entry, body, body_len);
+		mc_finish_fill(cache, entry, (unsigned int) ttl);
+	}
+	free(key);
+	free(body);
+
+	return body != NULL;
+}
+
+static bool load_gzip(FILE *const restrict file, const Gz_Cache restrict cache) {
+	int64_t mtime, size;
+	uint64_t path_len, data_len;
+
+	if ((fread(&mtime, sizeof(mtime), 1, file) != 1) || (fread(&size, sizeof(size), 1, file) != 1))
+		return false;
+
+	Byte *const path = read_block(file, &path_len, STR_MAX);
+	Byte *const data = path ? read_block(file, &data_len, BLOCK_MAX) : NULL;
+
+	if (data && cache)
+		gz_cache_put(cache, (String) path, mtime, size, data, data_len);
+	else
+		free(data);
+	free(path);
+
+	return path && data;
+}
+
+// Fills the caches from the snapshot at path, skipping records for a cache
+// that is NULL. Returns the number of records read, -1 when there is no
+// usable snapshot; records read before a damaged one are kept.
+int snapshot_load(const String restrict path, const Micro_Cache restrict microcache, const Gz_Cache restrict gz_cache) {
+	snapshot_header_t header;
+	uint8_t kind;
+	int records = 0;
+	FILE *const file = fopen(path, "rbe");
+
+	if (!file)
+		return -1;
+
+	if ((fread(&header, sizeof(header), 1, file) != 1) || (header.magic != SNAPSHOT_MAGIC)
+	    || (header.version != SNAPSHOT_VERSION)) {
+		fclose(file);
+		return -1;
+	}
+
+	while ((fread(&kind, sizeof(kind), 1, file) == 1) && (kind != RECORD_END)) {
+		if (!(((kind == RECORD_MICROCACHE) && load_microcache(file, microcache))
+		      || ((kind == RECORD_GZIP) && load_gzip(file, gz_cache))))
+			break;
+		records++;
+	}
+	fclose(file);
+
+	return records;
+}
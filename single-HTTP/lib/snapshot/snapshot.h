@@ -0,0 +1,13 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdbool.h>
+
+#include "../types/types.h"
+#include "../compress/compress.h"
+#include "../microcache/microcache.h"
+
+extern bool snapshot_save(const String, Micro_Cache const, Gz_Cache const);
+extern int snapshot_load(const String, Micro_Cache const, Gz_Cache const);
+
+#endif /* End SNAPSHOT_H */
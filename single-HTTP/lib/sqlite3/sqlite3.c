@@ -1,22 +1,36 @@
+#include <ctype.h>
 #include <errno.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <stdbool.h>
 #include <strings.h>
+#include <pthread.h>
 #include <sqlite3.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/eventfd.h>
 
 #include "../../globals.h"
 #include "../types/types.h"
 #include "../colors/colors.h"
+#include "../stats/stats.h"
+#include "sqlite3.h"
 
 #include "../../debug.h"
 
 #define ALL_TABLES -1
+#define SPECIFIERS_MAX 63
+#define QC_BINS 1024
+#define QC_PENDING 16 // Modified tables remembered before the whole cache is dropped
+#define QC_NAME_LEN 128
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+#define PROGRESS_OPS 1000 // Virtual machine instructions between deadline checks
+#define BUSY_WAIT_US 1000
 
 typedef struct query_s {
     String stmt, specifiers;
@@ -49,21 +63,20 @@ static Query parse_stmt(const String restrict stmt) {
 
     // const size_t result_len = strnlen(result, KBYTE_S * 2);
 
-    query->stmt = (String) calloc(2048, sizeof(char));
+    query->stmt = (String) calloc((KBYTE_S * 2) + NT_LEN, sizeof(char));
 
     if (!query->stmt)
         exit(EXIT_FAILURE);
-    strncpy(query->stmt, result, KBYTE_S * 2);
-    // (KBYTE_S * 2) + NT_LEN
-    query->specifiers = (String) calloc(64, sizeof(char));
+    snprintf(query->stmt, (KBYTE_S * 2) + NT_LEN, "%s", result);
+    query->specifiers = (String) calloc(SPECIFIERS_MAX + NT_LEN, sizeof(char));
 
     if (!query->specifiers)
         exit(EXIT_FAILURE);
 
     if (specifiers[0] != '\0') {
         query->is_parameterized = true;
-        query->specifiers_len = strnlen(specifiers, 63);
-        strncpy(query->specifiers, specifiers, 63);
+        query->specifiers_len = strnlen(specifiers, SPECIFIERS_MAX);
+        snprintf(query->specifiers, SPECIFIERS_MAX + NT_LEN, "%s", specifiers);
         return query;
     }
     query->is_parameterized = false;
@@ -72,6 +85,98 @@ static Query parse_stmt(const String restrict stmt) {
     return query;
 }
 
+// One bound parameter, kept so it can be both hashed into the cache key and
+// bound to the statement
+typedef struct sql_param_s {
+    char spec;
+    int i;
+    double f;
+    String s;
+    size_t len;
+} sql_param_t;
+
+// Result cache of the shared connection. Entries are keyed by the normalized
+// statement and its bound parameters and hold the row set serialized in one
+// block, so a hit is a hash lookup and a memcpy(). Each entry remembers the
+// tables its statement read, as reported by the authorizer while it was
+// prepared; the update hook and the authorizer of writing statements collect
+// the tables modified since, and entries that read one of them are dropped
+// before the next lookup.
+typedef struct qc_entry_s {
+    Byte *key;
+    size_t key_len, bytes;
+    uint64_t hash;
+    Sql_Rows rows;
+    String tables; // NUL terminated names, an empty name ends them
+    struct qc_entry_s *next, *newer, *older;
+} qc_entry_t;
+
+typedef qc_entry_t *Qc_Entry;
+
+static struct query_cache_s {
+    Qc_Entry bins[QC_BINS];
+    Qc_Entry newest, oldest;
+    size_t max_bytes, cur_bytes;
+    char pending[QC_PENDING][QC_NAME_LEN];
+    unsigned int pending_cnt;
+    bool pending_all;
+    uint64_t generation; // Counts the writes applied, a result read across one is not cached
+} _cache;
+
+// Tables a statement touched, gathered by the hooks of the connection that
+// runs it. Reads are taken while it is prepared for the cache, writes are
+// applied to the cache by the event loop once the statement is done.
+typedef struct sql_access_s {
+    char reads[KBYTE_S], writes[KBYTE_S];
+    size_t reads_len, writes_len;
+    bool collecting, reads_overflow, writes_overflow;
+} sql_access_t;
+
+// A connection and what its hooks report to. Writes are held in txn until
+// their transaction commits.
+typedef struct sql_conn_s {
+    sqlite3 *db;
+    sql_access_t *access;
+    uint64_t deadline_ms; // Monotonic clock, 0 for none
+    sql_access_t txn;
+} sql_conn_t;
+
+// A query submitted to the executor, with copies of its parameters
+typedef struct sql_job_s {
+    String stmt, arena;
+    sql_param_t params[SPECIFIERS_MAX];
+    unsigned int param_cnt;
+    Byte *key; // Set when the result may be cached
+    size_t key_len;
+    uint64_t hash, generation, deadline_ms;
+    sql_callback_t callback;
+    void *context;
+    Sql_Rows rows;
+    int status;
+    bool readonly;
+    sql_access_t access;
+    struct sql_job_s *next;
+} sql_job_t;
+
+typedef struct sql_worker_s {
+    pthread_t thread;
+    sql_conn_t conn;
+    Sql_Executor executor;
+} sql_worker_t;
+
+struct sql_executor_s {
+    sql_worker_t *workers;
+    unsigned int worker_cnt;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    sql_job_t *queued, *queued_tail, *done, *done_tail;
+    int event_fd;
+    bool stopping;
+};
+
+static sql_access_t _access;
+static sql_conn_t _shared = {.access = &_access};
+
 static void destroy_query(Query query) {
     free(query->stmt);
     query->stmt = NULL;
@@ -84,107 +189,936 @@ static void destroy_query(Query query) {
     return;
 }
 
-static void print_headers(const int rows, sqlite3_stmt *sql_byte_code) {
-    sqlite3_step(sql_byte_code);
-    printf("| %s |", sqlite3_column_name(sql_byte_code, 0));
+static void print_value(const String restrict value) {
+    printf(" %s |", value ? value : "NULL");
+}
 
-    for (int i = 1; i < rows; i++)
-        printf(" %s |", sqlite3_column_name(sql_byte_code, i));
+static void print_rows(const Sql_Rows restrict rows) {
+    printf("|");
+    for (unsigned int i = 0; i < rows->cols; i++)
+        print_value((String) sql_rows_name(rows, i));
     printf("\n");
+
+    for (unsigned int row = 0; row < rows->rows; row++) {
+        printf("|");
+        for (unsigned int i = 0; i < rows->cols; i++)
+            print_value((String) sql_rows_value(rows, row, i, NULL));
+        printf("\n");
+    }
+}
+
+static void mark_modified(const char *restrict table) {
+    if (!_cache.max_bytes || _cache.pending_all)
+        return;
+
+    for (unsigned int i = 0; i < _cache.pending_cnt; i++)
+        if (strcmp(_cache.pending[i], table) == 0)
+            return;
+
+    if ((_cache.pending_cnt == QC_PENDING) || (strlen(table) >= QC_NAME_LEN)) {
+        _cache.pending_all = true;
+        return;
+    }
+    strcpy(_cache.pending[_cache.pending_cnt++], table);
+}
+
+// Adds a name to a list of NUL terminated names, false once it is full
+static bool add_name(char *restrict names, size_t *restrict len, const char *restrict name) {
+    const size_t name_len = strlen(name) + NT_LEN;
+
+    for (size_t pos = 0; pos < *len; pos += strlen(names + pos) + NT_LEN)
+        if (strcmp(names + pos, name) == 0)
+            return true;
+
+    if (*len + name_len >= KBYTE_S)
+        return false;
+    memcpy(names + *len, name, name_len);
+    *len += name_len;
+
+    return true;
 }
 
-static void print_rows(const int rows, sqlite3_stmt *sql_byte_code) {
-    int result;
-    const char *row_value;
+static void reset_access(sql_access_t *const restrict access) {
+    access->reads_len = access->writes_len = 0;
+    access->collecting = access->reads_overflow = access->writes_overflow = false;
+}
 
-    do {
-        row_value = (char*) sqlite3_column_text(sql_byte_code, 0);
+static void add_write(sql_access_t *const restrict access, const char *restrict table) {
+    if (!add_name(access->writes, &access->writes_len, table))
+        access->writes_overflow = true; // Drops the whole cache
+}
 
-        printf("| %s |", row_value ? row_value: "NULL");
+// Marks the tables a finished statement wrote, on the thread of the cache
+static void apply_writes(const sql_access_t *const restrict access) {
+    if (!access->writes_len && !access->writes_overflow)
+        return;
+
+    _cache.generation++;
+    if (access->writes_overflow)
+        _cache.pending_all = true;
+    for (size_t pos = 0; pos < access->writes_len; pos += strlen(access->writes + pos) + NT_LEN)
+        mark_modified(access->writes + pos);
+}
+
+static void on_update(void *context, const int op, const char *db_name, const char *table, const sqlite3_int64 rowid) {
+    add_write(&((sql_conn_t*) context)->txn, table);
+}
 
-        for (int i = 1; i < rows; i++) {
-            row_value = (char*) sqlite3_column_text(sql_byte_code, i);
+// Sees every table a statement touches while it is prepared. Writes the update
+// hook misses are recorded here: WITHOUT ROWID tables, the truncate
+// optimization of an unqualified DELETE and schema changes.
+static int on_authorize(void *context, const int action, const char *arg1, const char *arg2, const char *db_name,
+                        const char *trigger) {
+    sql_conn_t *const conn = (sql_conn_t*) context;
+    sql_access_t *const access = conn->access;
+
+    switch (action) {
+    case SQLITE_READ:
+        if (access->collecting && arg1 && !add_name(access->reads, &access->reads_len, arg1))
+            access->reads_overflow = true; // Too many to track, the result is not cached
+        break;
+    case SQLITE_INSERT:
+    case SQLITE_UPDATE:
+    case SQLITE_DELETE:
+    case SQLITE_DROP_TABLE:
+        if (arg1)
+            add_write(&conn->txn, arg1);
+        break;
+    case SQLITE_ALTER_TABLE:
+        if (arg2)
+            add_write(&conn->txn, arg2);
+        break;
+    }
+
+    return SQLITE_OK;
+}
+
+// Hands the writes of a committing transaction to the statement that commits
+// it, so other connections cannot cache what they read before the commit. They
+// are kept until the transaction has ended, a COMMIT that fails leaves it open.
+static int on_commit(void *context) {
+    sql_conn_t *const conn = (sql_conn_t*) context;
+
+    if (conn->txn.writes_overflow)
+        conn->access->writes_overflow = true;
+    for (size_t pos = 0; pos < conn->txn.writes_len; pos += strlen(conn->txn.writes + pos) + NT_LEN)
+        add_write(conn->access, conn->txn.writes + pos);
+
+    return 0;
+}
 
-            printf(" %s |", row_value ? row_value: "NULL");
+static void on_rollback(void *context) {
+    reset_access(&((sql_conn_t*) context)->txn);
+}
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static bool past_deadline(const sql_conn_t *const restrict conn) {
+    return conn->deadline_ms && (now_ms() >= conn->deadline_ms);
+}
+
+// Interrupts a statement that runs past the deadline of its query
+static int on_progress(void *context) {
+    return past_deadline((sql_conn_t*) context);
+}
+
+// Waits on a locked database until the deadline, instead of failing at once
+static int on_busy(void *context, const int count) {
+    if (past_deadline((sql_conn_t*) context))
+        return 0;
+    usleep(BUSY_WAIT_US);
+
+    return 1;
+}
+
+static void open_conn(sql_conn_t *const restrict conn) {
+    if (sqlite3_open(_db_path, &conn->db) != SQLITE_OK) {
+        fprintf(stderr, RED "Database Error: Cannot open database: %s\n" RESET, sqlite3_errmsg(conn->db));
+        exit(EXIT_FAILURE);
+    }
+    sqlite3_update_hook(conn->db, on_update, conn);
+    sqlite3_set_authorizer(conn->db, on_authorize, conn);
+    sqlite3_commit_hook(conn->db, on_commit, conn);
+    sqlite3_rollback_hook(conn->db, on_rollback, conn);
+}
+
+// The connection every synchronous query of the server shares, opened on first
+// use
+static sqlite3 *shared_db(void) {
+    if (!_shared.db)
+        open_conn(&_shared);
+
+    return _shared.db;
+}
+
+static uint64_t get_hash(const Byte *restrict key, const size_t len) {
+    uint64_t result = FNV_OFFSET;
+
+    for (size_t i = 0; i < len; i++)
+        result = (result ^ key[i]) * FNV_PRIME;
+
+    return result;
+}
+
+static void append_key(Byte *restrict key, size_t *restrict len, const void *restrict data, const size_t data_len) {
+    memcpy(key + *len, data, data_len);
+    *len += data_len;
+}
+
+// The statement with whitespace collapsed and keywords and identifiers folded
+// to lower case outside of quotes, followed by the parameters as bound
+static Byte *build_key(const String restrict stmt, const sql_param_t *restrict params, const unsigned int param_cnt,
+                       size_t *restrict len) {
+    size_t key_len = strlen(stmt) + NT_LEN;
+    char quote = '\0';
+
+    for (unsigned int i = 0; i < param_cnt; i++)
+        key_len += sizeof(char) + sizeof(size_t) + sizeof(double) + params[i].len;
+
+    Byte *const key = (Byte*) malloc(key_len);
+    if (!key)
+        exit(EXIT_FAILURE);
+
+    *len = 0;
+    for (const char *c = stmt; *c; c++) {
+        if (quote) {
+            if (*c == quote)
+                quote = '\0';
+            key[(*len)++] = *c;
+        } else if (isspace((unsigned char) *c)) {
+            if (*len && (key[*len - 1] != ' '))
+                key[(*len)++] = ' ';
+        } else {
+            if ((*c == '\'') || (*c == '"') || (*c == '`'))
+                quote = *c;
+            key[(*len)++] = tolower((unsigned char) *c);
         }
-        printf("\n");
-        result = sqlite3_step(sql_byte_code);
+    }
+    while (*len && ((key[*len - 1] == ' ') || (key[*len - 1] == ';')))
+        (*len)--;
+    key[(*len)++] = '\0';
+
+    for (unsigned int i = 0; i < param_cnt; i++) {
+        append_key(key, len, &params[i].spec, sizeof(char));
+
+        switch (params[i].spec) {
+        case 'd':
+            append_key(key, len, &params[i].i, sizeof(int));
+            break;
+        case 'f':
+            append_key(key, len, &params[i].f, sizeof(double));
+            break;
+        default:
+            append_key(key, len, &params[i].len, sizeof(size_t));
+            append_key(key, len, params[i].s, params[i].len);
+        }
+    }
 
-    } while(result == SQLITE_ROW);
+    return key;
 }
 
-int sqlite_exec(const String restrict stmt, ...) {
-    sqlite3 *db;
-    sqlite3_stmt *sql_byte_code;
-    int result_code = sqlite3_open(_db_path, &db);
+static void unlink_lru(const Qc_Entry restrict entry) {
+    if (entry->newer)
+        entry->newer->older = entry->older;
+    else
+        _cache.newest = entry->older;
+    if (entry->older)
+        entry->older->newer = entry->newer;
+    else
+        _cache.oldest = entry->newer;
+}
 
-    if (result_code != SQLITE_OK) {
-        fprintf(stderr, RED "Database Error: Cannot open database: %s\n" RESET, sqlite3_errmsg(db));
+static void destroy_entry(Qc_Entry entry) {
+    Qc_Entry *link = &_cache.bins[entry->hash % QC_BINS];
+
+    while (*link != entry)
+        link = &(*link)->next;
+    *link = entry->next;
+    unlink_lru(entry);
+    _cache.cur_bytes -= entry->bytes;
+
+    free(entry->key);
+    free(entry->rows);
+    free(entry->tables);
+    free(entry);
+    entry = NULL;
+}
+
+static void push_newest(const Qc_Entry restrict entry) {
+    entry->older = _cache.newest;
+    entry->newer = NULL;
+    if (_cache.newest)
+        _cache.newest->newer = entry;
+    _cache.newest = entry;
+    if (!_cache.oldest)
+        _cache.oldest = entry;
+}
+
+static bool reads_table(const Qc_Entry restrict entry, const String restrict table) {
+    for (String name = entry->tables; *name; name += strlen(name) + NT_LEN)
+        if (strcmp(name, table) == 0)
+            return true;
+
+    return false;
+}
+
+// Drops the entries that read a table modified since the last lookup
+static void flush_modified(void) {
+    if (!_cache.pending_cnt && !_cache.pending_all)
+        return;
+
+    for (Qc_Entry entry = _cache.oldest, newer; entry; entry = newer) {
+        bool stale = _cache.pending_all;
+
+        newer = entry->newer;
+        for (unsigned int i = 0; !stale && (i < _cache.pending_cnt); i++)
+            stale = reads_table(entry, _cache.pending[i]);
+        if (stale)
+            destroy_entry(entry);
+    }
+    _cache.pending_cnt = 0;
+    _cache.pending_all = false;
+}
+
+static Qc_Entry find_entry(const Byte *restrict key, const size_t len, const uint64_t hash) {
+    for (Qc_Entry entry = _cache.bins[hash % QC_BINS]; entry; entry = entry->next)
+        if ((entry->hash == hash) && (entry->key_len == len) && (memcmp(entry->key, key, len) == 0))
+            return entry;
+
+    return NULL;
+}
+
+static Sql_Rows copy_rows(const Sql_Rows restrict rows) {
+    const Sql_Rows copy = (Sql_Rows) malloc(rows->size);
+    if (!copy)
         exit(EXIT_FAILURE);
+
+    memcpy(copy, rows, rows->size);
+
+    return copy;
+}
+
+// Takes ownership of key, the cache keeps its own copy of the rows
+static void insert_entry(Byte *restrict key, const size_t len, const uint64_t hash, const Sql_Rows restrict rows,
+                         const sql_access_t *const restrict access) {
+    const size_t bytes = sizeof(qc_entry_t) + len + rows->size + access->reads_len + NT_LEN;
+
+    if (bytes > _cache.max_bytes) {
+        free(key);
+        return;
     }
-    const Query restrict query = parse_stmt(stmt);
-    result_code = sqlite3_prepare_v2(db, query->stmt, KBYTE_S * 2, &sql_byte_code, NULL);
 
-    if (result_code != SQLITE_OK) {
+    while (_cache.cur_bytes + bytes > _cache.max_bytes)
+        destroy_entry(_cache.oldest);
+
+    const Qc_Entry entry = (Qc_Entry) calloc(1, sizeof(qc_entry_t));
+    if (!entry)
+        exit(EXIT_FAILURE);
+
+    entry->tables = (String) malloc(access->reads_len + NT_LEN);
+    if (!entry->tables)
+        exit(EXIT_FAILURE);
+
+    memcpy(entry->tables, access->reads, access->reads_len);
+    entry->tables[access->reads_len] = '\0';
+    entry->key = key;
+    entry->key_len = len;
+    entry->hash = hash;
+    entry->bytes = bytes;
+    entry->rows = copy_rows(rows);
+    entry->next = _cache.bins[hash % QC_BINS];
+    _cache.bins[hash % QC_BINS] = entry;
+    _cache.cur_bytes += bytes;
+    push_newest(entry);
+}
+
+static void append_cell(Byte **restrict data, size_t *restrict len, size_t *restrict cap, const void *restrict value,
+                        const size_t value_len) {
+    const size_t need = sizeof(size_t) + value_len + NT_LEN;
+
+    if (*len + need > *cap) {
+        *cap = (*len + need) * 2;
+        *data = (Byte*) realloc(*data, *cap);
+        if (!*data)
+            exit(EXIT_FAILURE);
+    }
+    memcpy(*data + *len, &value_len, sizeof(size_t));
+    memcpy(*data + *len + sizeof(size_t), value, value_len);
+    (*data)[*len + sizeof(size_t) + value_len] = '\0';
+    *len += need;
+}
+
+// Steps through the statement and serializes what it returns into one block:
+// the header, the offsets of the column names and of every value, then the
+// cells themselves, each its length followed by its octets and a NUL
+static Sql_Rows collect_rows(sqlite3 *restrict db, sqlite3_stmt *restrict sql_byte_code, int *restrict status) {
+    const unsigned int cols = sqlite3_column_count(sql_byte_code);
+    size_t cell_cnt = 0, cell_cap = cols * 2, data_len = 0, data_cap = KBYTE_S;
+    size_t *cells = (size_t*) malloc(((cell_cap > 0) ? cell_cap : 1) * sizeof(size_t));
+    Byte *data = (Byte*) malloc(data_cap);
+    unsigned int rows = 0;
+    int result_code;
+
+    if (!cells || !data)
+        exit(EXIT_FAILURE);
+
+    for (unsigned int i = 0; i < cols; i++) {
+        const char *name = sqlite3_column_name(sql_byte_code, i);
+
+        cells[cell_cnt++] = data_len;
+        append_cell(&data, &data_len, &data_cap, name, strlen(name));
+    }
+
+    while ((result_code = sqlite3_step(sql_byte_code)) == SQLITE_ROW) {
+        if (cell_cnt + cols > cell_cap) {
+            cell_cap = (cell_cnt + cols) * 2;
+            cells = (size_t*) realloc(cells, cell_cap * sizeof(size_t));
+            if (!cells)
+                exit(EXIT_FAILURE);
+        }
+
+        for (unsigned int i = 0; i < cols; i++) {
+            const int type = sqlite3_column_type(sql_byte_code, i);
+            const void *value = (type == SQLITE_BLOB) ? sqlite3_column_blob(sql_byte_code, i)
+                                                      : (const void*) sqlite3_column_text(sql_byte_code, i);
+
+            if (type == SQLITE_NULL) {
+                cells[cell_cnt++] = SIZE_MAX;
+                continue;
+            }
+            cells[cell_cnt++] = data_len;
+            append_cell(&data, &data_len, &data_cap, value, sqlite3_column_bytes(sql_byte_code, i));
+        }
+        rows++;
+    }
+
+    if (result_code != SQLITE_DONE) {
         if (verbose_flag)
             fprintf(stderr, YELLOW "SQL error: %s\n" RESET, sqlite3_errmsg(db));
+        free(cells);
+        free(data);
+        *status = result_code;
+        return NULL;
+    }
+    *status = SQLITE_OK;
+
+    const size_t head = sizeof(sql_rows_t) + cell_cnt * sizeof(size_t);
+    const Sql_Rows result = (Sql_Rows) malloc(head + data_len);
+    if (!result)
+        exit(EXIT_FAILURE);
+
+    result->size = head + data_len;
+    result->rows = rows;
+    result->cols = cols;
+    for (size_t i = 0; i < cell_cnt; i++)
+        result->cells[i] = (cells[i] == SIZE_MAX) ? 0 : head + cells[i];
+    memcpy((Byte*) result + head, data, data_len);
+    free(cells);
+    free(data);
+
+    return result;
+}
+
+static void bind_params(sqlite3_stmt *restrict sql_byte_code, const sql_param_t *restrict params,
+                        const unsigned int param_cnt) {
+    for (unsigned int i = 0; i < param_cnt; i++) {
+        switch (params[i].spec) {
+        case 'd':
+            sqlite3_bind_int(sql_byte_code, i + 1, params[i].i);
+            continue;
+        case 's':
+            sqlite3_bind_text(sql_byte_code, i + 1, params[i].s, params[i].len, SQLITE_STATIC);
+            continue;
+        case 'f':
+            sqlite3_bind_double(sql_byte_code, i + 1, params[i].f);
+            continue;
+        case 'b':
+            sqlite3_bind_blob(sql_byte_code, i + 1, params[i].s, params[i].len, SQLITE_STATIC);
+            continue;
+        }
+    }
+}
+
+static unsigned int read_params(const Query restrict query, sql_param_t *restrict params, va_list args) {
+    struct stat file;
+    unsigned int param_cnt = 0;
+
+    for (unsigned short i = 0; query->is_parameterized && (i < query->specifiers_len); i++) {
+        sql_param_t *const param = &params[param_cnt++];
+
+        memset(param, 0, sizeof(sql_param_t));
+        param->spec = query->specifiers[i];
+
+        switch (param->spec) {
+        case 'd':
+            param->i = va_arg(args, int);
+            continue;
+        case 's':
+            param->s = va_arg(args, char*);
+            param->len = strnlen(param->s, PATH_MAX);
+            continue;
+        case 'f':
+            param->f = va_arg(args, double);
+            continue;
+        case 'b':
+            param->s = va_arg(args, char*);
+            param->len = (stat(param->s, &file) == 0) ? (size_t) file.st_size : 0;
+            continue;
+        default:
+            param_cnt--;
+        }
+    }
+
+    return param_cnt;
+}
+
+// Prepares and steps a statement on a connection, whose hooks record the
+// tables it touches and the writes it committed. Only a statement that began
+// and ended outside a transaction counts as read-only for the cache: inside
+// one the rows may hold writes not committed yet, and BEGIN, COMMIT and the
+// like are read-only to SQLite. Returns the rows, NULL with the result code in
+// status.
+static Sql_Rows execute(sql_conn_t *const restrict conn, const String restrict stmt, const sql_param_t *restrict params,
+                        const unsigned int param_cnt, bool *restrict readonly, int *restrict status) {
+    sqlite3_stmt *sql_byte_code;
+
+    reset_access(conn->access);
+    conn->access->collecting = true;
+    *status = sqlite3_prepare_v2(conn->db, stmt, -1, &sql_byte_code, NULL);
+    conn->access->collecting = false;
+
+    if (*status != SQLITE_OK) {
+        if (verbose_flag)
+            fprintf(stderr, YELLOW "SQL error: %s\n" RESET, sqlite3_errmsg(conn->db));
         sqlite3_finalize(sql_byte_code);
-        sqlite3_close(db);
+        if (sqlite3_get_autocommit(conn->db))
+            reset_access(&conn->txn);
+        return NULL;
+    }
+    bind_params(sql_byte_code, params, param_cnt);
+    *readonly = sqlite3_stmt_readonly(sql_byte_code) && sqlite3_get_autocommit(conn->db);
+
+    const Sql_Rows rows = collect_rows(conn->db, sql_byte_code, status);
+
+    sqlite3_finalize(sql_byte_code);
+
+    // Out of any transaction, what is left was never committed
+    if (sqlite3_get_autocommit(conn->db))
+        reset_access(&conn->txn);
+    else
+        *readonly = false;
+
+    return rows;
+}
+
+static bool has_blob(const sql_param_t *restrict params, const unsigned int param_cnt) {
+    for (unsigned int i = 0; i < param_cnt; i++)
+        if (params[i].spec == 'b')
+            return true;
+
+    return false;
+}
+
+// A copy of the cached rows of a statement, NULL on a miss. Sets the key the
+// result is inserted under after a miss, or NULL when the cache is disabled.
+static Sql_Rows lookup(const String restrict stmt, const sql_param_t *restrict params, const unsigned int param_cnt,
+                       Byte **restrict key, size_t *restrict key_len, uint64_t *restrict hash) {
+    *key = NULL;
+
+    // Blobs are bound from files whose contents can change under the same name
+    if (!_cache.max_bytes || has_blob(params, param_cnt))
+        return NULL;
+
+    flush_modified();
+    *key = build_key(stmt, params, param_cnt, key_len);
+    *hash = get_hash(*key, *key_len);
+
+    const Qc_Entry entry = find_entry(*key, *key_len, *hash);
+
+    if (!entry)
+        return NULL;
+
+    _stats.query_hits++;
+    unlink_lru(entry);
+    push_newest(entry);
+    free(*key);
+    *key = NULL;
+
+    return copy_rows(entry->rows);
+}
+
+// Runs a statement on the shared connection. Read-only statements are answered
+// from the result cache when it is enabled and filled on a miss. Returns the
+// rows for the caller to free, NULL on error.
+static Sql_Rows run_query(const String restrict stmt, va_list args) {
+    sql_param_t params[SPECIFIERS_MAX];
+    const Query restrict query = parse_stmt(stmt);
+    const unsigned int param_cnt = read_params(query, params, args);
+    Byte *key;
+    size_t key_len = 0;
+    uint64_t hash = 0;
+    bool readonly = false;
+    int status;
+    Sql_Rows rows = NULL;
+
+    // Inside a transaction the connection sees its own writes, which the cache
+    // learns of at the commit
+    if (!_shared.db || sqlite3_get_autocommit(_shared.db))
+        rows = lookup(query->stmt, params, param_cnt, &key, &key_len, &hash);
+    else
+        key = NULL;
+
+    if (rows) {
+        destroy_query(query);
+        return rows;
+    }
+
+    shared_db();
+    rows = execute(&_shared, query->stmt, params, param_cnt, &readonly, &status);
+    destroy_query(query);
+    apply_writes(&_access);
+
+    const bool cacheable = key && readonly && !_access.reads_overflow;
+
+    if (cacheable)
+        _stats.query_misses++;
+
+    if (rows && cacheable)
+        insert_entry(key, key_len, hash, rows, &_access);
+    else
+        free(key);
+
+    return rows;
+}
+
+Sql_Rows sqlite_query(const String restrict stmt, ...) {
+    va_list args;
+
+    va_start(args, stmt);
+    const Sql_Rows rows = run_query(stmt, args);
+    va_end(args);
+
+    return rows;
+}
+
+const char *sql_rows_name(const Sql_Rows restrict rows, const unsigned int col) {
+    return (const char*) rows + rows->cells[col] + sizeof(size_t);
+}
+
+// The value at row and col, NULL for an SQL NULL. Text is NUL terminated.
+const char *sql_rows_value(const Sql_Rows restrict rows, const unsigned int row, const unsigned int col,
+                           size_t *restrict len) {
+    const size_t offset = rows->cells[rows->cols + (size_t) row * rows->cols + col];
+
+    if (!offset)
+        return NULL;
+    if (len)
+        memcpy(len, (const Byte*) rows + offset, sizeof(size_t));
+
+    return (const char*) rows + offset + sizeof(size_t);
+}
+
+void sql_rows_free(Sql_Rows rows) {
+    free(rows);
+    rows = NULL;
+}
+
+int sqlite_exec(const String restrict stmt, ...) {
+    va_list args;
+
+    va_start(args, stmt);
+    const Sql_Rows rows = run_query(stmt, args);
+    va_end(args);
+
+    if (!rows)
         return -1;
+
+    if (rows->cols)
+        print_rows(rows);
+    else if (verbose_flag)
+        printf("Rows affected: %d\n", sqlite3_changes(_shared.db));
+    sql_rows_free(rows);
+
+    return 0;
+}
+
+void sqlite_cache_init(const size_t max_bytes) {
+    _cache.max_bytes = max_bytes;
+}
+
+void sqlite_close(void) {
+    while (_cache.oldest)
+        destroy_entry(_cache.oldest);
+
+    if (_shared.db) {
+        sqlite3_close(_shared.db);
+        _shared.db = NULL;
     }
+}
 
-    if (query->is_parameterized) {
-        char c;
-        va_list args;
-        struct stat file;
-        String string;
+// Executor of queries for the event loop. Each of its threads owns a
+// connection and takes submitted queries from one queue; completed jobs are
+// put on a done list and announced on an eventfd the loop polls, which then
+// runs their callbacks with sqlite_executor_complete(). The result cache stays
+// with the loop thread: it is looked up on submission, and filled and
+// invalidated on completion. A query with a timeout is interrupted by the
+// progress handler once its deadline passes, and waits on a locked database
+// only until then.
+
+static void push_job(sql_job_t **restrict head, sql_job_t **restrict tail, sql_job_t *restrict job) {
+    job->next = NULL;
+
+    if (*tail)
+        (*tail)->next = job;
+    else
+        *head = job;
+    *tail = job;
+}
 
-        va_start(args, stmt);
+static void finish_job(const Sql_Executor restrict executor, sql_job_t *restrict job) {
+    pthread_mutex_lock(&executor->lock);
+    push_job(&executor->done, &executor->done_tail, job);
+    pthread_mutex_unlock(&executor->lock);
+    eventfd_write(executor->event_fd, 1);
+}
 
-        for (unsigned short i = 0; i < query->specifiers_len; i++) {
-            c = query->specifiers[i];
+static void *run_worker(void *const arg) {
+    sql_worker_t *const worker = (sql_worker_t*) arg;
+    const Sql_Executor executor = worker->executor;
 
-            switch (c) {
-            case 'd':
-                sqlite3_bind_int(sql_byte_code, i + 1, va_arg(args, int));
-                continue;
-            case 's':
-                string = va_arg(args, char*);
+    while (true) {
+        pthread_mutex_lock(&executor->lock);
+        while (!executor->stopping && !executor->queued)
+            pthread_cond_wait(&executor->ready, &executor->lock);
 
-                sqlite3_bind_text(sql_byte_code, i + 1, string, strnlen(string, PATH_MAX), SQLITE_STATIC);
-                continue;
-            case 'f':
-                sqlite3_bind_double(sql_byte_code, i + 1, va_arg(args, double));
-                continue;
-            case 'b':
-                string = va_arg(args, char*);
+        if (executor->stopping) {
+            pthread_mutex_unlock(&executor->lock);
+            break;
+        }
+        sql_job_t *const job = executor->queued;
 
-                stat(string, &file);
-                sqlite3_bind_blob(sql_byte_code, i + 1, string, file.st_size, SQLITE_STATIC);
-                continue;
-            }
+        if (!(executor->queued = job->next))
+            executor->queued_tail = NULL;
+        pthread_mutex_unlock(&executor->lock);
+
+        worker->conn.access = &job->access;
+        worker->conn.deadline_ms = job->deadline_ms;
+
+        if (past_deadline(&worker->conn)) // Expired while it was queued
+            job->status = SQLITE_INTERRUPT;
+        else
+            job->rows = execute(&worker->conn, job->stmt, job->params, job->param_cnt, &job->readonly, &job->status);
+        worker->conn.deadline_ms = 0;
+        finish_job(executor, job);
+    }
+
+    return NULL;
+}
+
+// Starts threads workers, each on a connection of its own
+Sql_Executor sqlite_executor_create(const unsigned int threads) {
+    const Sql_Executor executor = (Sql_Executor) calloc(1, sizeof(struct sql_executor_s));
+    if (!executor)
+        exit(EXIT_FAILURE);
+
+    executor->workers = (sql_worker_t*) calloc(threads, sizeof(sql_worker_t));
+    if (!executor->workers)
+        exit(EXIT_FAILURE);
+
+    executor->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (executor->event_fd == -1) {
+        free(executor->workers);
+        free(executor);
+        return NULL;
+    }
+    pthread_mutex_init(&executor->lock, NULL);
+    pthread_cond_init(&executor->ready, NULL);
+
+    for (unsigned int i = 0; i < threads; i++) {
+        sql_worker_t *const worker = &executor->workers[i];
+
+        // Opened here so sqlite_executor_destroy() can always interrupt it
+        open_conn(&worker->conn);
+        sqlite3_progress_handler(worker->conn.db, PROGRESS_OPS, on_progress, &worker->conn);
+        sqlite3_busy_handler(worker->conn.db, on_busy, &worker->conn);
+        worker->executor = executor;
+
+        if (pthread_create(&worker->thread, NULL, run_worker, worker) != 0) {
+            sqlite3_close(worker->conn.db);
+            break;
         }
-        va_end(args);
+        executor->worker_cnt++;
+    }
+
+    if (!executor->worker_cnt) {
+        sqlite_executor_destroy(executor);
+        return NULL;
+    }
+
+    return executor;
+}
+
+// Stops the workers, interrupting the queries they run. Queries that were
+// still queued complete with SQLITE_ABORT.
+void sqlite_executor_destroy(Sql_Executor executor) {
+    pthread_mutex_lock(&executor->lock);
+    executor->stopping = true;
+    pthread_cond_broadcast(&executor->ready);
+    pthread_mutex_unlock(&executor->lock);
+
+    for (unsigned int i = 0; i < executor->worker_cnt; i++)
+        sqlite3_interrupt(executor->workers[i].conn.db);
+
+    for (unsigned int i = 0; i < executor->worker_cnt; i++) {
+        pthread_join(executor->workers[i].thread, NULL);
+        sqlite3_close(executor->workers[i].conn.db);
+    }
+
+    while (executor->queued) {
+        sql_job_t *const job = executor->queued;
+
+        executor->queued = job->next;
+        job->status = SQLITE_ABORT;
+        push_job(&executor->done, &executor->done_tail, job);
     }
+    sqlite_executor_complete(executor);
+
+    pthread_mutex_destroy(&executor->lock);
+    pthread_cond_destroy(&executor->ready);
+    close(executor->event_fd);
+    free(executor->workers);
+    free(executor);
+    executor = NULL;
+}
+
+// Readable when completed queries wait for sqlite_executor_complete()
+int sqlite_executor_fd(const Sql_Executor restrict executor) {
+    return executor->event_fd;
+}
+
+// Copies the string parameters of a job into one block it owns
+static void copy_params(sql_job_t *restrict job) {
+    size_t len = 0, pos = 0;
 
-    if (strncasecmp("SELECT", query->stmt, 6) == 0) {
-        const int rows = sqlite3_column_count(sql_byte_code);
+    for (unsigned int i = 0; i < job->param_cnt; i++)
+        if (job->params[i].spec == 's')
+            len += job->params[i].len + NT_LEN;
+
+    if (!len)
+        return;
+
+    job->arena = (String) malloc(len);
+    if (!job->arena)
+        exit(EXIT_FAILURE);
 
-        print_headers(rows, sql_byte_code);
-        print_rows(rows, sql_byte_code);
-    } else {
-        sqlite3_step(sql_byte_code);
+    for (unsigned int i = 0; i < job->param_cnt; i++) {
+        sql_param_t *const param = &job->params[i];
 
+        if (param->spec != 's')
+            continue;
+        memcpy(job->arena + pos, param->s, param->len);
+        job->arena[pos + param->len] = '\0';
+        param->s = job->arena + pos;
+        pos += param->len + NT_LEN;
+    }
+}
+
+// Queues a statement, formatted like sqlite_exec(), for the executor. A cache
+// hit completes at once, on the next sqlite_executor_complete(). timeout_ms 0
+// lets the query run to its end. Blob parameters, bound from files, are not
+// accepted. Returns false when the query was not queued.
+bool sqlite_submit(const Sql_Executor restrict executor, const uint64_t timeout_ms, sql_callback_t callback,
+                   void *context, const String restrict stmt, ...) {
+    va_list args;
+    const Query restrict query = parse_stmt(stmt);
+    sql_job_t *const job = (sql_job_t*) calloc(1, sizeof(sql_job_t));
+    if (!job)
+        exit(EXIT_FAILURE);
+
+    va_start(args, stmt);
+    job->param_cnt = read_params(query, job->params, args);
+    va_end(args);
+
+    if (has_blob(job->params, job->param_cnt)) {
         if (verbose_flag)
-            printf("Rows affected: %d\n", sqlite3_changes(db));
+            fprintf(stderr, YELLOW "SQL error: blob parameters cannot be submitted\n" RESET);
+        destroy_query(query);
+        free(job);
+        return false;
+    }
+    job->callback = callback;
+    job->context = context;
+    job->rows = lookup(query->stmt, job->params, job->param_cnt, &job->key, &job->key_len, &job->hash);
+
+    if (job->rows) {
+        destroy_query(query);
+        finish_job(executor, job);
+        return true;
     }
+
+    job->stmt = strdup(query->stmt);
+    if (!job->stmt)
+        exit(EXIT_FAILURE);
+
     destroy_query(query);
-    sqlite3_finalize(sql_byte_code);
-    sqlite3_close(db);
+    copy_params(job);
+    job->generation = _cache.generation;
+    job->deadline_ms = timeout_ms ? now_ms() + timeout_ms : 0;
 
-    return 0;
+    pthread_mutex_lock(&executor->lock);
+    push_job(&executor->queued, &executor->queued_tail, job);
+    pthread_cond_signal(&executor->ready);
+    pthread_mutex_unlock(&executor->lock);
+
+    return true;
 }
 
+// Runs the callbacks of the completed queries, on the thread that owns the
+// result cache. Returns how many completed.
+unsigned int sqlite_executor_complete(const Sql_Executor restrict executor) {
+    eventfd_t count;
+    unsigned int completed = 0;
+    sql_job_t *job, *next;
+
+    eventfd_read(executor->event_fd, &count);
+    pthread_mutex_lock(&executor->lock);
+    job = executor->done;
+    executor->done = executor->done_tail = NULL;
+    pthread_mutex_unlock(&executor->lock);
+
+    for (; job; job = next, completed++) {
+        next = job->next;
+        apply_writes(&job->access);
+
+        const bool cacheable = job->key && job->readonly && !job->access.reads_overflow;
+
+        if (cacheable)
+            _stats.query_misses++;
+
+        // A write applied since submission may have landed before or after the read
+        if (job->rows && cacheable && (job->generation == _cache.generation)) {
+            flush_modified();
+            insert_entry(job->key, job->key_len, job->hash, job->rows, &job->access);
+        } else
+            free(job->key);
+
+        if (job->callback)
+            job->callback(job->context, job->rows, job->status);
+        else
+            sql_rows_free(job->rows);
+        free(job->stmt);
+        free(job->arena);
+        free(job);
+    }
+
+    return completed;
+}
 
 void sqlite_load_exec(const String restrict filepath) {
     sqlite3 *db;
@@ -1,13 +1,43 @@
-#ifndef SQLITE3_H
-#define SQLITE3_H
+#ifndef SQLITE3_LIB_H // SQLITE3_H is the guard of <sqlite3.h>
+#define SQLITE3_LIB_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
 
 #include "../types/types.h"
 
+// Rows returned by a query, serialized into one self-contained block
+typedef struct sql_rows_s {
+    size_t size; // Octets of the whole block
+    unsigned int rows, cols;
+    size_t cells[]; // Offsets of the column names, then of the values row by row, 0 for NULL
+} sql_rows_t;
+
+typedef sql_rows_t *Sql_Rows;
+
+// Runs on the event loop with the rows of a submitted query, which it owns, or
+// NULL and the SQLite result code of the failure
+typedef void (*sql_callback_t)(void *, Sql_Rows, const int);
+
+typedef struct sql_executor_s *Sql_Executor;
+
 extern int sqlite_exec(const String restrict, ...);
+extern Sql_Rows sqlite_query(const String restrict, ...);
+extern const char *sql_rows_name(const Sql_Rows restrict, const unsigned int);
+extern const char *sql_rows_value(const Sql_Rows restrict, const unsigned int, const unsigned int, size_t *restrict);
+extern void sql_rows_free(Sql_Rows);
+extern void sqlite_cache_init(const size_t);
+extern void sqlite_close(void);
+extern Sql_Executor sqlite_executor_create(const unsigned int);
+extern void sqlite_executor_destroy(Sql_Executor);
+extern int sqlite_executor_fd(const Sql_Executor restrict);
+extern bool sqlite_submit(const Sql_Executor restrict, const uint64_t, sql_callback_t, void *, const String restrict, ...);
+extern unsigned int sqlite_executor_complete(const Sql_Executor restrict);
 extern void sqlite_load_fixture(const String restrict);
 extern void sqlite_dumpdb(void);
 extern void sqlite_dumptable(const String restrict);
 extern void sqlite_load_exec(const String restrict);
 extern String sqlite_get_version(void);
 
-#endif /* End SQLITE3_H */
+#endif /* End SQLITE3_LIB_H */
@@ -0,0 +1,195 @@
+#include <time.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <strings.h>
+
+#include "static_file.h"
+#include "../http_headers/http_headers.h"
+
+// Validators and byte ranges for static files (RFC 7232 and RFC 7233).
+
+#define STR_MAX 2048
+#define HEADER_VALUE_LEN 1024
+#define HTTP_DATE_FORMAT "%a, %d %b %Y %H:%M:%S GMT"
+
+// Opaque tag built from inode, size and modification time. A weak tag only
+// promises semantic equivalence, so it can not be used to satisfy If-Range.
+void sf_make_etag(const struct stat *const restrict file, String restrict etag, const bool weak) {
+	snprintf(etag, SF_ETAG_LEN, "%s\"%lx-%llx-%llx\"", weak ? "W/" : "",
+	         (unsigned long) file->st_ino, (unsigned long long) file->st_size,
+	         (unsigned long long) file->st_mtime);
+}
+
+void sf_http_date(const time_t time, String restrict date) {
+	struct tm t_data;
+
+	gmtime_r(&time, &t_data);
+	strftime(date, SF_HTTP_DATE_LEN, HTTP_DATE_FORMAT, &t_data);
+}
+
+static bool parse_http_date(const String restrict date, time_t *const restrict time) {
+	struct tm t_data;
+
+	memset(&t_data, 0, sizeof(t_data));
+
+	if (!strptime(date, HTTP_DATE_FORMAT, &t_data))
+		return false;
+	*time = timegm(&t_data);
+
+	return true;
+}
+
+static String skip_weak(String tag) {
+	return (strncmp(tag, "W/", 2) == 0) ? tag + 2 : tag;
+}
+
+// Weak comparison of etag against a comma separated If-None-Match list
+static bool etag_listed(String list, const String restrict etag) {
+	const String opaque = skip_weak(etag);
+	const size_t opaque_len = strnlen(opaque, SF_ETAG_LEN);
+	String save;
+
+	for (String tag = strtok_r(list, ", \t", &save); tag; tag = strtok_r(NULL, ", \t", &save)) {
+		if (tag[0] == '*')
+			return true;
+		tag = skip_weak(tag);
+
+		if ((strnlen(tag, STR_MAX) == opaque_len) && (strncmp(tag, opaque, opaque_len) == 0))
+			return true;
+	}
+
+	return false;
+}
+
+// True when the client already holds the current representation. If-None-Match
+// takes precedence, If-Modified-Since is only evaluated in its absence.
+bool sf_is_not_modified(const String restrict headers, const String restrict etag, const time_t mtime) {
+	char value[HEADER_VALUE_LEN];
+	time_t since;
+
+	if (http_header_get(headers, "If-None-Match", value, HEADER_VALUE_LEN))
+		return etag_listed(value, etag);
+
+	if (http_header_get(headers, "If-Modified-Since", value, HEADER_VALUE_LEN) && parse_http_date(value, &since))
+		return mtime <= since;
+
+	return false;
+}
+
+// If-Range holds a strong validator or a date; on mismatch the Range header is
+// ignored and the whole file is sent.
+bool sf_range_applies(const String restrict headers, const String restrict etag, const time_t mtime) {
+	char value[HEADER_VALUE_LEN];
+	time_t date;
+
+	if (!http_header_get(headers, "If-Range", value, HEADER_VALUE_LEN))
+		return true;
+
+	if (value[0] == '"' || strncmp(value, "W/", 2) == 0)
+		return (etag[0] == '"') && (strncmp(value, etag, SF_ETAG_LEN) == 0);
+
+	return parse_http_date(value, &date) && (date == mtime);
+}
+
+static bool parse_offset(String *const restrict cursor, off_t *const restrict offset) {
+	String end;
+
+	if (!isdigit((unsigned char) **cursor))
+		return false;
+	*offset = (off_t) strtoll(*cursor, &end, 10);
+	*cursor = end;
+
+	return true;
+}
+
+// Sorts ranges by their first byte and merges those that overlap or touch, so
+// a set like "0-,0-,0-" can not multiply the size of the response. Returns the
+// number of ranges left.
+static unsigned int coalesce_ranges(byte_range_t *const restrict ranges, const unsigned int count) {
+	unsigned int merged = 0;
+
+	for (unsigned int i = 1; i < count; i++) { // Insertion sort, count is small
+		const byte_range_t range = ranges[i];
+		unsigned int j = i;
+
+		for (; j && (ranges[j - 1].first > range.first); j--)
+			ranges[j] = ranges[j - 1];
+		ranges[j] = range;
+	}
+
+	for (unsigned int i = 1; i < count; i++) {
+		if (ranges[i].first <= ranges[merged].last + 1) {
+			if (ranges[i].last > ranges[merged].last)
+				ranges[merged].last = ranges[i].last;
+		} else
+			ranges[++merged] = ranges[i];
+	}
+
+	return count ? merged + 1 : 0;
+}
+
+// Parses a "bytes=" range set against a file of size bytes. Returns the number
+// of satisfiable ranges written, coalesced and in ascending order, 0 when the
+// header is malformed or has more ranges than max (the header is then ignored)
+// and SF_UNSATISFIABLE when no range overlaps the file.
+int sf_parse_ranges(const String restrict value, const off_t size, byte_range_t *const restrict ranges, const unsigned int max) {
+	unsigned int count = 0, specs = 0;
+	String cursor = value;
+
+	if (strncasecmp(cursor, "bytes=", 6) != 0)
+		return 0;
+	cursor += 6;
+
+	while (*cursor) {
+		off_t first = 0, last = size - 1;
+
+		while (*cursor == ' ' || *cursor == '\t')
+			cursor++;
+
+		if (*cursor == '-') {
+			off_t suffix;
+
+			cursor++;
+			if (!parse_offset(&cursor, &suffix))
+				return 0;
+			if (suffix > size)
+				suffix = size;
+			first = size - suffix;
+
+			if (suffix == 0)
+				first = size;
+		} else {
+			if (!parse_offset(&cursor, &first) || *cursor++ != '-')
+				return 0;
+			if (isdigit((unsigned char) *cursor)) {
+				if (!parse_offset(&cursor, &last) || last < first)
+					return 0;
+				if (last >= size)
+					last = size - 1;
+			}
+		}
+
+		if (++specs > max)
+			return 0;
+		if (first < size) {
+			ranges[count].first = first;
+			ranges[count].last = last;
+			count++;
+		}
+
+		while (*cursor == ' ' || *cursor == '\t')
+			cursor++;
+		if (*cursor == ',')
+			cursor++;
+		else if (*cursor)
+			return 0;
+	}
+
+	if (specs == 0)
+		return 0;
+
+	return count ? (int) coalesce_ranges(ranges, count) : SF_UNSATISFIABLE;
+}
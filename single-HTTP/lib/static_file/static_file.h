@@ -0,0 +1,25 @@
+#ifndef STATIC_FILE_H
+#define STATIC_FILE_H
+
+#include <time.h>
+#include <stdbool.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "../types/types.h"
+
+#define SF_ETAG_LEN 64
+#define SF_HTTP_DATE_LEN 30
+#define SF_UNSATISFIABLE -1
+
+typedef struct byte_range_s {
+	off_t first, last;
+} byte_range_t;
+
+extern void sf_make_etag(const struct stat *const, String, const bool);
+extern void sf_http_date(const time_t, String);
+extern bool sf_is_not_modified(const String, const String, const time_t);
+extern bool sf_range_applies(const String, const String, const time_t);
+extern int sf_parse_ranges(const String, const off_t, byte_range_t *const, const unsigned int);
+
+#endif /* End STATIC_FILE_H */
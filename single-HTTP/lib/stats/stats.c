@@ -0,0 +1,46 @@
+#include <stdio.h>
+
+#include "../connection/connection.h"
+#include "stats.h"
+
+server_stats_t _stats;
+
+// Plain text body of the status page, one "name value" pair per line. Memory
+// per connection counts its struct and the buffers it holds.
+int stats_render(String restrict buffer, const size_t len) {
+	const unsigned long long conn_bytes = _stats.active * sizeof(connection_t) + _stats.buffer_bytes;
+
+	return snprintf(buffer, len,
+	                "connections_accepted %llu\n"
+	                "connections_active %u\n"
+	                "requests %llu\n"
+	                "keepalive_reuses %llu\n"
+	                "backpressure_pauses %llu\n"
+	                "rate_limited %llu\n"
+	                "shed_static %llu\n"
+	                "shed_dynamic %llu\n"
+	                "h2_connections %llu\n"
+	                "h2_streams %llu\n"
+	                "query_cache_hits %llu\n"
+	                "query_cache_misses %llu\n"
+	                "tls_handshakes %llu\n"
+	                "tls_resumed %llu\n"
+	                "tls_kernel_send %llu\n"
+	                "tls_handshake_failures %llu\n"
+	                "expired_first_byte %llu\n"
+	                "expired_header %llu\n"
+	                "expired_body %llu\n"
+	                "expired_write %llu\n"
+	                "expired_keepalive %llu\n"
+	                "buffer_bytes_in_use %llu\n"
+	                "buffer_bytes_pooled %llu\n"
+	                "connection_struct_bytes %zu\n"
+	                "memory_per_connection %llu\n",
+	                _stats.accepted, _stats.active, _stats.requests, _stats.keepalive_reuses, _stats.backpressure_pauses,
+	                _stats.rate_limited, _stats.shed_static, _stats.shed_dynamic, _stats.h2_connections,
+	                _stats.h2_streams, _stats.query_hits, _stats.query_misses, _stats.tls_handshakes,
+	                _stats.tls_resumed, _stats.tls_kernel_send, _stats.tls_failures, _stats.expired[TIMEOUT_FIRST_BYTE],
+	                _stats.expired[TIMEOUT_HEADER], _stats.expired[TIMEOUT_BODY], _stats.expired[TIMEOUT_WRITE],
+	                _stats.expired[TIMEOUT_KEEPALIVE], _stats.buffer_bytes, _stats.pooled_bytes, sizeof(connection_t),
+	                _stats.active ? conn_bytes / _stats.active : 0);
+}
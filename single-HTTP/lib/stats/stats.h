@@ -0,0 +1,30 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stddef.h>
+
+#include "../types/types.h"
+
+typedef enum timeout_phase_e {
+	TIMEOUT_FIRST_BYTE,
+	TIMEOUT_HEADER,
+	TIMEOUT_BODY,
+	TIMEOUT_WRITE,
+	TIMEOUT_KEEPALIVE,
+	TIMEOUT_PHASES
+} timeout_phase_t;
+
+typedef struct server_stats_s {
+	unsigned long long accepted, requests, keepalive_reuses, backpressure_pauses, rate_limited, shed_static, shed_dynamic,
+	                   h2_connections, h2_streams, query_hits, query_misses,
+	                   tls_handshakes, tls_resumed, tls_kernel_send, tls_failures,
+	                   expired[TIMEOUT_PHASES];
+	unsigned long long buffer_bytes, pooled_bytes; // Pool buffers held by connections, and kept free for reuse
+	unsigned int active;
+} server_stats_t;
+
+extern server_stats_t _stats;
+
+extern int stats_render(String, const size_t);
+
+#endif /* End STATS_H */
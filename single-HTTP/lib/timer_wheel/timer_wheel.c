@@ -0,0 +1,163 @@
+#include <time.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "timer_wheel.h"
+
+// Hierarchical timing wheel (Varghese & Lauck). Level n has TW_SLOTS slots of
+// TW_SLOTS^n ticks each; a timer is hashed into the lowest level whose range
+// covers its distance from the current tick and is cascaded one level down
+// whenever the level below wraps around. Timers are intrusive and doubly
+// linked, so scheduling and cancelling are O(1).
+
+#define SLOT_MASK (TW_SLOTS - 1)
+#define MS_PER_S 1000
+#define NS_PER_MS 1000000
+
+uint64_t tw_now_ms(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((uint64_t) ts.tv_sec * MS_PER_S) + (ts.tv_nsec / NS_PER_MS);
+}
+
+static void link_timer(const Timer_Wheel restrict wheel, const Tw_Timer restrict timer) {
+	const uint64_t delta = timer->expires - wheel->current;
+	unsigned int level = 0;
+
+	while ((level < TW_LEVELS - 1) && (delta >> (TW_SLOT_BITS * (level + 1))))
+		level++;
+
+	// Beyond the range of the top level, park the timer in its furthest slot
+	const uint64_t expires = (delta >> (TW_SLOT_BITS * TW_LEVELS)) ?
+	                         wheel->current + ((uint64_t) SLOT_MASK << (TW_SLOT_BITS * level)) : timer->expires;
+	Tw_Timer *const head = &wheel->slots[level][(expires >> (TW_SLOT_BITS * level)) & SLOT_MASK];
+
+	timer->next = *head;
+	if (*head)
+		(*head)->pprev = &timer->next;
+	*head = timer;
+	timer->pprev = head;
+}
+
+static void unlink_timer(const Tw_Timer restrict timer) {
+	*timer->pprev = timer->next;
+
+	if (timer->next)
+		timer->next->pprev = timer->pprev;
+	timer->next = NULL;
+	timer->pprev = NULL;
+}
+
+static void cascade(const Timer_Wheel restrict wheel, const unsigned int level) {
+	Tw_Timer timer = wheel->slots[level][(wheel->current >> (TW_SLOT_BITS * level)) & SLOT_MASK];
+
+	while (timer) {
+		const Tw_Timer next = timer->next;
+
+		unlink_timer(timer);
+		link_timer(wheel, timer);
+		timer = next;
+	}
+}
+
+Timer_Wheel tw_create(const unsigned int resolution_ms) {
+	if (resolution_ms < 1)
+		return NULL;
+
+	const Timer_Wheel wheel = (Timer_Wheel) calloc(1, sizeof(timer_wheel_t));
+	if (!wheel)
+		exit(EXIT_FAILURE);
+
+	wheel->resolution_ms = resolution_ms;
+	wheel->start_ms = tw_now_ms();
+
+	return wheel;
+}
+
+void tw_destroy(Timer_Wheel wheel) {
+	for (unsigned int level = 0; level < TW_LEVELS; level++)
+		for (unsigned int slot = 0; slot < TW_SLOTS; slot++)
+			while (wheel->slots[level][slot])
+				unlink_timer(wheel->slots[level][slot]);
+
+	free(wheel);
+	wheel = NULL;
+}
+
+void tw_init_timer(const Tw_Timer restrict timer, const Tw_Callback callback, void *const data) {
+	memset(timer, 0, sizeof(tw_timer_t));
+	timer->callback = callback;
+	timer->data = data;
+}
+
+bool tw_pending(const Tw_Timer restrict timer) {
+	return timer->pprev != NULL;
+}
+
+// (Re)arms timer to fire timeout_ms from now, rounded up to whole ticks
+void tw_schedule(const Timer_Wheel restrict wheel, const Tw_Timer restrict timer, const uint64_t timeout_ms) {
+	uint64_t ticks = (timeout_ms + wheel->resolution_ms - 1) / wheel->resolution_ms;
+
+	if (tw_pending(timer))
+		unlink_timer(timer);
+	else if (wheel->active++ == 0)
+		// An empty wheel is not advanced, so catch up before hashing the timer
+		wheel->current = (tw_now_ms() - wheel->start_ms) / wheel->resolution_ms;
+
+	if (ticks < 1)
+		ticks = 1;
+	timer->expires = wheel->current + ticks;
+	link_timer(wheel, timer);
+}
+
+void tw_cancel(const Timer_Wheel restrict wheel, const Tw_Timer restrict timer) {
+	if (!tw_pending(timer))
+		return;
+	unlink_timer(timer);
+	wheel->active--;
+}
+
+// Moves the wheel up to now_ms and runs every timer that expired on the way.
+// Callbacks may schedule or cancel any timer, including their own.
+unsigned int tw_advance(const Timer_Wheel restrict wheel, const uint64_t now_ms) {
+	const uint64_t target = (now_ms - wheel->start_ms) / wheel->resolution_ms;
+	unsigned int fired = 0;
+
+	if (wheel->active == 0 && target > wheel->current)
+		wheel->current = target;
+
+	while (wheel->current < target) {
+		wheel->current++;
+
+		for (unsigned int level = 1; level < TW_LEVELS; level++) {
+			if ((wheel->current >> (TW_SLOT_BITS * (level - 1))) & SLOT_MASK)
+				break;
+			cascade(wheel, level);
+		}
+
+		Tw_Timer *const head = &wheel->slots[0][wheel->current & SLOT_MASK];
+
+		while (*head) {
+			const Tw_Timer timer = *head;
+
+			unlink_timer(timer);
+			wheel->active--;
+			fired++;
+			timer->callback(timer->data);
+		}
+	}
+
+	return fired;
+}
+
+// Milliseconds until the next tick boundary, -1 when nothing is scheduled
+int tw_next_timeout(const Timer_Wheel restrict wheel, const uint64_t now_ms) {
+	if (wheel->active == 0)
+		return -1;
+
+	const uint64_t next_ms = wheel->start_ms + ((wheel->current + 1) * wheel->resolution_ms);
+
+	return (next_ms > now_ms) ? (int) (next_ms - now_ms) : 0;
+}
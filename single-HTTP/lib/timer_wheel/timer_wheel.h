@@ -0,0 +1,40 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define TW_LEVELS 4
+#define TW_SLOT_BITS 6
+#define TW_SLOTS (1 << TW_SLOT_BITS)
+
+typedef void (*Tw_Callback)(void *);
+
+typedef struct tw_timer_s {
+	struct tw_timer_s *next, **pprev;
+	uint64_t expires;
+	Tw_Callback callback;
+	void *data;
+} tw_timer_t;
+
+typedef tw_timer_t *Tw_Timer;
+
+typedef struct timer_wheel_s {
+	Tw_Timer slots[TW_LEVELS][TW_SLOTS];
+	uint64_t current, start_ms;
+	unsigned int resolution_ms, active;
+} timer_wheel_t;
+
+typedef timer_wheel_t *Timer_Wheel;
+
+extern Timer_Wheel tw_create(const unsigned int);
+extern void tw_destroy(Timer_Wheel);
+extern void tw_init_timer(Tw_Timer const, const Tw_Callback, void *const);
+extern void tw_schedule(Timer_Wheel const, Tw_Timer const, const uint64_t);
+extern void tw_cancel(Timer_Wheel const, Tw_Timer const);
+extern bool tw_pending(Tw_Timer const);
+extern unsigned int tw_advance(Timer_Wheel const, const uint64_t);
+extern int tw_next_timeout(Timer_Wheel const, const uint64_t);
+extern uint64_t tw_now_ms(void);
+
+#endif /* End TIMER_WHEEL_H */
@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <errno.h>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+#include "tls.h"
+
+// TLS termination with OpenSSL on non-blocking sockets. Sessions resume from
+// the server's session cache or from tickets, ALPN offers h2 ahead of
+// http/1.1. With kTLS enabled OpenSSL installs the keys in the kernel after
+// the handshake when it supports the negotiated cipher; plain writes and
+// sendfile() on the socket are then encrypted there, without a copy through
+// user space.
+
+#define SESSION_CONTEXT "single-HTTP"
+
+static const Byte _protocols[] = "\x02h2\x08http/1.1"; // In order of preference
+
+// The first of our protocols the client offers, no ALPN answer when none is
+static int select_protocol(SSL *ssl, const Byte **out, Byte *out_len, const Byte *in, unsigned int in_len, void *arg) {
+	if (SSL_select_next_proto((Byte**) out, out_len, _protocols, sizeof(_protocols) - 1, in, in_len)
+	    != OPENSSL_NPN_NEGOTIATED)
+		return SSL_TLSEXT_ERR_NOACK;
+
+	return SSL_TLSEXT_ERR_OK;
+}
+
+static Tls_Context fail(SSL_CTX *const ctx, String restrict error, const size_t error_len, const String restrict step) {
+	const unsigned long code = ERR_get_error();
+	const char *const reason = code ? ERR_reason_error_string(code) : NULL;
+
+	snprintf(error, error_len, "%s: %s", step, reason ? reason : "Unknown error");
+	ERR_clear_error();
+	SSL_CTX_free(ctx);
+
+	return NULL;
+}
+
+// Returns the context every TLS connection is accepted with, NULL with a
+// description of the failing step in error otherwise
+Tls_Context tls_create(const tls_options_t *const options, String error, const size_t error_len) {
+	SSL_CTX *const ctx = SSL_CTX_new(TLS_server_method());
+
+	if (!ctx)
+		return fail(NULL, error, error_len, "TLS Error");
+
+	SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+	SSL_CTX_set_options(ctx, SSL_OP_NO_RENEGOTIATION | SSL_OP_CIPHER_SERVER_PREFERENCE | SSL_OP_IGNORE_UNEXPECTED_EOF
+	                    | (options->tickets ? 0 : SSL_OP_NO_TICKET) | (options->ktls ? SSL_OP_ENABLE_KTLS : 0));
+	// The output queue retries from its own copy, idle connections hold no record buffers
+	SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER | SSL_MODE_RELEASE_BUFFERS);
+
+	if (options->session_cache) {
+		SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+		SSL_CTX_sess_set_cache_size(ctx, options->session_cache);
+	} else
+		SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+	SSL_CTX_set_session_id_context(ctx, (const Byte*) SESSION_CONTEXT, sizeof(SESSION_CONTEXT) - 1);
+	SSL_CTX_set_alpn_select_cb(ctx, select_protocol, NULL);
+
+	if (SSL_CTX_use_certificate_chain_file(ctx, options->certificate) != 1)
+		return fail(ctx, error, error_len, "Certificate Error");
+
+	if ((SSL_CTX_use_PrivateKey_file(ctx, options->private_key, SSL_FILETYPE_PEM) != 1)
+	    || (SSL_CTX_check_private_key(ctx) != 1))
+		return fail(ctx, error, error_len, "Private Key Error");
+
+	return ctx;
+}
+
+void tls_destroy(Tls_Context ctx) {
+	SSL_CTX_free(ctx);
+	ctx = NULL;
+}
+
+// A session on the accepted socket, the handshake is left to tls_handshake()
+Tls_Session tls_accept(Tls_Context const ctx, const int sock) {
+	SSL *const ssl = SSL_new(ctx);
+
+	if (!ssl || (SSL_set_fd(ssl, sock) != 1)) {
+		ERR_clear_error();
+		SSL_free(ssl);
+		return NULL;
+	}
+	SSL_set_accept_state(ssl);
+
+	return ssl;
+}
+
+tls_result_t tls_handshake(Tls_Session const ssl) {
+	const int result = SSL_do_handshake(ssl);
+
+	if (result == 1)
+		return TLS_DONE;
+
+	const int error = SSL_get_error(ssl, result);
+
+	if ((error == SSL_ERROR_WANT_READ) || (error == SSL_ERROR_WANT_WRITE))
+		return TLS_AGAIN;
+	ERR_clear_error();
+
+	return TLS_FAILED;
+}
+
+bool tls_established(Tls_Session const ssl) {
+	return SSL_is_init_finished(ssl);
+}
+
+bool tls_wants_write(Tls_Session const ssl) {
+	return SSL_want_write(ssl);
+}
+
+bool tls_resumed(Tls_Session const ssl) {
+	return SSL_session_reused(ssl);
+}
+
+// Writes to the socket are encrypted by the kernel
+bool tls_kernel_send(Tls_Session const ssl) {
+	return BIO_get_ktls_send(SSL_get_wbio(ssl));
+}
+
+// Follows recv(): the octets decrypted, 0 once the peer closed and -1 with
+// errno set otherwise, EAGAIN while a record is incomplete
+ssize_t tls_read(Tls_Session const ssl, Byte *buffer, const size_t len) {
+	size_t nbytes;
+
+	if (SSL_read_ex(ssl, buffer, len, &nbytes))
+		return nbytes;
+
+	switch (SSL_get_error(ssl, 0)) {
+	case SSL_ERROR_WANT_READ:
+	case SSL_ERROR_WANT_WRITE:
+		errno = EAGAIN;
+		return -1;
+	case SSL_ERROR_ZERO_RETURN:
+		return 0;
+	default:
+		ERR_clear_error();
+		errno = ECONNRESET;
+		return -1;
+	}
+}
+
+// Follows send(). After EAGAIN the record OpenSSL holds is written first, so
+// the retry has to pass the same octets again, from any address.
+ssize_t tls_write(Tls_Session const ssl, const Byte *data, const size_t len) {
+	size_t nbytes;
+
+	if (SSL_write_ex(ssl, data, len, &nbytes))
+		return nbytes;
+
+	const int error = SSL_get_error(ssl, 0);
+
+	if ((error == SSL_ERROR_WANT_WRITE) || (error == SSL_ERROR_WANT_READ)) {
+		errno = EAGAIN;
+		return -1;
+	}
+	ERR_clear_error();
+	errno = EPIPE;
+
+	return -1;
+}
+
+// Decrypted octets OpenSSL holds, which no readiness event announces
+size_t tls_pending(Tls_Session const ssl) {
+	return SSL_pending(ssl);
+}
+
+// Sends close_notify first when graceful and the handshake completed, without
+// waiting for the client's
+void tls_close(Tls_Session ssl, const bool graceful) {
+	if (graceful && SSL_is_init_finished(ssl))
+		SSL_shutdown(ssl);
+	ERR_clear_error();
+	SSL_free(ssl);
+	ssl = NULL;
+}
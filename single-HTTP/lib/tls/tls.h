@@ -0,0 +1,39 @@
+#ifndef TLS_H
+#define TLS_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "../types/types.h"
+
+typedef enum tls_result_e {
+	TLS_DONE,
+	TLS_AGAIN, // Waits for the socket, tls_wants_write() tells for which direction
+	TLS_FAILED
+} tls_result_t;
+
+typedef struct tls_options_s {
+	String certificate, private_key; // PEM files, the certificate file may hold the chain after the leaf
+	unsigned int session_cache; // Sessions kept for resumption by id, 0 disables the cache
+	bool tickets; // Resumption by session tickets, which keep no state on the server
+	bool ktls; // Hands the record crypto to the kernel when it takes the cipher
+} tls_options_t;
+
+typedef struct ssl_ctx_st *Tls_Context;
+typedef struct ssl_st *Tls_Session;
+
+extern Tls_Context tls_create(const tls_options_t *const, String, const size_t);
+extern void tls_destroy(Tls_Context);
+extern Tls_Session tls_accept(Tls_Context const, const int);
+extern tls_result_t tls_handshake(Tls_Session const);
+extern bool tls_established(Tls_Session const);
+extern bool tls_wants_write(Tls_Session const);
+extern bool tls_resumed(Tls_Session const);
+extern bool tls_kernel_send(Tls_Session const);
+extern ssize_t tls_read(Tls_Session const, Byte *, const size_t);
+extern ssize_t tls_write(Tls_Session const, const Byte *, const size_t);
+extern size_t tls_pending(Tls_Session const);
+extern void tls_close(Tls_Session, const bool);
+
+#endif /* End TLS_H */
@@ -0,0 +1,157 @@
+#include <time.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/limits.h>
+
+#include "trace.h"
+
+// In-process trace of the request phases: a ring of the most recent events,
+// each stamped with the time stamp counter, which is read in a few cycles and
+// without a system call. Nothing is formatted while serving; the ring is
+// converted on demand to the Chrome trace event format, which chrome://tracing
+// and Perfetto open. Each connection gets its own track, with one span per
+// phase from the previous point it passed to the next.
+
+#define MIN_EVENTS 64
+#define NS_PER_S 1000000000ULL
+#define NS_PER_US 1000.0
+#define TMP_EXT ".tmp"
+
+static const String _point_names[TRACE_POINTS] = {
+	[TP_ACCEPT] = TP_ACCEPT_PROBE,
+	[TP_FIRST_BYTE] = TP_FIRST_BYTE_PROBE,
+	[TP_PARSED] = TP_PARSED_PROBE,
+	[TP_ROUTED] = TP_ROUTED_PROBE,
+	[TP_LOGGED] = TP_LOGGED_PROBE,
+	[TP_FILE_OPENED] = TP_FILE_OPENED_PROBE,
+	[TP_FIRST_SENT] = TP_FIRST_SENT_PROBE,
+	[TP_LAST_SENT] = TP_LAST_SENT_PROBE
+};
+
+static uint64_t monotonic_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * NS_PER_S + ts.tv_nsec;
+}
+
+// Counter ticks, nanoseconds where there is no time stamp counter to read
+static uint64_t read_ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+	return __builtin_ia32_rdtsc();
+#else
+	return monotonic_ns();
+#endif
+}
+
+Trace_Ring trace_create(const unsigned int event_cnt) {
+	uint64_t size = MIN_EVENTS;
+	const Trace_Ring ring = (Trace_Ring) calloc(1, sizeof(trace_ring_t));
+	if (!ring)
+		exit(EXIT_FAILURE);
+
+	while (size < event_cnt)
+		size <<= 1;
+
+	ring->events = (trace_event_t*) calloc(size, sizeof(trace_event_t));
+	if (!ring->events)
+		exit(EXIT_FAILURE);
+
+	ring->mask = size - 1;
+	ring->start_ns = monotonic_ns();
+	ring->start_ticks = read_ticks();
+
+	return ring;
+}
+
+void trace_destroy(Trace_Ring ring) {
+	free(ring->events);
+	ring->events = NULL;
+
+	free(ring);
+	ring = NULL;
+}
+
+void trace_record(Trace_Ring const restrict ring, const trace_point_t point, const uint32_t id) {
+	trace_event_t *const event = &ring->events[ring->head++ & ring->mask];
+
+	event->ticks = read_ticks();
+	event->id = id;
+	event->point = point;
+}
+
+static int compare_events(const void *const a, const void *const b) {
+	const trace_event_t *const x = (const trace_event_t*) a, *const y = (const trace_event_t*) b;
+
+	if (x->id != y->id)
+		return (x->id < y->id) ? -1 : 1;
+	if (x->ticks != y->ticks)
+		return (x->ticks < y->ticks) ? -1 : 1;
+
+	return (x->point < y->point) ? -1 : (x->point > y->point);
+}
+
+// Writes the events in the ring to path as Chrome trace JSON, aside and then
+// renamed so a reader never sees half a file. The counter frequency is taken
+// from the ticks and the monotonic clock passed since the ring was created.
+bool trace_dump(Trace_Ring const restrict ring, const String restrict path) {
+	char tmp_path[PATH_MAX];
+	const uint64_t now_ns = monotonic_ns(), now_ticks = read_ticks();
+	const double ticks_per_us = (now_ns > ring->start_ns)
+		? (double) (now_ticks - ring->start_ticks) * NS_PER_US / (now_ns - ring->start_ns) : 1.0;
+	const uint64_t event_cnt = (ring->head <= ring->mask) ? ring->head : ring->mask + 1;
+	trace_event_t *const events = (trace_event_t*) malloc((event_cnt + 1) * sizeof(trace_event_t));
+	const pid_t pid = getpid();
+	bool first = true;
+
+	if (!events)
+		exit(EXIT_FAILURE);
+
+	memcpy(events, ring->events, event_cnt * sizeof(trace_event_t));
+	qsort(events, event_cnt, sizeof(trace_event_t), compare_events);
+
+	snprintf(tmp_path, PATH_MAX, "%s" TMP_EXT, path);
+	FILE *const file = fopen(tmp_path, "w");
+
+	if (!file) {
+		free(events);
+		return false;
+	}
+
+	fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", file);
+
+	for (uint64_t i = 0; i < event_cnt; i++) {
+		const trace_event_t *const event = &events[i];
+		const double ts = (double) (event->ticks - ring->start_ticks) / ticks_per_us;
+
+		if (event->point >= TRACE_POINTS)
+			continue;
+
+		fprintf(file, "%s\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":%d,\"tid\":%u}", first ? "" : ",",
+		        _point_names[event->point], ts, (int) pid, event->id);
+		first = false;
+
+		// The span a phase took ends at its point and starts at the previous
+		// one of the same connection, possibly in an earlier request
+		if ((i > 0) && (events[i - 1].id == event->id) && (events[i - 1].point < TRACE_POINTS)) {
+			const double start = (double) (events[i - 1].ticks - ring->start_ticks) / ticks_per_us;
+
+			fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%u}",
+			        _point_names[event->point], _point_names[events[i - 1].point], start, ts - start, (int) pid,
+			        event->id);
+		}
+	}
+	fputs("\n]}\n", file);
+	free(events);
+
+	if (fclose(file) != 0) {
+		remove(tmp_path);
+		return false;
+	}
+
+	return rename(tmp_path, path) == 0;
+}
@@ -0,0 +1,90 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "../types/types.h"
+
+typedef enum trace_point_e { // Phases of a request, in the order they are passed
+	TP_ACCEPT,
+	TP_FIRST_BYTE,
+	TP_PARSED,
+	TP_ROUTED,
+	TP_LOGGED,
+	TP_FILE_OPENED,
+	TP_FIRST_SENT,
+	TP_LAST_SENT,
+	TRACE_POINTS
+} trace_point_t;
+
+// Probe names as tools like bpftrace and perf list them, under the provider single_http
+#define TP_ACCEPT_PROBE "accept"
+#define TP_FIRST_BYTE_PROBE "first_byte"
+#define TP_PARSED_PROBE "parsed"
+#define TP_ROUTED_PROBE "routed"
+#define TP_LOGGED_PROBE "logged"
+#define TP_FILE_OPENED_PROBE "file_opened"
+#define TP_FIRST_SENT_PROBE "first_sent"
+#define TP_LAST_SENT_PROBE "last_sent"
+
+typedef struct trace_event_s {
+	uint64_t ticks;
+	uint32_t id; // Serial of the connection
+	uint32_t point;
+} trace_event_t;
+
+typedef struct trace_ring_s {
+	trace_event_t *events;
+	uint64_t head; // Events recorded so far, the ring keeps the last mask + 1
+	uint64_t mask;
+	uint64_t start_ticks, start_ns; // Pair the ticks are converted to time with
+} trace_ring_t;
+
+typedef trace_ring_t *Trace_Ring;
+
+// A USDT probe is a nop plus a .note.stapsdt entry naming its address and the
+// argument register, the same layout <sys/sdt.h> emits. It costs nothing until
+// a tracer attaches and patches the nop. The argument is the connection serial.
+#if (defined(__x86_64__) || defined(__aarch64__)) && !defined(TRACE_NO_PROBES)
+#define TRACE_PROBE(name, id) __asm__ __volatile__ ( \
+	"990: nop\n" \
+	".pushsection .note.stapsdt,\"?\",\"note\"\n" \
+	".balign 4\n" \
+	".4byte 992f-991f, 994f-993f, 3\n" \
+	"991: .asciz \"stapsdt\"\n" \
+	"992: .balign 4\n" \
+	"993: .8byte 990b\n" \
+	".8byte _.stapsdt.base\n" \
+	".8byte 0\n" \
+	".asciz \"single_http\"\n" \
+	".asciz \"" name "\"\n" \
+	".asciz \"8@%0\"\n" \
+	"994: .balign 4\n" \
+	".popsection\n" \
+	".ifndef _.stapsdt.base\n" \
+	".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n" \
+	".weak _.stapsdt.base\n" \
+	".hidden _.stapsdt.base\n" \
+	"_.stapsdt.base: .space 1\n" \
+	".size _.stapsdt.base, 1\n" \
+	".popsection\n" \
+	".endif\n" \
+	: : "r" ((uint64_t) (id)))
+#else
+#define TRACE_PROBE(name, id) ((void) (id))
+#endif
+
+// Fires the probe of a point and, when a ring is given, records the event in it
+#define TRACE(ring, point, id) do { \
+	TRACE_PROBE(TP_##point##_PROBE, id); \
+	if (ring) \
+		trace_record(ring, TP_##point, id); \
+} while (0)
+
+extern Trace_Ring trace_create(const unsigned int);
+extern void trace_destroy(Trace_Ring);
+extern void trace_record(Trace_Ring const, const trace_point_t, const uint32_t);
+extern bool trace_dump(Trace_Ring const, const String);
+
+#endif /* End TRACE_H */
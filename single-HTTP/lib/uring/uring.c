@@ -0,0 +1,251 @@
+#include <time.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+
+// Minimal io_uring binding on the raw system calls, liburing is not required.
+// The rings are shared with the kernel: the tails we produce are published
+// with release stores and the tails the kernel produces read with acquire loads.
+
+#define MS_PER_S 1000
+#define NS_PER_MS 1000000
+
+static int uring_setup(const unsigned int entries, struct io_uring_params *const params) {
+	return (int) syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uring_enter(const int fd, const unsigned int to_submit, const unsigned int min_complete, const unsigned int flags,
+                       const void *const arg, const size_t arg_len) {
+	return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, arg_len);
+}
+
+static int uring_register(const int fd, const unsigned int opcode, const void *const arg, const unsigned int nr_args) {
+	return (int) syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static bool map_rings(Uring const restrict ring, const struct io_uring_params *const params) {
+	ring->sq_ring_len = params->sq_off.array + (params->sq_entries * sizeof(unsigned int));
+	ring->cq_ring_len = params->cq_off.cqes + (params->cq_entries * sizeof(struct io_uring_cqe));
+	ring->sqes_len = params->sq_entries * sizeof(struct io_uring_sqe);
+
+	// Every kernel new enough for the operations used here shares one mapping
+	if (ring->cq_ring_len > ring->sq_ring_len)
+		ring->sq_ring_len = ring->cq_ring_len;
+
+	ring->sq_ring = mmap(NULL, ring->sq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+	                     IORING_OFF_SQ_RING);
+	if (ring->sq_ring == MAP_FAILED)
+		return false;
+	ring->cq_ring = ring->sq_ring;
+
+	ring->sqes = (struct io_uring_sqe*) mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+	                                         ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		munmap(ring->sq_ring, ring->sq_ring_len);
+		return false;
+	}
+
+	ring->sq_head = (unsigned int*) ((char*) ring->sq_ring + params->sq_off.head);
+	ring->sq_tail = (unsigned int*) ((char*) ring->sq_ring + params->sq_off.tail);
+	ring->sq_mask = (unsigned int*) ((char*) ring->sq_ring + params->sq_off.ring_mask);
+	ring->sq_array = (unsigned int*) ((char*) ring->sq_ring + params->sq_off.array);
+	ring->cq_head = (unsigned int*) ((char*) ring->cq_ring + params->cq_off.head);
+	ring->cq_tail = (unsigned int*) ((char*) ring->cq_ring + params->cq_off.tail);
+	ring->cq_mask = (unsigned int*) ((char*) ring->cq_ring + params->cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe*) ((char*) ring->cq_ring + params->cq_off.cqes);
+	ring->sq_entries = params->sq_entries;
+	ring->sqe_tail = *ring->sq_tail;
+
+	return true;
+}
+
+// Registers buf_cnt receive buffers of buf_size bytes the kernel picks from
+// for IOSQE_BUFFER_SELECT reads
+static bool map_buffers(Uring const restrict ring, const unsigned int buf_cnt, const unsigned int buf_size) {
+	struct io_uring_buf_reg reg;
+
+	ring->buf_ring_len = buf_cnt * sizeof(struct io_uring_buf);
+	ring->buf_ring = (struct io_uring_buf_ring*) mmap(NULL, ring->buf_ring_len, PROT_READ | PROT_WRITE,
+	                                                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (ring->buf_ring == MAP_FAILED)
+		return false;
+
+	ring->buffers = (Byte*) mmap(NULL, (size_t) buf_cnt * buf_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (ring->buffers == MAP_FAILED) {
+		munmap(ring->buf_ring, ring->buf_ring_len);
+		return false;
+	}
+	ring->buf_cnt = buf_cnt;
+	ring->buf_size = buf_size;
+
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (uint64_t) (uintptr_t) ring->buf_ring;
+	reg.ring_entries = buf_cnt;
+	reg.bgid = UR_BUFFER_GROUP;
+
+	if (uring_register(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1) {
+		munmap(ring->buffers, (size_t) buf_cnt * buf_size);
+		munmap(ring->buf_ring, ring->buf_ring_len);
+		return false;
+	}
+
+	for (unsigned int i = 0; i < buf_cnt; i++)
+		ur_recycle_buffer(ring, i);
+
+	return true;
+}
+
+// Returns NULL when the kernel lacks io_uring or one of the features the
+// server relies on (multishot receive, provided buffer rings), so the caller
+// can fall back to epoll. entries and buf_cnt must be powers of two.
+Uring ur_create(const unsigned int entries, const unsigned int buf_cnt, const unsigned int buf_size) {
+	struct io_uring_params params;
+	struct io_uring_rsrc_update ring_fd;
+	const Uring ring = (Uring) calloc(1, sizeof(uring_t));
+	if (!ring)
+		exit(EXIT_FAILURE);
+
+	memset(&params, 0, sizeof(params));
+	params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN | IORING_SETUP_SINGLE_ISSUER;
+	params.cq_entries = entries * 4; // Multishot requests post several completions each
+
+	ring->fd = uring_setup(entries, &params);
+
+	if ((ring->fd == -1) || !(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_EXT_ARG)) {
+		if (ring->fd != -1)
+			close(ring->fd);
+		free(ring);
+		return NULL;
+	}
+
+	if (!map_rings(ring, &params)) {
+		close(ring->fd);
+		free(ring);
+		return NULL;
+	}
+
+	if (!map_buffers(ring, buf_cnt, buf_size)) {
+		munmap(ring->sqes, ring->sqes_len);
+		munmap(ring->sq_ring, ring->sq_ring_len);
+		close(ring->fd);
+		free(ring);
+		return NULL;
+	}
+
+	// A registered ring descriptor spares the fd table lookup on every enter
+	ring->enter_fd = ring->fd;
+	memset(&ring_fd, 0, sizeof(ring_fd));
+	ring_fd.offset = -1U;
+	ring_fd.data = ring->fd;
+
+	if (uring_register(ring->fd, IORING_REGISTER_RING_FDS, &ring_fd, 1) == 1) {
+		ring->enter_fd = ring_fd.offset;
+		ring->enter_flags = IORING_ENTER_REGISTERED_RING;
+	}
+
+	return ring;
+}
+
+void ur_destroy(Uring ring) {
+	munmap(ring->buffers, (size_t) ring->buf_cnt * ring->buf_size);
+	munmap(ring->buf_ring, ring->buf_ring_len);
+	munmap(ring->sqes, ring->sqes_len);
+	munmap(ring->sq_ring, ring->sq_ring_len);
+	close(ring->fd);
+
+	free(ring);
+	ring = NULL;
+}
+
+// Fixed files skip the per-request fd lookup, index i refers to fds[i]
+bool ur_register_files(Uring const restrict ring, const int *const fds, const unsigned int fd_cnt) {
+	return uring_register(ring->fd, IORING_REGISTER_FILES, fds, fd_cnt) == 0;
+}
+
+// Returns a zeroed submission entry, the queue is flushed to the kernel first when it is full
+struct io_uring_sqe *ur_get_sqe(Uring const restrict ring) {
+	if (ring->sqe_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries)
+		ur_submit(ring);
+
+	const unsigned int index = ring->sqe_tail & *ring->sq_mask;
+	struct io_uring_sqe *const sqe = &ring->sqes[index];
+
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	ring->sq_array[index] = index;
+	ring->sqe_tail++;
+	ring->to_submit++;
+	__atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+
+	return sqe;
+}
+
+int ur_submit(Uring const restrict ring) {
+	int submitted;
+
+	do
+		submitted = uring_enter(ring->enter_fd, ring->to_submit, 0, ring->enter_flags, NULL, 0);
+	while ((submitted == -1) && (errno == EINTR));
+
+	if (submitted > 0)
+		ring->to_submit -= submitted;
+
+	return submitted;
+}
+
+// Submits everything queued and sleeps until a completion arrives or
+// timeout_ms passes, -1 waits without a timeout
+int ur_wait(Uring const restrict ring, const int timeout_ms) {
+	struct __kernel_timespec ts;
+	struct io_uring_getevents_arg arg;
+	const unsigned int to_submit = ring->to_submit;
+
+	memset(&arg, 0, sizeof(arg));
+	if (timeout_ms >= 0) {
+		ts.tv_sec = timeout_ms / MS_PER_S;
+		ts.tv_nsec = (long long) (timeout_ms % MS_PER_S) * NS_PER_MS;
+		arg.ts = (uint64_t) (uintptr_t) &ts;
+	}
+
+	// Completions that are already waiting make the wait unnecessary
+	const unsigned int ready = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE) - *ring->cq_head;
+	const int submitted = uring_enter(ring->enter_fd, to_submit, ready ? 0 : 1,
+	                                  ring->enter_flags | IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+
+	if (submitted > 0)
+		ring->to_submit -= submitted;
+
+	return submitted;
+}
+
+// Copies the oldest completion into cqe and releases its slot
+bool ur_next_cqe(Uring const restrict ring, struct io_uring_cqe *const cqe) {
+	const unsigned int head = *ring->cq_head;
+
+	if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+		return false;
+
+	*cqe = ring->cqes[head & *ring->cq_mask];
+	__atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+
+	return true;
+}
+
+Byte *ur_buffer(Uring const restrict ring, const unsigned int id) {
+	return ring->buffers + ((size_t) id * ring->buf_size);
+}
+
+// Hands a provided buffer back to the kernel once its data has been consumed
+void ur_recycle_buffer(Uring const restrict ring, const unsigned int id) {
+	const uint16_t tail = ring->buf_ring->tail;
+	struct io_uring_buf *const buf = &ring->buf_ring->bufs[tail & (ring->buf_cnt - 1)];
+
+	buf->addr = (uint64_t) (uintptr_t) ur_buffer(ring, id);
+	buf->len = ring->buf_size;
+	buf->bid = id;
+	__atomic_store_n(&ring->buf_ring->tail, (uint16_t) (tail + 1), __ATOMIC_RELEASE);
+}
@@ -0,0 +1,44 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <linux/io_uring.h>
+
+#include "../types/types.h"
+
+#define UR_BUFFER_GROUP 0
+
+typedef struct uring_s {
+	int fd, enter_fd;
+	unsigned int enter_flags, to_submit;
+	// Submission queue
+	unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned int sq_entries, sqe_tail;
+	struct io_uring_sqe *sqes;
+	// Completion queue
+	unsigned int *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe *cqes;
+	// Provided receive buffers
+	struct io_uring_buf_ring *buf_ring;
+	Byte *buffers;
+	unsigned int buf_cnt, buf_size;
+	// Mappings
+	void *sq_ring, *cq_ring;
+	size_t sq_ring_len, cq_ring_len, sqes_len, buf_ring_len;
+} uring_t;
+
+typedef uring_t *Uring;
+
+extern Uring ur_create(const unsigned int, const unsigned int, const unsigned int);
+extern void ur_destroy(Uring);
+extern bool ur_register_files(Uring const, const int *const, const unsigned int);
+extern struct io_uring_sqe *ur_get_sqe(Uring const);
+extern int ur_submit(Uring const);
+extern int ur_wait(Uring const, const int);
+extern bool ur_next_cqe(Uring const, struct io_uring_cqe *const);
+extern Byte *ur_buffer(Uring const, const unsigned int);
+extern void ur_recycle_buffer(Uring const, const unsigned int);
+
+#endif /* End URING_H */
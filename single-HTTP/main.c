@@ -4,78 +4,247 @@
 #include <netdb.h>
 #include <stdio.h>
 #include <libgen.h>
+#include <poll.h>
 #include <signal.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <stdbool.h>
+#include <sqlite3.h>
 #include <sys/stat.h>
 #include <arpa/inet.h>
+#include <sys/wait.h>
+#include <sys/epoll.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/resource.h>
 #include <linux/limits.h>
 
 #include "globals.h"
+#include "lib/stats/stats.h"
 #include "lib/logging/log.h"
 #include "lib/types/types.h"
 #include "lib/colors/colors.h"
+#include "lib/core/core.h"
 #include "lib/sqlite3/sqlite3.h"
+#include "lib/compress/compress.h"
+#include "lib/connection/connection.h"
+#include "lib/buffer_pool/buffer_pool.h"
 #include "lib/hashtable/hashtable.h"
+#include "lib/listener/listener.h"
+#include "lib/handoff/handoff.h"
+#include "lib/snapshot/snapshot.h"
+#include "lib/microcache/microcache.h"
+#include "lib/static_file/static_file.h"
+#include "lib/file_cache/file_cache.h"
+#include "lib/assets/assets.h"
+#include "lib/rate_limit/rate_limit.h"
+#include "lib/trace/trace.h"
+#include "lib/capture/capture.h"
+#include "lib/admission/admission.h"
+#include "lib/h2/h2.h"
+#include "lib/tls/tls.h"
+#include "lib/log_retention/log_retention.h"
+#include "lib/timer_wheel/timer_wheel.h"
+#include "lib/uring/uring.h"
+#include "lib/http_headers/http_headers.h"
 #include "lib/s_linked_list/s_linked_list.h"
 
-#define OK "HTTP/1.0 200 OK\n\n"
-#define CREATED "HTTP/1.0 201 CREATED\n\n"
-#define NOT_FOUND "HTTP/1.0 404 NOT FOUND\n\n"
-#define FORBIDDEN "HTTP/1.0 403 FORBIDDEN\n\n"
-#define BAD_REQUEST "HTTP/1.0 400 BAD REQUEST\n\n"
-#define SERVER_ERROR "HTTP/1.0 500 INTERNAL SERVER ERROR\n\n"
-#define NOT_SUPPORTED "HTTP/1.0 505 HTTP VERSION NOT SUPPORTED\n\n"
-#define NOT_IMPLEMENTED "HTTP/1.0 501 NOT IMPLEMENTED\n\n"
-
-#define DEFAULT_ROOT "/home/elliott/Github/C-Server-Collection/single-HTTP/"
-#define DEFAULT_LOG_ROOT "/home/elliott/Github/C-Server-Collection/single-HTTP/logs/"
+#define SERVICE_UNAVAILABLE "HTTP/1.0 503 SERVICE UNAVAILABLE\r\nRetry-After: 1\r\nContent-Length: 0\r\nConnection: close\r\n\r\n"
+#define SWITCHING_PROTOCOLS "HTTP/1.1 101 SWITCHING PROTOCOLS\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n"
+#define TOO_MANY_REQUESTS "HTTP/1.0 429 TOO MANY REQUESTS\r\nRetry-After: 1\r\nContent-Length: 0\r\nConnection: close\r\n\r\n"
+
+#define PARTIAL_CONTENT_LINE "HTTP/1.0 206 PARTIAL CONTENT\r\n"
+#define RANGE_NOT_SATISFIABLE_LINE "HTTP/1.0 416 RANGE NOT SATISFIABLE\r\n"
+#define VALIDATOR_HEADERS "Last-Modified: %s\r\nETag: %s\r\nAccept-Ranges: bytes\r\n"
+#define GZIP_HEADERS "Content-Encoding: gzip\r\nVary: Accept-Encoding\r\n"
+#define PART_HEADER_TEMPLATE "\r\n--%s\r\nContent-Type: %s\r\nContent-Range: bytes %lld-%lld/%lld\r\n\r\n"
+#define PART_CLOSE_TEMPLATE "\r\n--%s--\r\n"
+
 #define DEFAULT_DB_ROOT "/home/elliott/Github/C-Server-Collection/single-HTTP/database/db.sqlite3"
 
-#define DEFAULT_HT_S 10
-#define DEFAULT_PORT "8888"
-#define CONNECTION_TEMPLATE "Connection from %s for file %s"
-#define USAGE_MSG "Usage: %s [-h] [-V] [-v] [-d[table]] [-l <filepath>] [-s <configuration file>] [-u <unsigned int>] [-g <unsigned int>]\n"
+#define DEFAULT_MC_BINS 64
+#define DEFAULT_MC_MAX_BYTES (4 * MBYTE_S)
+#define DEFAULT_GZ_BINS 64
+#define DEFAULT_GZ_MAX_BYTES (8 * MBYTE_S)
+#define DEFAULT_GZ_MIN_BYTES 256
+#define DEFAULT_GZ_FILE_MAX_BYTES MBYTE_S
+#define DEFAULT_FC_BINS 256
+#define DEFAULT_FC_ENTRIES 1024
+#define DEFAULT_FC_TTL_MS 2000
+#define DEFAULT_RL_SLOTS 65536
+#define DEFAULT_FIRST_BYTE_MS 10000
+#define DEFAULT_BODY_MS 30000
+#define DEFAULT_HIGH_WATERMARK (64 * KBYTE_S)
+#define DEFAULT_LOW_WATERMARK (16 * KBYTE_S)
+#define DEFAULT_QC_MAX_BYTES 0
+#define DEFAULT_POOL_MAX_BYTES (4 * 1024 * 1024)
+#define DEFAULT_TLS_SESSIONS 20480
+#define STATUS_PATH "/server-status"
+#define ROWS_PATH "/api/test" // Rows of the test table, through the SQLite executor
+#define ROWS_MAX 100
+#define ROWS_TIMEOUT_MS 1000
+#define JSON_ESCAPE_LEN 6 // \u00XX
+#define JSON_SLACK 8
+#define USAGE_MSG "Usage: %s [-h] [-V] [-v] [-U] [-d[table]] [-l <filepath>] [-s <configuration file>] [-u <unsigned int>] [-g <unsigned int>]\n"
 
-#define BACKLOG 1
-#define STR_MAX 2048
 #define PORT_MIN 0
 #define PORT_MAX 65536
 #define MAX_ARGS 10
+#define MAX_RANGES 16
+#define MAX_EVENTS 64
+#define MAX_LISTENERS 8
+#define ACCEPT_BATCH 64
+#define URING_ACCEPTS 16
+#define TW_RESOLUTION_MS 100
+#define MAX_PHP_FILLS 32
+#define URING_ENTRIES 256
+#define MAX_FDS (1 << 24) // Descriptors have to fit the io_uring user_data
+#define URING_BUFFERS 256
+#define URING_SEND_BATCH 16 // Segments of queued output linked into one submission
 #define PACKET_MAX 1024
-#define HTTP_VER_AMT 3
-#define HTTP_REQ_AMT 8
-#define REQLINE_TOKEN_AMT 3
 
 #define MSG_LEN 4096
+#define TLS_RECORD_LEN 16384
+#define MC_KEY_LEN 1024
+#define BOUNDARY_LEN 24
+#define PART_HEADER_LEN 192
+#define STATUS_BODY_LEN 1024
 #define PORT_LEN 5
 #define GET_REQ_LEN 3
-#define PHP_EXT_LEN 4
 #define REQLINE_LEN 128
-#define CONF_EXT_LEN 5
-#define HTTP_VER_LEN 8
-#define CODE_200_LEN 17
-#define CODE_400_LEN 26
-#define CODE_403_LEN 24
-#define CODE_404_LEN 24
-#define CODE_500_LEN 36
-#define	CODE_501_LEN 30
-#define CODE_505_LEN 41
-#define HTTP_METHOD_LEN 7
+#define CODE_429_LEN 88
+#define CODE_503_LEN 90
+#define CODE_101_LEN 71
 #define DEFAULT_PAGE_LEN 22
 #define MDEFAULT_PAGE_LEN 2
-#define CONNECTION_TEMPLATE_LEN 28
-#define IMPLEMENTED_HTTP_METHODS_LEN 2
 
-S_Ll _paths;
-char _port[PORT_LEN] = DEFAULT_PORT,
-	 _doc_root[PATH_MAX] = DEFAULT_ROOT;
+typedef enum response_e {
+	RESP_CLOSE, // Unframed or failed response, the connection is closed
+	RESP_KEEP, // Framed response, the connection may be kept alive
+	RESP_DETACHED // The connection was handed to a pending backend run
+} response_t;
+
+// A request waiting on the SQLite executor. The connection is checked against
+// id on completion, it may have closed and its descriptor been reused.
+typedef struct rows_request_s {
+	int fd;
+	uint32_t id, stream;
+} rows_request_t;
+
+typedef enum admit_e {
+	ADMIT_OK,
+	ADMIT_LIMITED, // Over the rate limit of its client, answered with 429
+	ADMIT_SHED // Shed by admission control, answered with 503
+} admit_t;
+
+typedef enum io_tag_e { // Kind of io_uring request a completion belongs to
+	IO_IGNORE,
+	IO_ACCEPT,
+	IO_RECV,
+	IO_POLL,
+	IO_READY,
+	IO_PIPE,
+	IO_UPGRADE,
+	IO_SQL,
+	IO_SEND, // Sends and splices carry their connection, which outlives a close while they are in flight
+	IO_SEND_LAST,
+	IO_SPLICE_IN,
+	IO_SPLICE_OUT
+} io_tag_t;
+
+// user_data of an io_uring request: tag, serial of the owner and descriptor,
+// or tag and connection
+#define IO_DATA(tag, id, fd) (((uint64_t) (tag) << 56) | ((uint64_t) (id) << 24) | (uint64_t) (fd))
+#define IO_CONN_DATA(tag, conn) (((uint64_t) (tag) << 56) | (uint64_t) (uintptr_t) (conn))
+#define IO_TAG(data) ((io_tag_t) ((data) >> 56))
+#define IO_ID(data) ((uint32_t) ((data) >> 24))
+#define IO_FD(data) ((int) ((data) & 0xffffff))
+#define IO_CONN(data) ((Connection) (uintptr_t) ((data) & (((uint64_t) 1 << 56) - 1)))
+
+typedef struct php_fill_s {
+	int pipe_fd, client_fd; // client_fd is -1 when the output fills a micro-cache entry
+	pid_t pid;
+	Mc_Entry entry;
+	unsigned int ttl;
+	uint32_t id;
+	uint32_t stream; // HTTP/2 stream of the client the output belongs to
+	bool paused, polled;
+} php_fill_t;
 
-bool sigint_flag = true;
+S_Ll _paths;
+Timer_Wheel _wheel = NULL;
+Connection *_connections = NULL;
+unsigned int _max_connections = 0;
+int _epollfd = -1;
+Uring _uring = NULL; // Set when the io_uring backend is in use, epoll otherwise
+uint32_t _io_serial = 0;
+int _listeners[MAX_LISTENERS], _upgrade_fd = -1;
+bool _listener_tls[MAX_LISTENERS]; // Connections of the listener speak TLS
+unsigned int _listener_cnt = 0;
+listener_options_t _listen_options = {DEFAULT_BACKLOG, 0, 0, 0, 0, PUSH_NODELAY};
+struct accept_slot_s { // Peer address of one accept in flight on the io_uring backend
+	struct sockaddr_in6 addr;
+	socklen_t addr_len;
+} _accept_slots[MAX_LISTENERS * URING_ACCEPTS];
+Micro_Cache _microcache = NULL;
+Gz_Cache _gz_cache = NULL;
+File_Cache _file_cache = NULL;
+Rate_Limiter _rate_limiter = NULL;
+Admission _admission = NULL;
+ad_budget_t _budgets[RL_CLASSES] = {{0, 0}, {0, 0}};
+lr_policy_t _log_policy = {false, 0, 0, 0};
+Trace_Ring _trace = NULL; // Set when trace_events is configured
+Sql_Executor _sql_executor = NULL; // Set when sqlite_threads is configured
+Capture _capture = NULL; // Set when capture_sample_rate is configured
+Tls_Context _tls = NULL; // Set when tls_enabled is on
+double _capture_rate = 0.0;
+rl_limit_t _rate_limits[RL_CLASSES] = {{0, 0}, {0, 0}};
+php_fill_t _fills[MAX_PHP_FILLS];
+unsigned int _fill_cnt = 0;
+uint32_t _h2_stream = 0; // Stream the response being written belongs to, on an HTTP/2 connection
+const timeout_phase_t _phases[] = { // Deadline of each connection state
+	[CONN_ACCEPTED] = TIMEOUT_FIRST_BYTE,
+	[CONN_HEADERS] = TIMEOUT_HEADER,
+	[CONN_BODY] = TIMEOUT_BODY,
+	[CONN_DETACHED] = TIMEOUT_WRITE,
+	[CONN_IDLE] = TIMEOUT_KEEPALIVE,
+	[CONN_CLOSING] = TIMEOUT_WRITE,
+	[CONN_H2] = TIMEOUT_KEEPALIVE
+};
+uint64_t _timeouts[TIMEOUT_PHASES] = {
+	DEFAULT_FIRST_BYTE_MS, DEFAULT_HEADER_MS, DEFAULT_BODY_MS, DEFAULT_WRITE_MS, DEFAULT_KEEPALIVE_MS
+};
+unsigned int _fc_entries = DEFAULT_FC_ENTRIES, _rl_slots = DEFAULT_RL_SLOTS, _trace_events = 0, _sql_threads = 0;
+uint64_t _fc_ttl_ms = DEFAULT_FC_TTL_MS, _body_max_bytes = DEFAULT_BODY_MAX_BYTES;
+size_t _mc_max_bytes = DEFAULT_MC_MAX_BYTES,
+	   _gz_max_bytes = DEFAULT_GZ_MAX_BYTES,
+	   _gz_min_bytes = DEFAULT_GZ_MIN_BYTES,
+	   _gz_file_max_bytes = DEFAULT_GZ_FILE_MAX_BYTES,
+	   _high_watermark = DEFAULT_HIGH_WATERMARK,
+	   _low_watermark = DEFAULT_LOW_WATERMARK,
+	   _qc_max_bytes = DEFAULT_QC_MAX_BYTES,
+	   _pool_max_bytes = DEFAULT_POOL_MAX_BYTES;
+char _port[PORT_LEN + NT_LEN] = DEFAULT_PORT,
+	 _doc_root[PATH_MAX] = DEFAULT_ROOT,
+	 _mc_vary[STR_MAX] = "",
+	 _listen_addresses[STR_MAX] = "",
+	 _upgrade_socket[PATH_MAX] = "",
+	 _snapshot_path[PATH_MAX] = "",
+	 _spool_dir[PATH_MAX] = "/tmp",
+	 _trace_path[PATH_MAX] = "/tmp/single-HTTP.trace.json",
+	 _capture_path[PATH_MAX] = "/tmp/single-HTTP.capture",
+	 _tls_addresses[STR_MAX] = "*:8443",
+	 _tls_certificate[PATH_MAX] = "",
+	 _tls_private_key[PATH_MAX] = "";
+tls_options_t _tls_options = {_tls_certificate, _tls_private_key, DEFAULT_TLS_SESSIONS, true, true};
+
+bool verbose_flag = false;
+char _log_root[PATH_MAX + NT_LEN], _db_path[PATH_MAX + NT_LEN];
+
+bool sigint_flag = true, microcache_flag = false, weak_etag_flag = false, compression_flag = false, status_flag = false,
+	 uring_flag = false, upgrade_flag = false, draining_flag = false, asset_override_flag = false, trace_dump_flag = false,
+	 tls_flag = false;
 
 bool is_valid_port(void) { // Done
 	const int port_num = atoi(_port);
@@ -83,80 +252,128 @@ bool is_valid_port(void) { // Done
 	return ((PORT_MIN < port_num) && (port_num < PORT_MAX));
 }
 
-bool is_valid_request(String *const reqline) { // Done
-	const String restrict http_methods[HTTP_REQ_AMT] = {
-		"GET", "HEAD", "POST", "PUT", "DELETE", "CONNECT", "OPTIONS", "TRACE"
-	};
-
-	for (int i = 0; i < HTTP_REQ_AMT; i++) // Double check
-		if (strncmp(reqline[0], http_methods[i], strnlen(http_methods[i], STR_MAX)) == 0)
-			return true;
-
-	const String restrict http_ver[HTTP_VER_AMT] = {"HTTP/1.0", "HTTP/1.1", "HTTP/2.0"};
-
-	for (int i = 0; i < HTTP_VER_AMT; i++)
-		if (strncmp(reqline[2], http_ver[i], strnlen(http_ver[i], STR_MAX)) == 0)
-			return true;
-
-	return false;
-}
-
-String clean_config_line(String string) { // Done
-
-	while (*string < 'a' || *string > 'z')
-		string++;
-
-	String offset = strpbrk(string, " #\n");
-
-	if (!offset)
-		return string;
-	*offset = '\0';
-
-	return string;
-}
-
 void load_configuration(const String path) { // Done
-	const String extension = strrchr(path, '.');
-
-	if (!extension) {
-		if (verbose_flag)
-			puts(YELLOW "File Warning: -s option was not supplied a file" RESET);
-		return;
-	}
-
-	if (strncmp(extension, ".conf", CONF_EXT_LEN) != 0) {
-		if (verbose_flag)
-			puts(YELLOW "File Warning: -s option takes a configuration file as an argument\n"
-			       "Using default parameter values" RESET);
-		return;
-	}
-
-	char buffer[KBYTE_S] = "";
-	String line = "", defn = "", value = "";
-	FILE *conf_f = fopen(path, "r");
-
-	if ((!conf_f) && (verbose_flag))
-		printf(YELLOW "File Error: %s\nUsing default parameter values\n" RESET, strerror(errno));
-	else {
-		HashTable hashtable = ht_create(DEFAULT_HT_S);
-
-		while (fgets(buffer, KBYTE_S, conf_f)) {
-			if (buffer[0] == '#' || buffer[0] == '\n' || buffer[0] == '\t')
-				continue;
-			line = clean_config_line(buffer);
-			defn = strtok(line, "=");
-			value = strtok(NULL, "=");
-
-			ht_insert(&hashtable, defn, value);
-		}
-		strncpy(_port, ht_get_value(hashtable, "port"), PORT_LEN);
-		strncpy(_doc_root, ht_get_value(hashtable, "document_root"), PATH_MAX);
-		strncpy(_log_root, ht_get_value(hashtable, "log_root"), PATH_MAX);
-		strncpy(_db_path, ht_get_value(hashtable, "database_path"), PATH_MAX);
+	String option;
+	const String timeout_keys[TIMEOUT_PHASES] = {
+		"timeout_first_byte_ms", "timeout_header_ms", "timeout_body_ms", "timeout_write_ms", "timeout_keepalive_ms"
+	};
+	const HashTable hashtable = core_read_configuration(path);
+
+	if (hashtable) {
+		snprintf(_port, PORT_LEN + NT_LEN, "%s", ht_get_value(hashtable, "port"));
+		snprintf(_doc_root, PATH_MAX, "%s", ht_get_value(hashtable, "document_root"));
+		snprintf(_log_root, PATH_MAX + NT_LEN, "%s", ht_get_value(hashtable, "log_root"));
+		snprintf(_db_path, PATH_MAX + NT_LEN, "%s", ht_get_value(hashtable, "database_path"));
+
+		if ((option = ht_get_value(hashtable, "microcache_enabled")))
+			microcache_flag = (strncmp(option, "on", 3) == 0);
+		if ((option = ht_get_value(hashtable, "microcache_max_bytes")))
+			_mc_max_bytes = strtoull(option, NULL, 10);
+		if ((option = ht_get_value(hashtable, "microcache_vary")))
+			strncpy(_mc_vary, option, STR_MAX - NT_LEN);
+		if ((option = ht_get_value(hashtable, "etag_type")))
+			weak_etag_flag = (strncmp(option, "weak", 5) == 0);
+		if ((option = ht_get_value(hashtable, "compression_enabled")))
+			compression_flag = (strncmp(option, "on", 3) == 0);
+		if ((option = ht_get_value(hashtable, "compression_cache_bytes")))
+			_gz_max_bytes = strtoull(option, NULL, 10);
+		if ((option = ht_get_value(hashtable, "compression_min_bytes")))
+			_gz_min_bytes = strtoull(option, NULL, 10);
+		if ((option = ht_get_value(hashtable, "compression_max_bytes")))
+			_gz_file_max_bytes = strtoull(option, NULL, 10);
+		if ((option = ht_get_value(hashtable, "output_high_watermark")))
+			_high_watermark = strtoull(option, NULL, 10);
+		if ((option = ht_get_value(hashtable, "output_low_watermark")))
+			_low_watermark = strtoull(option, NULL, 10);
+		if ((option = ht_get_value(hashtable, "listen_addresses")))
+			strncpy(_listen_addresses, option, STR_MAX - NT_LEN);
+		if ((option = ht_get_value(hashtable, "listen_backlog")))
+			_listen_options.backlog = atoi(option);
+		if ((option = ht_get_value(hashtable, "tcp_defer_accept_s")))
+			_listen_options.defer_accept = atoi(option);
+		if ((option = ht_get_value(hashtable, "tcp_fastopen_queue")))
+			_listen_options.fastopen = atoi(option);
+		if ((option = ht_get_value(hashtable, "tcp_push")) && !listener_parse_push(option, &_listen_options.push)
+		    && verbose_flag)
+			printf(YELLOW "Configuration Warning: Unknown tcp_push policy %s\n" RESET, option);
+		if ((option = ht_get_value(hashtable, "socket_send_buffer")))
+			_listen_options.send_buffer = atoi(option);
+		if ((option = ht_get_value(hashtable, "socket_receive_buffer")))
+			_listen_options.receive_buffer = atoi(option);
+		if ((option = ht_get_value(hashtable, "rate_limit_static")) && !rl_parse_limit(option, &_rate_limits[RL_STATIC])
+		    && verbose_flag)
+			printf(YELLOW "Configuration Warning: Invalid rate_limit_static %s\n" RESET, option);
+		if ((option = ht_get_value(hashtable, "rate_limit_dynamic")) && !rl_parse_limit(option, &_rate_limits[RL_DYNAMIC])
+		    && verbose_flag)
+			printf(YELLOW "Configuration Warning: Invalid rate_limit_dynamic %s\n" RESET, option);
+		if ((option = ht_get_value(hashtable, "admission_static")) && !ad_parse_budget(option, &_budgets[RL_STATIC])
+		    && verbose_flag)
+			printf(YELLOW "Configuration Warning: Invalid admission_static %s\n" RESET, option);
+		if ((option = ht_get_value(hashtable, "admission_dynamic")) && !ad_parse_budget(option, &_budgets[RL_DYNAMIC])
+		    && verbose_flag)
+			printf(YELLOW "Configuration Warning: Invalid admission_dynamic %s\n" RESET, option);
+		if ((option = ht_get_value(hashtable, "rate_limit_slots")))
+			_rl_slots = strtoul(option, NULL, 10);
+		if ((option = ht_get_value(hashtable, "asset_override")))
+			asset_override_flag = (strncmp(option, "on", 3) == 0);
+		if ((option = ht_get_value(hashtable, "file_cache_entries")))
+			_fc_entries = strtoul(option, NULL, 10);
+		if ((option = ht_get_value(hashtable, "file_cache_ttl_ms")))
+			_fc_ttl_ms = strtoull(option, NULL, 10);
+		if ((option = ht_get_value(hashtable, "upgrade_socket")))
+			strncpy(_upgrade_socket, option, PATH_MAX - NT_LEN);
+		if ((option = ht_get_value(hashtable, "snapshot_path")))
+			strncpy(_snapshot_path, option, PATH_MAX - NT_LEN);
+		if ((option = ht_get_value(hashtable, "trace_events")))
+			_trace_events = strtoul(option, NULL, 10);
+		if ((option = ht_get_value(hashtable, "trace_path")))
+			strncpy(_trace_path, option, PATH_MAX - NT_LEN);
+		if ((option = ht_get_value(hashtable, "capture_path")))
+			strncpy(_capture_path, option, PATH_MAX - NT_LEN);
+		if ((option = ht_get_value(hashtable, "capture_sample_rate")))
+			_capture_rate = strtod(option, NULL);
+		if ((option = ht_get_value(hashtable, "log_compression")))
+			_log_policy.compress = (strncmp(option, "on", 3) == 0);
+		if ((option = ht_get_value(hashtable, "log_retention_days")))
+			_log_policy.max_age_days = strtoul(option, NULL, 10);
+		if ((option = ht_get_value(hashtable, "log_retention_bytes")))
+			_log_policy.max_bytes = strtoull(option, NULL, 10);
+		if ((option = ht_get_value(hashtable, "log_io_bytes_per_s")))
+			_log_policy.bytes_per_s = strtoull(option, NULL, 10);
+		if ((option = ht_get_value(hashtable, "query_cache_bytes")))
+			_qc_max_bytes = strtoull(option, NULL, 10);
+		if ((option = ht_get_value(hashtable, "buffer_pool_bytes")))
+			_pool_max_bytes = strtoull(option, NULL, 10);
+		if ((option = ht_get_value(hashtable, "sqlite_threads")))
+			_sql_threads = strtoul(option, NULL, 10);
+		if ((option = ht_get_value(hashtable, "request_body_max_bytes")))
+			_body_max_bytes = strtoull(option, NULL, 10);
+		if ((option = ht_get_value(hashtable, "request_body_spool_dir")))
+			strncpy(_spool_dir, option, PATH_MAX - NT_LEN);
+		if ((option = ht_get_value(hashtable, "io_backend")))
+			uring_flag = (strncmp(option, "io_uring", 9) == 0);
+		if ((option = ht_get_value(hashtable, "tls_enabled")))
+			tls_flag = (strncmp(option, "on", 3) == 0);
+		if ((option = ht_get_value(hashtable, "tls_addresses")))
+			strncpy(_tls_addresses, option, STR_MAX - NT_LEN);
+		if ((option = ht_get_value(hashtable, "tls_certificate")))
+			strncpy(_tls_certificate, option, PATH_MAX - NT_LEN);
+		if ((option = ht_get_value(hashtable, "tls_private_key")))
+			strncpy(_tls_private_key, option, PATH_MAX - NT_LEN);
+		if ((option = ht_get_value(hashtable, "tls_session_cache")))
+			_tls_options.session_cache = strtoul(option, NULL, 10);
+		if ((option = ht_get_value(hashtable, "tls_session_tickets")))
+			_tls_options.tickets = (strncmp(option, "on", 3) == 0);
+		if ((option = ht_get_value(hashtable, "tls_ktls")))
+			_tls_options.ktls = (strncmp(option, "on", 3) == 0);
+		if ((option = ht_get_value(hashtable, "status_enabled")))
+			status_flag = (strncmp(option, "on", 3) == 0);
+
+		for (int i = 0; i < TIMEOUT_PHASES; i++)
+			if ((option = ht_get_value(hashtable, timeout_keys[i])))
+				_timeouts[i] = strtoull(option, NULL, 10);
 		ht_destroy(hashtable);
 	}
-	if ((fclose(conf_f) != 0) && (verbose_flag))
-		printf(YELLOW "Configuration File Descriptor Error: %s\n" RESET, strerror(errno));
 }
 
 void compute_flags(const int argc, String *const argv, bool *v_flag) { // Done
@@ -164,7 +381,7 @@ void compute_flags(const int argc, String *const argv, bool *v_flag) { // Done
 	uid_t euid;
 	gid_t egid;
 
-	while ((c = getopt(argc, argv, "d::hl:Vvs:g:u:")) != -1) { // : at the start?
+	while ((c = getopt(argc, argv, "d::hl:VvUs:g:u:")) != -1) { // : at the start?
 		switch (c) {
 		case 'h':
 			printf(USAGE_MSG
@@ -173,6 +390,7 @@ void compute_flags(const int argc, String *const argv, bool *v_flag) { // Done
 				   "-h\tHelp menu\n"
 				   "-V\tVersion\n"
 				   "-v\tVerbose\n"
+				   "-U\tUpgrade, take over the listening sockets of the running server\n"
 				   "-s\tLoad a configuration file\n"
 				   "-u\tSet the effective user id for the process\n"
 				   "-g\tSet the effective group if for the process\n", basename(argv[0]));
@@ -192,6 +410,9 @@ void compute_flags(const int argc, String *const argv, bool *v_flag) { // Done
 		case 'v':
 			*v_flag = true;
 
+			break;
+		case 'U':
+			upgrade_flag = true;
 			break;
 		case 's':
 			load_configuration(optarg);
@@ -215,434 +436,2407 @@ void compute_flags(const int argc, String *const argv, bool *v_flag) { // Done
 	}
 }
 
-void process_php(const int client_fd, const String file_path) { // Done
-	const pid_t c_pid = fork();
+// First output of the current response, where its sending begins
+void start_response(const Connection conn) {
+	if (conn->responding)
+		return;
+	conn->responding = true;
+	TRACE(_trace, FIRST_SENT, conn->id);
+}
 
-	if (c_pid == -1) {
-		const String err_msg = strerror(errno);
+// Responses are queued on the client's connection and written as the socket
+// accepts them, a false return means the client is gone. On an HTTP/2
+// connection they go to the current stream, which frames them.
+bool send_range(const int client_fd, const int fd, const off_t offset, const size_t len) { // Zero-copy
+	const Connection conn = _connections[client_fd];
 
-		if (verbose_flag)
-			printf(YELLOW "Process Forking Error: %s\n" RESET, err_msg);
-		server_log(err_msg);
-	}
+	start_response(conn);
+	if (conn->h2)
+		return h2_write_file(conn->h2, _h2_stream, fd, offset, len);
+	return oq_send_file(&conn->output, client_fd, fd, offset, len);
+}
 
-	if (c_pid == 0) {
-		dup2(client_fd, STDOUT_FILENO);
-		execl("/usr/bin/php", "php", file_path, (String) NULL);
-	}
-	if ((close(client_fd) == -1) && (verbose_flag))
-		printf(YELLOW "File Descriptor Error 3: %s\n" RESET, strerror(errno));
+bool send_buffer(const int client_fd, const Byte *const buffer, const size_t len) {
+	const Connection conn = _connections[client_fd];
+
+	start_response(conn);
+	if (conn->h2)
+		return h2_write(conn->h2, _h2_stream, buffer, len, true);
+	return oq_send_buffer(&conn->output, client_fd, buffer, len);
+}
+
+bool send_static(const int client_fd, const Byte *const data, const size_t len) { // Embedded, never copied
+	const Connection conn = _connections[client_fd];
+
+	start_response(conn);
+	if (conn->h2)
+		return h2_write(conn->h2, _h2_stream, data, len, false);
+	return oq_send_static(&conn->output, client_fd, data, len);
 }
 
+// Sends a partial, from the built-in copy unless asset_override lets a file
+// on disk replace it
 void send_file(const int client_fd, const String path) { // Done
+	struct stat file;
+	const Asset asset = asset_find(path);
+
+	if (asset && !asset_override_flag) {
+		send_static(client_fd, asset->data, asset->len);
+		return;
+	}
+
 	const int fd = open(path, O_RDONLY);
 
-	if (fd == -1) {
+	if (asset && (fd == -1)) {
+		send_static(client_fd, asset->data, asset->len);
+		return;
+	}
+
+	if ((fd == -1) || (fstat(fd, &file) == -1)) {
 		const String err_msg = strerror(errno);
 
 		if (verbose_flag)
 			printf(YELLOW "Serve File Error: %s\n" RESET, err_msg);
 		server_log(err_msg);
-	} else {
-		String f_contents = (String) malloc((PACKET_MAX + NT_LEN) * sizeof(char));
+	} else
+		send_range(client_fd, fd, 0, file.st_size);
 
-		if (!f_contents) {
-			fprintf(stderr, RED "Memory Error: %s\n" RESET, strerror(errno));
-			exit(EXIT_FAILURE);
-		}
+	if ((close(fd) == -1) && (verbose_flag))
+		printf(YELLOW "Copy File Descriptor Error: %s\n" RESET, strerror(errno));
+}
 
-		size_t nbytes = read(fd, f_contents, PACKET_MAX);
+void arm_timer(const Connection conn, const timeout_phase_t phase) {
+	if (_timeouts[phase])
+		tw_schedule(_wheel, &conn->timer, _timeouts[phase]);
+	else
+		tw_cancel(_wheel, &conn->timer);
+}
 
-		while (nbytes > 0) {
-			send(client_fd, f_contents, nbytes, 0);
-			nbytes = read(fd, f_contents, PACKET_MAX);
-		}
+// Output of a connection on io_uring is sent by the ring, unless OpenSSL
+// encrypts it or a TLS handshake is still writing
+bool uring_sends(const Connection conn) {
+	return conn->output.deferred && (!conn->tls || tls_established(conn->tls));
+}
 
-		free(f_contents);
-		f_contents = NULL;
-	}
+struct io_uring_sqe *uring_splice(const int fd_in, const off_t off_in, const int fd_out, const size_t len,
+                                  const io_tag_t tag, const Connection conn) {
+	struct io_uring_sqe *const sqe = ur_get_sqe(_uring);
 
-	if ((close(fd) == -1) && (verbose_flag))
-		printf(YELLOW "Copy File Descriptor Error: %s\n" RESET, strerror(errno));
+	sqe->opcode = IORING_OP_SPLICE;
+	sqe->splice_fd_in = fd_in;
+	sqe->splice_off_in = (uint64_t) off_in;
+	sqe->fd = fd_out;
+	sqe->off = (uint64_t) -1;
+	sqe->len = len;
+	sqe->user_data = IO_CONN_DATA(tag, conn);
 
-	if ((close(client_fd) == -1) && (verbose_flag))
-		printf(YELLOW "Serve File Descriptor Error: %s\n" RESET, strerror(errno));
+	return sqe;
 }
 
-void respond(const int client_fd, String *const reqlines, const String path) { // Done
-	if (!is_valid_request(reqlines)) {
-		if (verbose_flag)
-			printf("%s %s [400 Bad Request]\n", reqlines[0], reqlines[1]);
-		send(client_fd, BAD_REQUEST, CODE_400_LEN, 0);
-		send_file(client_fd, "partials/code-responses/400.html");
+// Hands the queued output of a connection to the ring, one batch in flight at
+// a time: the memory segments at the head of the queue as linked sends,
+// followed by a chunk of a file range spliced into the connection's pipe and
+// linked to its splice out to the socket. MSG_WAITALL makes a short send fail
+// the link, so nothing behind it goes out of order. What a short splice left
+// in the pipe is sent on its own first.
+void uring_send(const Connection conn) {
+	Out_Queue const output = &conn->output;
+	struct io_uring_sqe *sqe = NULL;
+	Oq_Segment segment = output->head;
+	unsigned int batch = 0;
+
+	if ((conn->uring_ops & (CONN_OP_SEND | CONN_OP_POLL)) || !output->bytes)
 		return;
-	}
+	conn->uring_ops |= CONN_OP_SEND;
 
-	if (strncmp(reqlines[2], "HTTP/2.0", HTTP_VER_LEN) == 0) {
-		if (verbose_flag)
-			printf("GET %s %s [505 Http Version Not Supported]\n", reqlines[1], reqlines[2]);
-		send(client_fd, NOT_SUPPORTED, CODE_505_LEN, 0);
-		send_file(client_fd, "partials/code-responses/505.html");
+	if (output->piped) {
+		uring_splice(output->pipe[0], -1, conn->fd, output->piped, IO_SPLICE_OUT, conn);
 		return;
 	}
 
-	const String restrict implemented_http_methods[IMPLEMENTED_HTTP_METHODS_LEN] = {"GET", "POST"};
-	bool in = false;
+	for (; segment && (segment->kind != OQ_FILE) && (batch < URING_SEND_BATCH); segment = segment->next, batch++) {
+		if (sqe)
+			sqe->flags |= IOSQE_IO_LINK;
+		sqe = ur_get_sqe(_uring);
+		sqe->opcode = IORING_OP_SEND;
+		sqe->fd = conn->fd;
+		sqe->addr = (uint64_t) (uintptr_t) (segment->data + segment->offset);
+		sqe->len = segment->len;
+		sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+		sqe->user_data = IO_CONN_DATA(IO_SEND, conn);
+	}
 
-	for (unsigned int i = 0; i < IMPLEMENTED_HTTP_METHODS_LEN; i++)
-		if (strncmp(reqlines[0], implemented_http_methods[i], HTTP_METHOD_LEN) == 0) {
-			in = true;
-			break;
+	if (segment && (segment->kind == OQ_FILE) && (batch < URING_SEND_BATCH) && (output->pipe_size || oq_open_pipe(output))) {
+		const size_t len = (segment->len < output->pipe_size) ? segment->len : output->pipe_size;
+
+		if (sqe)
+			sqe->flags |= IOSQE_IO_LINK;
+		uring_splice(segment->fd, segment->offset, output->pipe[1], len, IO_SPLICE_IN, conn)->flags |= IOSQE_IO_LINK;
+		uring_splice(output->pipe[0], -1, conn->fd, len, IO_SPLICE_OUT, conn);
+		batch++;
+	} else if (sqe)
+		sqe->user_data = IO_CONN_DATA(IO_SEND_LAST, conn);
+	else { // Without a pipe the connection writes its output with oq_flush()
+		conn->uring_ops &= ~CONN_OP_SEND;
+		output->deferred = false;
+		return;
+	}
+	output->in_flight = batch;
+}
+
+// With io_uring a connection that wants input keeps one multishot receive in
+// flight, reading into the provided buffers, and queued output is handed to
+// uring_send(). A receive that is no longer wanted is cancelled; the data it
+// still delivers is kept in the request buffer. OpenSSL reads and writes a
+// TLS connection itself once a single shot poll reports it ready, a poll no
+// longer wanted is ignored when it completes.
+void uring_watch_connection(const Connection conn, const uint32_t events) {
+	struct io_uring_sqe *sqe;
+
+	if (conn->tls) {
+		if ((events & EPOLLIN) && !(conn->uring_ops & CONN_OP_READY)) {
+			sqe = ur_get_sqe(_uring);
+			sqe->opcode = IORING_OP_POLL_ADD;
+			sqe->fd = conn->fd;
+			sqe->poll32_events = POLLIN;
+			sqe->user_data = IO_DATA(IO_READY, conn->id, conn->fd);
+			conn->uring_ops |= CONN_OP_READY;
 		}
+	} else if ((events & EPOLLIN) && !(conn->uring_ops & CONN_OP_RECV)) {
+		sqe = ur_get_sqe(_uring);
+		sqe->opcode = IORING_OP_RECV;
+		sqe->fd = conn->fd;
+		sqe->ioprio = IORING_RECV_MULTISHOT;
+		sqe->flags = IOSQE_BUFFER_SELECT;
+		sqe->buf_group = UR_BUFFER_GROUP;
+		sqe->user_data = IO_DATA(IO_RECV, conn->id, conn->fd);
+		conn->uring_ops |= CONN_OP_RECV;
+	} else if (!(events & EPOLLIN) && ((conn->uring_ops & (CONN_OP_RECV | CONN_OP_CANCEL)) == CONN_OP_RECV)) {
+		sqe = ur_get_sqe(_uring);
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->addr = IO_DATA(IO_RECV, conn->id, conn->fd);
+		sqe->user_data = IO_DATA(IO_IGNORE, 0, 0);
+		conn->uring_ops |= CONN_OP_CANCEL;
+	}
 
-	if (!in) {
-		if (verbose_flag)
-			printf("%s %s [501 Not Implemented]\n", reqlines[0], reqlines[1]);
-		send(client_fd, NOT_IMPLEMENTED, CODE_501_LEN, 0);
-		send_file(client_fd, "partials/code-responses/501.html");
-		return;
+	if ((events & EPOLLOUT) && uring_sends(conn))
+		uring_send(conn);
+	if ((events & EPOLLOUT) && !uring_sends(conn) && !(conn->uring_ops & CONN_OP_POLL)) {
+		sqe = ur_get_sqe(_uring);
+		sqe->opcode = IORING_OP_POLL_ADD;
+		sqe->fd = conn->fd;
+		sqe->poll32_events = POLLOUT;
+		sqe->user_data = IO_DATA(IO_POLL, conn->id, conn->fd);
+		conn->uring_ops |= CONN_OP_POLL;
 	}
+	conn->events = events;
+}
 
-	const int fd = open(path, O_RDONLY);
+// Registers the events the connection currently needs: readable while it
+// accepts requests and is under the high watermark, writable while output is
+// queued or a TLS handshake waits to send
+void watch_connection(const Connection conn) {
+	struct epoll_event event;
 
-	if (fd != -1) {
-		if ((close(fd) == -1) && (verbose_flag))
-			printf(YELLOW "File Descriptor Error 1: %s\n" RESET, strerror(errno));
+	if ((conn->output.bytes >= _high_watermark) && !conn->paused) {
+		conn->paused = true;
+		_stats.backpressure_pauses++;
+	} else if (conn->output.bytes <= _low_watermark)
+		conn->paused = false;
 
-		if (verbose_flag)
-			printf(GREEN "GET %s [200 OK]\n" RESET, reqlines[1]);
-		send(client_fd, OK, CODE_200_LEN, 0);
-		const String extension = strrchr(path, '.');
+	event.events = (conn->output.bytes || (conn->tls && !tls_established(conn->tls) && tls_wants_write(conn->tls)))
+	               ? EPOLLOUT : 0;
+	event.data.fd = conn->fd;
 
-		if (strncmp(extension, ".php", PHP_EXT_LEN) == 0)
-			process_php(client_fd, path);
-		else
-			send_file(client_fd, path);
-	}
-	else if (errno == ENOENT) {
-		if (verbose_flag)
-			printf("GET %s [404 Not Found]\n", reqlines[1]);
-		send(client_fd, NOT_FOUND, CODE_404_LEN, 0);
-		send_file(client_fd, "partials/code-responses/404.html");
-	}
-	else if (errno == EACCES) {
-		if (verbose_flag)
-			printf(YELLOW "GET %s [403 Access Denied]\n" RESET, reqlines[1]);
-		send(client_fd, FORBIDDEN, CODE_403_LEN, 0);
-		send_file(client_fd, "partials/code-responses/403.html");
+	if (!conn->paused && (conn->state != CONN_DETACHED) && (conn->state != CONN_CLOSING))
+		event.events |= EPOLLIN;
+
+	if (_uring) {
+		uring_watch_connection(conn, event.events);
+		return;
 	}
-	else {
-		if (verbose_flag)
-			printf(RED "GET %s [500 Internal Server Error]\n" RESET, reqlines[1]);
-		send(client_fd, SERVER_ERROR, CODE_500_LEN, 0);
-		send_file(client_fd, "partials/code-responses/500.html");
+
+	if (event.events == conn->events)
+		return;
+
+	const int op = !conn->events ? EPOLL_CTL_ADD : (!event.events ? EPOLL_CTL_DEL : EPOLL_CTL_MOD);
+
+	if ((epoll_ctl(_epollfd, op, conn->fd, &event) == -1) && (verbose_flag))
+		printf(YELLOW "Epoll Error: %s\n" RESET, strerror(errno));
+	conn->events = event.events;
+}
+
+// Queued output runs on the write deadline, restarted whenever it makes
+// progress. Otherwise the deadline of the connection's phase applies; a
+// connection waiting for a shared backend run, or an HTTP/2 connection with
+// streams in progress, has none.
+void arm_connection(const Connection conn) {
+	if (conn->output.bytes)
+		arm_timer(conn, TIMEOUT_WRITE);
+	else if ((conn->state == CONN_DETACHED) || ((conn->state == CONN_H2) && h2_active_streams(conn->h2)))
+		tw_cancel(_wheel, &conn->timer);
+	else
+		arm_timer(conn, _phases[conn->state]);
+	watch_connection(conn);
+}
+
+// Requests still in flight hold a reference to the socket, so they are
+// cancelled before the close, which is queued on the ring behind them
+void uring_close(const int fd, const bool in_flight) {
+	struct io_uring_sqe *sqe;
+
+	if (in_flight) {
+		sqe = ur_get_sqe(_uring);
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->fd = fd;
+		sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+		sqe->flags = IOSQE_IO_HARDLINK;
+		sqe->user_data = IO_DATA(IO_IGNORE, 0, 0);
 	}
+	sqe = ur_get_sqe(_uring);
+	sqe->opcode = IORING_OP_CLOSE;
+	sqe->fd = fd;
+	sqe->user_data = IO_DATA(IO_IGNORE, 0, 0);
 }
 
-String *get_req_lines(String msg) { // Done
-	String *const reqline = (String*) malloc(REQLINE_TOKEN_AMT * sizeof(String));
+// Closes the pipe of a PHP run, reaps its process and drops it from the table.
+// Returns the exit status.
+int reap_php_fill(const unsigned int index) {
+	const php_fill_t fill = _fills[index];
+	int status = 0;
 
-	if (!reqline) {
-		fprintf(stderr, RED "Memory Error: %s\n" RESET, strerror(errno));
-		exit(EXIT_FAILURE);
+	if (_uring)
+		uring_close(fill.pipe_fd, fill.polled);
+	else if ((close(fill.pipe_fd) == -1) && (verbose_flag))
+		printf(YELLOW "Cache Pipe Descriptor Error: %s\n" RESET, strerror(errno));
+	waitpid(fill.pid, &status, 0);
+	_fills[index] = _fills[--_fill_cnt];
+
+	return status;
+}
+
+// Writes the captured request of the connection out, with the time its
+// response took
+void end_capture(const Connection conn, const bool complete) {
+	if (!conn->capture)
+		return;
+	cap_end(_capture, conn->capture, complete);
+	conn->capture = NULL;
+}
+
+// The last octet of the current response left the output queue
+void end_response(const Connection conn) {
+	TRACE(_trace, LAST_SENT, conn->id);
+	end_capture(conn, true);
+}
+
+void close_connection(const Connection conn) {
+	tw_cancel(_wheel, &conn->timer);
+	end_capture(conn, false);
+
+	// PHP runs still streaming to streams of the connection
+	if (conn->h2)
+		for (unsigned int i = _fill_cnt; i-- > 0; )
+			if (_fills[i].client_fd == conn->fd) {
+				kill(_fills[i].pid, SIGKILL);
+				reap_php_fill(i);
+			}
+
+	// Micro-cache fills the connection was parked on
+	for (unsigned int i = 0; i < _fill_cnt; i++)
+		if (_fills[i].entry)
+			mc_remove_waiter(_fills[i].entry, conn->fd);
+
+	if (conn->tls) {
+		tls_close(conn->tls, true);
+		conn->tls = conn->output.tls = NULL;
 	}
 
-	for (int i = 0; i < REQLINE_TOKEN_AMT; i++) {
-		reqline[i] = (String) calloc(REQLINE_LEN + NT_LEN, sizeof(char));
+	if (_uring) {
+		// Output queued right before the close, a GOAWAY for one, is tried once
+		if (conn->output.deferred && conn->output.bytes && !(conn->uring_ops & CONN_OP_SEND) && !conn->output.piped)
+			oq_flush(&conn->output, conn->fd);
+		uring_close(conn->fd, conn->uring_ops);
+	} else {
+		if (conn->events)
+			epoll_ctl(_epollfd, EPOLL_CTL_DEL, conn->fd, NULL);
 
-		if (!reqline[i]) {
-			fprintf(stderr, RED "Memory Error: %s\n" RESET, strerror(errno));
-			exit(EXIT_FAILURE);
-		}
+		if ((close(conn->fd) == -1) && (verbose_flag))
+			printf(YELLOW "Connection File Descriptor Error: %s\n" RESET, strerror(errno));
 	}
+	_connections[conn->fd] = NULL;
+	_stats.active--;
 
-	String tok = strtok(msg, " \t\n");
+	// The ring still reads the queued output, the last completion of the batch destroys it
+	if (conn->uring_ops & CONN_OP_SEND) {
+		conn->fd = -1;
+		return;
+	}
+	conn_destroy(conn);
+}
 
-	if (!tok)
-		return NULL;
+// Closes the connection once its last response has left the queue
+void finish_connection(const Connection conn) {
+	if (!conn->output.bytes) {
+		end_response(conn);
+		close_connection(conn);
+		return;
+	}
+	conn->state = CONN_CLOSING;
+	arm_connection(conn);
+}
 
-	strncpy(reqline[0], tok, (strnlen(tok, STR_MAX) + NT_LEN));
-	tok = strtok(NULL, " \t");
+// Writes the frames an HTTP/2 connection has ready and closes it once the
+// session is over. Returns NULL once the connection is closed.
+Connection flush_h2(const Connection conn) {
+	h2_flush(conn->h2);
 
-	if (!tok)
+	if (h2_finished(conn->h2)) {
+		finish_connection(conn);
 		return NULL;
+	}
+	arm_connection(conn);
 
-	strncpy(reqline[1], tok, (strnlen(tok, STR_MAX) + NT_LEN));
-	tok = strtok(NULL, " \t\n");
+	return conn;
+}
 
-	if (!tok)
-		return NULL;
+void build_cache_key(String *const reqlines, const String headers, String key) {
+	char vary[STR_MAX], value[HEADER_VALUE_LEN];
+	int len = snprintf(key, MC_KEY_LEN, "%s %s", reqlines[0], reqlines[1]);
 
-	strncpy(reqline[2], tok, (strnlen(tok, STR_MAX) + NT_LEN));
-	return reqline;
+	strncpy(vary, _mc_vary, STR_MAX);
+
+	for (String name = strtok(vary, ","); name && len < MC_KEY_LEN; name = strtok(NULL, ",")) {
+		if (!http_header_get(headers, name, value, HEADER_VALUE_LEN))
+			value[0] = '\0';
+		len += snprintf(key + len, MC_KEY_LEN - len, "\n%s:%s", name, value);
+	}
 }
 
-void free_req_lines(String *reqline) { // Done
-	if (!reqline)
+// Starts or stops watching the read end of a PHP pipe. epoll keeps the pipe
+// registered, io_uring needs a new single shot poll after every completion.
+void watch_php_fill(php_fill_t *const fill, const bool wanted) {
+	struct epoll_event event;
+
+	if (wanted == fill->polled)
 		return;
-	for (int i = 0; i < REQLINE_TOKEN_AMT; i++) {
-		if (!reqline[i])
-			continue;
-		free(reqline[i]);
-		reqline[i] = NULL;
+
+	if (_uring) {
+		if (!wanted) // The armed poll is left to fire, its completion is ignored
+			return;
+
+		struct io_uring_sqe *const sqe = ur_get_sqe(_uring);
+
+		sqe->opcode = IORING_OP_POLL_ADD;
+		sqe->fd = fill->pipe_fd;
+		sqe->poll32_events = POLLIN;
+		sqe->user_data = IO_DATA(IO_PIPE, fill->id, fill->pipe_fd);
+	} else {
+		event.events = EPOLLIN;
+		event.data.fd = fill->pipe_fd;
+		epoll_ctl(_epollfd, wanted ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, fill->pipe_fd, &event);
 	}
-	free(reqline);
-	reqline = NULL;
+	fill->polled = wanted;
 }
 
-void init_url_paths() {
-	s_ll_insert(_paths, "/", "static/html/index.html");
-	s_ll_insert(_paths, "/index", "static/html/index.html");
-	s_ll_insert(_paths, "/login", "views/login.php");
-	s_ll_insert(_paths, "/contact", "static/html/contact.html");
-	s_ll_insert(_paths, "/forbidden", "static/html/forbidden.html");
-}
+// Describes the request body to the PHP child the way CGI does, the spool file
+// becomes its standard input
+void export_body(const Connection conn) {
+	char value[HEADER_VALUE_LEN];
 
-void init_addrinfo(struct addrinfo *const addressinfo) { // Done
-	memset(addressinfo, 0, sizeof(*addressinfo));
-	(*addressinfo).ai_family = AF_INET6; // IPV4 & IPV6
-	(*addressinfo).ai_socktype = SOCK_STREAM; // TCP
-	(*addressinfo).ai_flags = AI_PASSIVE; // Gen socket
+	snprintf(value, HEADER_VALUE_LEN, "%llu", (unsigned long long) conn->body->len);
+	setenv("CONTENT_LENGTH", value, 1);
+	if (conn->body->type[0])
+		setenv("CONTENT_TYPE", conn->body->type, 1);
+	dup2(rb_rewind(conn->body), STDIN_FILENO);
 }
 
-int get_socket(int *const socketfd, struct addrinfo *const serviceinfo) { // Done
-	const short yes = 1;
-	const struct addrinfo *p;
+// Runs file_path through the PHP interpreter with its stdout on a pipe watched
+// by the event loop. Without a cache key the output is streamed to the client,
+// with one it is collected into a new micro-cache entry.
+response_t process_php(const int client_fd, const String file_path, const String key, const unsigned int ttl) {
+	int pipe_fds[2];
 
-	for (p = serviceinfo; p; p = p->ai_next) {
-		*socketfd = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
+	if ((_fill_cnt == MAX_PHP_FILLS) || (pipe2(pipe_fds, O_CLOEXEC) == -1)) {
+		if (verbose_flag)
+			printf(YELLOW "PHP Error: No backend slot available for %s\n" RESET, file_path);
+		send_buffer(client_fd, (Byte*) SERVER_ERROR, CODE_500_LEN);
+		send_file(client_fd, "partials/code-responses/500.html");
+		return RESP_CLOSE;
+	}
 
-		if (*socketfd == -1) {
-			if (verbose_flag)
-				printf(YELLOW "Socket Init Error: %s\n" RESET, strerror(errno));
-			continue;
-		}
+	const pid_t c_pid = fork();
 
-		if (setsockopt(*socketfd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(int)) == -1) {
-			fprintf(stderr, RED "Setsocket Error: %s\n" RESET, strerror(errno));
-			exit(EXIT_FAILURE);
-		}
+	if (c_pid == -1) {
+		const String err_msg = strerror(errno);
 
-		if (bind(*socketfd, p->ai_addr, p->ai_addrlen) == -1) {
-			if (verbose_flag)
-				printf(YELLOW "Bind Error: %s\n" RESET, strerror(errno));
-			if ((close(*socketfd) == -1) && (verbose_flag))
-				printf(YELLOW "Bind File Descriptor Error: %s\n" RESET, strerror(errno));
-			continue;
-		}
+		if (verbose_flag)
+			printf(YELLOW "Process Forking Error: %s\n" RESET, err_msg);
+		server_log(err_msg);
+		close(pipe_fds[0]);
+		close(pipe_fds[1]);
+		send_buffer(client_fd, (Byte*) SERVER_ERROR, CODE_500_LEN);
+		send_file(client_fd, "partials/code-responses/500.html");
+		return RESP_CLOSE;
+	}
 
-		break;
+	if (c_pid == 0) {
+		if (_connections[client_fd]->body)
+			export_body(_connections[client_fd]);
+		dup2(pipe_fds[1], STDOUT_FILENO);
+		execl("/usr/bin/php", "php", file_path, (String) NULL);
+		_exit(EXIT_FAILURE);
 	}
+	close(pipe_fds[1]);
+	// Only the read end, PHP itself writes to a blocking pipe
+	fcntl(pipe_fds[0], F_SETFL, O_NONBLOCK);
+
+	_fills[_fill_cnt].pipe_fd = pipe_fds[0];
+	_fills[_fill_cnt].pid = c_pid;
+	_fills[_fill_cnt].client_fd = key ? -1 : client_fd;
+	_fills[_fill_cnt].entry = key ? mc_begin_fill(_microcache, key) : NULL;
+	if (key)
+		mc_add_waiter(_fills[_fill_cnt].entry, client_fd, _connections[client_fd]->id);
+	_fills[_fill_cnt].ttl = ttl;
+	_fills[_fill_cnt].id = ++_io_serial;
+	_fills[_fill_cnt].stream = _h2_stream;
+	_fills[_fill_cnt].paused = false;
+	_fills[_fill_cnt].polled = false;
+	watch_php_fill(&_fills[_fill_cnt++], true);
+
+	if (!key)
+		send_buffer(client_fd, (Byte*) OK, CODE_200_LEN);
+
+	return RESP_DETACHED;
+}
 
-	freeaddrinfo(serviceinfo);
+response_t process_php_cached(const int client_fd, const String key, const String file_path, const unsigned int ttl) {
+	const Mc_Entry entry = mc_find(_microcache, key);
 
-	if (p)
-		return 0;
+	if (entry && entry->state == MC_READY) {
+		send_buffer(client_fd, (Byte*) OK, CODE_200_LEN);
+		send_buffer(client_fd, entry->body, entry->body_len);
+		return RESP_CLOSE;
+	}
 
-	return -1;
+	// Waiters are whole connections, an HTTP/2 stream runs the page on its own
+	if (_connections[client_fd]->h2)
+		return process_php(client_fd, file_path, NULL, ttl);
 
-}
+	if (entry) {
+		mc_add_waiter(entry, client_fd, _connections[client_fd]->id);
+		return RESP_DETACHED;
+	}
 
-void handle_sigint(const int arg) { // Done
-	sigint_flag = false;
+	return process_php(client_fd, file_path, key, ttl);
 }
 
-void init_signals(void) { // Done
-	struct sigaction new_action_int;
+void complete_php_fill(const unsigned int index) {
+	const php_fill_t fill = _fills[index];
+	const int status = reap_php_fill(index);
 
-	new_action_int.sa_handler = handle_sigint;
+	if (!fill.entry && _connections[fill.client_fd]->h2) {
+		h2_end(_connections[fill.client_fd]->h2, fill.stream);
+		flush_h2(_connections[fill.client_fd]);
+		return;
+	}
 
-	sigemptyset(&new_action_int.sa_mask);
-	new_action_int.sa_flags = 0;
+	if (!fill.entry) {
+		finish_connection(_connections[fill.client_fd]);
+		return;
+	}
 
-	if (sigaction(SIGINT, &new_action_int, NULL) == -1) {
-		fprintf(stderr, RED "Sigal Error: %s\n" RESET, strerror(errno));
-		exit(EXIT_FAILURE);
+	const bool success = WIFEXITED(status) && (WEXITSTATUS(status) == EXIT_SUCCESS);
+
+	for (unsigned int i = 0; i < fill.entry->waiter_cnt; i++) {
+		const int client_fd = fill.entry->waiters[i].fd;
+		const Connection conn = _connections[client_fd];
+
+		if (!conn || (conn->id != fill.entry->waiters[i].id)) // Closed, its descriptor maybe reused
+			continue;
+
+		if (success) {
+			send_buffer(client_fd, (Byte*) OK, CODE_200_LEN);
+			send_buffer(client_fd, fill.entry->body, fill.entry->body_len);
+		} else {
+			send_buffer(client_fd, (Byte*) SERVER_ERROR, CODE_500_LEN);
+			send_file(client_fd, "partials/code-responses/500.html");
+		}
+		finish_connection(conn);
 	}
+
+	if (success)
+		mc_finish_fill(_microcache, fill.entry, fill.ttl);
+	else
+		mc_abort_fill(_microcache, fill.entry);
 }
 
-bool is_image(const String restrict extension) {
-	const String img_ext[] = {".png", ".jpg", ".jpeg", ".tiff", ".gif", ".bmp", ".svg", ".ico"};
-	const size_t img_ext_len = sizeof(img_ext) / sizeof(String);
+// Stops the PHP run streaming to a client that went away or stopped reading
+void abort_php_fill(const Connection conn) {
+	for (unsigned int i = 0; i < _fill_cnt; i++)
+		if (_fills[i].client_fd == conn->fd) {
+			kill(_fills[i].pid, SIGKILL);
+			oq_clear(&conn->output);
+			complete_php_fill(i);
+			return;
+		}
+	close_connection(conn);
+}
 
-	for (unsigned int i = 0; i < img_ext_len; i++)
-		if (strncmp(extension, img_ext[i], CONF_EXT_LEN) == 0)
-			return true;
-	return false;
+// Stops reading a PHP pipe while its client is above the high watermark, so a
+// slow reader applies backpressure to the backend instead of growing the queue
+void throttle_php_fill(const Connection conn) {
+	for (unsigned int i = 0; i < _fill_cnt; i++)
+		if (_fills[i].client_fd == conn->fd) {
+			_fills[i].paused = conn->paused;
+			watch_php_fill(&_fills[i], !conn->paused);
+		}
 }
 
-bool is_audio(const String restrict extension) {
-	const String img_ext[] = {".wav", ".flac", ".opus", ".mp3", ".aac", ".ogg", ".pcm", ".aiff", ".wma", ".alac"};
-	const size_t img_ext_len = sizeof(img_ext) / sizeof(String);
+void read_php_fill(const int pipe_fd) {
+	Byte buffer[PACKET_MAX];
+	unsigned int i = 0;
 
-	for (unsigned int i = 0; i < img_ext_len; i++)
-		if (strncmp(extension, img_ext[i], CONF_EXT_LEN) == 0)
-			return true;
-	return false;
-}
+	while ((i < _fill_cnt) && (_fills[i].pipe_fd != pipe_fd))
+		i++;
+	if (i == _fill_cnt)
+		return;
 
-bool is_video(const String restrict extension) {
-	const String img_ext[] = {".mp4", ".mov", ".avi", ".flv", ".wmv"};
-	const size_t img_ext_len = sizeof(img_ext) / sizeof(String);
+	const ssize_t nbytes = read(pipe_fd, buffer, PACKET_MAX);
 
-	for (unsigned int i = 0; i < img_ext_len; i++)
-		if (strncmp(extension, img_ext[i], CONF_EXT_LEN) == 0)
-			return true;
-	return false;
-}
+	if (nbytes > 0) {
+		if (_fills[i].entry) {
+			mc_append(_fills[i].entry, buffer, nbytes);
+			return;
+		}
 
-bool is_binary(const String restrict extension) {
-	const String img_ext[] = {".exe", ".img", ".bin"};
-	const size_t img_ext_len = sizeof(img_ext) / sizeof(String);
+		const Connection conn = _connections[_fills[i].client_fd];
 
-	for (unsigned int i = 0; i < img_ext_len; i++)
-		if (strncmp(extension, img_ext[i], CONF_EXT_LEN) == 0)
-			return true;
-	return false;
+		_h2_stream = _fills[i].stream;
+
+		if (!send_buffer(conn->fd, buffer, nbytes)) {
+			if (conn->h2) { // Only the stream was reset, the connection goes on
+				kill(_fills[i].pid, SIGKILL);
+				complete_php_fill(i);
+			} else
+				abort_php_fill(conn);
+		} else if (!conn->h2 || flush_h2(conn)) {
+			arm_connection(conn);
+			throttle_php_fill(conn);
+		}
+	} else if ((nbytes == 0) || ((errno != EINTR) && (errno != EAGAIN)))
+		complete_php_fill(i);
 }
 
-void process_request(const int fd, String msg, const String ipv6_address) { // Done
-	char con_msg[CONNECTION_TEMPLATE_LEN + PATH_MAX],
-		 **const reqlines = get_req_lines(msg);
+// Timer callback for a connection that missed the deadline of its current
+// phase. A stalled socket is reset instead of closed so it does not sit in
+// TIME_WAIT; an idle keep-alive connection is closed gracefully.
+void expire_connection(void *const data) {
+	const Connection conn = (Connection) data;
+	const struct linger reset = {1, 0};
+	const bool idle = (conn->state == CONN_IDLE) || ((conn->state == CONN_H2) && !conn->output.bytes);
 
-	if (!reqlines) {
-		snprintf(con_msg, CONNECTION_TEMPLATE_LEN + INET6_ADDRSTRLEN, "Connection from %s; BAD REQUEST", ipv6_address);
+	_stats.expired[conn->output.bytes ? TIMEOUT_WRITE : _phases[conn->state]]++;
 
+	if (!idle) {
 		if (verbose_flag)
-			printf(YELLOW "%s\n" RESET, con_msg);
-		server_log(con_msg);
-		send(fd, BAD_REQUEST, CODE_400_LEN, 0);
-		send_file(fd, "partials/code-responses/400.html");
-	} else {
-		S_Ll_Node data;
-		const String restrict extension = strrchr(reqlines[1], '.');
-
-		if (extension) {
-			if (strncmp(extension, ".css", CONF_EXT_LEN) == 0)
-				strncat(_doc_root, "static/css/", PATH_MAX);
-			else if (strncmp(extension, ".js", CONF_EXT_LEN) == 0)
-				strncat(_doc_root, "static/javascript/", PATH_MAX);
-			else if (is_image(extension))
-				strncat(_doc_root, "static/images/", PATH_MAX);
-			else if (is_video(extension))
-				strncat(_doc_root, "static/video/", PATH_MAX);
-			else if (is_binary(extension))
-				strncat(_doc_root, "static/binary/", PATH_MAX);
-			else if (is_audio(extension))
-				strncat(_doc_root, "static/audio/", PATH_MAX);
-			strncat(_doc_root, reqlines[1], PATH_MAX);
-		}
-		else if ((data = s_ll_find(_paths, reqlines[1])))
-			strncat(_doc_root, data->path, PATH_MAX);
-		snprintf(con_msg, CONNECTION_TEMPLATE_LEN + PATH_MAX, CONNECTION_TEMPLATE, ipv6_address, reqlines[1]);
+			printf(YELLOW "Connection from %s timed out\n" RESET, conn->address);
+		setsockopt(conn->fd, SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+	}
 
-		if (verbose_flag)
-			printf("%s\n", con_msg);
-		server_log(con_msg);
-		respond(fd, reqlines, _doc_root);
+	if (conn->state == CONN_DETACHED)
+		abort_php_fill(conn);
+	else {
+		if (idle && conn->h2) // Tells the client no request was lost
+			h2_shutdown(conn->h2);
+		close_connection(conn);
 	}
-	free_req_lines(reqlines);
 }
 
-int main(const int argc, String *const argv) {
-	char ipv6_address[INET6_ADDRSTRLEN];
-	int masterfd, newfd;
-	struct addrinfo addressinfo, *serviceinfo;
-	struct sockaddr_in6 client_addr;
-	socklen_t sin_size = sizeof(client_addr); // Does this change with every connection?
-	const mode_t mode_d = 0770;
-
-	verbose_flag = true;
-	_paths = s_ll_create();
-	strncpy(_log_root, DEFAULT_LOG_ROOT, PATH_MAX);
-	strncpy(_db_path, DEFAULT_DB_ROOT, PATH_MAX);
+bool send_multipart(const int client_fd, const Fc_Entry file, const byte_range_t *const ranges, const int range_cnt,
+                    const String etag, const String last_modified, const bool keep_alive) {
+	char boundary[BOUNDARY_LEN], header[HEADER_BLOCK_LEN], parts[MAX_RANGES][PART_HEADER_LEN];
+	int part_lens[MAX_RANGES];
+	long long content_len;
 
-	init_signals();
-	if (argc > MAX_ARGS) {
-		printf(USAGE_MSG, basename(argv[0]));
-		exit(EXIT_FAILURE);
-	}
+	snprintf(boundary, BOUNDARY_LEN, "%08lx%08lx", (unsigned long) time(NULL), (unsigned long) random());
+	content_len = snprintf(NULL, 0, PART_CLOSE_TEMPLATE, boundary);
 
-	compute_flags(argc, argv, &verbose_flag);
-	if (!is_valid_port()) {
-		fprintf(stderr, RED "Port Error: Invalid port %s\n" RESET, _port);
-		exit(EXIT_FAILURE);
+	for (int i = 0; i < range_cnt; i++) {
+		part_lens[i] = snprintf(parts[i], PART_HEADER_LEN, PART_HEADER_TEMPLATE, boundary, file->mime,
+		                        (long long) ranges[i].first, (long long) ranges[i].last, (long long) file->file.st_size);
+		content_len += part_lens[i] + (ranges[i].last - ranges[i].first + 1);
 	}
 
-	if ((mkdir(_log_root, mode_d) == -1) && (verbose_flag))
-		if (errno != EEXIST) {
-			printf("Log Directory Error: %s\n", strerror(errno));
-			exit(EXIT_FAILURE);
-		}
+	const int len = snprintf(header, HEADER_BLOCK_LEN, PARTIAL_CONTENT_LINE "%s"
+	                         "Content-Type: multipart/byteranges; boundary=%s\r\nContent-Length: %lld\r\n"
+	                         VALIDATOR_HEADERS "\r\n", CONNECTION_HEADER(keep_alive), boundary, content_len,
+	                         last_modified, etag);
 
-	init_addrinfo(&addressinfo);
+	if (!send_buffer(client_fd, (Byte*) header, len))
+		return false;
 
-	if (getaddrinfo(NULL, _port, &addressinfo, &serviceinfo) != 0) {
-		fprintf(stderr, RED "Get Address Info Error: %s\n" RESET, gai_strerror(errno));
-		exit(EXIT_FAILURE);
-	}
+	for (int i = 0; i < range_cnt; i++)
+		if (!send_buffer(client_fd, (Byte*) parts[i], part_lens[i])
+		    || !send_range(client_fd, file->fd, ranges[i].first, ranges[i].last - ranges[i].first + 1))
+			return false;
 
-	if (get_socket(&masterfd, serviceinfo) == -1)
-		exit(EXIT_FAILURE);
+	return send_buffer(client_fd, (Byte*) header, snprintf(header, HEADER_BLOCK_LEN, PART_CLOSE_TEMPLATE, boundary));
+}
 
-	if (listen(masterfd, BACKLOG) == -1) {
-		fprintf(stderr, RED "Listen Error: %s\n" RESET, strerror(errno));
-		exit(EXIT_FAILURE);
+// Sends the gzip representation of a text file: a .gz sidecar that is at least
+// as new as the file itself, otherwise the body compressed once into the
+// compression cache. Returns the status code sent, 0 when the identity
+// encoding has to be used instead and -1 when the client is gone.
+int serve_gzip(const int client_fd, const String headers, const Fc_Entry file, const String etag, const String last_modified,
+               const bool keep_alive) {
+	char gz_path[PATH_MAX + CONF_EXT_LEN], gz_etag[SF_ETAG_LEN], header[HEADER_BLOCK_LEN];
+	const size_t etag_len = strnlen(etag, SF_ETAG_LEN);
+	bool sent;
+	int len;
+
+	// Each encoding is a separate representation and needs its own validator
+	snprintf(gz_etag, SF_ETAG_LEN, "%.*s-gz\"", (int) (etag_len - 1), etag);
+
+	if (sf_is_not_modified(headers, gz_etag, file->file.st_mtime)) {
+		len = snprintf(header, HEADER_BLOCK_LEN, NOT_MODIFIED_LINE "%sETag: %s\r\nLast-Modified: %s\r\n"
+		               "Vary: Accept-Encoding\r\n\r\n", CONNECTION_HEADER(keep_alive), gz_etag, last_modified);
+
+		return send_buffer(client_fd, (Byte*) header, len) ? 304 : -1;
 	}
 
-	init_url_paths();
+	// The sidecar lookup is cached like any other file, misses included
+	snprintf(gz_path, PATH_MAX + CONF_EXT_LEN, "%s.gz", file->path);
+	const Fc_Entry sidecar = fc_open(_file_cache, gz_path);
 
-	String msg = (String) malloc((MSG_LEN + NT_LEN) * sizeof(char));
+	if (!sidecar->error && (sidecar->file.st_mtime >= file->file.st_mtime)) {
+		len = snprintf(header, HEADER_BLOCK_LEN, OK_LINE "%sContent-Type: %s\r\nContent-Length: %lld\r\n" GZIP_HEADERS
+		               VALIDATOR_HEADERS "\r\n", CONNECTION_HEADER(keep_alive), file->mime, (long long) sidecar->file.st_size,
+		               last_modified, gz_etag);
+		sent = send_buffer(client_fd, (Byte*) header, len) && send_range(client_fd, sidecar->fd, 0, sidecar->file.st_size);
 
-	if (!msg) {
-		fprintf(stderr, RED "Memory Error: %s\n" RESET, strerror(errno));
-		exit(EXIT_FAILURE);
+		return sent ? 200 : -1;
 	}
 
-	if (verbose_flag)
-		printf(GREEN "Initialization: SUCCESS;\n"
-		       "Listening on port: %s\n"
-		       "Root directory is: %s\n"
-		       "Log root is: %s\n"
-		       "Using: %s\n" RESET,
-		       _port, _doc_root, _log_root, sqlite_get_version());
+	// Compressed whole on the event loop, so larger files go out as they are
+	if ((file->file.st_size < (off_t) _gz_min_bytes) || (file->file.st_size > (off_t) _gz_file_max_bytes))
+		return 0;
 
-	sqlite_exec("SELECT * FROM test;");
+	const Gz_Entry entry = gz_cache_get(_gz_cache, file->path, file->fd, &file->file);
 
-	const int default_root_len = strnlen(_doc_root, PATH_MAX);
+	if (!entry)
+		return 0;
 
-	while (sigint_flag) {
-		_doc_root[default_root_len] = '\0';
-		newfd = accept(masterfd, &client_addr, &sin_size);
+	len = snprintf(header, HEADER_BLOCK_LEN, OK_LINE "%sContent-Type: %s\r\nContent-Length: %lld\r\n" GZIP_HEADERS
+	               VALIDATOR_HEADERS "\r\n", CONNECTION_HEADER(keep_alive), file->mime, (long long) entry->data_len,
+	               last_modified, gz_etag);
+	sent = send_buffer(client_fd, (Byte*) header, len) && send_buffer(client_fd, entry->data, entry->data_len);
 
-		if (newfd == -1) {
-			const String err_msg = strerror(errno);
+	return sent ? 200 : -1;
+}
+
+// Answers conditional and range requests for a file on disk: 304 when the
+// client's validators still match, 206 for one or more byte ranges and 416 when
+// none of them overlap the file. Bodies are sent with sendfile() from the
+// descriptor held by the file cache.
+response_t serve_static(const int client_fd, String *const reqlines, const String headers, const Fc_Entry file, const bool keep_alive) {
+	char etag[SF_ETAG_LEN], last_modified[SF_HTTP_DATE_LEN], value[HEADER_VALUE_LEN], header[HEADER_BLOCK_LEN];
+	byte_range_t ranges[MAX_RANGES];
+	bool sent = true;
+	int len, status, range_cnt = 0;
+
+	sf_make_etag(&file->file, etag, weak_etag_flag);
+	sf_http_date(file->file.st_mtime, last_modified);
+
+	// Ranges are only served from the identity encoding
+	const bool gzip = compression_flag && gz_is_compressible(file->path) && gz_accepted(headers)
+	                  && !http_header_get(headers, "Range", value, HEADER_VALUE_LEN);
+
+	if (gzip && (status = serve_gzip(client_fd, headers, file, etag, last_modified, keep_alive))) {
+		if (verbose_flag)
+			printf(GREEN "GET %s [%d gzip]\n" RESET, reqlines[1], status);
+		sent = (status > 0);
+	} else if (sf_is_not_modified(headers, etag, file->file.st_mtime)) {
+		if (verbose_flag)
+			printf(GREEN "GET %s [304 Not Modified]\n" RESET, reqlines[1]);
+		len = snprintf(header, HEADER_BLOCK_LEN, NOT_MODIFIED_LINE "%sETag: %s\r\nLast-Modified: %s\r\n\r\n",
+		               CONNECTION_HEADER(keep_alive), etag, last_modified);
+		sent = send_buffer(client_fd, (Byte*) header, len);
+	} else {
+		if (http_header_get(headers, "Range", value, HEADER_VALUE_LEN) && sf_range_applies(headers, etag, file->file.st_mtime))
+			range_cnt = sf_parse_ranges(value, file->file.st_size, ranges, MAX_RANGES);
+
+		if (range_cnt == SF_UNSATISFIABLE) {
+			if (verbose_flag)
+				printf(YELLOW "GET %s [416 Range Not Satisfiable]\n" RESET, reqlines[1]);
+			len = snprintf(header, HEADER_BLOCK_LEN, RANGE_NOT_SATISFIABLE_LINE "%sContent-Range: bytes */%lld\r\n"
+			               "Content-Length: 0\r\n\r\n", CONNECTION_HEADER(keep_alive), (long long) file->file.st_size);
+			sent = send_buffer(client_fd, (Byte*) header, len);
+		} else if (range_cnt == 1) {
+			if (verbose_flag)
+				printf(GREEN "GET %s [206 Partial Content]\n" RESET, reqlines[1]);
+			len = snprintf(header, HEADER_BLOCK_LEN, PARTIAL_CONTENT_LINE "%sContent-Type: %s\r\n"
+			               "Content-Range: bytes %lld-%lld/%lld\r\nContent-Length: %lld\r\n" VALIDATOR_HEADERS "\r\n",
+			               CONNECTION_HEADER(keep_alive), file->mime, (long long) ranges[0].first, (long long) ranges[0].last,
+			               (long long) file->file.st_size, (long long) (ranges[0].last - ranges[0].first + 1), last_modified, etag);
+			sent = send_buffer(client_fd, (Byte*) header, len)
+			       && send_range(client_fd, file->fd, ranges[0].first, ranges[0].last - ranges[0].first + 1);
+		} else if (range_cnt > 1) {
+			if (verbose_flag)
+				printf(GREEN "GET %s [206 Partial Content]\n" RESET, reqlines[1]);
+			sent = send_multipart(client_fd, file, ranges, range_cnt, etag, last_modified, keep_alive);
+		} else {
+			len = snprintf(header, HEADER_BLOCK_LEN, OK_LINE "%sContent-Type: %s\r\nContent-Length: %lld\r\n%s"
+			               VALIDATOR_HEADERS "\r\n", CONNECTION_HEADER(keep_alive), file->mime, (long long) file->file.st_size,
+			               (compression_flag && gz_is_compressible(file->path)) ? "Vary: Accept-Encoding\r\n" : "",
+			               last_modified, etag);
+			sent = send_buffer(client_fd, (Byte*) header, len) && send_range(client_fd, file->fd, 0, file->file.st_size);
+		}
+	}
+
+	return sent ? RESP_KEEP : RESP_CLOSE;
+}
+
+// Answers from the table compiled into the binary: 304 when the validators
+// match, otherwise the whole body, gzip encoded if a variant was built. Byte
+// ranges are not served for built-in assets, which do not advertise them.
+response_t serve_asset(const int client_fd, String *const reqlines, const String headers, const Asset asset, const bool keep_alive) {
+	char header[HEADER_BLOCK_LEN];
+	const bool gzip = compression_flag && asset->gz_data && gz_accepted(headers);
+	const String etag = gzip ? asset->gz_etag : asset->etag;
+	int len;
+
+	if (sf_is_not_modified(headers, etag, asset->mtime)) {
+		if (verbose_flag)
+			printf(GREEN "GET %s [304 Not Modified, built-in]\n" RESET, reqlines[1]);
+		len = snprintf(header, HEADER_BLOCK_LEN, NOT_MODIFIED_LINE "%sETag: %s\r\n\r\n", CONNECTION_HEADER(keep_alive), etag);
+
+		return send_buffer(client_fd, (Byte*) header, len) ? RESP_KEEP : RESP_CLOSE;
+	}
+
+	if (verbose_flag)
+		printf(GREEN "GET %s [200 OK, built-in%s]\n" RESET, reqlines[1], gzip ? " gzip" : "");
+	len = snprintf(header, HEADER_BLOCK_LEN, OK_LINE "%s%s\r\n", CONNECTION_HEADER(keep_alive),
+	               gzip ? asset->gz_headers : asset->headers);
+
+	return (send_buffer(client_fd, (Byte*) header, len)
+	        && send_static(client_fd, gzip ? asset->gz_data : asset->data, gzip ? asset->gz_len : asset->len)) ? RESP_KEEP : RESP_CLOSE;
+}
+
+response_t serve_status(const int client_fd, const bool keep_alive) {
+	char body[STATUS_BODY_LEN], header[HEADER_BLOCK_LEN];
+	const int body_len = stats_render(body, STATUS_BODY_LEN);
+	const int len = snprintf(header, HEADER_BLOCK_LEN, OK_LINE "%sContent-Type: text/plain\r\nContent-Length: %d\r\n"
+	                         "Cache-Control: no-store\r\n\r\n", CONNECTION_HEADER(keep_alive), body_len);
+
+	return (send_buffer(client_fd, (Byte*) header, len) && send_buffer(client_fd, (Byte*) body, body_len)) ? RESP_KEEP : RESP_CLOSE;
+}
+
+// Appends a JSON string, NULL as null. Room is left for the punctuation
+// written around it.
+void append_json(String *const json, size_t *const len, size_t *const cap, const char *const value, const size_t value_len) {
+	if (*len + (value_len * JSON_ESCAPE_LEN) + JSON_SLACK > *cap) {
+		*cap = (*len + (value_len * JSON_ESCAPE_LEN) + JSON_SLACK) * 2;
+		*json = (String) realloc(*json, *cap);
+		if (!*json)
+			exit(EXIT_FAILURE);
+	}
+
+	if (!value) {
+		*len += sprintf(*json + *len, "null");
+		return;
+	}
+	(*json)[(*len)++] = '"';
+
+	for (size_t i = 0; i < value_len; i++) {
+		const unsigned char c = value[i];
+
+		if ((c == '"') || (c == '\\')) {
+			(*json)[(*len)++] = '\\';
+			(*json)[(*len)++] = c;
+		} else if (c < 0x20)
+			*len += sprintf(*json + *len, "\\u%04x", c);
+		else
+			(*json)[(*len)++] = c;
+	}
+	(*json)[(*len)++] = '"';
+	(*json)[*len] = '\0';
+}
+
+// The rows as a JSON array of objects keyed by column name, for the caller to
+// free
+String render_rows(const Sql_Rows rows, size_t *const len) {
+	size_t cap = KBYTE_S, value_len;
+	String json = (String) malloc(cap);
+	if (!json)
+		exit(EXIT_FAILURE);
+
+	*len = 0;
+	json[(*len)++] = '[';
+
+	for (unsigned int row = 0; row < rows->rows; row++) {
+		if (row)
+			json[(*len)++] = ',';
+		json[(*len)++] = '{';
+
+		for (unsigned int col = 0; col < rows->cols; col++) {
+			const char *const name = sql_rows_name(rows, col), *const value = sql_rows_value(rows, row, col, &value_len);
+
+			if (col)
+				json[(*len)++] = ',';
+			append_json(&json, len, &cap, name, strlen(name));
+			json[(*len)++] = ':';
+			append_json(&json, len, &cap, value, value ? value_len : 0);
+		}
+		json[(*len)++] = '}';
+	}
+	json[(*len)++] = ']';
+
+	return json;
+}
+
+// Answers a request that waited on the executor, then ends it as a PHP run ends
+void complete_rows(void *const context, const Sql_Rows rows, const int status) {
+	rows_request_t *const request = (rows_request_t*) context;
+	const Connection conn = _connections[request->fd];
+
+	if (!conn || (conn->id != request->id) || ((conn->state != CONN_DETACHED) && !conn->h2)) {
+		sql_rows_free(rows);
+		free(request);
+		return;
+	}
+	_h2_stream = request->stream;
+
+	if (rows) {
+		char header[HEADER_BLOCK_LEN];
+		size_t body_len;
+		const String body = render_rows(rows, &body_len);
+		const int len = snprintf(header, HEADER_BLOCK_LEN, OK_LINE "Content-Type: application/json\r\nContent-Length: %zu\r\n"
+		                         "Cache-Control: no-store\r\n\r\n", body_len);
+
+		if (send_buffer(conn->fd, (Byte*) header, len))
+			send_buffer(conn->fd, (Byte*) body, body_len);
+		free(body);
+		sql_rows_free(rows);
+	} else if ((status == SQLITE_INTERRUPT) || (status == SQLITE_BUSY))
+		send_buffer(conn->fd, (Byte*) SERVICE_UNAVAILABLE, CODE_503_LEN);
+	else {
+		send_buffer(conn->fd, (Byte*) SERVER_ERROR, CODE_500_LEN);
+		send_file(conn->fd, "partials/code-responses/500.html");
+	}
+	free(request);
+
+	if (conn->h2) {
+		h2_end(conn->h2, _h2_stream);
+		flush_h2(conn);
+	} else
+		finish_connection(conn);
+}
+
+// Hands the query of ROWS_PATH to the executor, the event loop goes on with
+// other connections until it completes
+response_t serve_rows(const int client_fd) {
+	rows_request_t *const request = (rows_request_t*) malloc(sizeof(rows_request_t));
+	if (!request)
+		exit(EXIT_FAILURE);
+
+	request->fd = client_fd;
+	request->id = _connections[client_fd]->id;
+	request->stream = _h2_stream;
+
+	if (!sqlite_submit(_sql_executor, ROWS_TIMEOUT_MS, complete_rows, request, "SELECT * FROM test LIMIT %d;", ROWS_MAX)) {
+		free(request);
+		send_buffer(client_fd, (Byte*) SERVER_ERROR, CODE_500_LEN);
+		send_file(client_fd, "partials/code-responses/500.html");
+		return RESP_CLOSE;
+	}
+
+	return RESP_DETACHED;
+}
+
+response_t respond(const int client_fd, String *const reqlines, const String path, const String headers, const S_Ll_Node route,
+                   const bool keep_alive) { // Done
+	if (!core_valid_request(reqlines)) {
+		if (verbose_flag)
+			printf("%s %s [400 Bad Request]\n", reqlines[0], reqlines[1]);
+		send_buffer(client_fd, (Byte*) BAD_REQUEST, CODE_400_LEN);
+		send_file(client_fd, "partials/code-responses/400.html");
+		return RESP_CLOSE;
+	}
+
+	// HTTP/2 is only spoken by connections that negotiated it
+	if ((strncmp(reqlines[2], "HTTP/2.0", HTTP_VER_LEN) == 0) && !_connections[client_fd]->h2) {
+		if (verbose_flag)
+			printf("GET %s %s [505 Http Version Not Supported]\n", reqlines[1], reqlines[2]);
+		send_buffer(client_fd, (Byte*) NOT_SUPPORTED, CODE_505_LEN);
+		send_file(client_fd, "partials/code-responses/505.html");
+		return RESP_CLOSE;
+	}
+
+	if (!core_implemented(reqlines[0])) {
+		if (verbose_flag)
+			printf("%s %s [501 Not Implemented]\n", reqlines[0], reqlines[1]);
+		send_buffer(client_fd, (Byte*) NOT_IMPLEMENTED, CODE_501_LEN);
+		send_file(client_fd, "partials/code-responses/501.html");
+		return RESP_CLOSE;
+	}
+
+	const Asset asset = asset_find(path);
+
+	if (asset && !asset_override_flag) {
+		TRACE(_trace, FILE_OPENED, _connections[client_fd]->id);
+		return serve_asset(client_fd, reqlines, headers, asset, keep_alive);
+	}
+
+	const Fc_Entry file = fc_open(_file_cache, path);
+
+	TRACE(_trace, FILE_OPENED, _connections[client_fd]->id);
+
+	if (file->error && asset) // Nothing on disk overrides it
+		return serve_asset(client_fd, reqlines, headers, asset, keep_alive);
+
+	if (!file->error) {
+		if (verbose_flag)
+			printf(GREEN "GET %s [200 OK]\n" RESET, reqlines[1]);
+		const String extension = strrchr(path, '.');
+
+		if (extension && (strncmp(extension, ".php", PHP_EXT_LEN) == 0)) {
+			char script[PATH_MAX * 2];
+
+			// The interpreter opens the script itself, by its absolute path
+			snprintf(script, sizeof(script), "%s%s", _doc_root, path);
+
+			// Only GET responses are shared, a POST always reaches the backend
+			if (microcache_flag && route && route->cache_ttl && (strncmp(reqlines[0], "GET", HTTP_METHOD_LEN) == 0)) {
+				char key[MC_KEY_LEN];
+
+				build_cache_key(reqlines, headers, key);
+				return process_php_cached(client_fd, key, script, route->cache_ttl);
+			}
+			return process_php(client_fd, script, NULL, 0);
+		} else
+			return serve_static(client_fd, reqlines, headers, file, keep_alive);
+	}
+	else if ((file->error == ENOENT) || (file->error == ENOTDIR) || (file->error == EISDIR)) {
+		if (verbose_flag)
+			printf("GET %s [404 Not Found]\n", reqlines[1]);
+		send_buffer(client_fd, (Byte*) NOT_FOUND, CODE_404_LEN);
+		send_file(client_fd, "partials/code-responses/404.html");
+	}
+	else if ((file->error == EACCES) || (file->error == EXDEV) || (file->error == ELOOP)) { // EXDEV: outside the root
+		if (verbose_flag)
+			printf(YELLOW "GET %s [403 Access Denied]\n" RESET, reqlines[1]);
+		send_buffer(client_fd, (Byte*) FORBIDDEN, CODE_403_LEN);
+		send_file(client_fd, "partials/code-responses/403.html");
+	}
+	else {
+		if (verbose_flag)
+			printf(RED "GET %s [500 Internal Server Error]\n" RESET, reqlines[1]);
+		send_buffer(client_fd, (Byte*) SERVER_ERROR, CODE_500_LEN);
+		send_file(client_fd, "partials/code-responses/500.html");
+	}
+
+	return RESP_CLOSE;
+}
+
+// Opens a listening socket for every entry of the comma separated list
+void open_listeners(const String list, const bool tls) {
+	char addresses[STR_MAX], error[STR_MAX];
+
+	snprintf(addresses, STR_MAX, "%s", list);
+
+	for (String address = strtok(addresses, ","); address; address = strtok(NULL, ",")) {
+		if (_listener_cnt == MAX_LISTENERS) {
+			fprintf(stderr, RED "Listen Error: More than %d addresses\n" RESET, MAX_LISTENERS);
+			exit(EXIT_FAILURE);
+		}
+
+		const int fd = listener_open(address, &_listen_options, error, STR_MAX);
+
+		if (fd == -1) {
+			fprintf(stderr, RED "%s (%s)\n" RESET, error, address);
+			exit(EXIT_FAILURE);
+		}
+		_listener_tls[_listener_cnt] = tls;
+		_listeners[_listener_cnt++] = fd;
+	}
+}
+
+// Opens one listening socket per entry of listen_addresses, or the wildcard
+// address on port when the list is not configured, followed by those of
+// tls_addresses. In upgrade mode the sockets of the running server are taken
+// over instead, in the same order; its configuration is expected to match.
+void init_listeners(void) {
+	char addresses[STR_MAX], error[STR_MAX];
+	unsigned int tls_cnt = 0;
+
+	if (upgrade_flag) {
+		const int fd_cnt = handoff_receive(_upgrade_socket, _listeners, MAX_LISTENERS, error, STR_MAX);
+
+		if (fd_cnt == -1) {
+			fprintf(stderr, RED "%s (%s)\n" RESET, error, _upgrade_socket);
+			exit(EXIT_FAILURE);
+		}
+		_listener_cnt = fd_cnt;
+
+		if (tls_flag) {
+			snprintf(addresses, STR_MAX, "%s", _tls_addresses);
+			for (String address = strtok(addresses, ","); address; address = strtok(NULL, ","))
+				tls_cnt++;
+		}
+
+		for (unsigned int i = (tls_cnt < _listener_cnt) ? _listener_cnt - tls_cnt : 0; i < _listener_cnt; i++)
+			_listener_tls[i] = true;
+		return;
+	}
+
+	if (_listen_addresses[0])
+		snprintf(addresses, STR_MAX, "%s", _listen_addresses);
+	else
+		snprintf(addresses, STR_MAX, "*:%s", _port);
+	open_listeners(addresses, false);
+
+	if (tls_flag)
+		open_listeners(_tls_addresses, true);
+}
+
+// The context every TLS listener accepts with, its certificate and key have
+// to load before the server starts
+void init_tls(void) {
+	char error[STR_MAX];
+
+	if (!tls_flag)
+		return;
+
+	if (!(_tls = tls_create(&_tls_options, error, STR_MAX))) {
+		fprintf(stderr, RED "%s (%s)\n" RESET, error, _tls_certificate);
+		exit(EXIT_FAILURE);
+	}
+}
+
+int listener_index(const int fd) {
+	for (unsigned int i = 0; i < _listener_cnt; i++)
+		if (_listeners[i] == fd)
+			return i;
+	return -1;
+}
+
+void handle_sigint(const int arg) { // Done
+	sigint_flag = false;
+}
+
+void handle_sigusr2(const int arg) {
+	trace_dump_flag = true;
+}
+
+void init_signals(void) { // Done
+	struct sigaction new_action_int;
+
+	new_action_int.sa_handler = handle_sigint;
+
+	sigemptyset(&new_action_int.sa_mask);
+	new_action_int.sa_flags = 0;
+
+	if (sigaction(SIGINT, &new_action_int, NULL) == -1) {
+		fprintf(stderr, RED "Sigal Error: %s\n" RESET, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	// Dumps the trace ring, the loop does the writing
+	new_action_int.sa_handler = handle_sigusr2;
+
+	if (sigaction(SIGUSR2, &new_action_int, NULL) == -1) {
+		fprintf(stderr, RED "Sigal Error: %s\n" RESET, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	// A peer closing mid response must fail the send instead of killing the server
+	new_action_int.sa_handler = SIG_IGN;
+
+	if (sigaction(SIGPIPE, &new_action_int, NULL) == -1) {
+		fprintf(stderr, RED "Sigal Error: %s\n" RESET, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+}
+
+response_t process_request(const int fd, String msg, const String ipv6_address, const bool keep_alive) { // Done
+	const String headers = strchr(msg, '\n');
+	char con_msg[CONNECTION_TEMPLATE_LEN + PATH_MAX];
+	String reqlines[CORE_REQLINE_TOKENS];
+	response_t response = RESP_CLOSE;
+
+	if (!core_request_line(msg, reqlines)) {
+		snprintf(con_msg, CONNECTION_TEMPLATE_LEN + INET6_ADDRSTRLEN, "Connection from %s; BAD REQUEST", ipv6_address);
+
+		if (verbose_flag)
+			printf(YELLOW "%s\n" RESET, con_msg);
+		server_log(con_msg);
+		send_buffer(fd, (Byte*) BAD_REQUEST, CODE_400_LEN);
+		send_file(fd, "partials/code-responses/400.html");
+	} else if (status_flag && (strncmp(reqlines[1], STATUS_PATH, PATH_MAX) == 0))
+		response = serve_status(fd, keep_alive);
+	else if (_sql_executor && (strncmp(reqlines[1], ROWS_PATH, PATH_MAX) == 0) && (strncmp(reqlines[0], "GET", HTTP_METHOD_LEN) == 0))
+		response = serve_rows(fd);
+	else {
+		char path[PATH_MAX];
+		const S_Ll_Node data = core_route(_paths, reqlines[1], path);
+
+		TRACE(_trace, ROUTED, _connections[fd]->id);
+		snprintf(con_msg, CONNECTION_TEMPLATE_LEN + PATH_MAX, CONNECTION_TEMPLATE, ipv6_address, reqlines[1]);
+
+		if (verbose_flag)
+			printf("%s\n", con_msg);
+		server_log(con_msg);
+		TRACE(_trace, LOGGED, _connections[fd]->id);
+		response = respond(fd, reqlines, path, headers ? headers + 1 : NULL, data, keep_alive);
+	}
+
+	return response;
+}
+
+bool wants_keep_alive(const String msg) {
+	return _timeouts[TIMEOUT_KEEPALIVE] && core_wants_keep_alive(msg);
+}
+
+void add_connection(const int newfd, const struct sockaddr_in6 *const client_addr, const bool tls) {
+	char ipv6_address[INET6_ADDRSTRLEN];
+
+	if ((unsigned int) newfd >= _max_connections) {
+		if (verbose_flag)
+			printf(YELLOW "Accept Error: Connection limit reached\n" RESET);
+		close(newfd);
+		return;
+	}
+
+	inet_ntop(AF_INET6, &client_addr->sin6_addr, ipv6_address, INET6_ADDRSTRLEN);
+
+	const Connection conn = conn_create(newfd, ipv6_address);
+
+	if (tls && !(conn->tls = tls_accept(_tls, newfd))) {
+		if (verbose_flag)
+			printf(YELLOW "TLS Error: No session for %s\n" RESET, conn->address);
+		close(newfd);
+		conn_destroy(conn);
+		return;
+	}
+	conn->id = ++_io_serial;
+	conn->output.deferred = (_uring != NULL);
+	conn->client = rl_client_key(&client_addr->sin6_addr);
+	conn->arrival_us = _admission ? ad_now_us() : 0; // Until the first segment reports its own
+	TRACE(_trace, ACCEPT, conn->id);
+	tw_init_timer(&conn->timer, expire_connection, conn);
+	watch_connection(conn);
+
+	if (!conn->events) {
+		close(newfd);
+		conn_destroy(conn);
+		return;
+	}
+	_connections[newfd] = conn;
+	_stats.accepted++;
+	_stats.active++;
+	arm_timer(conn, TIMEOUT_FIRST_BYTE);
+}
+
+// Drains the accept queue of a listener, at most ACCEPT_BATCH connections per
+// wakeup so a burst on one listener can not starve the others
+void accept_connection(const int listener) {
+	struct sockaddr_in6 client_addr;
+	const bool tls = _listener_tls[listener_index(listener)];
+
+	for (unsigned int i = 0; i < ACCEPT_BATCH; i++) {
+		socklen_t sin_size = sizeof(client_addr);
+		const int newfd = accept4(listener, (struct sockaddr*) &client_addr, &sin_size, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+		if (newfd == -1) {
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))
+				return;
+
+			const String err_msg = strerror(errno);
+
+			if (verbose_flag)
+				printf(YELLOW "Accept Error: %s\n" RESET, err_msg);
+			server_log(err_msg);
+			return;
+		}
+		add_connection(newfd, &client_addr, tls);
+	}
+}
+
+// Queues an accept on listener index slot / URING_ACCEPTS, registered as the
+// fixed file of the same index. URING_ACCEPTS single shot accepts stay in flight
+// per listener so a burst is taken in batches, each reporting its peer address
+// (a multishot accept can not); the re-arm rides along with the next submission.
+void uring_accept(const unsigned int slot) {
+	struct io_uring_sqe *const sqe = ur_get_sqe(_uring);
+
+	_accept_slots[slot].addr_len = sizeof(struct sockaddr_in6);
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->fd = slot / URING_ACCEPTS;
+	sqe->flags = IOSQE_FIXED_FILE;
+	sqe->addr = (uint64_t) (uintptr_t) &_accept_slots[slot].addr;
+	sqe->addr2 = (uint64_t) (uintptr_t) &_accept_slots[slot].addr_len;
+	sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+	sqe->user_data = IO_DATA(IO_ACCEPT, slot, 0);
+}
+
+// Opens the upgrade socket a replacing server connects to. A server that
+// can not open it keeps running, it just can not be upgraded gracefully.
+void init_upgrade_socket(void) {
+	char error[STR_MAX];
+
+	if (!_upgrade_socket[0])
+		return;
+
+	if ((_upgrade_fd = handoff_listen(_upgrade_socket, error, STR_MAX)) == -1) {
+		if (verbose_flag)
+			printf(YELLOW "%s (%s)\n" RESET, error, _upgrade_socket);
+		server_log(error);
+	}
+}
+
+void watch_upgrade_socket(void) {
+	struct epoll_event event;
+
+	if (_uring) {
+		struct io_uring_sqe *const sqe = ur_get_sqe(_uring);
+
+		sqe->opcode = IORING_OP_POLL_ADD;
+		sqe->fd = _upgrade_fd;
+		sqe->poll32_events = POLLIN;
+		sqe->user_data = IO_DATA(IO_UPGRADE, 0, 0);
+	} else {
+		event.events = EPOLLIN;
+		event.data.fd = _upgrade_fd;
+		epoll_ctl(_epollfd, EPOLL_CTL_ADD, _upgrade_fd, &event);
+	}
+}
+
+// Completions of the SQLite executor are announced on its eventfd
+void watch_sql_executor(void) {
+	const int fd = sqlite_executor_fd(_sql_executor);
+	struct epoll_event event;
+
+	if (_uring) {
+		struct io_uring_sqe *const sqe = ur_get_sqe(_uring);
+
+		sqe->opcode = IORING_OP_POLL_ADD;
+		sqe->fd = fd;
+		sqe->poll32_events = POLLIN;
+		sqe->user_data = IO_DATA(IO_SQL, 0, 0);
+	} else {
+		event.events = EPOLLIN;
+		event.data.fd = fd;
+		epoll_ctl(_epollfd, EPOLL_CTL_ADD, fd, &event);
+	}
+}
+
+// Stops accepting on every listener. The sockets stay open in the server that
+// took them over; on io_uring the accepts in flight on the fixed files are
+// cancelled so no connection lands here anymore.
+void stop_listening(void) {
+	for (unsigned int i = 0; i < _listener_cnt; i++) {
+		if (_uring) {
+			struct io_uring_sqe *const sqe = ur_get_sqe(_uring);
+
+			sqe->opcode = IORING_OP_ASYNC_CANCEL;
+			sqe->fd = i;
+			sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_FD_FIXED | IORING_ASYNC_CANCEL_ALL;
+			sqe->user_data = IO_DATA(IO_IGNORE, 0, 0);
+		} else
+			epoll_ctl(_epollfd, EPOLL_CTL_DEL, _listeners[i], NULL);
+		close(_listeners[i]);
+	}
+	_listener_cnt = 0;
+
+	if (!_uring)
+		epoll_ctl(_epollfd, EPOLL_CTL_DEL, _upgrade_fd, NULL);
+	close(_upgrade_fd);
+	_upgrade_fd = -1;
+}
+
+// A replacing server connected to the upgrade socket: the caches are written
+// to the snapshot it loads, the listening sockets are handed over and this
+// server drains. Kept-alive connections without a request are closed, the
+// others are answered with Connection: close and the loop ends once none is
+// left.
+void handle_upgrade(void) {
+	char error[STR_MAX];
+
+	if (_snapshot_path[0] && !snapshot_save(_snapshot_path, _microcache, _gz_cache) && verbose_flag)
+		printf(YELLOW "Snapshot Warning: Could not write %s\n" RESET, _snapshot_path);
+
+	if (!handoff_send(_upgrade_fd, _listeners, _listener_cnt, error, STR_MAX)) {
+		if (verbose_flag)
+			printf(YELLOW "%s\n" RESET, error);
+		server_log(error);
+
+		if (_uring)
+			watch_upgrade_socket();
+		return;
+	}
+
+	stop_listening();
+	draining_flag = true;
+
+	for (unsigned int fd = 0; fd < _max_connections; fd++)
+		if (_connections[fd] && (_connections[fd]->state == CONN_IDLE))
+			close_connection(_connections[fd]);
+		else if (_connections[fd] && (_connections[fd]->state == CONN_H2)) { // Ends once its streams are answered
+			h2_shutdown(_connections[fd]->h2);
+			flush_h2(_connections[fd]);
+		}
+
+	if (verbose_flag)
+		puts(GREEN "Upgrade: Listening sockets handed over, draining" RESET);
+}
+
+void dump_trace(void) {
+	trace_dump_flag = false;
+
+	if (!_trace)
+		return;
+
+	if (trace_dump(_trace, _trace_path)) {
+		if (verbose_flag)
+			printf(GREEN "Trace: Written to %s\n" RESET, _trace_path);
+	} else {
+		const String err_msg = strerror(errno);
+
+		if (verbose_flag)
+			printf(YELLOW "Trace Error: %s (%s)\n" RESET, err_msg, _trace_path);
+		server_log(err_msg);
+	}
+}
+
+// The loops run until SIGINT, or after an upgrade until the last connection
+// and backend run of this server are done
+bool is_serving(void) {
+	return sigint_flag && !(draining_flag && (_stats.active == 0) && (_fill_cnt == 0));
+}
+
+// Route class of a request from a scan of its target alone: PHP pages, named
+// directly or through a route, are dynamic and everything else is static
+rl_class_t request_class(const String request) {
+	char target[REQLINE_LEN + NT_LEN];
+	const String start = strchr(request, ' ');
+
+	if (!start)
+		return RL_STATIC;
+
+	const size_t len = strcspn(start + 1, " \t\r\n?");
+
+	if (len > REQLINE_LEN)
+		return RL_STATIC;
+
+	memcpy(target, start + 1, len);
+	target[len] = '\0';
+
+	const S_Ll_Node route = strrchr(target, '.') ? NULL : s_ll_find(_paths, target);
+	const String extension = strrchr(route ? route->path : target, '.');
+
+	return (extension && (strncmp(extension, ".php", PHP_EXT_LEN + NT_LEN) == 0)) ? RL_DYNAMIC : RL_STATIC;
+}
+
+// Rate limit and admission of a request from its header block alone, so a
+// refused request costs no body, file lookup or PHP run. The queue delay runs
+// from the arrival of the segment that started the request.
+admit_t admit_request(const Connection conn, const String request) {
+	if (!_rate_limiter && !_admission)
+		return ADMIT_OK;
+
+	const rl_class_t class = request_class(request);
+
+	if (_rate_limiter && !rl_allow(_rate_limiter, conn->client, class, tw_now_ms())) {
+		_stats.rate_limited++;
+		return ADMIT_LIMITED;
+	}
+
+	if (_admission) {
+		const uint64_t now_us = ad_now_us();
+
+		if (!ad_admit(_admission, class, (now_us > conn->arrival_us) ? now_us - conn->arrival_us : 0, tw_now_ms())) {
+			if (class == RL_DYNAMIC)
+				_stats.shed_dynamic++;
+			else
+				_stats.shed_static++;
+			return ADMIT_SHED;
+		}
+	}
+
+	return ADMIT_OK;
+}
+
+// Answers a refused HTTP/1 request, the connection closes
+void refuse_request(const Connection conn, const admit_t admit) {
+	tw_cancel(_wheel, &conn->timer);
+	_stats.requests++;
+	TRACE(_trace, PARSED, conn->id);
+
+	if (admit == ADMIT_LIMITED)
+		send_buffer(conn->fd, (Byte*) TOO_MANY_REQUESTS, CODE_429_LEN);
+	else
+		send_buffer(conn->fd, (Byte*) SERVICE_UNAVAILABLE, CODE_503_LEN);
+	finish_connection(conn);
+}
+
+// Admits an HTTP/2 request once its header block arrived, a refused stream is
+// answered and ended before its body is spooled
+void admit_stream(const Connection conn, const uint32_t stream, const String request) {
+	// The request an h2c upgrade carries over was admitted as HTTP/1 already
+	const admit_t admit = ((stream == 1) && conn->h2->upgraded) ? ADMIT_OK : admit_request(conn, request);
+
+	if (admit == ADMIT_OK)
+		return;
+
+	_h2_stream = stream;
+	conn->responding = false;
+	_stats.requests++;
+	_stats.h2_streams++;
+	TRACE(_trace, PARSED, conn->id);
+
+	if (admit == ADMIT_LIMITED)
+		send_buffer(conn->fd, (Byte*) TOO_MANY_REQUESTS, CODE_429_LEN);
+	else
+		send_buffer(conn->fd, (Byte*) SERVICE_UNAVAILABLE, CODE_503_LEN);
+	h2_end(conn->h2, stream);
+}
+
+// Answers one request of an HTTP/2 connection through the same routing as
+// HTTP/1, the session frames what the response writes. Its body is the
+// connection's for the time of the call, like an HTTP/1 body. A stream waiting
+// for a PHP run is ended by the run.
+void dispatch_stream(const Connection conn, const uint32_t stream, const String request, const Request_Body body,
+                     const rb_status_t status) {
+	char value[HEADER_VALUE_LEN];
+
+	_h2_stream = stream;
+	conn->responding = false;
+	_stats.requests++;
+	_stats.h2_streams++;
+	TRACE(_trace, PARSED, conn->id);
+
+	if (status == RB_TOO_LARGE) {
+		send_buffer(conn->fd, (Byte*) PAYLOAD_TOO_LARGE, CODE_413_LEN);
+		h2_end(conn->h2, stream);
+		return;
+	}
+
+	if (status != RB_COMPLETE) {
+		send_buffer(conn->fd, (Byte*) SERVER_ERROR, CODE_500_LEN);
+		send_file(conn->fd, "partials/code-responses/500.html");
+		h2_end(conn->h2, stream);
+		return;
+	}
+
+	if (body && http_header_get(strchr(request, '\n') + 1, "Content-Type", value, HEADER_VALUE_LEN))
+		snprintf(body->type, RB_TYPE_LEN, "%.*s", RB_TYPE_LEN - NT_LEN, value);
+	conn->body = body;
+
+	const response_t response = process_request(conn->fd, request, conn->address, true);
+
+	if (conn->body) { // A PHP run holds its own descriptor of the spool file
+		rb_destroy(conn->body);
+		conn->body = NULL;
+	}
+
+	if (response != RESP_DETACHED)
+		h2_end(conn->h2, stream);
+}
+
+// Runs the frames in the buffer through the session, answers the requests they
+// complete and keeps an incomplete frame for the next read. Returns NULL once
+// the connection is closed.
+Connection process_h2(const Connection conn) {
+	const ssize_t used = h2_input(conn->h2, (Byte*) conn->buffer, conn->buffer_len);
+	Request_Body body;
+	rb_status_t status;
+	String request;
+	uint32_t stream;
+
+	if (used == -1) {
+		if (verbose_flag)
+			printf(YELLOW "Connection from %s; HTTP/2 protocol error\n" RESET, conn->address);
+		finish_connection(conn);
+		return NULL;
+	}
+	conn->buffer_len -= used;
+	memmove(conn->buffer, conn->buffer + used, conn->buffer_len);
+	conn->buffer[conn->buffer_len] = '\0';
+
+	while ((stream = h2_next_request(conn->h2, &request)))
+		admit_stream(conn, stream, request);
+	while ((stream = h2_next_complete(conn->h2, &request, &body, &status)))
+		dispatch_stream(conn, stream, request, body, status);
+
+	return flush_h2(conn);
+}
+
+// Switches a connection to HTTP/2, with an input buffer that holds a whole frame
+void start_h2(const Connection conn, const H2_Session session) {
+	conn->h2 = session;
+	conn->state = CONN_H2;
+	_stats.h2_connections++;
+	conn_hold_buffer(conn, H2_INPUT_LEN);
+}
+
+// Answers an HTTP/1.1 request asking for h2c with 101 and carries it on as
+// stream 1 of the new session. The upgrade is declined, and the request
+// answered over HTTP/1, when it has a body or its settings do not decode.
+bool upgrade_to_h2(const Connection conn, const size_t header_len) {
+	char value[HEADER_VALUE_LEN], settings[HEADER_VALUE_LEN];
+	const String line_end = strchr(conn->buffer, '\n');
+
+	if (draining_flag || !line_end || !http_header_get(line_end + 1, "Upgrade", value, HEADER_VALUE_LEN)
+	    || !strcasestr(value, "h2c") || !http_header_get(line_end + 1, "HTTP2-Settings", settings, HEADER_VALUE_LEN))
+		return false;
+
+	const H2_Session session = h2_create(conn->fd, &conn->output, _high_watermark, _spool_dir, _body_max_bytes);
+
+	if (!h2_upgrade(session, settings, conn->buffer, header_len)) {
+		h2_destroy(session);
+		return false;
+	}
+	oq_send_buffer(&conn->output, conn->fd, (Byte*) SWITCHING_PROTOCOLS, CODE_101_LEN); // Ahead of the session's first frame
+	start_h2(conn, session);
+
+	return true;
+}
+
+// An HTTP/1 connection with no input pending gives its receive buffer back,
+// the next request takes one from the pool again
+void release_input(const Connection conn) {
+	if (!conn->buffer_len && !conn->h2)
+		conn_drop_buffer(conn);
+}
+
+// Answers the request held in the first header_len bytes of the buffer and
+// drops consumed bytes from it. Returns NULL once the connection is closed or
+// handed over to a pending backend run.
+Connection dispatch_request(const Connection conn, const size_t header_len, const size_t consumed) {
+	const bool keep_alive = wants_keep_alive(conn->buffer) && !draining_flag;
+	const char next = conn->buffer[header_len];
+
+	tw_cancel(_wheel, &conn->timer);
+	conn->buffer[header_len] = '\0';
+
+	if ((consumed == header_len) && !conn->body && upgrade_to_h2(conn, header_len)) {
+		conn->buffer[header_len] = next;
+		conn->buffer_len -= consumed;
+		memmove(conn->buffer, conn->buffer + consumed, conn->buffer_len);
+		conn->buffer[conn->buffer_len] = '\0';
+		return process_h2(conn);
+	}
+
+	conn->responding = false;
+	_stats.requests++;
+	TRACE(_trace, PARSED, conn->id);
+
+	if (_capture && cap_sampled(_capture, conn->id)) {
+		end_capture(conn, true); // A pipelined response still draining
+		conn->capture = cap_begin(_capture, conn->id, (Byte*) conn->buffer, header_len, conn->body ? conn->body->fd : -1,
+		                          conn->body ? conn->body->len : 0, conn->body && conn->body->chunked);
+	}
+
+	if (_listen_options.push == PUSH_CORK)
+		listener_cork(conn->fd, true);
+
+	const response_t response = process_request(conn->fd, conn->buffer, conn->address, keep_alive);
+
+	if (conn->body) { // A PHP run holds its own descriptor of the spool file
+		rb_destroy(conn->body);
+		conn->body = NULL;
+	}
+
+	if (_listen_options.push == PUSH_CORK) // Pushes what the response wrote as full segments
+		listener_cork(conn->fd, false);
+
+	if (response == RESP_DETACHED) {
+		conn->state = CONN_DETACHED;
+		arm_connection(conn);
+		return NULL;
+	}
+
+	if ((response == RESP_CLOSE) || !keep_alive) {
+		finish_connection(conn);
+		return NULL;
+	}
+
+	if (!conn->output.bytes)
+		end_response(conn);
+
+	conn->buffer[header_len] = next;
+	conn->buffer_len -= consumed;
+	memmove(conn->buffer, conn->buffer + consumed, conn->buffer_len);
+	conn->buffer[conn->buffer_len] = '\0';
+
+	if (conn->buffer_len > 0) { // Pipelined, its wait starts once the one before it is answered
+		conn->state = CONN_HEADERS;
+		_stats.keepalive_reuses++;
+		if (_admission)
+			conn->arrival_us = ad_now_us();
+	} else {
+		conn->state = CONN_IDLE;
+		release_input(conn);
+	}
+	arm_connection(conn);
+
+	return conn;
+}
+
+// Ends a request whose body could not be received, the connection closes
+void reject_body(const Connection conn, const rb_status_t status) {
+	if (status == RB_CLOSED) {
+		close_connection(conn);
+		return;
+	}
+
+	if (verbose_flag)
+		printf(YELLOW "Connection from %s; Request body %s\n" RESET, conn->address,
+		       (status == RB_TOO_LARGE) ? "too large" : (status == RB_INVALID) ? "malformed" : "not spooled");
+
+	if (status == RB_TOO_LARGE)
+		send_buffer(conn->fd, (Byte*) PAYLOAD_TOO_LARGE, CODE_413_LEN);
+	else if (status == RB_INVALID) {
+		send_buffer(conn->fd, (Byte*) BAD_REQUEST, CODE_400_LEN);
+		send_file(conn->fd, "partials/code-responses/400.html");
+	} else {
+		send_buffer(conn->fd, (Byte*) SERVER_ERROR, CODE_500_LEN);
+		send_file(conn->fd, "partials/code-responses/500.html");
+	}
+	finish_connection(conn);
+}
+
+// Starts receiving the body of the request in the first header_len bytes of
+// the buffer into a spool file. A client waiting for 100 Continue is told to
+// go on unless the announced length is refused outright. Body octets already
+// in the buffer are written out, the rest is spliced from the socket in the
+// CONN_BODY state. Returns NULL once the connection is closed.
+Connection receive_body(const Connection conn, const size_t header_len, const bool chunked, const uint64_t content_len) {
+	char value[HEADER_VALUE_LEN];
+	const String line_end = strchr(conn->buffer, '\n');
+	size_t used = 0;
+
+	if (content_len > _body_max_bytes) {
+		reject_body(conn, RB_TOO_LARGE);
+		return NULL;
+	}
+
+	if (!(conn->body = rb_create(_spool_dir, chunked, content_len, _body_max_bytes))) {
+		if (verbose_flag)
+			printf(YELLOW "Spool File Error: %s\n" RESET, strerror(errno));
+		reject_body(conn, RB_FAILED);
+		return NULL;
+	}
+
+	if (http_header_get(line_end + 1, "Content-Type", value, HEADER_VALUE_LEN))
+		snprintf(conn->body->type, RB_TYPE_LEN, "%.*s", RB_TYPE_LEN - NT_LEN, value);
+
+	if ((conn->buffer_len == header_len) && http_header_get(line_end + 1, "Expect", value, HEADER_VALUE_LEN)
+	    && (strcasecmp(value, "100-continue") == 0))
+		oq_send_buffer(&conn->output, conn->fd, (Byte*) CONTINUE, CODE_100_LEN); // Not the response itself
+
+	const rb_status_t status = rb_feed(conn->body, (Byte*) conn->buffer + header_len, conn->buffer_len - header_len, &used);
+
+	if (status == RB_COMPLETE)
+		return dispatch_request(conn, header_len, header_len + used);
+
+	if (status != RB_MORE) {
+		reject_body(conn, status);
+		return NULL;
+	}
+
+	conn->header_len = header_len;
+	conn->buffer_len = header_len;
+	conn->buffer[header_len] = '\0';
+	conn->state = CONN_BODY;
+	arm_connection(conn);
+
+	return conn;
+}
+
+// Dispatches every complete request in the buffer, more than one when the
+// client pipelines, until the output queue reaches the high watermark. A
+// request body is waited for before the request is answered. Returns NULL once
+// the connection is closed or handed over.
+Connection parse_connection(Connection conn) {
+	while (conn && (conn->state == CONN_HEADERS) && !conn->paused) {
+		// HTTP/2 with prior knowledge opens with its connection preface
+		if (strncmp(conn->buffer, H2_PREFACE, (conn->buffer_len < H2_PREFACE_LEN) ? conn->buffer_len : H2_PREFACE_LEN) == 0) {
+			if (conn->buffer_len < H2_PREFACE_LEN)
+				return conn;
+			start_h2(conn, h2_create(conn->fd, &conn->output, _high_watermark, _spool_dir, _body_max_bytes));
+			return process_h2(conn);
+		}
+
+		size_t header_len;
+
+		if (!core_header_end(conn->buffer, &header_len)) {
+			if (conn->buffer_len == conn->buffer_size) {
+				if (verbose_flag)
+					printf(YELLOW "Connection from %s; Request header too large\n" RESET, conn->address);
+				send_buffer(conn->fd, (Byte*) BAD_REQUEST, CODE_400_LEN);
+				send_file(conn->fd, "partials/code-responses/400.html");
+				finish_connection(conn);
+				return NULL;
+			}
+			return conn;
+		}
+
+		const admit_t admit = admit_request(conn, conn->buffer);
+
+		if (admit != ADMIT_OK) { // Before its body is received
+			refuse_request(conn, admit);
+			return NULL;
+		}
+
+		uint64_t content_len;
+		bool chunked;
+
+		if (core_request_framing(conn->buffer, &chunked, &content_len))
+			conn = receive_body(conn, header_len, chunked, content_len);
+		else
+			conn = dispatch_request(conn, header_len, header_len);
+	}
+
+	return conn;
+}
+
+void end_of_input(const Connection conn, const bool eof) {
+	// Only reachable with io_uring, where a receive can complete after the
+	// connection stopped reading. The response in progress finishes on its own.
+	if (conn->paused || (conn->state == CONN_DETACHED) || (conn->state == CONN_CLOSING))
+		return;
+
+	// A client that half-closes after an unterminated request is still answered
+	if (eof && (conn->state == CONN_HEADERS)) {
+		const admit_t admit = admit_request(conn, conn->buffer);
+
+		if (admit != ADMIT_OK)
+			refuse_request(conn, admit);
+		else
+			dispatch_request(conn, conn->buffer_len, conn->buffer_len);
+	} else
+		close_connection(conn);
+}
+
+// Feeds data received by the io_uring backend, or decrypted by OpenSSL,
+// through the state machine read_connection() drives. A chunk can end one
+// request body and start the next request, so it is consumed piecewise.
+// Returns NULL once the connection is closed or handed over.
+Connection consume_input(Connection conn, const char *data, size_t len) {
+	while (conn && (len > 0)) {
+		if ((conn->state == CONN_DETACHED) || (conn->state == CONN_CLOSING))
+			return conn; // Read past the last request of the connection
+
+		if (conn->state == CONN_BODY) { // Already copied out of the kernel, written as it is
+			size_t used = 0;
+			const rb_status_t status = rb_feed(conn->body, (Byte*) data, len, &used);
+
+			if ((status != RB_COMPLETE) && (status != RB_MORE)) {
+				reject_body(conn, status);
+				return NULL;
+			}
+			data += used;
+			len -= used;
+
+			if (status == RB_COMPLETE)
+				conn = dispatch_request(conn, conn->header_len, conn->header_len);
+			else
+				arm_connection(conn);
+			continue;
+		}
+
+		conn_hold_buffer(conn, MSG_LEN);
+
+		const size_t space = conn->buffer_size - conn->buffer_len;
+		const size_t chunk = (len < space) ? len : space;
+
+		// A full buffer that parses is only left behind while the output drains
+		if (chunk == 0) {
+			close_connection(conn);
+			return NULL;
+		}
+
+		if ((conn->state != CONN_HEADERS) && (conn->state != CONN_H2)) {
+			if (conn->state == CONN_IDLE)
+				_stats.keepalive_reuses++;
+			TRACE(_trace, FIRST_BYTE, conn->id);
+			if (_admission && (conn->state == CONN_IDLE)) // Receives carry no kernel time stamps here
+				conn->arrival_us = ad_now_us();
+			conn->state = CONN_HEADERS;
+			arm_connection(conn);
+		}
+		if (_admission && (conn->state == CONN_H2)) // Receives carry no kernel time stamps here
+			conn->arrival_us = ad_now_us();
+		memcpy(conn->buffer + conn->buffer_len, data, chunk);
+		conn->buffer_len += chunk;
+		conn->buffer[conn->buffer_len] = '\0';
+		data += chunk;
+		len -= chunk;
+		conn = (conn->state == CONN_H2) ? process_h2(conn) : parse_connection(conn);
+	}
+
+	return conn;
+}
+
+// Records are decrypted into a buffer that is fed through consume_input().
+// Decrypted octets OpenSSL still holds raise no event, so they are read on.
+void read_tls(Connection conn) {
+	char data[TLS_RECORD_LEN];
+
+	do {
+		const ssize_t nbytes = tls_read(conn->tls, (Byte*) data, TLS_RECORD_LEN);
+
+		if ((nbytes == -1) && (errno == EAGAIN))
+			return;
+
+		if (nbytes <= 0) {
+			end_of_input(conn, nbytes == 0);
+			return;
+		}
+		conn = consume_input(conn, data, nbytes);
+	} while (conn && (conn->events & EPOLLIN) && tls_pending(conn->tls));
+}
+
+// Drives the handshake of a TLS connection, on the first byte deadline. When
+// kTLS takes the negotiated cipher the kernel encrypts from then on and
+// responses keep using send() and sendfile(), otherwise the output queue
+// encrypts through OpenSSL.
+void handshake_connection(const Connection conn) {
+	const tls_result_t result = tls_handshake(conn->tls);
+
+	if (result == TLS_FAILED) {
+		_stats.tls_failures++;
+		if (verbose_flag)
+			printf(YELLOW "TLS Error: Handshake with %s failed\n" RESET, conn->address);
+		close_connection(conn);
+		return;
+	}
+
+	if (result == TLS_AGAIN) {
+		watch_connection(conn);
+		return;
+	}
+	_stats.tls_handshakes++;
+
+	if (tls_resumed(conn->tls))
+		_stats.tls_resumed++;
+	if (tls_kernel_send(conn->tls))
+		_stats.tls_kernel_send++;
+	else {
+		conn->output.tls = conn->tls;
+		conn->output.deferred = false;
+	}
+	watch_connection(conn);
+	read_tls(conn); // A request that came with the client's last flight
+}
+
+void read_connection(const Connection conn) {
+	ssize_t nbytes;
+
+	if (conn->tls) {
+		if (tls_established(conn->tls))
+			read_tls(conn);
+		else
+			handshake_connection(conn);
+		return;
+	}
+
+	if (conn->state == CONN_BODY) { // Straight from the socket into the spool file
+		const rb_status_t status = rb_splice(conn->body, conn->fd);
+
+		if (status == RB_COMPLETE)
+			dispatch_request(conn, conn->header_len, conn->header_len);
+		else if (status == RB_MORE)
+			arm_connection(conn);
+		else
+			reject_body(conn, status);
+		return;
+	}
+
+	conn_hold_buffer(conn, MSG_LEN);
+
+	// First bytes of a request, or frames that may open HTTP/2 streams
+	if (_admission && ((conn->state == CONN_ACCEPTED) || (conn->state == CONN_IDLE) || (conn->state == CONN_H2)))
+		nbytes = ad_recv(conn->fd, conn->buffer + conn->buffer_len, conn->buffer_size - conn->buffer_len, &conn->arrival_us);
+	else
+		nbytes = recv(conn->fd, conn->buffer + conn->buffer_len, conn->buffer_size - conn->buffer_len, MSG_DONTWAIT);
+
+	if ((nbytes == -1) && ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))) {
+		release_input(conn);
+		return;
+	}
+
+	if (nbytes <= 0) {
+		end_of_input(conn, nbytes == 0);
+		return;
+	}
+
+	if ((conn->state != CONN_HEADERS) && (conn->state != CONN_H2)) {
+		if (conn->state == CONN_IDLE)
+			_stats.keepalive_reuses++;
+		TRACE(_trace, FIRST_BYTE, conn->id);
+		conn->state = CONN_HEADERS;
+		arm_connection(conn);
+	}
+	conn->buffer_len += nbytes;
+	conn->buffer[conn->buffer_len] = '\0';
+
+	if (conn->state == CONN_H2)
+		process_h2(conn);
+	else
+		parse_connection(conn);
+}
+
+// Follows up on output that left the queue: ends the response once the queue
+// drained, closes a closing connection and resumes what waited for room
+void output_written(const Connection conn, const bool progress, const bool paused) {
+	if (progress && !conn->output.bytes && (conn->state != CONN_DETACHED))
+		end_response(conn);
+
+	if (!conn->output.bytes && (conn->state == CONN_CLOSING)) {
+		close_connection(conn);
+		return;
+	}
+
+	if (conn->state == CONN_H2) { // Frames held back for the queue to drain
+		if (flush_h2(conn))
+			throttle_php_fill(conn);
+		return;
+	}
+
+	if (progress)
+		arm_connection(conn);
+
+	if (conn->state == CONN_DETACHED)
+		throttle_php_fill(conn);
+	else if (paused && !conn->paused)
+		parse_connection(conn); // Requests pipelined while the output drained
+}
+
+void write_connection(const Connection conn) {
+	const size_t queued = conn->output.bytes;
+	const bool paused = conn->paused;
+
+	if (conn->tls && !tls_established(conn->tls)) {
+		handshake_connection(conn);
+		return;
+	}
+
+	if (uring_sends(conn)) { // Polled after the ring found the socket full
+		uring_send(conn);
+		return;
+	}
+
+	if (!oq_flush(&conn->output, conn->fd)) {
+		if (conn->state == CONN_DETACHED)
+			abort_php_fill(conn);
+		else
+			close_connection(conn);
+		return;
+	}
+	output_written(conn, conn->output.bytes < queued, paused);
+}
+
+void init_event_loop(void) {
+	struct rlimit fd_limit;
+	struct epoll_event event;
+
+	if (getrlimit(RLIMIT_NOFILE, &fd_limit) == -1) {
+		fprintf(stderr, RED "Resource Limit Error: %s\n" RESET, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	_max_connections = ((fd_limit.rlim_cur == RLIM_INFINITY) || (fd_limit.rlim_cur > MAX_FDS)) ? MAX_FDS : fd_limit.rlim_cur;
+	_connections = (Connection*) calloc(_max_connections, sizeof(Connection));
+
+	if (!_connections) {
+		fprintf(stderr, RED "Memory Error: %s\n" RESET, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	_wheel = tw_create(TW_RESOLUTION_MS);
+
+	if (uring_flag) {
+		_uring = ur_create(URING_ENTRIES, URING_BUFFERS, MSG_LEN);
+
+		if (_uring && !ur_register_files(_uring, _listeners, _listener_cnt)) {
+			ur_destroy(_uring);
+			_uring = NULL;
+		}
+
+		if (_uring) {
+			for (unsigned int slot = 0; slot < _listener_cnt * URING_ACCEPTS; slot++)
+				uring_accept(slot);
+			return;
+		}
+
+		if (verbose_flag)
+			puts(YELLOW "io_uring Warning: Not available, using epoll" RESET);
+	}
+
+	if ((_epollfd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+		fprintf(stderr, RED "Epoll Error: %s\n" RESET, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	event.events = EPOLLIN;
+
+	for (unsigned int i = 0; i < _listener_cnt; i++) {
+		event.data.fd = _listeners[i];
+
+		if (epoll_ctl(_epollfd, EPOLL_CTL_ADD, _listeners[i], &event) == -1) {
+			fprintf(stderr, RED "Epoll Error: %s\n" RESET, strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+	}
+}
+
+void run_epoll_loop(void) {
+	struct epoll_event events[MAX_EVENTS];
+
+	while (is_serving()) {
+		if (trace_dump_flag)
+			dump_trace();
+
+		const int nready = epoll_wait(_epollfd, events, MAX_EVENTS, tw_next_timeout(_wheel, tw_now_ms()));
+
+		if (nready == -1) {
+			if (errno != EINTR) {
+				const String err_msg = strerror(errno);
+
+				if (verbose_flag)
+					printf(YELLOW "Epoll Error: %s\n" RESET, err_msg);
+				server_log(err_msg);
+			}
+			continue;
+		}
+
+		for (int i = 0; i < nready; i++) {
+			const int fd = events[i].data.fd;
+
+			if (listener_index(fd) != -1)
+				accept_connection(fd);
+			else if (fd == _upgrade_fd)
+				handle_upgrade();
+			else if (_sql_executor && (fd == sqlite_executor_fd(_sql_executor)))
+				sqlite_executor_complete(_sql_executor);
+			else if (((unsigned int) fd < _max_connections) && _connections[fd]) {
+				if (events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP))
+					write_connection(_connections[fd]);
+				if (_connections[fd] && (_connections[fd]->events & EPOLLIN) && (events[i].events & EPOLLIN))
+					read_connection(_connections[fd]);
+			} else
+				read_php_fill(fd);
+		}
+		tw_advance(_wheel, tw_now_ms());
+	}
+}
+
+// Completion of a send or splice queued by uring_send(). The last one of the
+// batch follows up on the output as write_connection() does, or destroys the
+// connection when it was closed in the meantime.
+void uring_sent(const io_tag_t tag, const Connection conn, const int res) {
+	Out_Queue const output = &conn->output;
+
+	if (res > 0)
+		conn->uring_ops |= CONN_OP_SENT;
+	else if (res == -EAGAIN)
+		conn->uring_ops |= CONN_OP_BLOCKED;
+	else if (res != -ECANCELED) // A file that shrank splices nothing
+		conn->uring_ops |= CONN_OP_FAILED;
+
+	if ((tag == IO_SEND) || (tag == IO_SEND_LAST))
+		oq_sent(output, (res > 0) ? res : 0);
+	else if (tag == IO_SPLICE_IN) {
+		if (res > 0)
+			oq_piped(output, res);
+		return;
+	} else
+		oq_unpiped(output, (res > 0) ? res : 0);
+
+	if (tag == IO_SEND)
+		return;
+
+	const unsigned int ops = conn->uring_ops;
+
+	conn->uring_ops &= ~(CONN_OP_SEND | CONN_OP_SENT | CONN_OP_BLOCKED | CONN_OP_FAILED);
+	output->in_flight = 0;
+
+	if (conn->fd == -1)
+		conn_destroy(conn);
+	else if ((ops & CONN_OP_FAILED) && (conn->state == CONN_DETACHED))
+		abort_php_fill(conn);
+	else if (ops & CONN_OP_FAILED)
+		close_connection(conn);
+	else if (ops & CONN_OP_BLOCKED) { // Sent on again once the socket has room
+		struct io_uring_sqe *const sqe = ur_get_sqe(_uring);
+
+		sqe->opcode = IORING_OP_POLL_ADD;
+		sqe->fd = conn->fd;
+		sqe->poll32_events = POLLOUT;
+		sqe->user_data = IO_DATA(IO_POLL, conn->id, conn->fd);
+		conn->uring_ops |= CONN_OP_POLL;
+		if (ops & CONN_OP_SENT)
+			output_written(conn, true, conn->paused);
+	} else if (ops & CONN_OP_SENT)
+		output_written(conn, true, conn->paused);
+	else
+		watch_connection(conn);
+}
+
+void uring_completion(const struct io_uring_cqe *const cqe) {
+	const int fd = IO_FD(cqe->user_data);
+	const uint32_t id = IO_ID(cqe->user_data);
+	const Connection conn = ((unsigned int) fd < _max_connections) ? _connections[fd] : NULL;
+	const bool current = conn && (conn->id == id);
+	unsigned int i = 0;
+
+	switch (IO_TAG(cqe->user_data)) {
+	case IO_ACCEPT:
+		if (cqe->res >= 0)
+			add_connection(cqe->res, &_accept_slots[id].addr, _listener_tls[id / URING_ACCEPTS]);
+		else if (cqe->res != -ECANCELED) {
+			const String err_msg = strerror(-cqe->res);
 
 			if (verbose_flag)
 				printf(YELLOW "Accept Error: %s\n" RESET, err_msg);
 			server_log(err_msg);
-			continue;
 		}
+		if (!draining_flag)
+			uring_accept(id);
+		return;
+	case IO_RECV:
+		if (current && !(cqe->flags & IORING_CQE_F_MORE))
+			conn->uring_ops &= ~(CONN_OP_RECV | CONN_OP_CANCEL);
+
+		if (cqe->flags & IORING_CQE_F_BUFFER) {
+			const unsigned int buffer = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+
+			if (current)
+				consume_input(conn, (char*) ur_buffer(_uring, buffer), cqe->res);
+			ur_recycle_buffer(_uring, buffer);
+		} else if (current && (cqe->res != -ENOBUFS) && (cqe->res != -ECANCELED))
+			end_of_input(conn, cqe->res == 0);
+		break;
+	case IO_POLL:
+		if (current) {
+			conn->uring_ops &= ~CONN_OP_POLL;
+			write_connection(conn);
+		}
+		break;
+	case IO_READY:
+		if (current) {
+			conn->uring_ops &= ~CONN_OP_READY;
+			if (conn->events & EPOLLIN)
+				read_connection(conn);
+		}
+		break;
+	case IO_UPGRADE:
+		if (_upgrade_fd != -1)
+			handle_upgrade();
+		return;
+	case IO_SQL:
+		sqlite_executor_complete(_sql_executor);
+		watch_sql_executor();
+		return;
+	case IO_SEND:
+	case IO_SEND_LAST:
+	case IO_SPLICE_IN:
+	case IO_SPLICE_OUT:
+		uring_sent(IO_TAG(cqe->user_data), IO_CONN(cqe->user_data), cqe->res);
+		return;
+	case IO_PIPE:
+		while ((i < _fill_cnt) && (_fills[i].id != id))
+			i++;
+		if (i == _fill_cnt)
+			return;
+		_fills[i].polled = false;
+
+		if (!_fills[i].paused) {
+			read_php_fill(fd);
+
+			// The fill may have completed or moved within the array
+			i = 0;
+			while ((i < _fill_cnt) && (_fills[i].id != id))
+				i++;
+			if ((i < _fill_cnt) && !_fills[i].paused)
+				watch_php_fill(&_fills[i], true);
+		}
+		return;
+	default:
+		return;
+	}
+
+	// Re-arms what the completion ended, unless the connection is gone
+	if (current && _connections[fd] && (_connections[fd]->id == id))
+		watch_connection(conn);
+}
+
+// One io_uring_enter per iteration submits everything the previous iteration
+// queued and collects the completions
+void run_uring_loop(void) {
+	struct io_uring_cqe cqe;
 
-		inet_ntop(AF_INET6, &(((struct sockaddr_in6*)&client_addr)->sin6_addr), ipv6_address, INET6_ADDRSTRLEN);
+	while (is_serving()) {
+		if (trace_dump_flag)
+			dump_trace();
 
-		if (recv(newfd, msg, MSG_LEN, 0) > 0)
-			process_request(newfd, msg, ipv6_address);
-		else {
+		if ((ur_wait(_uring, tw_next_timeout(_wheel, tw_now_ms())) == -1) && (errno != EINTR) && (errno != ETIME)
+		    && (errno != EBUSY)) {
 			const String err_msg = strerror(errno);
 
 			if (verbose_flag)
-				printf(YELLOW "Inboud Data Read Error: %s\n" RESET, err_msg);
+				printf(YELLOW "io_uring Error: %s\n" RESET, err_msg);
 			server_log(err_msg);
 		}
+
+		while (ur_next_cqe(_uring, &cqe))
+			uring_completion(&cqe);
+		tw_advance(_wheel, tw_now_ms());
 	}
-	s_ll_destroy(_paths);
+}
+
+int main(const int argc, String *const argv) {
+	const mode_t mode_d = 0770;
+
+	verbose_flag = true;
+	_paths = s_ll_create();
+	strncpy(_log_root, DEFAULT_LOG_ROOT, PATH_MAX);
+	strncpy(_db_path, DEFAULT_DB_ROOT, PATH_MAX);
+
+	init_signals();
+	if (argc > MAX_ARGS) {
+		printf(USAGE_MSG, basename(argv[0]));
+		exit(EXIT_FAILURE);
+	}
+
+	compute_flags(argc, argv, &verbose_flag);
+	if (!is_valid_port()) {
+		fprintf(stderr, RED "Port Error: Invalid port %s\n" RESET, _port);
+		exit(EXIT_FAILURE);
+	}
+
+	if ((mkdir(_log_root, mode_d) == -1) && (verbose_flag))
+		if (errno != EEXIST) {
+			printf("Log Directory Error: %s\n", strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+
+	init_tls();
+	init_listeners();
+	core_default_routes(_paths);
+
+	if (lr_enabled(&_log_policy) && !lr_start(_log_root, &_log_policy) && verbose_flag)
+		printf(YELLOW "Log Retention Error: Housekeeping thread not started\n" RESET);
+
+	if (_rate_limits[RL_STATIC].rate || _rate_limits[RL_DYNAMIC].rate)
+		_rate_limiter = rl_create(_rl_slots, _rate_limits);
+	if (_trace_events)
+		_trace = trace_create(_trace_events);
+	if ((_capture_rate > 0.0) && !(_capture = cap_open(_capture_path, _capture_rate)) && verbose_flag)
+		printf(YELLOW "Capture Error: %s (%s)\n" RESET, strerror(errno), _capture_path);
+
+	if (_budgets[RL_STATIC].target_us || _budgets[RL_DYNAMIC].target_us) {
+		_admission = ad_create(_budgets);
+
+		for (unsigned int i = 0; i < _listener_cnt; i++)
+			if (!ad_stamp_arrivals(_listeners[i]) && verbose_flag)
+				printf(YELLOW "Admission Warning: No arrival time stamps, %s\n" RESET, strerror(errno));
+	}
+
+	if (!(_file_cache = fc_create(_doc_root, DEFAULT_FC_BINS, _fc_entries, _fc_ttl_ms))) {
+		fprintf(stderr, RED "Document Root Error: %s (%s)\n" RESET, _fc_entries < 2 ? "file_cache_entries below 2"
+		        : strerror(errno), _doc_root);
+		exit(EXIT_FAILURE);
+	}
+	init_event_loop();
+	init_upgrade_socket();
+
+	if (_upgrade_fd != -1)
+		watch_upgrade_socket();
+
+	if (microcache_flag)
+		_microcache = mc_create(DEFAULT_MC_BINS, _mc_max_bytes);
+	if (compression_flag)
+		_gz_cache = gz_cache_create(DEFAULT_GZ_BINS, _gz_max_bytes);
+
+	if (_snapshot_path[0] && (_microcache || _gz_cache)) {
+		const int records = snapshot_load(_snapshot_path, _microcache, _gz_cache);
+
+		if ((records != -1) && verbose_flag)
+			printf(GREEN "Snapshot: %d cache entries restored\n" RESET, records);
+	}
+
+	if (verbose_flag)
+		printf(GREEN "Initialization: SUCCESS;\n"
+		       "Listening on: %s\n"
+		       "Root directory is: %s\n"
+		       "Log root is: %s\n"
+		       "I/O backend: %s\n"
+		       "Using: %s\n" RESET,
+		       upgrade_flag ? "sockets taken over" : (_listen_addresses[0] ? _listen_addresses : _port), _doc_root, _log_root, _uring ? "io_uring" : "epoll", sqlite_get_version());
+
+	bp_init(_pool_max_bytes);
+	sqlite_cache_init(_qc_max_bytes);
+	sqlite_exec("SELECT * FROM test;");
+
+	if (_sql_threads) {
+		if ((_sql_executor = sqlite_executor_create(_sql_threads)))
+			watch_sql_executor();
+		else if (verbose_flag)
+			printf(YELLOW "SQLite Executor Error: %s\n" RESET, strerror(errno));
+	}
+
+	if (_uring)
+		run_uring_loop();
+	else
+		run_epoll_loop();
 
-	if ((close(masterfd) == -1) && (verbose_flag))
-		printf(YELLOW "Master File Descriptor Error: %s\n" RESET, strerror(errno));
-	free(msg);
-	msg = NULL;
+	for (unsigned int fd = 0; fd < _max_connections; fd++)
+		if (_connections[fd])
+			close_connection(_connections[fd]);
+	s_ll_destroy(_paths);
+	bp_trim();
+	if (_sql_executor)
+		sqlite_executor_destroy(_sql_executor);
+	sqlite_close();
+	lr_stop();
+
+	if (_microcache)
+		mc_destroy(_microcache);
+	if (_gz_cache)
+		gz_cache_destroy(_gz_cache);
+	fc_destroy(_file_cache);
+	if (_rate_limiter)
+		rl_destroy(_rate_limiter);
+	if (_admission)
+		ad_destroy(_admission);
+	if (_trace) {
+		dump_trace();
+		trace_destroy(_trace);
+	}
+	if (_capture)
+		cap_close(_capture);
+	if (_tls)
+		tls_destroy(_tls);
+	tw_destroy(_wheel);
+	free(_connections);
+	_connections = NULL;
+
+	if (_uring) {
+		ur_submit(_uring); // The queued closes
+		ur_destroy(_uring);
+	} else if ((close(_epollfd) == -1) && (verbose_flag))
+		printf(YELLOW "Epoll File Descriptor Error: %s\n" RESET, strerror(errno));
+
+	for (unsigned int i = 0; i < _listener_cnt; i++)
+		if ((close(_listeners[i]) == -1) && (verbose_flag))
+			printf(YELLOW "Listener File Descriptor Error: %s\n" RESET, strerror(errno));
+
+	if (_upgrade_fd != -1) { // Not handed over, nobody else uses the path
+		close(_upgrade_fd);
+		unlink(_upgrade_socket);
+	}
 
 	return EXIT_SUCCESS;
 }
-
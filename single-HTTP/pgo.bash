@@ -0,0 +1,122 @@
+#!/bin/bash
+
+# Builds single-HTTP with profile guided and link time optimization, see
+# make pgo. A plain production build records pgo/workload.http as a capture,
+# an instrumented build is trained by replaying it, and the build that uses
+# the profile is timed against the plain one on the same capture. Work files
+# go to pgo-data/, the optimized binary replaces single-HTTP.
+#
+# The speedup is reported in the CPU time of the server, which a PHP
+# interpreter does not add to, and in the time the replays took.
+# PGO_PORT (8890), PGO_ROUNDS (20, times the workload is recorded),
+# PGO_RUNS (10, replays timed per build) and PGO_CONNECTIONS (8, replay
+# connections at once) change the defaults.
+
+set -e
+
+port=${PGO_PORT:-8890}
+rounds=${PGO_ROUNDS:-20}
+runs=${PGO_RUNS:-10}
+connections=${PGO_CONNECTIONS:-8}
+data=$PWD/pgo-data
+profile=$data/profile
+
+# $1: extra compiler flags, $2: name of the binary in pgo-data
+build() {
+	rm -f *.o
+	make production PGO_FLAGS="$1"
+	mv single-HTTP "$data/$2"
+}
+
+# $1: binary in pgo-data, $2: configuration file
+serve() {
+	"$data/$1" -s "$2" > /dev/null 2>&1 &
+	pid=$!
+
+	# Listening once it answers
+	for _ in $(seq 50); do
+		(exec 3<> /dev/tcp/127.0.0.1/$port) 2> /dev/null && return
+		sleep 0.1
+	done
+
+	echo "pgo.bash: $1 is not listening on port $port" >&2
+	exit 1
+}
+
+# Written on a clean exit, the profile of an instrumented build among others
+stop() {
+	kill -INT $pid
+	wait $pid || true
+	pid=""
+}
+
+# Prints the seconds the replays took and the CPU seconds the server spent
+# on them, PHP and the other children it ran aside
+measure() {
+	local wall=0
+
+	serve "$1" "$data/serve.conf"
+	for _ in $(seq "$runs"); do
+		local seconds=$(./replay -p "$port" -s 0 -c "$connections" "$data/capture" | sed -n 's/^replayed .* in \([0-9.]*\) s .*/\1/p')
+
+		wall=$(awk -v a="$wall" -v b="$seconds" 'BEGIN { print a + b }')
+	done
+
+	# Fields 14 and 15 of the stat file are the user and system time, in clock ticks
+	local cpu=$(awk -v hz="$(getconf CLK_TCK)" '{ print ($14 + $15) / hz }' /proc/$pid/stat)
+
+	stop
+	echo "$wall $cpu"
+}
+
+trap '[[ $pid ]] && kill -INT $pid' EXIT # A server left running would hold the port
+
+rm -rf "$data"
+mkdir -p "$data/logs"
+make replay
+
+cat > "$data/serve.conf" << EOF
+port=$port
+document_root=$PWD/
+log_root=$data/logs/
+database_path=$data/db.sqlite3
+EOF
+cat "$data/serve.conf" - > "$data/record.conf" << EOF
+capture_path=$data/capture
+capture_sample_rate=1
+EOF
+
+build "" single-HTTP-plain
+
+echo "Recording pgo/workload.http $rounds times"
+mapfile -t sessions < <(grep -v -e '^#' -e '^$' pgo/workload.http)
+trap '' PIPE # A connection may close before all of its requests were written
+serve single-HTTP-plain "$data/record.conf"
+for _ in $(seq "$rounds"); do
+	for session in "${sessions[@]}"; do
+		exec 3<> /dev/tcp/127.0.0.1/$port
+		printf '%b' "$session" >&3 || true
+		cat <&3 > /dev/null || true
+		exec 3<&-
+	done
+done
+stop
+
+build "-fprofile-generate=$profile -fprofile-update=prefer-atomic" single-HTTP-instrumented
+
+echo "Training"
+serve single-HTTP-instrumented "$data/serve.conf"
+./replay -p "$port" -s 0 -c "$connections" "$data/capture" > /dev/null
+stop
+
+build "-fprofile-use=$profile -fprofile-partial-training -Wno-missing-profile -flto=auto" single-HTTP-pgo
+rm -f *.o
+
+plain=$(measure single-HTTP-plain)
+pgo=$(measure single-HTTP-pgo)
+cp "$data/single-HTTP-pgo" single-HTTP
+
+echo "$plain $pgo" | awk -v runs="$runs" '{
+	printf "%d replays of the capture  production %7.3f s  pgo %7.3f s  %.2fx\n", runs, $1, $3, $1 / $3
+	printf "server CPU time            production %7.3f s  pgo %7.3f s  %.2fx\n", $2, $4, $4 ? $2 / $4 : 0
+}'
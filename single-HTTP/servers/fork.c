@@ -0,0 +1,181 @@
+#include <poll.h>
+#include <errno.h>
+#include <stdio.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "../globals.h"
+#include "../lib/core/core.h"
+#include "../lib/logging/log.h"
+#include "../lib/types/types.h"
+#include "../lib/colors/colors.h"
+#include "../lib/listener/listener.h"
+
+// fork-HTTP: a process per connection, forked after the accept, which serves
+// the socket with blocking calls through the core and exits. The parent only
+// accepts and reaps, and waits while max_workers children run; the kernel
+// queues the rest in the listen backlog. A child shares nothing it could
+// corrupt, a crash costs one connection. On SIGINT the parent stops
+// accepting and waits for the children.
+
+#define PORT_MIN 0
+#define PORT_MAX 65536
+#define POLL_MS 100
+
+Core _core = NULL;
+unsigned int _active = 0;
+
+bool sigint_flag = true, verbose_flag = false;
+char _log_root[PATH_MAX + NT_LEN], _db_path[PATH_MAX + NT_LEN];
+
+void handle_sigint(const int arg) {
+	sigint_flag = false;
+}
+
+void handle_sigchld(const int arg) { // Interrupts the wait for the listener, children are reaped there
+}
+
+void init_signals(void) {
+	struct sigaction new_action_int, new_action_chld, new_action_pipe;
+
+	new_action_int.sa_handler = handle_sigint;
+	sigemptyset(&new_action_int.sa_mask);
+	new_action_int.sa_flags = 0;
+
+	new_action_chld.sa_handler = handle_sigchld;
+	sigemptyset(&new_action_chld.sa_mask);
+	new_action_chld.sa_flags = 0;
+
+	new_action_pipe.sa_handler = SIG_IGN;
+	sigemptyset(&new_action_pipe.sa_mask);
+	new_action_pipe.sa_flags = 0;
+
+	if ((sigaction(SIGINT, &new_action_int, NULL) == -1) || (sigaction(SIGCHLD, &new_action_chld, NULL) == -1)
+	    || (sigaction(SIGPIPE, &new_action_pipe, NULL) == -1)) {
+		fprintf(stderr, RED "Sigal Error: %s\n" RESET, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+}
+
+// Reaps the children that exited, blocking for one when wait is set
+void reap_workers(const bool wait) {
+	while (_active && (waitpid(-1, NULL, wait ? 0 : WNOHANG) > 0)) {
+		_active--;
+		if (wait)
+			break;
+	}
+}
+
+void accept_connection(const int listener) {
+	char ipv6_address[INET6_ADDRSTRLEN];
+	struct sockaddr_in6 client_addr;
+	socklen_t sin_size = sizeof(client_addr);
+	const int newfd = accept4(listener, (struct sockaddr*) &client_addr, &sin_size, SOCK_CLOEXEC);
+
+	if (newfd == -1) {
+		if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) {
+			const String err_msg = strerror(errno);
+
+			if (verbose_flag)
+				printf(YELLOW "Accept Error: %s\n" RESET, err_msg);
+			server_log(err_msg);
+		}
+		return;
+	}
+	inet_ntop(AF_INET6, &client_addr.sin6_addr, ipv6_address, INET6_ADDRSTRLEN);
+
+	fflush(stdout); // Or the child prints what the parent buffered once more
+	const pid_t c_pid = fork();
+
+	if (c_pid == 0) {
+		close(listener);
+		core_serve_connection(_core, newfd, ipv6_address);
+		close(newfd);
+		exit(EXIT_SUCCESS);
+	}
+
+	if (c_pid == -1) {
+		const String err_msg = strerror(errno);
+
+		if (verbose_flag)
+			printf(YELLOW "Process Forking Error: %s\n" RESET, err_msg);
+		server_log(err_msg);
+	} else
+		_active++;
+
+	if ((close(newfd) == -1) && (verbose_flag))
+		printf(YELLOW "Connection File Descriptor Error: %s\n" RESET, strerror(errno));
+}
+
+int main(const int argc, String *const argv) {
+	char address[CORE_PORT_LEN + 3], error[KBYTE_S];
+	const mode_t mode_d = 0770;
+	core_options_t options;
+
+	core_default_options(&options);
+	init_signals();
+	core_compute_flags(argc, argv, &options);
+
+	const int port_num = atoi(options.port);
+
+	if ((port_num <= PORT_MIN) || (port_num >= PORT_MAX)) {
+		fprintf(stderr, RED "Port Error: Invalid port %s\n" RESET, options.port);
+		exit(EXIT_FAILURE);
+	}
+
+	if ((mkdir(_log_root, mode_d) == -1) && (errno != EEXIST)) {
+		fprintf(stderr, RED "Log Directory Error: %s\n" RESET, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	if (!(_core = core_create(&options))) {
+		fprintf(stderr, RED "Document Root Error: %s (%s)\n" RESET, strerror(errno), options.doc_root);
+		exit(EXIT_FAILURE);
+	}
+
+	const listener_options_t listen_options = {options.backlog, 0, 0, 0, 0, PUSH_NODELAY};
+
+	snprintf(address, sizeof(address), "*:%s", options.port);
+	const int listener = listener_open(address, &listen_options, error, KBYTE_S);
+
+	if (listener == -1) {
+		fprintf(stderr, RED "%s (%s)\n" RESET, error, address);
+		exit(EXIT_FAILURE);
+	}
+
+	if (verbose_flag)
+		printf(GREEN "Initialization: SUCCESS;\n"
+		       "Listening on port: %s\n"
+		       "Root directory is: %s\n"
+		       "Log root is: %s\n"
+		       "Processes: %u at most\n" RESET,
+		       options.port, options.doc_root, _log_root, options.max_workers);
+
+	struct pollfd pfd = {listener, POLLIN, 0};
+
+	while (sigint_flag) {
+		reap_workers(false);
+
+		if (_active >= options.max_workers)
+			reap_workers(true);
+		else if (poll(&pfd, 1, POLL_MS) > 0)
+			accept_connection(listener);
+	}
+
+	if ((close(listener) == -1) && (verbose_flag))
+		printf(YELLOW "Master File Descriptor Error: %s\n" RESET, strerror(errno));
+
+	// The connections in progress run to their end, a second SIGINT leaves them
+	while (_active && (waitpid(-1, NULL, 0) > 0))
+		_active--;
+	core_destroy(_core);
+
+	return EXIT_SUCCESS;
+}
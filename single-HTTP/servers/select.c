@@ -0,0 +1,373 @@
+#include <time.h>
+#include <errno.h>
+#include <stdio.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+
+#include "../globals.h"
+#include "../lib/core/core.h"
+#include "../lib/logging/log.h"
+#include "../lib/types/types.h"
+#include "../lib/colors/colors.h"
+#include "../lib/listener/listener.h"
+#include "../lib/out_queue/out_queue.h"
+#include "../lib/buffer_pool/buffer_pool.h"
+
+// select-HTTP: one thread multiplexes every connection with select(). Sockets
+// are non-blocking, responses go through an output queue that is flushed as
+// the socket becomes writable, and request bodies are spliced as they arrive.
+// A connection stops being read while its queue holds HIGH_WATERMARK, and
+// descriptors past FD_SETSIZE are refused. On SIGINT it stops accepting,
+// closes idle connections and ends once the others did.
+
+#define PORT_MIN 0
+#define PORT_MAX 65536
+#define SELECT_MS 100
+#define HIGH_WATERMARK (64 * KBYTE_S)
+#define POOL_MAX_BYTES (4 * MBYTE_S)
+
+typedef struct client_s {
+	bool open, closing; // closing: nothing more is read, the descriptor closes once the output is sent
+	char buffer[CORE_REQUEST_LEN + NT_LEN];
+	size_t len, header_len, used; // used: octets of the body that came with the header block
+	Request_Body body; // Set while the body of the request is being spooled
+	out_queue_t output;
+	uint64_t deadline_ms;
+	char address[INET6_ADDRSTRLEN];
+} client_t;
+
+Core _core = NULL;
+client_t _clients[FD_SETSIZE];
+unsigned int _open = 0;
+
+bool sigint_flag = true, verbose_flag = false;
+char _log_root[PATH_MAX + NT_LEN], _db_path[PATH_MAX + NT_LEN];
+
+void handle_sigint(const int arg) {
+	sigint_flag = false;
+}
+
+void handle_sigchld(const int arg) { // Exited PHP runs are reaped by the kernel
+}
+
+void init_signals(void) {
+	struct sigaction new_action_int, new_action_chld, new_action_pipe;
+
+	new_action_int.sa_handler = handle_sigint;
+	sigemptyset(&new_action_int.sa_mask);
+	new_action_int.sa_flags = 0;
+
+	new_action_chld.sa_handler = handle_sigchld;
+	sigemptyset(&new_action_chld.sa_mask);
+	new_action_chld.sa_flags = SA_NOCLDWAIT | SA_RESTART;
+
+	new_action_pipe.sa_handler = SIG_IGN;
+	sigemptyset(&new_action_pipe.sa_mask);
+	new_action_pipe.sa_flags = 0;
+
+	if ((sigaction(SIGINT, &new_action_int, NULL) == -1) || (sigaction(SIGCHLD, &new_action_chld, NULL) == -1)
+	    || (sigaction(SIGPIPE, &new_action_pipe, NULL) == -1)) {
+		fprintf(stderr, RED "Sigal Error: %s\n" RESET, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+}
+
+uint64_t now_ms(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Each wait has its own deadline: write_ms while output is queued, read_ms
+// within a request and keepalive_ms between requests
+void arm_deadline(client_t *const restrict client, const uint64_t now) {
+	if (client->output.bytes)
+		client->deadline_ms = now + _core->options.write_ms;
+	else if (client->len || client->body)
+		client->deadline_ms = now + _core->options.read_ms;
+	else
+		client->deadline_ms = now + _core->options.keepalive_ms;
+}
+
+void close_client(const int fd) {
+	client_t *const client = &_clients[fd];
+
+	if (client->body)
+		rb_destroy(client->body);
+	oq_clear(&client->output);
+
+	if ((close(fd) == -1) && (verbose_flag))
+		printf(YELLOW "Connection File Descriptor Error: %s\n" RESET, strerror(errno));
+	client->open = false;
+	_open--;
+}
+
+void accept_connections(const int listener, const uint64_t now) {
+	struct sockaddr_in6 client_addr;
+	socklen_t sin_size = sizeof(client_addr);
+	int newfd;
+
+	while ((newfd = accept4(listener, (struct sockaddr*) &client_addr, &sin_size, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1) {
+		if (newfd >= FD_SETSIZE) { // select() can not watch it
+			if (verbose_flag)
+				puts(YELLOW "Connection Error: Descriptor beyond FD_SETSIZE" RESET);
+			close(newfd);
+			continue;
+		}
+
+		client_t *const client = &_clients[newfd];
+
+		memset(&client->output, 0, sizeof(out_queue_t));
+		client->open = true;
+		client->closing = false;
+		client->len = client->header_len = client->used = 0;
+		client->body = NULL;
+		client->buffer[0] = '\0';
+		client->deadline_ms = now + _core->options.read_ms;
+		inet_ntop(AF_INET6, &client_addr.sin6_addr, client->address, INET6_ADDRSTRLEN);
+		_open++;
+		sin_size = sizeof(client_addr);
+	}
+
+	if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) {
+		const String err_msg = strerror(errno);
+
+		if (verbose_flag)
+			printf(YELLOW "Accept Error: %s\n" RESET, err_msg);
+		server_log(err_msg);
+	}
+}
+
+// Answers the request whose header block and body were received, and keeps
+// what was pipelined after it
+void dispatch(const int fd) {
+	client_t *const client = &_clients[fd];
+	core_output_t out = {fd, &client->output};
+	const char next = client->buffer[client->header_len];
+	const bool keep_alive = _core->options.keepalive_ms && sigint_flag && core_wants_keep_alive(client->buffer);
+
+	client->buffer[client->header_len] = '\0';
+
+	if ((core_respond(_core, &out, client->buffer, client->address, client->body, keep_alive) == CORE_CLOSE) || !keep_alive)
+		client->closing = true;
+	if (client->body) { // A PHP run holds its own descriptor of the spool file
+		rb_destroy(client->body);
+		client->body = NULL;
+	}
+
+	client->buffer[client->header_len] = next;
+	client->len -= client->header_len + client->used;
+	memmove(client->buffer, client->buffer + client->header_len + client->used, client->len);
+	client->buffer[client->len] = '\0';
+}
+
+// Takes the requests already in the buffer until one is incomplete or the
+// output queue is full
+void process_buffer(const int fd) {
+	client_t *const client = &_clients[fd];
+	core_output_t out = {fd, &client->output};
+
+	while (!client->closing && !client->body && (client->output.bytes < HIGH_WATERMARK)) {
+		if (!core_header_end(client->buffer, &client->header_len)) {
+			if (client->len == CORE_REQUEST_LEN) {
+				if (verbose_flag)
+					puts(YELLOW "Connection Error: Request header too large" RESET);
+				core_send_buffer(&out, (Byte*) BAD_REQUEST, CODE_400_LEN);
+				core_send_page(_core, &out, "partials/code-responses/400.html");
+				client->closing = true;
+			}
+			return;
+		}
+
+		const rb_status_t status = core_begin_body(_core, &out, client->buffer, client->header_len, client->len,
+		                                           &client->body, &client->used);
+
+		if (status == RB_MORE) // The rest is spliced as it arrives
+			return;
+
+		if (status != RB_COMPLETE) {
+			core_reject_body(_core, &out, client->address, status);
+			client->closing = true;
+			return;
+		}
+		dispatch(fd);
+	}
+}
+
+void read_client(const int fd) {
+	client_t *const client = &_clients[fd];
+
+	if (client->body) {
+		const rb_status_t status = rb_splice(client->body, fd);
+		core_output_t out = {fd, &client->output};
+
+		if (status == RB_MORE)
+			return;
+
+		if (status != RB_COMPLETE) {
+			core_reject_body(_core, &out, client->address, status);
+			client->closing = true;
+			return;
+		}
+		dispatch(fd);
+		process_buffer(fd);
+		return;
+	}
+
+	const ssize_t nbytes = recv(fd, client->buffer + client->len, CORE_REQUEST_LEN - client->len, 0);
+
+	if (nbytes == 0) {
+		client->closing = true;
+		return;
+	}
+	if (nbytes == -1) {
+		if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))
+			client->closing = true;
+		return;
+	}
+	client->len += nbytes;
+	client->buffer[client->len] = '\0';
+	process_buffer(fd);
+}
+
+void write_client(const int fd) {
+	client_t *const client = &_clients[fd];
+
+	if (!oq_flush(&client->output, fd)) {
+		oq_clear(&client->output);
+		client->closing = true;
+		return;
+	}
+
+	if (client->output.bytes < HIGH_WATERMARK) // Pipelined requests wait for the queue to drain
+		process_buffer(fd);
+}
+
+void serve_clients(const int listener, fd_set *const restrict read_set, fd_set *const restrict write_set) {
+	const uint64_t now = now_ms();
+
+	if ((listener != -1) && FD_ISSET(listener, read_set))
+		accept_connections(listener, now);
+
+	for (int fd = 0; fd < FD_SETSIZE; fd++) {
+		client_t *const client = &_clients[fd];
+
+		if (!client->open || (fd == listener))
+			continue;
+
+		const bool active = FD_ISSET(fd, write_set) || FD_ISSET(fd, read_set);
+
+		if (FD_ISSET(fd, write_set))
+			write_client(fd);
+		if (FD_ISSET(fd, read_set) && !client->closing)
+			read_client(fd);
+		if (active)
+			arm_deadline(client, now);
+
+		const bool idle = !client->len && !client->body && !client->output.bytes;
+
+		if ((client->closing && !client->output.bytes) || (!sigint_flag && idle) || (now >= client->deadline_ms))
+			close_client(fd);
+	}
+}
+
+int main(const int argc, String *const argv) {
+	char address[CORE_PORT_LEN + 3], error[KBYTE_S];
+	const mode_t mode_d = 0770;
+	core_options_t options;
+	fd_set read_set, write_set;
+
+	core_default_options(&options);
+	init_signals();
+	core_compute_flags(argc, argv, &options);
+
+	const int port_num = atoi(options.port);
+
+	if ((port_num <= PORT_MIN) || (port_num >= PORT_MAX)) {
+		fprintf(stderr, RED "Port Error: Invalid port %s\n" RESET, options.port);
+		exit(EXIT_FAILURE);
+	}
+
+	if ((mkdir(_log_root, mode_d) == -1) && (errno != EEXIST)) {
+		fprintf(stderr, RED "Log Directory Error: %s\n" RESET, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	if (!(_core = core_create(&options))) {
+		fprintf(stderr, RED "Document Root Error: %s (%s)\n" RESET, strerror(errno), options.doc_root);
+		exit(EXIT_FAILURE);
+	}
+	bp_init(POOL_MAX_BYTES);
+
+	const listener_options_t listen_options = {options.backlog, 0, 0, 0, 0, PUSH_NODELAY};
+
+	snprintf(address, sizeof(address), "*:%s", options.port);
+	int listener = listener_open(address, &listen_options, error, KBYTE_S);
+
+	if (listener == -1) {
+		fprintf(stderr, RED "%s (%s)\n" RESET, error, address);
+		exit(EXIT_FAILURE);
+	}
+
+	if (verbose_flag)
+		printf(GREEN "Initialization: SUCCESS;\n"
+		       "Listening on port: %s\n"
+		       "Root directory is: %s\n"
+		       "Log root is: %s\n"
+		       "Connections: %d at most\n" RESET,
+		       options.port, options.doc_root, _log_root, FD_SETSIZE);
+
+	while ((listener != -1) || _open) {
+		struct timeval timeout = {0, SELECT_MS * 1000};
+		int max_fd = listener;
+
+		if (!sigint_flag && (listener != -1)) {
+			if ((close(listener) == -1) && (verbose_flag))
+				printf(YELLOW "Master File Descriptor Error: %s\n" RESET, strerror(errno));
+			listener = -1;
+		}
+
+		FD_ZERO(&read_set);
+		FD_ZERO(&write_set);
+		if (listener != -1)
+			FD_SET(listener, &read_set);
+
+		for (int fd = 0; fd < FD_SETSIZE; fd++) {
+			const client_t *const client = &_clients[fd];
+
+			if (!client->open)
+				continue;
+			if (!client->closing && (client->output.bytes < HIGH_WATERMARK))
+				FD_SET(fd, &read_set);
+			if (client->output.bytes)
+				FD_SET(fd, &write_set);
+			if (fd > max_fd)
+				max_fd = fd;
+		}
+
+		if (select(max_fd + 1, &read_set, &write_set, NULL, &timeout) == -1) {
+			if (errno != EINTR) {
+				fprintf(stderr, RED "Select Error: %s\n" RESET, strerror(errno));
+				exit(EXIT_FAILURE);
+			}
+			FD_ZERO(&read_set);
+			FD_ZERO(&write_set);
+		}
+		serve_clients(listener, &read_set, &write_set); // Deadlines are checked on every pass
+	}
+
+	core_destroy(_core);
+	bp_trim();
+
+	return EXIT_SUCCESS;
+}
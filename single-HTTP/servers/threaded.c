@@ -0,0 +1,228 @@
+#include <time.h>
+#include <poll.h>
+#include <errno.h>
+#include <stdio.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "../globals.h"
+#include "../lib/core/core.h"
+#include "../lib/logging/log.h"
+#include "../lib/types/types.h"
+#include "../lib/colors/colors.h"
+#include "../lib/listener/listener.h"
+
+// threaded-HTTP: a thread per connection, which reads and writes its socket
+// with blocking calls through the core. The main thread accepts, and waits
+// while max_workers connections are being served; the kernel queues the
+// rest in the listen backlog. On SIGINT it stops accepting and lets the
+// connections end within their deadlines.
+
+#define PORT_MIN 0
+#define PORT_MAX 65536
+#define STACK_LEN (256 * 1024)
+#define POLL_MS 100
+
+typedef struct worker_s {
+	int fd;
+	char address[INET6_ADDRSTRLEN];
+} worker_t;
+
+Core _core = NULL;
+unsigned int _active = 0;
+pthread_mutex_t _active_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t _worker_done = PTHREAD_COND_INITIALIZER;
+pthread_attr_t _worker_attr;
+
+bool sigint_flag = true, verbose_flag = false;
+char _log_root[PATH_MAX + NT_LEN], _db_path[PATH_MAX + NT_LEN];
+
+void handle_sigint(const int arg) {
+	sigint_flag = false;
+}
+
+void handle_sigchld(const int arg) { // Exited PHP runs are reaped by the kernel
+}
+
+void init_signals(void) {
+	struct sigaction new_action_int, new_action_chld, new_action_pipe;
+
+	new_action_int.sa_handler = handle_sigint;
+	sigemptyset(&new_action_int.sa_mask);
+	new_action_int.sa_flags = 0;
+
+	new_action_chld.sa_handler = handle_sigchld;
+	sigemptyset(&new_action_chld.sa_mask);
+	new_action_chld.sa_flags = SA_NOCLDWAIT | SA_RESTART;
+
+	new_action_pipe.sa_handler = SIG_IGN;
+	sigemptyset(&new_action_pipe.sa_mask);
+	new_action_pipe.sa_flags = 0;
+
+	if ((sigaction(SIGINT, &new_action_int, NULL) == -1) || (sigaction(SIGCHLD, &new_action_chld, NULL) == -1)
+	    || (sigaction(SIGPIPE, &new_action_pipe, NULL) == -1)) {
+		fprintf(stderr, RED "Sigal Error: %s\n" RESET, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+}
+
+void *serve_worker(void *const arg) {
+	worker_t *const worker = (worker_t*) arg;
+
+	core_serve_connection(_core, worker->fd, worker->address);
+
+	if ((close(worker->fd) == -1) && (verbose_flag))
+		printf(YELLOW "Connection File Descriptor Error: %s\n" RESET, strerror(errno));
+	free(worker);
+
+	pthread_mutex_lock(&_active_lock);
+	_active--;
+	pthread_cond_signal(&_worker_done);
+	pthread_mutex_unlock(&_active_lock);
+
+	return NULL;
+}
+
+// Waits a while for a worker to end, with _active_lock held
+void wait_worker_done(void) {
+	struct timespec until;
+
+	clock_gettime(CLOCK_REALTIME, &until);
+	until.tv_nsec += POLL_MS * 1000000L;
+
+	if (until.tv_nsec >= 1000000000L) {
+		until.tv_sec++;
+		until.tv_nsec -= 1000000000L;
+	}
+	pthread_cond_timedwait(&_worker_done, &_active_lock, &until);
+}
+
+// Waits until fewer than limit workers run, false when SIGINT came first
+bool wait_workers(const unsigned int limit) {
+	pthread_mutex_lock(&_active_lock);
+	while ((_active >= limit) && sigint_flag)
+		wait_worker_done();
+	pthread_mutex_unlock(&_active_lock);
+
+	return sigint_flag;
+}
+
+void drain_workers(void) {
+	pthread_mutex_lock(&_active_lock);
+	while (_active)
+		wait_worker_done();
+	pthread_mutex_unlock(&_active_lock);
+}
+
+void accept_connection(const int listener) {
+	struct sockaddr_in6 client_addr;
+	socklen_t sin_size = sizeof(client_addr);
+	const int newfd = accept4(listener, (struct sockaddr*) &client_addr, &sin_size, SOCK_CLOEXEC);
+
+	if (newfd == -1) {
+		if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) {
+			const String err_msg = strerror(errno);
+
+			if (verbose_flag)
+				printf(YELLOW "Accept Error: %s\n" RESET, err_msg);
+			server_log(err_msg);
+		}
+		return;
+	}
+
+	worker_t *const worker = (worker_t*) malloc(sizeof(worker_t));
+	pthread_t thread;
+
+	if (!worker) {
+		fprintf(stderr, RED "Memory Error: %s\n" RESET, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	worker->fd = newfd;
+	inet_ntop(AF_INET6, &client_addr.sin6_addr, worker->address, INET6_ADDRSTRLEN);
+
+	pthread_mutex_lock(&_active_lock);
+	_active++;
+	pthread_mutex_unlock(&_active_lock);
+
+	if (pthread_create(&thread, &_worker_attr, serve_worker, worker) != 0) {
+		if (verbose_flag)
+			printf(YELLOW "Thread Error: No thread for %s\n" RESET, worker->address);
+		close(newfd);
+		free(worker);
+
+		pthread_mutex_lock(&_active_lock);
+		_active--;
+		pthread_mutex_unlock(&_active_lock);
+	}
+}
+
+int main(const int argc, String *const argv) {
+	char address[CORE_PORT_LEN + 3], error[KBYTE_S];
+	const mode_t mode_d = 0770;
+	core_options_t options;
+
+	core_default_options(&options);
+	init_signals();
+	core_compute_flags(argc, argv, &options);
+
+	const int port_num = atoi(options.port);
+
+	if ((port_num <= PORT_MIN) || (port_num >= PORT_MAX)) {
+		fprintf(stderr, RED "Port Error: Invalid port %s\n" RESET, options.port);
+		exit(EXIT_FAILURE);
+	}
+
+	if ((mkdir(_log_root, mode_d) == -1) && (errno != EEXIST)) {
+		fprintf(stderr, RED "Log Directory Error: %s\n" RESET, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	if (!(_core = core_create(&options))) {
+		fprintf(stderr, RED "Document Root Error: %s (%s)\n" RESET, strerror(errno), options.doc_root);
+		exit(EXIT_FAILURE);
+	}
+
+	const listener_options_t listen_options = {options.backlog, 0, 0, 0, 0, PUSH_NODELAY};
+
+	snprintf(address, sizeof(address), "*:%s", options.port);
+	const int listener = listener_open(address, &listen_options, error, KBYTE_S);
+
+	if (listener == -1) {
+		fprintf(stderr, RED "%s (%s)\n" RESET, error, address);
+		exit(EXIT_FAILURE);
+	}
+
+	pthread_attr_init(&_worker_attr);
+	pthread_attr_setdetachstate(&_worker_attr, PTHREAD_CREATE_DETACHED);
+	pthread_attr_setstacksize(&_worker_attr, STACK_LEN);
+
+	if (verbose_flag)
+		printf(GREEN "Initialization: SUCCESS;\n"
+		       "Listening on port: %s\n"
+		       "Root directory is: %s\n"
+		       "Log root is: %s\n"
+		       "Threads: %u at most\n" RESET,
+		       options.port, options.doc_root, _log_root, options.max_workers);
+
+	struct pollfd pfd = {listener, POLLIN, 0};
+
+	while (wait_workers(options.max_workers))
+		if (poll(&pfd, 1, POLL_MS) > 0)
+			accept_connection(listener);
+
+	if ((close(listener) == -1) && (verbose_flag))
+		printf(YELLOW "Master File Descriptor Error: %s\n" RESET, strerror(errno));
+
+	drain_workers(); // The connections in progress run to their end
+	pthread_attr_destroy(&_worker_attr);
+	core_destroy(_core);
+
+	return EXIT_SUCCESS;
+}
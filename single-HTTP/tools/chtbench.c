@@ -0,0 +1,211 @@
+#include <time.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdbool.h>
+
+#include "../lib/types/types.h"
+#include "../lib/concurrent_hashtable/concurrent_hashtable.h"
+
+// Companion benchmark of lib/concurrent_hashtable. The table is filled with
+// a number of keys, then for 1, 2, 4 and so on up to the given number of
+// threads, every thread looks up random keys for the same time while one
+// more thread keeps replacing values with compare-and-swap, so the lookups
+// pay for reclamation and never wait for it. Each phase prints the lookups
+// per second and how they scaled from one thread; linear scaling needs as
+// many idle cores as threads.
+//
+// Usage: chtbench [-t threads] [-k keys] [-d seconds] [-w]
+//        -w leaves the writer out
+
+#define DEFAULT_THREADS 8
+#define DEFAULT_KEYS 100000
+#define DEFAULT_SECONDS 2
+#define KEY_LEN 32
+#define BATCH 64 // Lookups between two looks at the stop flag
+
+typedef struct worker_s {
+	pthread_t thread;
+	uint64_t seed, operations;
+} __attribute__((aligned(CHT_CACHE_LINE))) worker_t; // A line of its own, the counters are written in the loop
+
+static Concurrent_HashTable _table;
+static char (*_keys)[KEY_LEN];
+static size_t _key_cnt = DEFAULT_KEYS;
+static volatile bool _stop = false;
+
+static uint64_t now_us(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint64_t next_random(uint64_t *const restrict state) { // xorshift64
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+
+	return *state;
+}
+
+static uint64_t *new_value(const uint64_t number) {
+	uint64_t *const value = (uint64_t*) malloc(sizeof(uint64_t));
+	if (!value)
+		exit(EXIT_FAILURE);
+	*value = number;
+
+	return value;
+}
+
+static void *run_reader(void *const arg) {
+	worker_t *const worker = (worker_t*) arg;
+	const Cht_Thread self = cht_join(_table);
+	uint64_t sum = 0;
+
+	while (!_stop) {
+		for (unsigned int i = 0; i < BATCH; i++) {
+			cht_pin(self);
+			const uint64_t *const value = (const uint64_t*) cht_get(self, _keys[next_random(&worker->seed) % _key_cnt]);
+
+			sum += value ? *value : 0; // Read pinned, the writer may have retired it
+			cht_unpin(self);
+		}
+		worker->operations += BATCH;
+	}
+	cht_leave(self);
+
+	return (void*) (uintptr_t) sum;
+}
+
+static void *run_writer(void *const arg) {
+	worker_t *const worker = (worker_t*) arg;
+	const Cht_Thread self = cht_join(_table);
+
+	while (!_stop) {
+		const String key = _keys[next_random(&worker->seed) % _key_cnt];
+		uint64_t *const desired = new_value(worker->operations);
+
+		cht_pin(self);
+		while (!cht_update(self, key, cht_get(self, key), desired))
+			;
+		cht_unpin(self);
+		worker->operations++;
+	}
+	cht_leave(self);
+
+	return NULL;
+}
+
+// Lookups per second of threads readers, with the writer unless left out
+static double run_phase(worker_t *const workers, const size_t threads, const bool writer, const unsigned int seconds,
+                        uint64_t *const restrict writes) {
+	worker_t update = {.seed = 0x9e3779b97f4a7c15ULL};
+	uint64_t operations = 0;
+
+	_stop = false;
+	for (size_t i = 0; i < threads; i++) {
+		workers[i].seed = 0x2545f4914f6cdd1dULL * (i + 1);
+		workers[i].operations = 0;
+
+		if (pthread_create(&workers[i].thread, NULL, run_reader, &workers[i]) != 0) {
+			fprintf(stderr, "chtbench: pthread_create: %s\n", strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (writer && (pthread_create(&update.thread, NULL, run_writer, &update) != 0)) {
+		fprintf(stderr, "chtbench: pthread_create: %s\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	const uint64_t start = now_us();
+
+	sleep(seconds);
+	_stop = true;
+
+	for (size_t i = 0; i < threads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		operations += workers[i].operations;
+	}
+	if (writer)
+		pthread_join(update.thread, NULL);
+	*writes = update.operations;
+
+	return operations / ((now_us() - start) / 1e6);
+}
+
+int main(const int argc, String *const argv) {
+	size_t threads = DEFAULT_THREADS;
+	unsigned int seconds = DEFAULT_SECONDS;
+	bool writer = true;
+	int c;
+
+	while ((c = getopt(argc, argv, "t:k:d:w")) != -1) {
+		switch (c) {
+		case 't':
+			threads = strtoul(optarg, NULL, 10);
+			break;
+		case 'k':
+			_key_cnt = strtoul(optarg, NULL, 10);
+			break;
+		case 'd':
+			seconds = strtoul(optarg, NULL, 10);
+			break;
+		case 'w':
+			writer = false;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-t threads] [-k keys] [-d seconds] [-w]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (!threads || !_key_cnt || !seconds) {
+		fprintf(stderr, "Usage: %s [-t threads] [-k keys] [-d seconds] [-w]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	worker_t *workers;
+
+	_keys = calloc(_key_cnt, KEY_LEN);
+	if ((posix_memalign((void**) &workers, CHT_CACHE_LINE, threads * sizeof(worker_t)) != 0) || !_keys)
+		exit(EXIT_FAILURE);
+
+	// Grown from its smallest size, so every shard resizes on the way
+	_table = cht_create(0, free);
+
+	const Cht_Thread self = cht_join(_table);
+
+	cht_pin(self);
+	for (size_t i = 0; i < _key_cnt; i++) {
+		snprintf(_keys[i], KEY_LEN, "/session/%zu", i);
+		cht_insert(self, _keys[i], new_value(i));
+	}
+	cht_unpin(self);
+	cht_leave(self);
+
+	printf("%zu keys, %u s per phase, %s\n", _key_cnt, seconds, writer ? "one writer replacing values" : "no writer");
+	printf("%8s %16s %16s %9s %14s\n", "threads", "lookups/s", "per thread", "scaling", "writes/s");
+
+	double single = 0.0;
+
+	for (size_t count = 1; count; count = (count == threads) ? 0 : (count * 2 < threads) ? count * 2 : threads) {
+		uint64_t writes;
+		const double rate = run_phase(workers, count, writer, seconds, &writes);
+
+		if (count == 1)
+			single = rate;
+		printf("%8zu %16.0f %16.0f %8.2fx %14.0f\n", count, rate, rate / count, rate / single, writes / (double) seconds);
+	}
+
+	cht_destroy(_table);
+	free(_keys);
+	free(workers);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,213 @@
+#include <zlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <linux/limits.h>
+
+#include "../lib/types/types.h"
+#include "../lib/compress/compress.h"
+#include "../lib/file_cache/file_cache.h"
+#include "../lib/static_file/static_file.h"
+
+// Build step that compiles the files named on the command line into a C source
+// with the asset table of lib/assets: one page-aligned read-only blob holding
+// every body and its gzip variant, plus per file the validators and the header
+// block the server sends in front of it. Run by the Makefile, see assets_data.c.
+
+#define NT_LEN 1
+#define TMP_EXT ".tmp"
+#define BYTES_PER_LINE 16
+#define PAGE_SIZE 4096
+#define HEADERS_LEN 512
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+typedef struct embedded_s {
+	String path;
+	Byte *data, *gz_data;
+	size_t len, gz_len;
+	time_t mtime;
+	char etag[SF_ETAG_LEN], gz_etag[SF_ETAG_LEN], headers[HEADERS_LEN], gz_headers[HEADERS_LEN];
+} embedded_t;
+
+static int compare_paths(const void *const a, const void *const b) {
+	return strcmp(*(const String*) a, *(const String*) b);
+}
+
+static Byte *read_contents(const String restrict path, size_t *const restrict len, time_t *const restrict mtime) {
+	struct stat file;
+	FILE *const input = fopen(path, "rb");
+
+	if (!input || (fstat(fileno(input), &file) == -1)) {
+		fprintf(stderr, "embed_assets: %s: %s\n", path, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	Byte *const data = (Byte*) malloc(file.st_size + NT_LEN);
+	if (!data)
+		exit(EXIT_FAILURE);
+
+	if (file.st_size && (fread(data, file.st_size, 1, input) != 1)) {
+		fprintf(stderr, "embed_assets: %s: Short read\n", path);
+		exit(EXIT_FAILURE);
+	}
+	fclose(input);
+	*len = file.st_size;
+	*mtime = file.st_mtime;
+
+	return data;
+}
+
+// The tag is derived from the contents, so a rebuild of unchanged files keeps
+// the validators clients already hold
+static void load_asset(embedded_t *const restrict asset, const String restrict path) {
+	char last_modified[SF_HTTP_DATE_LEN];
+	uint64_t hash = FNV_OFFSET;
+
+	asset->path = path;
+	asset->data = read_contents(path, &asset->len, &asset->mtime);
+
+	for (size_t i = 0; i < asset->len; i++)
+		hash = (hash ^ asset->data[i]) * FNV_PRIME;
+
+	snprintf(asset->etag, SF_ETAG_LEN, "\"%llx-%llx\"", (unsigned long long) hash, (unsigned long long) asset->len);
+	snprintf(asset->gz_etag, SF_ETAG_LEN, "\"%llx-%llx-gz\"", (unsigned long long) hash, (unsigned long long) asset->len);
+	sf_http_date(asset->mtime, last_modified);
+
+	snprintf(asset->headers, HEADERS_LEN, "Content-Type: %s\r\nContent-Length: %llu\r\n%sLast-Modified: %s\r\nETag: %s\r\n",
+	         fc_mime_type(path), (unsigned long long) asset->len, gz_is_compressible(path) ? "Vary: Accept-Encoding\r\n" : "",
+	         last_modified, asset->etag);
+
+	if (!gz_is_compressible(path) || !(asset->gz_data = gz_compress(asset->data, asset->len, Z_BEST_COMPRESSION, &asset->gz_len)))
+		return;
+
+	if (asset->gz_len >= asset->len) {
+		free(asset->gz_data);
+		asset->gz_data = NULL;
+		asset->gz_len = 0;
+		return;
+	}
+
+	snprintf(asset->gz_headers, HEADERS_LEN, "Content-Type: %s\r\nContent-Length: %llu\r\nContent-Encoding: gzip\r\n"
+	         "Vary: Accept-Encoding\r\nLast-Modified: %s\r\nETag: %s\r\n", fc_mime_type(path),
+	         (unsigned long long) asset->gz_len, last_modified, asset->gz_etag);
+}
+
+static void write_string(FILE *const restrict output, const String restrict string) {
+	fputc('"', output);
+
+	for (const char *c = string; *c; c++)
+		if (*c == '\r')
+			fputs("\\r", output);
+		else if (*c == '\n')
+			fputs("\\n", output);
+		else if ((*c == '"') || (*c == '\\'))
+			fprintf(output, "\\%c", *c);
+		else
+			fputc(*c, output);
+
+	fputc('"', output);
+}
+
+static void write_bytes(FILE *const restrict output, const Byte *const restrict data, const size_t len, size_t *const restrict column) {
+	for (size_t i = 0; i < len; i++) {
+		fprintf(output, (*column % BYTES_PER_LINE) ? " 0x%02x," : "\n\t0x%02x,", data[i]);
+		(*column)++;
+	}
+}
+
+static void write_source(FILE *const restrict output, const embedded_t *const restrict assets, const unsigned int asset_cnt) {
+	size_t column = 0, offset = 0;
+
+	fputs("// Generated by tools/embed_assets, do not edit\n\n#include \"lib/assets/assets.h\"\n\n", output);
+	fprintf(output, "static const Byte asset_data[] __attribute__((aligned(%d))) = {", PAGE_SIZE);
+
+	for (unsigned int i = 0; i < asset_cnt; i++) {
+		write_bytes(output, assets[i].data, assets[i].len, &column);
+		write_bytes(output, assets[i].gz_data, assets[i].gz_len, &column);
+	}
+
+	if (column == 0) // No empty initializers in C
+		fputs("\n\t0x00", output);
+	fputs("\n};\n\nconst asset_t _assets[] = {", output);
+
+	for (unsigned int i = 0; i < asset_cnt; i++) {
+		const embedded_t *const asset = &assets[i];
+
+		fputs("\n\t{", output);
+		write_string(output, asset->path);
+		fprintf(output, ", asset_data + %llu, ", (unsigned long long) offset);
+		offset += asset->len;
+
+		if (asset->gz_data)
+			fprintf(output, "asset_data + %llu", (unsigned long long) offset);
+		else
+			fputs("NULL", output);
+		offset += asset->gz_len;
+
+		fprintf(output, ", %llu, %llu, %lld,\n\t ", (unsigned long long) asset->len, (unsigned long long) asset->gz_len,
+		        (long long) asset->mtime);
+		write_string(output, (String) asset->etag);
+		fputs(", ", output);
+		write_string(output, (String) asset->gz_etag);
+		fputs(",\n\t ", output);
+		write_string(output, (String) asset->headers);
+		fputs(",\n\t ", output);
+		write_string(output, (String) asset->gz_headers);
+		fputs("},", output);
+	}
+
+	if (asset_cnt == 0)
+		fputs("\n\t{NULL, NULL, NULL, 0, 0, 0, NULL, NULL, NULL, NULL}", output);
+	fprintf(output, "\n};\n\nconst unsigned int _asset_cnt = %u;\n", asset_cnt);
+}
+
+int main(const int argc, String *const argv) {
+	char tmp_path[PATH_MAX + NT_LEN];
+
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s <output.c> [file...]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	const unsigned int asset_cnt = argc - 2;
+	String *const paths = argv + 2;
+	embedded_t *const assets = (embedded_t*) calloc(asset_cnt + NT_LEN, sizeof(embedded_t));
+
+	if (!assets)
+		exit(EXIT_FAILURE);
+
+	// The server finds an asset by binary search
+	qsort(paths, asset_cnt, sizeof(String), compare_paths);
+
+	for (unsigned int i = 0; i < asset_cnt; i++)
+		load_asset(&assets[i], paths[i]);
+
+	// Written aside and renamed, so an interrupted build leaves no partial table
+	snprintf(tmp_path, sizeof(tmp_path), "%s" TMP_EXT, argv[1]);
+	FILE *const output = fopen(tmp_path, "w");
+
+	if (!output) {
+		fprintf(stderr, "embed_assets: %s: %s\n", tmp_path, strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	write_source(output, assets, asset_cnt);
+
+	if ((fclose(output) != 0) || (rename(tmp_path, argv[1]) == -1)) {
+		fprintf(stderr, "embed_assets: %s: %s\n", argv[1], strerror(errno));
+		remove(tmp_path);
+		return EXIT_FAILURE;
+	}
+
+	for (unsigned int i = 0; i < asset_cnt; i++) {
+		free(assets[i].data);
+		free(assets[i].gz_data);
+	}
+	free(assets);
+
+	return EXIT_SUCCESS;
+}
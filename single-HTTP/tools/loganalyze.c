@@ -0,0 +1,533 @@
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <zlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/limits.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "../lib/types/types.h"
+
+// Companion tool that summarizes the server's logs over a range of days. The
+// day files, logs/YYYY/Mon/WW/Day.log as written by server_log(), are mapped,
+// or inflated into memory once log retention compressed them to Day.log.gz,
+// and cut into chunks at line boundaries; worker threads take chunks in turn
+// and count paths, clients and seconds into tables of their own, keyed by
+// pointers into the mappings, which are merged once every chunk is done.
+//
+// Usage: loganalyze [-r log_root] [-t threads] [-k top] YYYY-MM-DD [YYYY-MM-DD]
+
+#define NT_LEN 1
+#define DEFAULT_LOG_ROOT "logs/"
+#define DEFAULT_TOP 10
+#define DAY_PATH_LEN 20
+#define GZ_EXT ".gz"
+#define GZ_READ_LEN (1024 * 1024)
+#define CHUNK_MIN (4 * 1024 * 1024)
+#define CHUNKS_PER_THREAD 8
+#define TABLE_MIN 1024
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+// "[Mon Oct 19 09:42:53 2026]: " in front of every message
+#define STAMP_LEN 24
+#define PREFIX_LEN (STAMP_LEN + 4)
+#define CONNECTION_PREFIX "Connection from "
+#define CONNECTION_PREFIX_LEN 16
+#define FILE_INFIX " for file "
+#define FILE_INFIX_LEN 10
+#define BAD_REQUEST_SUFFIX "; BAD REQUEST"
+#define BAD_REQUEST_SUFFIX_LEN 13
+
+typedef struct log_file_s {
+	char path[PATH_MAX];
+	const char *data;
+	size_t len;
+	bool inflated; // data is allocated rather than mapped
+} log_file_t;
+
+typedef struct chunk_s {
+	const log_file_t *file;
+	size_t start, end; // Lines starting in [start, end) belong to the chunk
+} chunk_t;
+
+typedef struct count_s {
+	const char *key;
+	uint32_t len;
+	uint64_t hash, count;
+} count_t;
+
+// Open addressing, grown at half load
+typedef struct count_table_s {
+	count_t *slots;
+	size_t cap, used;
+} count_table_t;
+
+typedef struct tally_s {
+	count_table_t paths, clients, seconds;
+	uint64_t requests, bad_requests, errors, malformed;
+} tally_t;
+
+typedef struct worker_s {
+	pthread_t thread;
+	tally_t tally;
+} worker_t;
+
+static chunk_t *_chunks;
+static size_t _chunk_cnt, _next_chunk = 0;
+
+static uint64_t get_hash(const char *restrict key, const size_t len) {
+	uint64_t result = FNV_OFFSET;
+
+	for (size_t i = 0; i < len; i++)
+		result = (result ^ (Byte) key[i]) * FNV_PRIME;
+
+	return result;
+}
+
+static void table_init(count_table_t *const restrict table) {
+	table->cap = TABLE_MIN;
+	table->used = 0;
+	table->slots = (count_t*) calloc(table->cap, sizeof(count_t));
+	if (!table->slots)
+		exit(EXIT_FAILURE);
+}
+
+static count_t *table_slot(count_t *const restrict slots, const size_t cap, const char *restrict key, const size_t len,
+                           const uint64_t hash) {
+	size_t i = hash & (cap - 1);
+
+	while (slots[i].key && ((slots[i].hash != hash) || (slots[i].len != len) || (memcmp(slots[i].key, key, len) != 0)))
+		i = (i + 1) & (cap - 1);
+
+	return &slots[i];
+}
+
+static void table_add(count_table_t *const restrict table, const char *restrict key, const size_t len, const uint64_t hash,
+                      const uint64_t count) {
+	if ((table->used + 1) * 2 > table->cap) {
+		const size_t cap = table->cap * 2;
+		count_t *const slots = (count_t*) calloc(cap, sizeof(count_t));
+
+		if (!slots)
+			exit(EXIT_FAILURE);
+
+		for (size_t i = 0; i < table->cap; i++)
+			if (table->slots[i].key)
+				*table_slot(slots, cap, table->slots[i].key, table->slots[i].len, table->slots[i].hash) = table->slots[i];
+		free(table->slots);
+		table->slots = slots;
+		table->cap = cap;
+	}
+
+	count_t *const slot = table_slot(table->slots, table->cap, key, len, hash);
+
+	if (!slot->key) {
+		slot->key = key;
+		slot->len = len;
+		slot->hash = hash;
+		table->used++;
+	}
+	slot->count += count;
+}
+
+static void table_merge(count_table_t *const restrict into, const count_table_t *const restrict from) {
+	for (size_t i = 0; i < from->cap; i++)
+		if (from->slots[i].key)
+			table_add(into, from->slots[i].key, from->slots[i].len, from->slots[i].hash, from->slots[i].count);
+}
+
+// First newline in [p, end), or end. Sixteen octets are compared at a time.
+static const char *find_newline(const char *p, const char *const end) {
+#ifdef __SSE2__
+	const __m128i newline = _mm_set1_epi8('\n');
+
+	for (; p + sizeof(__m128i) <= end; p += sizeof(__m128i)) {
+		const int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) p), newline));
+
+		if (mask)
+			return p + __builtin_ctz(mask);
+	}
+#endif
+	const char *const found = memchr(p, '\n', end - p);
+
+	return found ? found : end;
+}
+
+static void count_line(tally_t *const restrict tally, const char *const restrict line, const size_t len) {
+	if ((len < PREFIX_LEN) || (line[0] != '[') || (line[STAMP_LEN + 1] != ']')) {
+		tally->malformed++;
+		return;
+	}
+
+	const char *const msg = line + PREFIX_LEN, *const end = line + len;
+
+	if (((size_t) (end - msg) < CONNECTION_PREFIX_LEN) || (memcmp(msg, CONNECTION_PREFIX, CONNECTION_PREFIX_LEN) != 0)) {
+		tally->errors++; // Everything else the server logs is an error message
+		return;
+	}
+
+	const char *const client = msg + CONNECTION_PREFIX_LEN;
+	const char *client_end = client;
+
+	while ((client_end < end) && (*client_end != ' ') && (*client_end != ';'))
+		client_end++;
+	table_add(&tally->clients, client, client_end - client, get_hash(client, client_end - client), 1);
+
+	if (((size_t) (end - client_end) >= BAD_REQUEST_SUFFIX_LEN)
+	    && (memcmp(client_end, BAD_REQUEST_SUFFIX, BAD_REQUEST_SUFFIX_LEN) == 0)) {
+		tally->bad_requests++;
+		return;
+	}
+
+	if (((size_t) (end - client_end) < FILE_INFIX_LEN) || (memcmp(client_end, FILE_INFIX, FILE_INFIX_LEN) != 0)) {
+		tally->malformed++;
+		return;
+	}
+
+	const char *const path = client_end + FILE_INFIX_LEN;
+
+	tally->requests++;
+	table_add(&tally->paths, path, end - path, get_hash(path, end - path), 1);
+	table_add(&tally->seconds, line + 1, STAMP_LEN, get_hash(line + 1, STAMP_LEN), 1);
+}
+
+static void count_chunk(tally_t *const restrict tally, const chunk_t *const restrict chunk) {
+	const char *const data = chunk->file->data, *const file_end = data + chunk->file->len;
+	const char *p = data + chunk->start;
+
+	// A line cut by the start of the chunk belongs to the one before
+	if (chunk->start && (p[-1] != '\n'))
+		p = find_newline(p, file_end) + 1;
+
+	while (p < data + chunk->end) {
+		const char *const newline = find_newline(p, file_end);
+
+		count_line(tally, p, newline - p);
+		p = newline + 1;
+	}
+}
+
+static void *run_worker(void *const arg) {
+	tally_t *const tally = &((worker_t*) arg)->tally;
+	size_t i;
+
+	table_init(&tally->paths);
+	table_init(&tally->clients);
+	table_init(&tally->seconds);
+
+	while ((i = __atomic_fetch_add(&_next_chunk, 1, __ATOMIC_RELAXED)) < _chunk_cnt)
+		count_chunk(tally, &_chunks[i]);
+
+	return NULL;
+}
+
+static bool parse_date(const String restrict text, struct tm *const restrict date) {
+	memset(date, 0, sizeof(struct tm));
+
+	const String end = strptime(text, "%Y-%m-%d", date);
+
+	date->tm_hour = 12; // Clear of daylight saving transitions
+	date->tm_isdst = -1;
+
+	return end && (*end == '\0') && (mktime(date) != -1);
+}
+
+// Reads a compressed day file whole into memory, false when it cannot be read
+static bool inflate_file(log_file_t *const restrict log) {
+	const gzFile gz = gzopen(log->path, "rb");
+	size_t cap = GZ_READ_LEN;
+	char *data = (char*) malloc(cap);
+	int nbytes;
+
+	if (!data)
+		exit(EXIT_FAILURE);
+
+	if (!gz) {
+		free(data);
+		return false;
+	}
+	gzbuffer(gz, GZ_READ_LEN);
+	log->len = 0;
+
+	while ((nbytes = gzread(gz, data + log->len, cap - log->len > GZ_READ_LEN ? GZ_READ_LEN : cap - log->len)) > 0) {
+		log->len += nbytes;
+
+		if (log->len == cap) {
+			cap *= 2;
+			data = (char*) realloc(data, cap);
+			if (!data)
+				exit(EXIT_FAILURE);
+		}
+	}
+
+	if ((gzclose(gz) != Z_OK) || (nbytes < 0) || !log->len) {
+		free(data);
+		return false;
+	}
+	log->data = data;
+	log->inflated = true;
+
+	return true;
+}
+
+// Maps the day files from first to last, days without a log are skipped
+static log_file_t *map_files(const String restrict log_root, struct tm first, struct tm *const restrict last,
+                             size_t *const restrict file_cnt, size_t *const restrict total) {
+	const time_t end = mktime(last);
+	size_t cap = 16;
+	log_file_t *files = (log_file_t*) malloc(cap * sizeof(log_file_t));
+
+	if (!files)
+		exit(EXIT_FAILURE);
+	*file_cnt = *total = 0;
+
+	for (time_t day = mktime(&first); day <= end; first.tm_mday++, day = mktime(&first)) {
+		char day_path[DAY_PATH_LEN + NT_LEN];
+		struct stat file;
+
+		if (*file_cnt == cap) {
+			cap *= 2;
+			files = (log_file_t*) realloc(files, cap * sizeof(log_file_t));
+			if (!files)
+				exit(EXIT_FAILURE);
+		}
+
+		log_file_t *const log = &files[*file_cnt];
+
+		strftime(day_path, sizeof(day_path), "%Y/%b/%U/%a.log", &first);
+		snprintf(log->path, PATH_MAX, "%s%s", log_root, day_path);
+		log->inflated = false;
+
+		const int fd = open(log->path, O_RDONLY | O_CLOEXEC);
+
+		if ((fd == -1) && (errno == ENOENT)) {
+			strncat(log->path, GZ_EXT, PATH_MAX - strlen(log->path) - NT_LEN);
+
+			if (inflate_file(log)) {
+				*total += log->len;
+				(*file_cnt)++;
+			} else if (access(log->path, F_OK) == 0)
+				fprintf(stderr, "loganalyze: %s: cannot be inflated, skipped\n", log->path);
+			continue;
+		}
+
+		if ((fd == -1) || (fstat(fd, &file) == -1) || (file.st_size == 0)) {
+			if ((fd == -1) && (errno != ENOENT))
+				fprintf(stderr, "loganalyze: %s: %s\n", log->path, strerror(errno));
+			if (fd != -1)
+				close(fd);
+			continue;
+		}
+
+		log->len = file.st_size;
+		log->data = mmap(NULL, log->len, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+		close(fd);
+
+		if (log->data == MAP_FAILED) {
+			fprintf(stderr, "loganalyze: %s: %s\n", log->path, strerror(errno));
+			continue;
+		}
+		madvise((void*) log->data, log->len, MADV_SEQUENTIAL);
+		*total += log->len;
+		(*file_cnt)++;
+	}
+
+	return files;
+}
+
+static void split_chunks(const log_file_t *const restrict files, const size_t file_cnt, const size_t total,
+                         const unsigned int threads) {
+	size_t chunk_len = total / (threads * CHUNKS_PER_THREAD);
+
+	if (chunk_len < CHUNK_MIN)
+		chunk_len = CHUNK_MIN;
+
+	_chunk_cnt = 0;
+	for (size_t i = 0; i < file_cnt; i++)
+		_chunk_cnt += (files[i].len + chunk_len - 1) / chunk_len;
+
+	_chunks = (chunk_t*) malloc((_chunk_cnt + NT_LEN) * sizeof(chunk_t));
+	if (!_chunks)
+		exit(EXIT_FAILURE);
+
+	for (size_t i = 0, n = 0; i < file_cnt; i++)
+		for (size_t start = 0; start < files[i].len; start += chunk_len, n++) {
+			_chunks[n].file = &files[i];
+			_chunks[n].start = start;
+			_chunks[n].end = (start + chunk_len < files[i].len) ? start + chunk_len : files[i].len;
+		}
+}
+
+static int compare_counts(const void *const a, const void *const b) {
+	const uint64_t x = ((const count_t*) a)->count, y = ((const count_t*) b)->count;
+
+	return (x < y) - (x > y);
+}
+
+static void sift_down(count_t *const restrict heap, const size_t len, size_t i) {
+	for (size_t child; (child = 2 * i + 1) < len; i = child) {
+		if ((child + 1 < len) && (heap[child + 1].count < heap[child].count))
+			child++;
+		if (heap[i].count <= heap[child].count)
+			return;
+
+		const count_t swap = heap[i];
+
+		heap[i] = heap[child];
+		heap[child] = swap;
+	}
+}
+
+// The top entries by count, kept in a min-heap of size top while the table is
+// walked, then printed in descending order
+static void print_top(const String restrict title, const count_table_t *const restrict table, const size_t top) {
+	count_t *const heap = (count_t*) malloc((top + NT_LEN) * sizeof(count_t));
+	size_t len = 0;
+
+	if (!heap)
+		exit(EXIT_FAILURE);
+
+	for (size_t i = 0; i < table->cap; i++) {
+		if (!table->slots[i].key)
+			continue;
+
+		if (len < top) {
+			heap[len++] = table->slots[i];
+
+			if (len == top)
+				for (size_t j = top / 2 + 1; j-- > 0; )
+					sift_down(heap, len, j);
+		} else if (top && (table->slots[i].count > heap[0].count)) {
+			heap[0] = table->slots[i];
+			sift_down(heap, len, 0);
+		}
+	}
+	qsort(heap, len, sizeof(count_t), compare_counts);
+
+	printf("\n%s (%zu distinct)\n", title, table->used);
+	for (size_t i = 0; i < len; i++)
+		printf("%12llu  %.*s\n", (unsigned long long) heap[i].count, (int) heap[i].len, heap[i].key);
+	free(heap);
+}
+
+static double elapsed_s(const struct timespec *const restrict start) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int main(const int argc, String *const argv) {
+	String log_root = DEFAULT_LOG_ROOT;
+	long threads = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t top = DEFAULT_TOP;
+	struct tm first, last;
+	struct timespec start;
+	int c;
+
+	while ((c = getopt(argc, argv, "r:t:k:")) != -1) {
+		switch (c) {
+		case 'r':
+			log_root = optarg;
+			break;
+		case 't':
+			threads = atol(optarg);
+			break;
+		case 'k':
+			top = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-r log_root] [-t threads] [-k top] YYYY-MM-DD [YYYY-MM-DD]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if ((optind >= argc) || !parse_date(argv[optind], &first)
+	    || !parse_date((optind + 1 < argc) ? argv[optind + 1] : argv[optind], &last)) {
+		fprintf(stderr, "Usage: %s [-r log_root] [-t threads] [-k top] YYYY-MM-DD [YYYY-MM-DD]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if (threads < 1)
+		threads = 1;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	size_t file_cnt, total;
+	log_file_t *const files = map_files(log_root, first, &last, &file_cnt, &total);
+	worker_t *const workers = (worker_t*) calloc(threads, sizeof(worker_t));
+
+	if (!workers)
+		exit(EXIT_FAILURE);
+	split_chunks(files, file_cnt, total, threads);
+
+	for (long i = 0; i < threads; i++)
+		if (pthread_create(&workers[i].thread, NULL, run_worker, &workers[i]) != 0) {
+			fprintf(stderr, "loganalyze: pthread_create: %s\n", strerror(errno));
+			return EXIT_FAILURE;
+		}
+
+	tally_t *const tally = &workers[0].tally;
+
+	for (long i = 0; i < threads; i++) {
+		pthread_join(workers[i].thread, NULL);
+
+		if (i == 0)
+			continue;
+		table_merge(&tally->paths, &workers[i].tally.paths);
+		table_merge(&tally->clients, &workers[i].tally.clients);
+		table_merge(&tally->seconds, &workers[i].tally.seconds);
+		tally->requests += workers[i].tally.requests;
+		tally->bad_requests += workers[i].tally.bad_requests;
+		tally->errors += workers[i].tally.errors;
+		tally->malformed += workers[i].tally.malformed;
+	}
+
+	const double seconds = elapsed_s(&start);
+	const count_t *peak = NULL;
+
+	for (size_t i = 0; i < tally->seconds.cap; i++)
+		if (tally->seconds.slots[i].key && (!peak || (tally->seconds.slots[i].count > peak->count)))
+			peak = &tally->seconds.slots[i];
+
+	printf("files %zu, %zu bytes in %.3f s with %ld threads (%.1f MB/s)\n", file_cnt, total, seconds, threads,
+	       seconds > 0 ? total / seconds / 1e6 : 0.0);
+	printf("requests %llu\nbad_requests %llu\nerrors %llu\nmalformed %llu\n", (unsigned long long) tally->requests,
+	       (unsigned long long) tally->bad_requests, (unsigned long long) tally->errors,
+	       (unsigned long long) tally->malformed);
+	if (peak)
+		printf("requests_per_second average %.2f over %zu active seconds, peak %llu at %.*s\n",
+		       (double) tally->requests / tally->seconds.used, tally->seconds.used,
+		       (unsigned long long) peak->count, (int) peak->len, peak->key);
+	print_top("top paths", &tally->paths, top);
+	print_top("top clients", &tally->clients, top);
+
+	for (size_t i = 0; i < file_cnt; i++) {
+		if (files[i].inflated)
+			free((void*) files[i].data);
+		else
+			munmap((void*) files[i].data, files[i].len);
+	}
+	for (long i = 0; i < threads; i++) {
+		free(workers[i].tally.paths.slots);
+		free(workers[i].tally.clients.slots);
+		free(workers[i].tally.seconds.slots);
+	}
+	free(workers);
+	free(files);
+	free(_chunks);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,715 @@
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <semaphore.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "../lib/types/types.h"
+#include "../lib/capture/capture.h"
+
+// Companion tool that replays a capture written by the server's capture_path
+// against a server. Every recorded connection gets a connection and a thread
+// of its own that sends its requests in order, each one no earlier than its
+// recorded arrival divided by the speed factor and never before the previous
+// response ended, so keep-alive reuse and the number of connections open at
+// a time follow the recording. At speed 0 requests go out as fast as the
+// responses come back, with at most as many connections at once as the
+// recording peaked at. The latency of every request, from its last octet sent
+// to the end of its response, is then compared with the one the server
+// recorded, from the request complete to the last octet of the response
+// queued.
+//
+// Usage: replay [-a address] [-p port] [-s speed] [-c connections] [-k top] capture_file
+
+#define DEFAULT_ADDRESS "127.0.0.1"
+#define DEFAULT_PORT "8888"
+#define DEFAULT_TOP 10
+#define READ_LEN (64 * 1024)
+#define STACK_LEN (256 * 1024)
+#define CHUNK_LINE_LEN 32
+#define HEX 16
+#define US_PER_MS 1000.0
+
+typedef struct request_s {
+	const cap_record_t *head;
+	const char *data; // Header block, then body
+	uint64_t latency_us; // Replayed
+	int status; // Of the replayed response, 0 when it failed
+} request_t;
+
+// The requests of one recorded connection, a run of _order
+typedef struct session_s {
+	size_t first, count;
+} session_t;
+
+// Buffered input of a connection
+typedef struct reader_s {
+	int fd;
+	size_t pos, len;
+	char buf[READ_LEN];
+} reader_t;
+
+typedef struct target_s {
+	const char *name;
+	size_t len, first, count; // Run of the valid requests sorted by target
+	double recorded_ms, replayed_ms;
+} target_t;
+
+static request_t *_requests;
+static size_t *_order, _request_cnt = 0;
+static session_t *_sessions;
+static size_t _session_cnt = 0;
+static struct addrinfo *_server;
+static double _speed = 1.0;
+static struct timespec _start;
+static sem_t _slots; // Connections allowed at once at speed 0
+static pthread_mutex_t _lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t _idle = PTHREAD_COND_INITIALIZER;
+static size_t _running = 0;
+static uint64_t _reconnects = 0;
+
+static uint64_t now_us(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Sleeps until offset_us of the recording, scaled to the speed
+static void wait_for(const uint64_t offset_us) {
+	if (_speed <= 0.0)
+		return;
+
+	const uint64_t ns = (uint64_t) (offset_us * 1000.0 / _speed);
+	struct timespec at = {_start.tv_sec + ns / 1000000000ULL, _start.tv_nsec + ns % 1000000000ULL};
+
+	if (at.tv_nsec >= 1000000000L) {
+		at.tv_sec++;
+		at.tv_nsec -= 1000000000L;
+	}
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &at, NULL) == EINTR)
+		;
+}
+
+static int connect_server(void) {
+	const int one = 1;
+
+	for (const struct addrinfo *ai = _server; ai; ai = ai->ai_next) {
+		const int fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+
+		if (fd == -1)
+			continue;
+		if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+			setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+			return fd;
+		}
+		close(fd);
+	}
+
+	return -1;
+}
+
+static bool send_all(const int fd, const char *restrict data, size_t len) {
+	while (len) {
+		const ssize_t nbytes = send(fd, data, len, MSG_NOSIGNAL);
+
+		if (nbytes == -1) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		data += nbytes;
+		len -= nbytes;
+	}
+
+	return true;
+}
+
+// A body recorded decoded from chunks goes out as a single chunk
+static bool send_request(const int fd, const request_t *const restrict request) {
+	const cap_record_t *const head = request->head;
+	const char *const body = request->data + head->header_len;
+	char line[CHUNK_LINE_LEN];
+
+	if (!send_all(fd, request->data, head->header_len))
+		return false;
+
+	if (!(head->flags & CAP_CHUNKED))
+		return send_all(fd, body, head->body_len);
+
+	if (head->body_len) {
+		snprintf(line, CHUNK_LINE_LEN, "%llx\r\n", (unsigned long long) head->body_len);
+		if (!send_all(fd, line, strlen(line)) || !send_all(fd, body, head->body_len) || !send_all(fd, "\r\n", 2))
+			return false;
+	}
+
+	return send_all(fd, "0\r\n\r\n", 5);
+}
+
+// Reads more input after what is buffered. Returns false at the end of input.
+static bool fill(reader_t *const restrict reader) {
+	if (reader->pos) {
+		memmove(reader->buf, reader->buf + reader->pos, reader->len - reader->pos);
+		reader->len -= reader->pos;
+		reader->pos = 0;
+	}
+	if (reader->len == READ_LEN)
+		return false;
+
+	ssize_t nbytes;
+
+	while (((nbytes = recv(reader->fd, reader->buf + reader->len, READ_LEN - reader->len, 0)) == -1) && (errno == EINTR))
+		;
+	if (nbytes <= 0)
+		return false;
+	reader->len += nbytes;
+
+	return true;
+}
+
+// Length of the buffered input up to the end of what stop finds, reading until
+// it is found. 0 when the input ends first.
+static size_t find_end(reader_t *const restrict reader, const char *(*stop)(const char *, const char *)) {
+	const char *end;
+
+	while (!(end = stop(reader->buf + reader->pos, reader->buf + reader->len)))
+		if (!fill(reader))
+			return 0;
+
+	return end - (reader->buf + reader->pos);
+}
+
+static const char *line_end(const char *start, const char *end) {
+	const char *const newline = memchr(start, '\n', end - start);
+
+	return newline ? newline + 1 : NULL;
+}
+
+static const char *header_end(const char *start, const char *end) {
+	for (const char *p = start; (p = memchr(p, '\n', end - p)); p++)
+		if ((p + 1 < end) && (p[1] == '\n'))
+			return p + 2;
+		else if ((p + 2 < end) && (p[1] == '\r') && (p[2] == '\n'))
+			return p + 3;
+
+	return NULL;
+}
+
+// Drops len octets of input, buffered or not
+static bool skip(reader_t *const restrict reader, uint64_t len) {
+	while (len) {
+		if (reader->pos == reader->len) {
+			reader->pos = reader->len = 0;
+			if (!fill(reader))
+				return false;
+		}
+
+		const size_t take = (reader->len - reader->pos < len) ? reader->len - reader->pos : len;
+
+		reader->pos += take;
+		len -= take;
+	}
+
+	return true;
+}
+
+// Takes one line of input. Returns its length, 0 when the input ends first.
+static size_t take_line(reader_t *const restrict reader) {
+	const size_t len = find_end(reader, line_end);
+
+	reader->pos += len;
+
+	return len;
+}
+
+static bool skip_chunks(reader_t *const restrict reader) {
+	size_t len;
+
+	while ((len = find_end(reader, line_end))) {
+		const uint64_t size = strtoull(reader->buf + reader->pos, NULL, HEX);
+
+		reader->pos += len;
+		if (!size)
+			break;
+
+		if (!skip(reader, size) || !take_line(reader)) // The CRLF after the data
+			return false;
+	}
+
+	// Trailer fields up to the empty line
+	while (len && (len = take_line(reader)))
+		if (len <= 2)
+			return true;
+
+	return false;
+}
+
+// Value of a field in the header block at start, NULL when it is missing
+static const char *field(const char *start, const char *end, const String restrict name) {
+	const size_t name_len = strlen(name);
+
+	for (const char *line = start; line < end; ) {
+		const char *const next = line_end(line, end);
+
+		if ((end - line > (ptrdiff_t) name_len) && (strncasecmp(line, name, name_len) == 0) && (line[name_len] == ':')) {
+			line += name_len + 1;
+			while ((*line == ' ') || (*line == '\t'))
+				line++;
+			return line;
+		}
+		if (!next)
+			break;
+		line = next;
+	}
+
+	return NULL;
+}
+
+// Reads one response and what it says about the connection. Returns its
+// status, 0 when the input ended first.
+static int read_response(reader_t *const restrict reader, const bool head_request, bool *const restrict keep) {
+	int status;
+	size_t len;
+
+	do { // Interim responses, 100 Continue, come first
+		if (!(len = find_end(reader, header_end)))
+			return 0;
+
+		const char *const start = reader->buf + reader->pos;
+
+		status = (len > 12) ? atoi(start + 9) : 0;
+		reader->pos += (status >= 100 && status < 200) ? len : 0;
+	} while (status >= 100 && status < 200);
+
+	const char *const start = reader->buf + reader->pos, *const end = start + len;
+	const char *const connection = field(start, end, "Connection");
+	const char *const encoding = field(start, end, "Transfer-Encoding");
+	const char *const length = field(start, end, "Content-Length");
+	const bool http10 = (strncmp(start, "HTTP/1.0", 8) == 0);
+
+	*keep = connection ? (strncasecmp(connection, "keep-alive", 10) == 0) : !http10;
+	if (connection && (strncasecmp(connection, "close", 5) == 0))
+		*keep = false;
+	reader->pos += len;
+
+	if (!status)
+		return 0;
+	if (head_request || (status == 204) || (status == 304))
+		return status;
+	if (encoding && strncasecmp(encoding, "chunked", 7) == 0)
+		return skip_chunks(reader) ? status : 0;
+	if (length)
+		return skip(reader, strtoull(length, NULL, 10)) ? status : 0;
+
+	// Delimited by the end of the connection
+	*keep = false;
+	reader->pos = reader->len = 0;
+	while (fill(reader))
+		reader->pos = reader->len = 0;
+
+	return status;
+}
+
+static void *replay_session(void *const arg) {
+	const session_t *const session = (const session_t*) arg;
+	reader_t *const reader = (reader_t*) malloc(sizeof(reader_t));
+	bool keep = false;
+
+	if (!reader)
+		exit(EXIT_FAILURE);
+	reader->fd = -1;
+
+	for (size_t i = 0; i < session->count; i++) {
+		request_t *const request = &_requests[_order[session->first + i]];
+
+		wait_for(request->head->offset_us);
+
+		if (reader->fd == -1) {
+			if (i)
+				__atomic_add_fetch(&_reconnects, 1, __ATOMIC_RELAXED);
+			if ((reader->fd = connect_server()) == -1)
+				continue;
+			reader->pos = reader->len = 0;
+		}
+
+		if (send_request(reader->fd, request)) {
+			const uint64_t sent_us = now_us();
+
+			request->status = read_response(reader, strncmp(request->data, "HEAD ", 5) == 0, &keep);
+			request->latency_us = now_us() - sent_us;
+		}
+
+		if (!request->status || !keep) {
+			close(reader->fd);
+			reader->fd = -1;
+		}
+	}
+
+	if (reader->fd != -1)
+		close(reader->fd);
+	free(reader);
+
+	if (_speed <= 0.0)
+		sem_post(&_slots);
+	pthread_mutex_lock(&_lock);
+	if (!--_running)
+		pthread_cond_signal(&_idle);
+	pthread_mutex_unlock(&_lock);
+
+	return NULL;
+}
+
+// Splits the mapped capture into its records. Returns false when it is not one.
+static bool read_capture(const char *data, const size_t len) {
+	size_t pos = CAP_MAGIC_LEN + sizeof(uint64_t), cap = 0;
+
+	if ((len < pos) || (memcmp(data, CAP_MAGIC, CAP_MAGIC_LEN) != 0))
+		return false;
+
+	while (pos + sizeof(cap_record_t) <= len) {
+		const cap_record_t *const head = (const cap_record_t*) (data + pos);
+		const uint64_t record_len = sizeof(cap_record_t) + head->header_len + head->body_len;
+
+		if (record_len > len - pos)
+			break; // Cut short by a server that did not stop cleanly
+
+		if (_request_cnt == cap) {
+			cap = cap ? cap * 2 : 1024;
+			_requests = (request_t*) realloc(_requests, cap * sizeof(request_t));
+			if (!_requests)
+				exit(EXIT_FAILURE);
+		}
+		_requests[_request_cnt++] = (request_t) {head, data + pos + sizeof(cap_record_t), 0, 0};
+		pos += record_len;
+	}
+
+	return true;
+}
+
+static int compare_order(const void *const a, const void *const b) {
+	const cap_record_t *const x = _requests[*(const size_t*) a].head, *const y = _requests[*(const size_t*) b].head;
+
+	if (x->conn != y->conn)
+		return (x->conn > y->conn) - (x->conn < y->conn);
+
+	return (x->offset_us > y->offset_us) - (x->offset_us < y->offset_us);
+}
+
+static int compare_sessions(const void *const a, const void *const b) {
+	const uint64_t x = _requests[_order[((const session_t*) a)->first]].head->offset_us;
+	const uint64_t y = _requests[_order[((const session_t*) b)->first]].head->offset_us;
+
+	return (x > y) - (x < y);
+}
+
+static int compare_u64(const void *const a, const void *const b) {
+	const uint64_t x = *(const uint64_t*) a, y = *(const uint64_t*) b;
+
+	return (x > y) - (x < y);
+}
+
+static int compare_double(const void *const a, const void *const b) {
+	const double x = *(const double*) a, y = *(const double*) b;
+
+	return (x > y) - (x < y);
+}
+
+// Groups the requests by connection, each session in arrival order and the
+// sessions by their first arrival. Returns the most sessions open at once.
+static size_t build_sessions(void) {
+	_order = (size_t*) malloc(_request_cnt * sizeof(size_t));
+	_sessions = (session_t*) malloc(_request_cnt * sizeof(session_t));
+	if (!_order || !_sessions)
+		exit(EXIT_FAILURE);
+
+	for (size_t i = 0; i < _request_cnt; i++)
+		_order[i] = i;
+	qsort(_order, _request_cnt, sizeof(size_t), compare_order);
+
+	for (size_t i = 0; i < _request_cnt; i++) {
+		if (!i || (_requests[_order[i]].head->conn != _requests[_order[i - 1]].head->conn))
+			_sessions[_session_cnt++] = (session_t) {i, 0};
+		_sessions[_session_cnt - 1].count++;
+	}
+	qsort(_sessions, _session_cnt, sizeof(session_t), compare_sessions);
+
+	// Opens and closes of every session, a close sorts odd so it goes before an open at the same time
+	uint64_t *const edges = (uint64_t*) malloc(_session_cnt * 2 * sizeof(uint64_t));
+	size_t open = 0, peak = 0;
+
+	if (!edges)
+		exit(EXIT_FAILURE);
+
+	for (size_t i = 0; i < _session_cnt; i++) {
+		const cap_record_t *const first = _requests[_order[_sessions[i].first]].head;
+		const cap_record_t *const last = _requests[_order[_sessions[i].first + _sessions[i].count - 1]].head;
+
+		edges[i * 2] = first->offset_us * 2 + 1;
+		edges[i * 2 + 1] = (last->offset_us + last->latency_us) * 2;
+	}
+	qsort(edges, _session_cnt * 2, sizeof(uint64_t), compare_u64);
+
+	for (size_t i = 0; i < _session_cnt * 2; i++) {
+		if (edges[i] & 1)
+			peak = (++open > peak) ? open : peak;
+		else
+			open--;
+	}
+	free(edges);
+
+	return peak;
+}
+
+// Method and path of the request line, without the query
+static size_t target_len(const char *restrict data, const size_t len) {
+	const char *const space = memchr(data, ' ', len);
+
+	if (!space)
+		return 0;
+
+	size_t end = space - data + 1;
+
+	while ((end < len) && (data[end] != ' ') && (data[end] != '?') && (data[end] != '\r') && (data[end] != '\n'))
+		end++;
+
+	return end;
+}
+
+static int compare_targets(const void *const a, const void *const b) {
+	const request_t *const x = &_requests[*(const size_t*) a], *const y = &_requests[*(const size_t*) b];
+	const size_t x_len = target_len(x->data, x->head->header_len), y_len = target_len(y->data, y->head->header_len);
+	const int order = memcmp(x->data, y->data, (x_len < y_len) ? x_len : y_len);
+
+	return order ? order : (x_len > y_len) - (x_len < y_len);
+}
+
+static int compare_divergence(const void *const a, const void *const b) {
+	const target_t *const x = (const target_t*) a, *const y = (const target_t*) b;
+	const double dx = x->replayed_ms - x->recorded_ms, dy = y->replayed_ms - y->recorded_ms;
+	const double ax = (dx < 0) ? -dx : dx, ay = (dy < 0) ? -dy : dy;
+
+	return (ax < ay) - (ax > ay);
+}
+
+static uint64_t percentile(const uint64_t *restrict sorted, const size_t len, const double share) {
+	return len ? sorted[(size_t) (share * (len - 1))] : 0;
+}
+
+static void print_latencies(const String restrict title, uint64_t *restrict values, const size_t len) {
+	qsort(values, len, sizeof(uint64_t), compare_u64);
+	printf("%-10s %10.3f %10.3f %10.3f %10.3f\n", title, percentile(values, len, 0.5) / US_PER_MS,
+	       percentile(values, len, 0.9) / US_PER_MS, percentile(values, len, 0.99) / US_PER_MS,
+	       len ? values[len - 1] / US_PER_MS : 0.0);
+}
+
+// Median of the recorded and replayed latencies of a run of valid requests
+static void target_medians(target_t *const restrict target, const size_t *restrict valid, uint64_t *restrict scratch) {
+	for (size_t i = 0; i < target->count; i++)
+		scratch[i] = _requests[valid[target->first + i]].head->latency_us;
+	qsort(scratch, target->count, sizeof(uint64_t), compare_u64);
+	target->recorded_ms = percentile(scratch, target->count, 0.5) / US_PER_MS;
+
+	for (size_t i = 0; i < target->count; i++)
+		scratch[i] = _requests[valid[target->first + i]].latency_us;
+	qsort(scratch, target->count, sizeof(uint64_t), compare_u64);
+	target->replayed_ms = percentile(scratch, target->count, 0.5) / US_PER_MS;
+}
+
+static void report(const size_t top) {
+	size_t *const valid = (size_t*) malloc((_request_cnt + 1) * sizeof(size_t));
+	uint64_t *const recorded = (uint64_t*) malloc((_request_cnt + 1) * sizeof(uint64_t));
+	uint64_t *const replayed = (uint64_t*) malloc((_request_cnt + 1) * sizeof(uint64_t));
+	double *const ratios = (double*) malloc((_request_cnt + 1) * sizeof(double));
+	target_t *const targets = (target_t*) malloc((_request_cnt + 1) * sizeof(target_t));
+	uint64_t classes[6] = {0}, failed = 0, aborted = 0;
+	size_t valid_cnt = 0, target_cnt = 0;
+
+	if (!valid || !recorded || !replayed || !ratios || !targets)
+		exit(EXIT_FAILURE);
+
+	for (size_t i = 0; i < _request_cnt; i++) {
+		const request_t *const request = &_requests[i];
+
+		if (!request->status) {
+			failed++;
+			continue;
+		}
+		classes[(request->status / 100 < 6) ? request->status / 100 : 0]++;
+
+		if (request->head->flags & CAP_ABORTED) {
+			aborted++;
+			continue;
+		}
+		recorded[valid_cnt] = request->head->latency_us;
+		replayed[valid_cnt] = request->latency_us;
+		ratios[valid_cnt] = (double) (request->latency_us ? request->latency_us : 1)
+		                    / (request->head->latency_us ? request->head->latency_us : 1);
+		valid[valid_cnt++] = i;
+	}
+
+	printf("failed %llu, reconnects %llu, recorded as aborted %llu\n", (unsigned long long) failed,
+	       (unsigned long long) _reconnects, (unsigned long long) aborted);
+	printf("status 1xx %llu, 2xx %llu, 3xx %llu, 4xx %llu, 5xx %llu, other %llu\n",
+	       (unsigned long long) classes[1], (unsigned long long) classes[2], (unsigned long long) classes[3],
+	       (unsigned long long) classes[4], (unsigned long long) classes[5], (unsigned long long) classes[0]);
+	printf("latency_ms %10s %10s %10s %10s\n", "p50", "p90", "p99", "max");
+	print_latencies("recorded", recorded, valid_cnt);
+	print_latencies("replayed", replayed, valid_cnt);
+
+	qsort(ratios, valid_cnt, sizeof(double), compare_double);
+	if (valid_cnt)
+		printf("replayed/recorded per request: p10 %.2fx, p50 %.2fx, p90 %.2fx, p99 %.2fx\n",
+		       ratios[(size_t) (0.1 * (valid_cnt - 1))], ratios[(size_t) (0.5 * (valid_cnt - 1))],
+		       ratios[(size_t) (0.9 * (valid_cnt - 1))], ratios[(size_t) (0.99 * (valid_cnt - 1))]);
+
+	qsort(valid, valid_cnt, sizeof(size_t), compare_targets);
+
+	for (size_t i = 0; i < valid_cnt; i++) {
+		if (!i || compare_targets(&valid[i], &valid[i - 1])) {
+			const request_t *const request = &_requests[valid[i]];
+
+			targets[target_cnt++] = (target_t) {request->data, target_len(request->data, request->head->header_len), i,
+			                                    0, 0.0, 0.0};
+		}
+		targets[target_cnt - 1].count++;
+	}
+
+	for (size_t i = 0; i < target_cnt; i++)
+		target_medians(&targets[i], valid, recorded);
+	qsort(targets, target_cnt, sizeof(target_t), compare_divergence);
+
+	printf("targets by divergence of the median\n%12s %12s %12s %10s  %s\n", "delta_ms", "recorded_ms", "replayed_ms",
+	       "requests", "target");
+	for (size_t i = 0; (i < target_cnt) && (i < top); i++)
+		printf("%+12.3f %12.3f %12.3f %10zu  %.*s\n", targets[i].replayed_ms - targets[i].recorded_ms,
+		       targets[i].recorded_ms, targets[i].replayed_ms, targets[i].count, (int) targets[i].len, targets[i].name);
+
+	free(valid);
+	free(recorded);
+	free(replayed);
+	free(ratios);
+	free(targets);
+}
+
+int main(const int argc, String *const argv) {
+	String address = DEFAULT_ADDRESS, port = DEFAULT_PORT;
+	const struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM};
+	size_t top = DEFAULT_TOP, connections = 0;
+	struct stat file;
+	pthread_attr_t attr;
+	int c, fd;
+
+	while ((c = getopt(argc, argv, "a:p:s:c:k:")) != -1) {
+		switch (c) {
+		case 'a':
+			address = optarg;
+			break;
+		case 'p':
+			port = optarg;
+			break;
+		case 's':
+			_speed = strtod(optarg, NULL);
+			break;
+		case 'c':
+			connections = strtoul(optarg, NULL, 10);
+			break;
+		case 'k':
+			top = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-a address] [-p port] [-s speed] [-c connections] [-k top] capture_file\n",
+			        argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (optind >= argc) {
+		fprintf(stderr, "Usage: %s [-a address] [-p port] [-s speed] [-c connections] [-k top] capture_file\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if (((fd = open(argv[optind], O_RDONLY | O_CLOEXEC)) == -1) || (fstat(fd, &file) == -1)) {
+		fprintf(stderr, "replay: %s: %s\n", argv[optind], strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	const char *const data = (file.st_size > 0) ? mmap(NULL, file.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+
+	close(fd);
+	if ((data == MAP_FAILED) || !read_capture(data, file.st_size)) {
+		fprintf(stderr, "replay: %s: not a capture\n", argv[optind]);
+		return EXIT_FAILURE;
+	}
+
+	if ((c = getaddrinfo(address, port, &hints, &_server)) != 0) {
+		fprintf(stderr, "replay: %s: %s\n", address, gai_strerror(c));
+		return EXIT_FAILURE;
+	}
+
+	const size_t peak = _request_cnt ? build_sessions() : 0;
+
+	if (!connections)
+		connections = peak ? peak : 1;
+	sem_init(&_slots, 0, connections);
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	pthread_attr_setstacksize(&attr, STACK_LEN);
+	clock_gettime(CLOCK_MONOTONIC, &_start);
+
+	for (size_t i = 0; i < _session_cnt; i++) {
+		pthread_t thread;
+
+		if (_speed > 0.0)
+			wait_for(_requests[_order[_sessions[i].first]].head->offset_us);
+		else
+			sem_wait(&_slots);
+
+		pthread_mutex_lock(&_lock);
+		_running++;
+		pthread_mutex_unlock(&_lock);
+
+		if (pthread_create(&thread, &attr, replay_session, &_sessions[i]) != 0) {
+			fprintf(stderr, "replay: pthread_create: %s\n", strerror(errno));
+			return EXIT_FAILURE;
+		}
+	}
+
+	pthread_mutex_lock(&_lock);
+	while (_running)
+		pthread_cond_wait(&_idle, &_lock);
+	pthread_mutex_unlock(&_lock);
+
+	const double seconds = (now_us() - (_start.tv_sec * 1000000ULL + _start.tv_nsec / 1000)) / 1e6;
+
+	if (_speed > 0.0)
+		printf("replayed %zu requests on %zu connections in %.3f s at %.2fx, %zu open at most when recorded\n",
+		       _request_cnt, _session_cnt, seconds, _speed, peak);
+	else
+		printf("replayed %zu requests on %zu connections in %.3f s as fast as possible, %zu open at most\n",
+		       _request_cnt, _session_cnt, seconds, connections);
+	report(top);
+
+	pthread_attr_destroy(&attr);
+	sem_destroy(&_slots);
+	freeaddrinfo(_server);
+	munmap((void*) data, file.st_size);
+	free(_requests);
+	free(_order);
+	free(_sessions);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,152 @@
+#include <time.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netinet/in.h>
+
+#include "../lib/types/types.h"
+#include "../lib/rate_limit/rate_limit.h"
+
+// Companion benchmark of lib/rate_limit. Every thread checks random clients
+// of a population against one shared table for a number of checks, with the
+// clock advancing a millisecond every thousand checks so buckets refill. More
+// clients than slots keep the CLOCK eviction busy. Prints the time of one
+// rl_allow() and the checks per second of all threads together.
+//
+// Usage: rlbench [-c clients] [-s slots] [-n checks] [-t threads]
+
+#define DEFAULT_CLIENTS 200000
+#define DEFAULT_SLOTS 65536
+#define DEFAULT_CHECKS 10000000
+#define DEFAULT_THREADS 1
+#define CHECKS_PER_MS 1000
+
+typedef struct worker_s {
+	pthread_t thread;
+	uint64_t seed, allowed;
+	double elapsed_s;
+} __attribute__((aligned(64))) worker_t; // A line of its own, the counters are written in the loop
+
+static Rate_Limiter _limiter;
+static uint64_t *_clients;
+static size_t _client_cnt = DEFAULT_CLIENTS, _check_cnt = DEFAULT_CHECKS;
+
+static uint64_t now_us(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint64_t next_random(uint64_t *const restrict state) { // xorshift64
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+
+	return *state;
+}
+
+static void *run_worker(void *const arg) {
+	worker_t *const worker = (worker_t*) arg;
+	const uint64_t start = now_us();
+
+	for (size_t i = 0; i < _check_cnt; i++) {
+		const uint64_t random = next_random(&worker->seed);
+		const rl_class_t class = (random >> 63) ? RL_DYNAMIC : RL_STATIC;
+
+		worker->allowed += rl_allow(_limiter, _clients[random % _client_cnt], class, i / CHECKS_PER_MS);
+	}
+	worker->elapsed_s = (now_us() - start) / 1e6;
+
+	return NULL;
+}
+
+int main(const int argc, String *const argv) {
+	const rl_limit_t limits[RL_CLASSES] = {{100, 200}, {10, 20}};
+	unsigned int slots = DEFAULT_SLOTS;
+	size_t threads = DEFAULT_THREADS;
+	int c;
+
+	while ((c = getopt(argc, argv, "c:s:n:t:")) != -1) {
+		switch (c) {
+		case 'c':
+			_client_cnt = strtoul(optarg, NULL, 10);
+			break;
+		case 's':
+			slots = strtoul(optarg, NULL, 10);
+			break;
+		case 'n':
+			_check_cnt = strtoul(optarg, NULL, 10);
+			break;
+		case 't':
+			threads = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-c clients] [-s slots] [-n checks] [-t threads]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (!_client_cnt || !slots || !_check_cnt || !threads) {
+		fprintf(stderr, "Usage: %s [-c clients] [-s slots] [-n checks] [-t threads]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	worker_t *workers;
+
+	if (posix_memalign((void**) &workers, 64, threads * sizeof(worker_t)) != 0)
+		exit(EXIT_FAILURE);
+	memset(workers, 0, threads * sizeof(worker_t));
+
+	_clients = (uint64_t*) calloc(_client_cnt, sizeof(uint64_t));
+	if (!_clients)
+		exit(EXIT_FAILURE);
+
+	// IPv4 clients, as rl_client_key() maps them
+	for (size_t i = 0; i < _client_cnt; i++) {
+		struct in6_addr address = IN6ADDR_ANY_INIT;
+
+		address.s6_addr[10] = address.s6_addr[11] = 0xff;
+		address.s6_addr[12] = 10;
+		address.s6_addr[13] = (i >> 16) & 0xff;
+		address.s6_addr[14] = (i >> 8) & 0xff;
+		address.s6_addr[15] = i & 0xff;
+		_clients[i] = rl_client_key(&address);
+	}
+
+	_limiter = rl_create(slots, limits);
+
+	for (size_t i = 0; i < threads; i++) {
+		workers[i].seed = 0x2545f4914f6cdd1dULL * (i + 1);
+
+		if (pthread_create(&workers[i].thread, NULL, run_worker, &workers[i]) != 0) {
+			fprintf(stderr, "rlbench: pthread_create: %s\n", strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	double slowest = 0.0;
+	uint64_t allowed = 0;
+
+	for (size_t i = 0; i < threads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		allowed += workers[i].allowed;
+		if (workers[i].elapsed_s > slowest)
+			slowest = workers[i].elapsed_s;
+	}
+
+	printf("%zu clients, %u slots, %zu threads, %zu checks each\n", _client_cnt, _limiter->mask + 1, threads, _check_cnt);
+	printf("%.1f ns per check, %.0f checks/s, %.1f%% allowed\n", slowest * 1e9 / _check_cnt,
+	       threads * _check_cnt / slowest, 100.0 * allowed / (threads * _check_cnt));
+
+	rl_destroy(_limiter);
+	free(_clients);
+	free(workers);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,367 @@
+#include <time.h>
+#include <errno.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+#include "../lib/types/types.h"
+
+// Companion benchmark of a TLS listener. Three phases of the same length run
+// on as many threads as connections: full handshakes, each on a new
+// connection without a session; resumed handshakes, offering the session a
+// first request left behind (a ticket, or the id the server cached); and
+// encrypted throughput, where every thread fetches the target over one
+// keep-alive connection as often as it can. Certificates are not verified.
+//
+// Usage: tlsbench [-a address] [-p port] [-c connections] [-d seconds] [-t target]
+
+#define DEFAULT_ADDRESS "127.0.0.1"
+#define DEFAULT_PORT "8443"
+#define DEFAULT_CONNECTIONS 8
+#define DEFAULT_SECONDS 5
+#define DEFAULT_TARGET "/"
+#define READ_LEN (64 * 1024)
+#define REQUEST_LEN 1024
+#define MBYTE 1048576.0
+
+typedef enum phase_e {
+	PHASE_FULL,
+	PHASE_RESUMED,
+	PHASE_THROUGHPUT
+} phase_t;
+
+typedef struct worker_s {
+	pthread_t thread;
+	phase_t phase;
+	SSL_SESSION *session; // Offered by the resumed phase
+	uint64_t handshakes, resumed, failures, responses, bytes;
+} worker_t;
+
+// Buffered input of a connection
+typedef struct reader_s {
+	SSL *ssl;
+	size_t pos, len;
+	char buf[READ_LEN];
+} reader_t;
+
+static struct addrinfo *_server;
+static SSL_CTX *_ctx;
+static String _target = DEFAULT_TARGET;
+static volatile bool _stop = false;
+
+static uint64_t now_us(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int connect_server(void) {
+	const int one = 1;
+
+	for (const struct addrinfo *ai = _server; ai; ai = ai->ai_next) {
+		const int fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+
+		if (fd == -1)
+			continue;
+		if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+			setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+			return fd;
+		}
+		close(fd);
+	}
+
+	return -1;
+}
+
+// A blocking connection with its handshake done, NULL when either failed
+static SSL *open_session(SSL_SESSION *const session) {
+	const int fd = connect_server();
+
+	if (fd == -1)
+		return NULL;
+
+	SSL *const ssl = SSL_new(_ctx);
+
+	if (!ssl || (SSL_set_fd(ssl, fd) != 1) || (session && (SSL_set_session(ssl, session) != 1))
+	    || (SSL_connect(ssl) != 1)) {
+		ERR_clear_error();
+		SSL_free(ssl);
+		close(fd);
+		return NULL;
+	}
+
+	return ssl;
+}
+
+// close_notify first, OpenSSL does not resume a session that ended without it
+static void close_session(SSL *const ssl) {
+	const int fd = SSL_get_fd(ssl);
+
+	SSL_shutdown(ssl);
+	ERR_clear_error();
+	SSL_free(ssl);
+	close(fd);
+}
+
+// Reads more input after what is buffered. Returns false at the end of input.
+static bool fill(reader_t *const restrict reader) {
+	if (reader->pos) {
+		memmove(reader->buf, reader->buf + reader->pos, reader->len - reader->pos);
+		reader->len -= reader->pos;
+		reader->pos = 0;
+	}
+	if (reader->len == READ_LEN)
+		return false;
+
+	const int nbytes = SSL_read(reader->ssl, reader->buf + reader->len, READ_LEN - reader->len);
+
+	if (nbytes <= 0) {
+		ERR_clear_error();
+		return false;
+	}
+	reader->len += nbytes;
+
+	return true;
+}
+
+// Sends a request for the target and reads its response. Returns the length
+// of the body, -1 when the response is not complete or has no Content-Length.
+static long long fetch(reader_t *const restrict reader, const bool keep_alive) {
+	char request[REQUEST_LEN];
+	const int len = snprintf(request, REQUEST_LEN, "GET %s HTTP/1.1\r\nHost: tlsbench\r\nConnection: %s\r\n\r\n", _target,
+	                         keep_alive ? "keep-alive" : "close");
+	const char *end;
+
+	if (SSL_write(reader->ssl, request, len) != len) {
+		ERR_clear_error();
+		return -1;
+	}
+
+	while (!(end = memmem(reader->buf + reader->pos, reader->len - reader->pos, "\r\n\r\n", 4)))
+		if (!fill(reader))
+			return -1;
+
+	const size_t header_len = end + 4 - (reader->buf + reader->pos);
+	const char *const field = memmem(reader->buf + reader->pos, header_len, "Content-Length:", 15);
+
+	if (!field)
+		return -1;
+
+	const long long body_len = strtoll(field + 15, NULL, 10);
+	long long left = body_len;
+
+	reader->pos += header_len;
+
+	while (left > 0) {
+		if (reader->pos == reader->len) {
+			reader->pos = reader->len = 0;
+			if (!fill(reader))
+				return -1;
+		}
+
+		const size_t take = ((long long) (reader->len - reader->pos) < left) ? reader->len - reader->pos : (size_t) left;
+
+		reader->pos += take;
+		left -= take;
+	}
+
+	return body_len;
+}
+
+static void *run_worker(void *const arg) {
+	worker_t *const worker = (worker_t*) arg;
+	reader_t *const reader = (reader_t*) calloc(1, sizeof(reader_t));
+	long long body_len;
+
+	if (!reader)
+		exit(EXIT_FAILURE);
+
+	if (worker->phase == PHASE_THROUGHPUT) {
+		if (!(reader->ssl = open_session(NULL))) {
+			worker->failures++;
+			free(reader);
+			return NULL;
+		}
+		while (!_stop && ((body_len = fetch(reader, true)) >= 0)) {
+			worker->responses++;
+			worker->bytes += body_len;
+		}
+		if (!_stop)
+			worker->failures++;
+		close_session(reader->ssl);
+		free(reader);
+		return NULL;
+	}
+
+	while (!_stop) {
+		// A copy each time, OpenSSL can mark a session it offered as no longer resumable
+		SSL_SESSION *const session = (worker->phase == PHASE_RESUMED) ? SSL_SESSION_dup(worker->session) : NULL;
+		SSL *const ssl = open_session(session);
+
+		SSL_SESSION_free(session);
+
+		if (!ssl) {
+			worker->failures++;
+			continue;
+		}
+		worker->handshakes++;
+		if (SSL_session_reused(ssl))
+			worker->resumed++;
+		close_session(ssl);
+	}
+	free(reader);
+
+	return NULL;
+}
+
+// A session to resume, taken after a response so TLS 1.3 tickets arrived
+static SSL_SESSION *first_session(void) {
+	reader_t *const reader = (reader_t*) calloc(1, sizeof(reader_t));
+	SSL_SESSION *session = NULL;
+
+	if (!reader)
+		exit(EXIT_FAILURE);
+
+	if ((reader->ssl = open_session(NULL))) {
+		fetch(reader, false);
+		session = SSL_get1_session(reader->ssl);
+		close_session(reader->ssl);
+	}
+	free(reader);
+
+	return session;
+}
+
+// Runs the phase on every worker for the given time, returns the seconds it took
+static double run_phase(worker_t *const workers, const size_t connections, const phase_t phase, const unsigned int seconds) {
+	const uint64_t start = now_us();
+
+	_stop = false;
+	for (size_t i = 0; i < connections; i++) {
+		workers[i].phase = phase;
+		workers[i].handshakes = workers[i].resumed = workers[i].failures = workers[i].responses = workers[i].bytes = 0;
+
+		if (pthread_create(&workers[i].thread, NULL, run_worker, &workers[i]) != 0) {
+			fprintf(stderr, "tlsbench: pthread_create: %s\n", strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+	}
+	sleep(seconds);
+	_stop = true;
+
+	for (size_t i = 0; i < connections; i++)
+		pthread_join(workers[i].thread, NULL);
+
+	return (now_us() - start) / 1e6;
+}
+
+static void sum(const worker_t *const workers, const size_t connections, worker_t *const total) {
+	memset(total, 0, sizeof(worker_t));
+
+	for (size_t i = 0; i < connections; i++) {
+		total->handshakes += workers[i].handshakes;
+		total->resumed += workers[i].resumed;
+		total->failures += workers[i].failures;
+		total->responses += workers[i].responses;
+		total->bytes += workers[i].bytes;
+	}
+}
+
+int main(const int argc, String *const argv) {
+	String address = DEFAULT_ADDRESS, port = DEFAULT_PORT;
+	const struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM};
+	size_t connections = DEFAULT_CONNECTIONS;
+	unsigned int seconds = DEFAULT_SECONDS;
+	worker_t total;
+	int c;
+
+	while ((c = getopt(argc, argv, "a:p:c:d:t:")) != -1) {
+		switch (c) {
+		case 'a':
+			address = optarg;
+			break;
+		case 'p':
+			port = optarg;
+			break;
+		case 'c':
+			connections = strtoul(optarg, NULL, 10);
+			break;
+		case 'd':
+			seconds = strtoul(optarg, NULL, 10);
+			break;
+		case 't':
+			_target = optarg;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-a address] [-p port] [-c connections] [-d seconds] [-t target]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (!connections || !seconds) {
+		fprintf(stderr, "Usage: %s [-a address] [-p port] [-c connections] [-d seconds] [-t target]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if ((c = getaddrinfo(address, port, &hints, &_server)) != 0) {
+		fprintf(stderr, "tlsbench: %s: %s\n", address, gai_strerror(c));
+		return EXIT_FAILURE;
+	}
+
+	if (!(_ctx = SSL_CTX_new(TLS_client_method()))) {
+		fprintf(stderr, "tlsbench: %s\n", ERR_reason_error_string(ERR_get_error()));
+		return EXIT_FAILURE;
+	}
+	SSL_CTX_set_session_cache_mode(_ctx, SSL_SESS_CACHE_CLIENT);
+
+	SSL_SESSION *const session = first_session();
+	worker_t *const workers = (worker_t*) calloc(connections, sizeof(worker_t));
+
+	if (!session) {
+		fprintf(stderr, "tlsbench: no TLS session with %s:%s\n", address, port);
+		return EXIT_FAILURE;
+	}
+	if (!workers)
+		exit(EXIT_FAILURE);
+
+	printf("%s:%s, %s %s, %zu connections, %u s per phase\n", address, port, SSL_SESSION_get_protocol_version(session)
+	       == TLS1_3_VERSION ? "TLSv1.3" : "TLSv1.2", SSL_CIPHER_get_name(SSL_SESSION_get0_cipher(session)), connections,
+	       seconds);
+
+	double elapsed = run_phase(workers, connections, PHASE_FULL, seconds);
+
+	sum(workers, connections, &total);
+	printf("full handshakes     %10.1f/s  %llu failed\n", total.handshakes / elapsed, (unsigned long long) total.failures);
+
+	for (size_t i = 0; i < connections; i++)
+		workers[i].session = session;
+	elapsed = run_phase(workers, connections, PHASE_RESUMED, seconds);
+	sum(workers, connections, &total);
+	printf("resumed handshakes  %10.1f/s  %llu failed, %.1f%% resumed\n", total.handshakes / elapsed,
+	       (unsigned long long) total.failures, total.handshakes ? 100.0 * total.resumed / total.handshakes : 0.0);
+
+	elapsed = run_phase(workers, connections, PHASE_THROUGHPUT, seconds);
+	sum(workers, connections, &total);
+	printf("throughput          %10.1f MB/s  %.1f responses/s of %s, %llu connections failed\n",
+	       total.bytes / MBYTE / elapsed, total.responses / elapsed, _target, (unsigned long long) total.failures);
+
+	SSL_SESSION_free(session);
+	SSL_CTX_free(_ctx);
+	freeaddrinfo(_server);
+	free(workers);
+
+	return EXIT_SUCCESS;
+}
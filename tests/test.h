@@ -0,0 +1,28 @@
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../single-HTTP/lib/colors/colors.h"
+
+// Shared by the unit tests in this directory, see make test in single-HTTP.
+// A failed CHECK is reported and counted, TEST_END exits with the verdict.
+
+static unsigned int _test_failures = 0, _test_checks = 0;
+
+#define CHECK(condition) do { \
+	_test_checks++; \
+	if (!(condition)) { \
+		_test_failures++; \
+		fprintf(stderr, RED "%s:%d: CHECK(%s) failed\n" RESET, __FILE__, __LINE__, #condition); \
+	} \
+} while (0)
+
+#define TEST_END() do { \
+	printf("%s%s: %u of %u checks passed" RESET "\n", _test_failures ? RED : GREEN, __FILE__, \
+	       _test_checks - _test_failures, _test_checks); \
+	return _test_failures ? EXIT_FAILURE : EXIT_SUCCESS; \
+} while (0)
+
+#endif /* End TEST_H */
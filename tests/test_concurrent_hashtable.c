@@ -0,0 +1,136 @@
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "test.h"
+#include "../single-HTTP/lib/concurrent_hashtable/concurrent_hashtable.h"
+
+// Threads get, insert, replace, remove and walk a small key space at once, so
+// shards resize and retired values are freed while others read them; some
+// threads leave and join again on the way. Every value carries its own key,
+// a value read under the wrong key or after it was freed fails a check. Built
+// with ThreadSanitizer and AddressSanitizer by make stress.
+
+#define THREADS 6
+#define OPERATIONS 200000
+#define KEYS 5000
+#define KEY_LEN 32
+#define REJOIN_EVERY 50000
+#define ITERATE_EVERY 1000
+
+typedef struct value_s {
+	char key[KEY_LEN];
+	uint64_t generation;
+} value_t;
+
+static Concurrent_HashTable _table;
+static unsigned int _mismatches = 0;
+
+static uint64_t next_random(uint64_t *const restrict state) { // xorshift64
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+
+	return *state;
+}
+
+static value_t *new_value(const String key, const uint64_t generation) {
+	value_t *const value = (value_t*) malloc(sizeof(value_t));
+	if (!value)
+		exit(EXIT_FAILURE);
+	snprintf(value->key, KEY_LEN, "%s", key);
+	value->generation = generation;
+
+	return value;
+}
+
+static void check_value(const String key, const value_t *const value) {
+	if (value && (strcmp(value->key, key) != 0))
+		__atomic_add_fetch(&_mismatches, 1, __ATOMIC_RELAXED);
+}
+
+static bool visit(const String key, void *const value, void *const arg) {
+	check_value(key, (const value_t*) value);
+	(*(uint64_t*) arg)++;
+
+	return true;
+}
+
+static void *run(void *const arg) {
+	const uintptr_t number = (uintptr_t) arg;
+	uint64_t seed = 0x2545f4914f6cdd1dULL * (number + 1);
+	Cht_Thread self = cht_join(_table);
+	char key[KEY_LEN];
+
+	for (unsigned int i = 0; i < OPERATIONS; i++) {
+		const uint64_t random = next_random(&seed);
+		const unsigned int operation = (random >> 20) % 10;
+
+		snprintf(key, KEY_LEN, "/session/%lu", (unsigned long) (random % KEYS));
+		cht_pin(self);
+
+		if (operation < 5)
+			check_value(key, (const value_t*) cht_get(self, key));
+		else if (operation < 7) {
+			value_t *const value = new_value(key, 0);
+
+			if (cht_insert(self, key, value))
+				free(value);
+		} else if (operation < 9) {
+			const value_t *const expected = (const value_t*) cht_get(self, key);
+
+			if (expected) {
+				value_t *const desired = new_value(key, expected->generation + 1);
+
+				if (!cht_update(self, key, (void*) expected, desired))
+					free(desired);
+			}
+		} else if (i % ITERATE_EVERY == 0) {
+			uint64_t visited = 0;
+
+			cht_iterate(self, visit, &visited);
+		} else
+			cht_remove(self, key);
+
+		cht_unpin(self);
+
+		if ((number % 2) && (i % REJOIN_EVERY == 0)) {
+			cht_leave(self);
+			self = cht_join(_table);
+		}
+	}
+	cht_leave(self);
+
+	return NULL;
+}
+
+int main(void) {
+	pthread_t threads[THREADS];
+	uint64_t visited = 0;
+	bool started = true;
+
+	_table = cht_create(0, free);
+
+	for (uintptr_t i = 0; i < THREADS; i++)
+		started &= pthread_create(&threads[i], NULL, run, (void*) i) == 0;
+	CHECK(started);
+	for (unsigned int i = 0; i < THREADS; i++)
+		pthread_join(threads[i], NULL);
+	CHECK(_mismatches == 0);
+
+	// What is left is reachable and whole
+	const Cht_Thread self = cht_join(_table);
+
+	cht_pin(self);
+	cht_iterate(self, visit, &visited);
+	CHECK(_mismatches == 0 && visited <= KEYS);
+	CHECK(!cht_get(self, "/session/absent"));
+	value_t *const value = new_value("/session/absent", 0);
+	CHECK(!cht_insert(self, "/session/absent", value) && cht_get(self, "/session/absent") == value);
+	cht_unpin(self);
+	cht_leave(self);
+
+	cht_destroy(_table);
+
+	TEST_END();
+}
@@ -31,7 +31,7 @@ c = "\033[0m"
 
 def test_socket(sock, atuple):
     global total_good, total_bad
-    sent = sock.send(bytes(atuple[0] + " HTTP/1.1", "utf-8"))
+    sent = sock.send(bytes(atuple[0] + " HTTP/1.1\r\nConnection: close\r\n\r\n", "utf-8"))
 
     for i in range(100):
         try:
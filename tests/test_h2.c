@@ -0,0 +1,240 @@
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "test.h"
+#include "../single-HTTP/lib/h2/h2.h"
+
+// Frames are fed to h2_input() of a session writing to one end of a socket
+// pair, what it answers is read back from the other: a request that is passed
+// on, or the GOAWAY and its error code after a connection error. Request
+// bodies are spooled under /tmp.
+
+#define FRAME_DATA 0x0
+#define FRAME_HEADERS 0x1
+#define FRAME_SETTINGS 0x4
+#define FRAME_PING 0x6
+#define FRAME_GOAWAY 0x7
+#define FRAME_CONTINUATION 0x9
+
+#define FLAG_END_STREAM 0x1
+#define FLAG_END_HEADERS 0x4
+#define FLAG_PADDED 0x8
+
+#define ERROR_PROTOCOL 0x1
+#define ERROR_FRAME_SIZE 0x6
+
+#define INPUT_LEN (2 * H2_INPUT_LEN)
+#define NO_GOAWAY 0xffffffffU
+#define BODY_MAX 8
+
+// RFC 7541 C.3.1: GET / of www.example.com over http
+static const Byte _block[] = {
+	0x82, 0x86, 0x84, 0x41, 0x0f, 'w', 'w', 'w', '.', 'e', 'x', 'a', 'm', 'p', 'l', 'e', '.', 'c', 'o', 'm'
+};
+
+typedef struct client_s {
+	int sockets[2]; // The session writes to the first, the test reads the second
+	out_queue_t output;
+	H2_Session session;
+	Byte input[INPUT_LEN];
+	size_t len;
+} client_t;
+
+static void open_client(client_t *const client) {
+	memset(client, 0, sizeof(client_t));
+	socketpair(AF_UNIX, SOCK_STREAM, 0, client->sockets);
+	client->session = h2_create(client->sockets[0], &client->output, H2_OUT_LEN, "/tmp", BODY_MAX);
+	memcpy(client->input, H2_PREFACE, H2_PREFACE_LEN);
+	client->len = H2_PREFACE_LEN;
+}
+
+static void close_client(client_t *const client) {
+	h2_destroy(client->session);
+	oq_clear(&client->output);
+	close(client->sockets[0]);
+	close(client->sockets[1]);
+}
+
+static void frame(client_t *const client, const Byte type, const Byte flags, const uint32_t stream, const Byte *const payload,
+                  const size_t len) {
+	Byte *const header = client->input + client->len;
+
+	header[0] = len >> 16;
+	header[1] = len >> 8;
+	header[2] = len;
+	header[3] = type;
+	header[4] = flags;
+	header[5] = stream >> 24;
+	header[6] = stream >> 16;
+	header[7] = stream >> 8;
+	header[8] = stream;
+	if (len)
+		memcpy(header + H2_FRAME_HEADER_LEN, payload, len);
+	client->len += H2_FRAME_HEADER_LEN + len;
+}
+
+// Feeds what was framed so far, returns what h2_input() did
+static ssize_t feed(client_t *const client) {
+	const ssize_t used = h2_input(client->session, client->input, client->len);
+
+	h2_flush(client->session);
+	client->len = 0;
+
+	return used;
+}
+
+// Error code of the GOAWAY the session sent, NO_GOAWAY when it sent none
+static uint32_t goaway_code(client_t *const client) {
+	Byte output[INPUT_LEN];
+	const ssize_t len = recv(client->sockets[1], output, INPUT_LEN, MSG_DONTWAIT);
+
+	for (ssize_t at = 0; (len > 0) && (at + H2_FRAME_HEADER_LEN <= len);) {
+		const size_t frame_len = ((size_t) output[at] << 16) | (output[at + 1] << 8) | output[at + 2];
+		const Byte *const payload = output + at + H2_FRAME_HEADER_LEN;
+
+		if ((output[at + 3] == FRAME_GOAWAY) && (frame_len == 8))
+			return ((uint32_t) payload[4] << 24) | ((uint32_t) payload[5] << 16) | (payload[6] << 8) | payload[7];
+		at += H2_FRAME_HEADER_LEN + frame_len;
+	}
+
+	return NO_GOAWAY;
+}
+
+static bool passes_request(client_t *const client, const uint32_t expected) {
+	String request;
+	const uint32_t stream = h2_next_request(client->session, &request);
+
+	return (stream == expected) && (strncmp(request, "GET / HTTP/2.0\r\nhost: www.example.com\r\n", 39) == 0);
+}
+
+int main(void) {
+	client_t client;
+	Byte payload[H2_FRAME_LEN + 1];
+	ssize_t expected;
+
+	// A request in one HEADERS frame, then one split over CONTINUATION frames
+	open_client(&client);
+	frame(&client, FRAME_SETTINGS, 0, 0, NULL, 0);
+	frame(&client, FRAME_HEADERS, FLAG_END_STREAM | FLAG_END_HEADERS, 1, _block, sizeof(_block));
+	expected = client.len;
+	CHECK(feed(&client) == expected && passes_request(&client, 1));
+	frame(&client, FRAME_HEADERS, FLAG_END_STREAM, 3, _block, 5);
+	frame(&client, FRAME_CONTINUATION, 0, 3, _block + 5, 5);
+	frame(&client, FRAME_CONTINUATION, FLAG_END_HEADERS, 3, _block + 10, sizeof(_block) - 10);
+	expected = client.len;
+	CHECK(feed(&client) == expected && passes_request(&client, 3));
+	CHECK(goaway_code(&client) == NO_GOAWAY);
+	close_client(&client);
+
+	// A frame is only consumed once all of it arrived
+	open_client(&client);
+	frame(&client, FRAME_HEADERS, FLAG_END_STREAM | FLAG_END_HEADERS, 1, _block, sizeof(_block));
+	CHECK(h2_input(client.session, client.input, client.len - 1) == H2_PREFACE_LEN);
+	CHECK(h2_input(client.session, client.input + H2_PREFACE_LEN, client.len - H2_PREFACE_LEN) == (ssize_t) (client.len - H2_PREFACE_LEN));
+	client.len = 0;
+	CHECK(passes_request(&client, 1));
+	close_client(&client);
+
+	// Padding inside HEADERS is dropped, padding longer than the frame is an error
+	open_client(&client);
+	payload[0] = 4;
+	memcpy(payload + 1, _block, sizeof(_block));
+	memset(payload + 1 + sizeof(_block), 0, 4);
+	frame(&client, FRAME_HEADERS, FLAG_END_STREAM | FLAG_END_HEADERS | FLAG_PADDED, 1, payload, 1 + sizeof(_block) + 4);
+	expected = client.len;
+	CHECK(feed(&client) == expected && passes_request(&client, 1));
+	payload[0] = 200;
+	frame(&client, FRAME_HEADERS, FLAG_END_STREAM | FLAG_END_HEADERS | FLAG_PADDED, 3, payload, 1 + sizeof(_block));
+	CHECK(feed(&client) == -1 && goaway_code(&client) == ERROR_PROTOCOL);
+	close_client(&client);
+
+	// The pad length of DATA has to leave room for itself
+	open_client(&client);
+	frame(&client, FRAME_HEADERS, FLAG_END_HEADERS, 1, _block, sizeof(_block));
+	payload[0] = 3;
+	frame(&client, FRAME_DATA, FLAG_PADDED, 1, payload, 3);
+	CHECK(feed(&client) == -1 && goaway_code(&client) == ERROR_PROTOCOL);
+	close_client(&client);
+
+	// DATA is spooled and the request passed on with its body at END_STREAM
+	Request_Body body;
+	rb_status_t status;
+	String request;
+	char spooled[BODY_MAX];
+
+	open_client(&client);
+	frame(&client, FRAME_HEADERS, FLAG_END_HEADERS, 1, _block, sizeof(_block));
+	frame(&client, FRAME_DATA, 0, 1, (const Byte*) "abc", 3);
+	expected = client.len;
+	CHECK(feed(&client) == expected && passes_request(&client, 1));
+	CHECK(h2_next_complete(client.session, &request, &body, &status) == 0);
+	payload[0] = 2;
+	memcpy(payload + 1, "de\0\0", 4);
+	frame(&client, FRAME_DATA, FLAG_END_STREAM | FLAG_PADDED, 1, payload, 5);
+	feed(&client);
+	CHECK(h2_next_complete(client.session, &request, &body, &status) == 1 && status == RB_COMPLETE && body->len == 5);
+	CHECK(read(rb_rewind(body), spooled, BODY_MAX) == 5 && memcmp(spooled, "abcde", 5) == 0);
+	rb_destroy(body);
+	CHECK(h2_next_complete(client.session, &request, &body, &status) == 0);
+
+	// A body beyond the limit is dropped and the request passed on to be refused
+	frame(&client, FRAME_HEADERS, FLAG_END_HEADERS, 3, _block, sizeof(_block));
+	frame(&client, FRAME_DATA, 0, 3, (const Byte*) "abcdefghij", 10);
+	frame(&client, FRAME_DATA, FLAG_END_STREAM, 3, (const Byte*) "k", 1);
+	feed(&client);
+	CHECK(passes_request(&client, 3));
+	CHECK(h2_next_complete(client.session, &request, &body, &status) == 3 && status == RB_TOO_LARGE && !body);
+	close_client(&client);
+
+	// Frames beyond the largest size announced, judged on their header alone
+	open_client(&client);
+	memset(payload, 0, sizeof(payload));
+	frame(&client, FRAME_DATA, 0, 1, payload, H2_FRAME_LEN + 1);
+	CHECK(h2_input(client.session, client.input, H2_PREFACE_LEN + H2_FRAME_HEADER_LEN) == -1);
+	CHECK(goaway_code(&client) == ERROR_FRAME_SIZE);
+	close_client(&client);
+
+	open_client(&client);
+	frame(&client, FRAME_PING, 0, 0, payload, 7);
+	CHECK(feed(&client) == -1 && goaway_code(&client) == ERROR_FRAME_SIZE);
+	close_client(&client);
+
+	// A header block may only be continued by CONTINUATION of its own stream
+	open_client(&client);
+	frame(&client, FRAME_HEADERS, FLAG_END_STREAM, 1, _block, 5);
+	frame(&client, FRAME_PING, 0, 0, payload, 8);
+	CHECK(feed(&client) == -1 && goaway_code(&client) == ERROR_PROTOCOL);
+	close_client(&client);
+
+	open_client(&client);
+	frame(&client, FRAME_HEADERS, FLAG_END_STREAM, 1, _block, 5);
+	frame(&client, FRAME_CONTINUATION, FLAG_END_HEADERS, 3, _block + 5, sizeof(_block) - 5);
+	CHECK(feed(&client) == -1 && goaway_code(&client) == ERROR_PROTOCOL);
+	close_client(&client);
+
+	open_client(&client);
+	frame(&client, FRAME_HEADERS, FLAG_END_STREAM, 1, _block, 5);
+	frame(&client, FRAME_HEADERS, FLAG_END_STREAM | FLAG_END_HEADERS, 3, _block, sizeof(_block));
+	CHECK(feed(&client) == -1 && goaway_code(&client) == ERROR_PROTOCOL);
+	close_client(&client);
+
+	open_client(&client);
+	frame(&client, FRAME_CONTINUATION, FLAG_END_HEADERS, 1, _block, sizeof(_block));
+	CHECK(feed(&client) == -1 && goaway_code(&client) == ERROR_PROTOCOL);
+	close_client(&client);
+
+	// Streams are opened by the client, on odd ids that only grow
+	open_client(&client);
+	frame(&client, FRAME_HEADERS, FLAG_END_STREAM | FLAG_END_HEADERS, 2, _block, sizeof(_block));
+	CHECK(feed(&client) == -1 && goaway_code(&client) == ERROR_PROTOCOL);
+	close_client(&client);
+
+	// Not the connection preface
+	open_client(&client);
+	memcpy(client.input, "GET / HTTP/1.1\r\n\r\n      ", H2_PREFACE_LEN);
+	CHECK(feed(&client) == -1 && goaway_code(&client) == ERROR_PROTOCOL);
+	close_client(&client);
+
+	TEST_END();
+}
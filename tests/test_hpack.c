@@ -0,0 +1,167 @@
+#include <string.h>
+
+#include "test.h"
+#include "../single-HTTP/lib/hpack/hpack.h"
+
+// The examples of RFC 7541 Appendix C: three requests on one connection
+// without Huffman code (C.3) and with it (C.4), then three responses through
+// a table of 256 octets that has to evict (C.6). Each block is decoded with
+// the table the blocks before it left, the responses are encoded as well.
+
+#define MAX_FIELDS 16
+#define SCRATCH_LEN 4096
+#define OUT_LEN 512
+
+typedef struct example_s {
+	const char *hex;
+	const char *fields[MAX_FIELDS][2];
+	size_t table_size; // Of the dynamic table afterwards
+} example_t;
+
+static const example_t _requests[] = { // C.3, the same fields as C.4
+	{"828684410f7777772e6578616d706c652e636f6d",
+	 {{":method", "GET"}, {":scheme", "http"}, {":path", "/"}, {":authority", "www.example.com"}}, 57},
+	{"828684be58086e6f2d6361636865",
+	 {{":method", "GET"}, {":scheme", "http"}, {":path", "/"}, {":authority", "www.example.com"},
+	  {"cache-control", "no-cache"}}, 110},
+	{"828785bf400a637573746f6d2d6b65790c637573746f6d2d76616c7565",
+	 {{":method", "GET"}, {":scheme", "https"}, {":path", "/index.html"}, {":authority", "www.example.com"},
+	  {"custom-key", "custom-value"}}, 164}
+};
+
+static const char *const _huffman_requests[] = { // C.4
+	"828684418cf1e3c2e5f23a6ba0ab90f4ff",
+	"828684be5886a8eb10649cbf",
+	"828785bf408825a849e95ba97d7f8925a849e95bb8e8b4bf"
+};
+
+static const example_t _responses[] = { // C.6
+	{"488264025885aec3771a4b6196d07abe941054d444a8200595040b8166e082a62d1bff6e919d29ad171863c78f0b97c8e9ae82ae43d3",
+	 {{":status", "302"}, {"cache-control", "private"}, {"date", "Mon, 21 Oct 2013 20:13:21 GMT"},
+	  {"location", "https://www.example.com"}}, 222},
+	{"4883640effc1c0bf",
+	 {{":status", "307"}, {"cache-control", "private"}, {"date", "Mon, 21 Oct 2013 20:13:21 GMT"},
+	  {"location", "https://www.example.com"}}, 222},
+	{"88c16196d07abe941054d444a8200595040b8166e084a62d1bffc05a839bd9ab77ad94e7821dd7f2e6c7b335dfdfcd5b3960d5af27087f3672c1ab270fb5291f9587316065c003ed4ee5b1063d5007",
+	 {{":status", "200"}, {"cache-control", "private"}, {"date", "Mon, 21 Oct 2013 20:13:22 GMT"},
+	  {"location", "https://www.example.com"}, {"content-encoding", "gzip"},
+	  {"set-cookie", "foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; max-age=3600; version=1"}}, 215}
+};
+
+// The encoder writes "307" as it is, its Huffman code is no shorter
+static const char *const _encoded_307 = "4803333037c1c0bf";
+
+static size_t from_hex(const char *hex, Byte *const out) {
+	size_t len = 0;
+
+	for (; hex[0] && hex[1]; hex += 2) {
+		unsigned int octet;
+
+		sscanf(hex, "%2x", &octet);
+		out[len++] = (Byte) octet;
+	}
+
+	return len;
+}
+
+static unsigned int field_cnt(const example_t *const example) {
+	unsigned int count = 0;
+
+	while ((count < MAX_FIELDS) && example->fields[count][0])
+		count++;
+
+	return count;
+}
+
+// Decodes hex with table, true when it yields exactly the fields of example
+static bool decodes_to(const Hpack_Table table, const char *const hex, const example_t *const example) {
+	Byte block[OUT_LEN];
+	hpack_field_t fields[MAX_FIELDS];
+	char scratch[SCRATCH_LEN];
+	const size_t len = from_hex(hex, block);
+	const int count = hpack_decode(table, block, len, fields, MAX_FIELDS, scratch, SCRATCH_LEN);
+
+	if ((count < 0) || ((unsigned int) count != field_cnt(example)))
+		return false;
+
+	for (int i = 0; i < count; i++)
+		if ((strcmp(fields[i].name, example->fields[i][0]) != 0) || (strcmp(fields[i].value, example->fields[i][1]) != 0)
+		    || (fields[i].value_len != strlen(example->fields[i][1])))
+			return false;
+
+	return table->size == example->table_size;
+}
+
+// Encodes the fields of example, each one indexed as the RFC's encoder does
+static bool encodes_to(const Hpack_Table table, const example_t *const example, const char *const hex) {
+	Byte expected[OUT_LEN], out[OUT_LEN];
+	const size_t expected_len = from_hex(hex, expected);
+	size_t len = 0;
+
+	for (unsigned int i = 0; i < field_cnt(example); i++) {
+		const char *const name = example->fields[i][0], *const value = example->fields[i][1];
+		const size_t written = hpack_encode_field(table, (String) name, strlen(name), (String) value, strlen(value), true,
+		                                          out + len, OUT_LEN - len);
+
+		if (!written)
+			return false;
+		len += written;
+	}
+
+	return (len == expected_len) && (memcmp(out, expected, len) == 0) && (table->size == example->table_size);
+}
+
+int main(void) {
+	const unsigned int request_cnt = sizeof(_requests) / sizeof(_requests[0]);
+	const unsigned int response_cnt = sizeof(_responses) / sizeof(_responses[0]);
+	hpack_table_t decoder, encoder;
+
+	hpack_init(&decoder, HPACK_DEFAULT_TABLE_SIZE);
+	for (unsigned int i = 0; i < request_cnt; i++)
+		CHECK(decodes_to(&decoder, _requests[i].hex, &_requests[i]));
+	hpack_free(&decoder);
+
+	hpack_init(&decoder, HPACK_DEFAULT_TABLE_SIZE);
+	for (unsigned int i = 0; i < request_cnt; i++)
+		CHECK(decodes_to(&decoder, _huffman_requests[i], &_requests[i]));
+	hpack_free(&decoder);
+
+	hpack_init(&decoder, 256);
+	hpack_init(&encoder, 256);
+	for (unsigned int i = 0; i < response_cnt; i++) {
+		CHECK(decodes_to(&decoder, _responses[i].hex, &_responses[i]));
+		CHECK(encodes_to(&encoder, &_responses[i], (i == 1) ? _encoded_307 : _responses[i].hex));
+	}
+	CHECK(decoder.cnt == 3 && encoder.cnt == 3);
+
+	// What the encoder wrote decodes back to the same fields
+	hpack_free(&decoder);
+	hpack_free(&encoder);
+	hpack_init(&decoder, 256);
+	CHECK(decodes_to(&decoder, _responses[0].hex, &_responses[0]) && decodes_to(&decoder, _encoded_307, &_responses[1]));
+	hpack_free(&decoder);
+
+	// Malformed blocks: an index past both tables, a truncated string, a size
+	// update above the limit, an integer that never ends
+	static const char *const malformed[] = {"be", "4105616263", "3fe21f", "ffffffffffffff"};
+	const example_t none = {"", {{NULL, NULL}}, 0};
+
+	for (unsigned int i = 0; i < sizeof(malformed) / sizeof(malformed[0]); i++) {
+		hpack_init(&decoder, HPACK_DEFAULT_TABLE_SIZE);
+		CHECK(!decodes_to(&decoder, malformed[i], &none));
+		hpack_free(&decoder);
+	}
+
+	// A shrunk limit evicts at once and is announced before the next status
+	Byte out[OUT_LEN];
+
+	hpack_init(&encoder, HPACK_DEFAULT_TABLE_SIZE);
+	CHECK(hpack_encode_field(&encoder, "content-type", 12, "text/html", 9, true, out, OUT_LEN) > 0 && encoder.cnt == 1);
+	hpack_set_limit(&encoder, 0);
+	CHECK(encoder.cnt == 0 && encoder.size == 0);
+	CHECK(hpack_encode_status(&encoder, 200, out, OUT_LEN) == 2 && out[0] == 0x20 && out[1] == 0x88);
+	CHECK(hpack_encode_status(&encoder, 200, out, OUT_LEN) == 1 && out[0] == 0x88);
+	hpack_free(&encoder);
+
+	TEST_END();
+}
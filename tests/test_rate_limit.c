@@ -0,0 +1,129 @@
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "test.h"
+#include "../single-HTTP/lib/rate_limit/rate_limit.h"
+
+// The clock is passed in, so refills are exact. The eviction checks use the
+// smallest table, one probe window, where every client competes for the same
+// eight slots.
+
+#define SLOTS 8
+
+static uint64_t client(const String address) {
+	struct in6_addr parsed;
+
+	inet_pton(AF_INET6, address, &parsed);
+
+	return rl_client_key(&parsed);
+}
+
+// Requests allowed of count made at the same time
+static unsigned int allowed(const Rate_Limiter limiter, const uint64_t key, const rl_class_t class, const uint64_t now_ms,
+                            const unsigned int count) {
+	unsigned int result = 0;
+
+	for (unsigned int i = 0; i < count; i++)
+		result += rl_allow(limiter, key, class, now_ms);
+
+	return result;
+}
+
+static unsigned int used_slots(const Rate_Limiter limiter) {
+	unsigned int result = 0;
+
+	for (unsigned int i = 0; i <= limiter->mask; i++)
+		result += (limiter->slots[i].key != 0);
+
+	return result;
+}
+
+int main(void) {
+	rl_limit_t limit;
+
+	// Parsing of "rate/burst"
+	CHECK(rl_parse_limit("10/5", &limit) && limit.rate == 10 && limit.burst == 5);
+	CHECK(rl_parse_limit("20", &limit) && limit.rate == 20 && limit.burst == 20);
+	CHECK(rl_parse_limit("0", &limit) && limit.rate == 0);
+	CHECK(!rl_parse_limit("5/0", &limit));
+	CHECK(!rl_parse_limit("x", &limit));
+	CHECK(!rl_parse_limit("1/5000000", &limit));
+
+	// Client keys: a whole IPv4 address, the /64 of an IPv6 one
+	CHECK(client("::ffff:192.0.2.1") != client("::ffff:192.0.2.2"));
+	CHECK(client("2001:db8::1") == client("2001:db8::ffff:1"));
+	CHECK(client("2001:db8::1") != client("2001:db8:0:1::1"));
+
+	const rl_limit_t limits[RL_CLASSES] = {{10, 5}, {0, 0}};
+	Rate_Limiter limiter = rl_create(1024, limits);
+	const uint64_t a = client("::ffff:192.0.2.1"), b = client("::ffff:192.0.2.2");
+
+	// A new client starts with a full bucket, a burst beyond it is refused
+	CHECK(allowed(limiter, a, RL_STATIC, 1000, 8) == 5);
+	CHECK(allowed(limiter, b, RL_STATIC, 1000, 8) == 5);
+
+	// 10 per second is one token per 100 ms, fractions carry over
+	CHECK(allowed(limiter, a, RL_STATIC, 1050, 2) == 0);
+	CHECK(allowed(limiter, a, RL_STATIC, 1100, 2) == 1);
+	CHECK(allowed(limiter, a, RL_STATIC, 1399, 4) == 2);
+	CHECK(allowed(limiter, a, RL_STATIC, 1400, 2) == 1);
+
+	// An idle bucket refills up to the burst and no further
+	CHECK(allowed(limiter, a, RL_STATIC, 60000, 8) == 5);
+
+	// A rate of 0 leaves the class unlimited
+	CHECK(allowed(limiter, a, RL_DYNAMIC, 60000, 100) == 100);
+
+	// Elapsed time is taken modulo the 32 bit millisecond clock in the state
+	const uint64_t wrap = (uint64_t) 1 << 32;
+
+	CHECK(allowed(limiter, b, RL_STATIC, wrap - 50, 8) == 5);
+	CHECK(allowed(limiter, b, RL_STATIC, wrap + 50, 2) == 1);
+	rl_destroy(limiter);
+
+	// Classes keep buckets of their own
+	const rl_limit_t both[RL_CLASSES] = {{1, 1}, {1, 1}};
+
+	limiter = rl_create(1024, both);
+	CHECK(allowed(limiter, a, RL_STATIC, 1000, 2) == 1);
+	CHECK(allowed(limiter, a, RL_DYNAMIC, 1000, 2) == 1);
+	rl_destroy(limiter);
+
+	// A full table evicts by CLOCK and never grows
+	uint64_t clients[SLOTS + 1];
+	char address[INET6_ADDRSTRLEN];
+
+	limiter = rl_create(SLOTS, both);
+	CHECK(limiter->mask == SLOTS - 1);
+
+	for (unsigned int i = 0; i <= SLOTS; i++) {
+		snprintf(address, INET6_ADDRSTRLEN, "::ffff:198.51.100.%u", i + 1);
+		clients[i] = client(address);
+	}
+	for (unsigned int i = 0; i < SLOTS; i++)
+		CHECK(allowed(limiter, clients[i], RL_STATIC, 1000, 1) == 1);
+	CHECK(used_slots(limiter) == SLOTS);
+
+	// As after a sweep, then half the clients come back and are refused
+	memset(limiter->referenced, 0, SLOTS);
+	for (unsigned int i = 0; i < SLOTS / 2; i++)
+		CHECK(allowed(limiter, clients[i], RL_STATIC, 1000, 1) == 0);
+
+	// The newcomer takes the slot of a client that did not, the ones that came
+	// back keep their empty buckets
+	CHECK(allowed(limiter, clients[SLOTS], RL_STATIC, 1000, 1) == 1);
+	CHECK(used_slots(limiter) == SLOTS);
+	for (unsigned int i = 0; i < SLOTS / 2; i++)
+		CHECK(allowed(limiter, clients[i], RL_STATIC, 1000, 1) == 0);
+	CHECK(allowed(limiter, clients[SLOTS], RL_STATIC, 1000, 1) == 0);
+
+	// With every slot referenced, one sweep clears them all and still evicts
+	for (unsigned int i = 0; i < SLOTS; i++)
+		limiter->referenced[i] = 1;
+	snprintf(address, INET6_ADDRSTRLEN, "::ffff:203.0.113.1");
+	CHECK(allowed(limiter, client(address), RL_STATIC, 1000, 2) == 1);
+	CHECK(used_slots(limiter) == SLOTS);
+	rl_destroy(limiter);
+
+	TEST_END();
+}
@@ -0,0 +1,140 @@
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "test.h"
+#include "../single-HTTP/lib/request_body/request_body.h"
+
+// Bodies are decoded from memory with rb_feed(), whole or an octet at a time,
+// and from one end of a socket pair with rb_splice(). What was spooled is read
+// back from the start of the spool file, under /tmp.
+
+#define LIMIT 16
+#define SPOOLED_LEN 64
+
+static const char _chunked[] = "3\r\nabc\r\n2;name=value\r\nde\r\n0\r\nX-Sum: 5\r\n\r\n";
+
+// Feeds all of data at once, *used tells where the body ended
+static rb_status_t feed(const Request_Body body, const char *const data, size_t *const used) {
+	*used = 0;
+
+	return rb_feed(body, (const Byte*) data, strlen(data), used);
+}
+
+// Feeds data an octet at a time, stopping at the first status that is not RB_MORE
+static rb_status_t feed_octets(const Request_Body body, const char *const data) {
+	rb_status_t status = RB_MORE;
+	size_t used;
+
+	for (size_t i = 0; data[i] && (status == RB_MORE); i++)
+		status = rb_feed(body, (const Byte*) data + i, 1, &used);
+
+	return status;
+}
+
+static bool spooled(const Request_Body body, const char *const expected) {
+	char data[SPOOLED_LEN];
+	const ssize_t len = read(rb_rewind(body), data, SPOOLED_LEN);
+
+	return (len == (ssize_t) strlen(expected)) && (body->len == (uint64_t) len) && (memcmp(data, expected, len) == 0);
+}
+
+// Result of decoding a chunked body of data in one feed
+static rb_status_t chunked(const char *const data) {
+	size_t used;
+	const Request_Body body = rb_create("/tmp", true, 0, LIMIT);
+	const rb_status_t status = feed(body, data, &used);
+
+	rb_destroy(body);
+
+	return status;
+}
+
+int main(void) {
+	Request_Body body;
+	size_t used;
+	int sockets[2];
+	char line[RB_LINE_LEN + 8], rest[4];
+
+	// Content-Length, the request pipelined behind the body is not taken
+	body = rb_create("/tmp", false, 5, LIMIT);
+	CHECK(feed(body, "abcdeGET", &used) == RB_COMPLETE && used == 5 && spooled(body, "abcde"));
+	rb_destroy(body);
+
+	// Chunked with an extension and a trailer field, in one feed and an octet at a time
+	body = rb_create("/tmp", true, 0, LIMIT);
+	CHECK(feed(body, "3\r\nabc\r\n2;name=value\r\nde\r\n0\r\nX-Sum: 5\r\n\r\nGET", &used) == RB_COMPLETE);
+	CHECK(used == sizeof(_chunked) - 1 && spooled(body, "abcde"));
+	rb_destroy(body);
+
+	body = rb_create("/tmp", true, 0, LIMIT);
+	CHECK(feed_octets(body, _chunked) == RB_COMPLETE && spooled(body, "abcde"));
+	rb_destroy(body);
+
+	// Lines split across feeds, a bare LF ends a line as well
+	body = rb_create("/tmp", true, 0, LIMIT);
+	CHECK(feed(body, "1", &used) == RB_MORE && feed(body, "0\r", &used) == RB_MORE);
+	CHECK(feed(body, "\nabcdefghijklmnop\n0\nTrail", &used) == RB_MORE);
+	CHECK(feed(body, "er: x\r\n", &used) == RB_MORE && feed(body, "\r\n", &used) == RB_COMPLETE);
+	CHECK(spooled(body, "abcdefghijklmnop"));
+	rb_destroy(body);
+
+	// Malformed sizes
+	CHECK(chunked("zz\r\nab\r\n0\r\n\r\n") == RB_INVALID);
+	CHECK(chunked("3x\r\nabc\r\n0\r\n\r\n") == RB_INVALID);
+	CHECK(chunked("\r\n") == RB_INVALID);
+	CHECK(chunked("-1\r\n") == RB_INVALID);
+	CHECK(chunked("+3\r\nabc\r\n0\r\n\r\n") == RB_INVALID);
+	CHECK(chunked(" 3\r\nabc\r\n0\r\n\r\n") == RB_INVALID);
+	CHECK(chunked("0x3\r\nabc\r\n0\r\n\r\n") == RB_INVALID);
+	CHECK(chunked("A\r\nabcdefghij\r\n0\r\n\r\n") == RB_COMPLETE);
+
+	// The CRLF closing a chunk has to be there
+	CHECK(chunked("3\r\nabcX\r\n0\r\n\r\n") == RB_INVALID);
+	CHECK(chunked("3\r\nabc0\r\n\r\n") == RB_INVALID);
+
+	// Lines of RB_LINE_LEN octets or more, a size and a trailer field
+	memset(line, '0', RB_LINE_LEN);
+	memcpy(line + RB_LINE_LEN, "1\r\n", 4);
+	CHECK(chunked(line) == RB_INVALID);
+	memset(line, 'x', RB_LINE_LEN);
+	memcpy(line + RB_LINE_LEN, "\r\n", 3);
+	body = rb_create("/tmp", true, 0, LIMIT);
+	CHECK(feed(body, "0\r\n", &used) == RB_MORE && feed_octets(body, line) == RB_INVALID);
+	rb_destroy(body);
+
+	// The limit holds for one chunk, for the sum of them and for sizes past 64 bits
+	CHECK(chunked("11\r\n") == RB_TOO_LARGE);
+	CHECK(chunked("8\r\nabcdefgh\r\n9\r\n") == RB_TOO_LARGE);
+	CHECK(chunked("8\r\nabcdefgh\r\n8\r\nabcdefgh\r\n0\r\n\r\n") == RB_COMPLETE);
+	CHECK(chunked("ffffffffffffffff\r\n") == RB_TOO_LARGE);
+	CHECK(chunked("100000000000000000000\r\n") == RB_TOO_LARGE);
+
+	// Spliced from a socket, the next request stays in it
+	socketpair(AF_UNIX, SOCK_STREAM, 0, sockets);
+	body = rb_create("/tmp", true, 0, LIMIT);
+	send(sockets[1], "3\r\nabc\r\n", 8, 0);
+	CHECK(rb_splice(body, sockets[0]) == RB_MORE);
+	send(sockets[1], "2\r\nde\r\n0\r\nX-Sum: 5\r\n\r\nGET", 25, 0);
+	CHECK(rb_splice(body, sockets[0]) == RB_COMPLETE && spooled(body, "abcde"));
+	CHECK(recv(sockets[0], rest, sizeof(rest), MSG_DONTWAIT) == 3 && memcmp(rest, "GET", 3) == 0);
+	rb_destroy(body);
+
+	body = rb_create("/tmp", true, 0, LIMIT);
+	send(sockets[1], "3\r\nabcX\r\n", 9, 0);
+	CHECK(rb_splice(body, sockets[0]) == RB_INVALID);
+	rb_destroy(body);
+	close(sockets[1]);
+	close(sockets[0]);
+
+	// A client that closes inside the body
+	socketpair(AF_UNIX, SOCK_STREAM, 0, sockets);
+	body = rb_create("/tmp", false, 5, LIMIT);
+	send(sockets[1], "abc", 3, 0);
+	close(sockets[1]);
+	CHECK(rb_splice(body, sockets[0]) == RB_CLOSED);
+	rb_destroy(body);
+	close(sockets[0]);
+
+	TEST_END();
+}
@@ -0,0 +1,64 @@
+#include <string.h>
+
+#include "test.h"
+#include "../single-HTTP/lib/static_file/static_file.h"
+
+// sf_parse_ranges() against a file of 1000 bytes
+
+#define SIZE 1000
+#define MAX 16
+
+static byte_range_t _ranges[MAX];
+
+static int parse(const char *const value) {
+	char copy[256];
+
+	snprintf(copy, sizeof(copy), "%s", value);
+	memset(_ranges, 0, sizeof(_ranges));
+
+	return sf_parse_ranges(copy, SIZE, _ranges, MAX);
+}
+
+static bool range_is(const int i, const off_t first, const off_t last) {
+	return (_ranges[i].first == first) && (_ranges[i].last == last);
+}
+
+int main(void) {
+	// Closed, open-ended and suffix ranges
+	CHECK(parse("bytes=0-499") == 1 && range_is(0, 0, 499));
+	CHECK(parse("bytes=500-") == 1 && range_is(0, 500, 999));
+	CHECK(parse("bytes=-200") == 1 && range_is(0, 800, 999));
+	CHECK(parse("bytes=-5000") == 1 && range_is(0, 0, 999));
+	CHECK(parse("bytes=900-5000") == 1 && range_is(0, 900, 999));
+	CHECK(parse("BYTES=0-0") == 1 && range_is(0, 0, 0));
+
+	// Disjoint ranges stay apart, in ascending order
+	CHECK(parse("bytes=500-599, 0-99") == 2 && range_is(0, 0, 99) && range_is(1, 500, 599));
+	CHECK(parse("bytes=0-99,-100") == 2 && range_is(0, 0, 99) && range_is(1, 900, 999));
+
+	// Overlapping and adjacent ranges are coalesced
+	CHECK(parse("bytes=0-,0-,0-,0-") == 1 && range_is(0, 0, 999));
+	CHECK(parse("bytes=0-499,200-699") == 1 && range_is(0, 0, 699));
+	CHECK(parse("bytes=0-99,100-199") == 1 && range_is(0, 0, 199));
+	CHECK(parse("bytes=100-199,0-149,-50") == 2 && range_is(0, 0, 199) && range_is(1, 950, 999));
+	CHECK(parse("bytes=0-9,20-29,5-25") == 1 && range_is(0, 0, 29));
+	CHECK(parse("bytes=300-399,0-999") == 1 && range_is(0, 0, 999));
+
+	// Unsatisfiable: nothing overlaps the file
+	CHECK(parse("bytes=1000-") == SF_UNSATISFIABLE);
+	CHECK(parse("bytes=1000-2000,5000-") == SF_UNSATISFIABLE);
+	CHECK(parse("bytes=-0") == SF_UNSATISFIABLE);
+	CHECK(parse("bytes=2000-,0-9") == 1 && range_is(0, 0, 9));
+
+	// Malformed or too many ranges: the header is ignored
+	CHECK(parse("bytes=") == 0);
+	CHECK(parse("items=0-9") == 0);
+	CHECK(parse("bytes=9-0") == 0);
+	CHECK(parse("bytes=a-b") == 0);
+	CHECK(parse("bytes=0-9;10-19") == 0);
+	CHECK(parse("bytes=0,1") == 0);
+	CHECK(parse("bytes=0-0,1-1,2-2,3-3,4-4,5-5,6-6,7-7,8-8,9-9,10-10,11-11,12-12,13-13,14-14,15-15,16-16") == 0);
+	CHECK(parse("bytes=0-0,1-1,2-2,3-3,4-4,5-5,6-6,7-7,8-8,9-9,10-10,11-11,12-12,13-13,14-14,15-15") == 1);
+
+	TEST_END();
+}
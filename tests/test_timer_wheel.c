@@ -0,0 +1,134 @@
+#include <string.h>
+
+#include "test.h"
+#include "../single-HTTP/lib/timer_wheel/timer_wheel.h"
+
+// Timers are driven by a clock of whole ticks: a resolution of a second keeps
+// the real time the wheel reads on its first schedule within tick 0. The
+// anchor stays scheduled past the end, so the wheel never runs empty and
+// never catches up with the real clock.
+
+#define RESOLUTION_MS 1000
+#define TIMERS 8
+
+typedef struct probe_s {
+	tw_timer_t timer;
+	uint64_t fired_at; // Tick, 0 while it has not fired
+	unsigned int fired;
+	Tw_Timer cancel; // Cancelled from the callback when set
+	uint64_t reschedule; // Rescheduled from the callback in ticks when set
+} probe_t;
+
+static Timer_Wheel _wheel;
+static uint64_t _tick;
+
+static void on_expiry(void *const data) {
+	probe_t *const probe = (probe_t*) data;
+
+	probe->fired_at = _tick;
+	probe->fired++;
+
+	if (probe->cancel)
+		tw_cancel(_wheel, probe->cancel);
+	if (probe->reschedule) {
+		tw_schedule(_wheel, &probe->timer, probe->reschedule * RESOLUTION_MS);
+		probe->reschedule = 0;
+	}
+}
+
+static void init(probe_t *const probe) {
+	memset(probe, 0, sizeof(probe_t));
+	tw_init_timer(&probe->timer, on_expiry, probe);
+}
+
+// Advances the wheel one tick at a time up to tick, returns the timers fired
+static unsigned int advance_to(const uint64_t tick) {
+	unsigned int fired = 0;
+
+	while (_tick < tick) {
+		_tick++;
+		fired += tw_advance(_wheel, _wheel->start_ms + _tick * RESOLUTION_MS);
+	}
+
+	return fired;
+}
+
+int main(void) {
+	static const uint64_t deadlines[TIMERS] = {1, 63, 64, 65, 4095, 4096, 5000, 300000};
+	probe_t anchor, probes[TIMERS], a, b, c, far;
+
+	_wheel = tw_create(RESOLUTION_MS);
+	CHECK(tw_next_timeout(_wheel, _wheel->start_ms) == -1);
+
+	init(&anchor);
+	tw_schedule(_wheel, &anchor.timer, ((uint64_t) 1 << 26) * RESOLUTION_MS);
+
+	// Each timer fires on its own tick, whichever levels it cascaded through
+	for (unsigned int i = 0; i < TIMERS; i++) {
+		init(&probes[i]);
+		tw_schedule(_wheel, &probes[i].timer, deadlines[i] * RESOLUTION_MS);
+	}
+	CHECK(advance_to(deadlines[TIMERS - 1]) == TIMERS);
+	for (unsigned int i = 0; i < TIMERS; i++)
+		CHECK(probes[i].fired == 1 && probes[i].fired_at == deadlines[i]);
+	CHECK(_wheel->active == 1);
+
+	// Timeouts round up to whole ticks and never fire on the current one
+	init(&a);
+	tw_schedule(_wheel, &a.timer, 0);
+	tw_schedule(_wheel, &probes[0].timer, RESOLUTION_MS + 1);
+	CHECK(advance_to(_tick + 1) == 1 && a.fired_at == _tick);
+	CHECK(advance_to(_tick + 1) == 1 && probes[0].fired_at == _tick);
+
+	// Rescheduling a pending timer moves it, cancelling one keeps it from firing
+	init(&a);
+	init(&b);
+	tw_schedule(_wheel, &a.timer, 10 * RESOLUTION_MS);
+	tw_schedule(_wheel, &a.timer, 100 * RESOLUTION_MS);
+	tw_schedule(_wheel, &b.timer, 50 * RESOLUTION_MS);
+	tw_cancel(_wheel, &b.timer);
+	tw_cancel(_wheel, &b.timer);
+	CHECK(!tw_pending(&b.timer) && _wheel->active == 2);
+	const uint64_t armed = _tick;
+	CHECK(advance_to(armed + 100) == 1 && a.fired_at == armed + 100 && !b.fired);
+
+	// A callback cancels a timer due on the same tick and one due later
+	init(&a);
+	init(&b);
+	init(&c);
+	a.cancel = &b.timer;
+	b.cancel = &a.timer;
+	tw_schedule(_wheel, &a.timer, 70 * RESOLUTION_MS);
+	tw_schedule(_wheel, &b.timer, 70 * RESOLUTION_MS);
+	tw_schedule(_wheel, &c.timer, 200 * RESOLUTION_MS);
+	init(&probes[1]);
+	probes[1].cancel = &c.timer;
+	tw_schedule(_wheel, &probes[1].timer, 69 * RESOLUTION_MS);
+	CHECK(advance_to(_tick + 300) == 2);
+	CHECK((a.fired + b.fired) == 1 && !c.fired && probes[1].fired == 1);
+	CHECK(_wheel->active == 1);
+
+	// A callback reschedules its own timer, across a level boundary
+	init(&a);
+	a.reschedule = 4100;
+	tw_schedule(_wheel, &a.timer, 5 * RESOLUTION_MS);
+	const uint64_t rearmed = _tick + 5;
+	CHECK(advance_to(rearmed + 4100) == 2 && a.fired == 2 && a.fired_at == rearmed + 4100);
+
+	// Beyond the top level the timer is parked and still fires on time
+	init(&far);
+	const uint64_t parked = _tick + ((uint64_t) 1 << 24) + 100;
+	tw_schedule(_wheel, &far.timer, (((uint64_t) 1 << 24) + 100) * RESOLUTION_MS);
+	CHECK(advance_to(parked - 1) == 0 && tw_pending(&far.timer));
+	CHECK(advance_to(parked) == 1 && far.fired_at == parked);
+
+	// The next timeout is the next tick boundary while anything is pending
+	CHECK(tw_next_timeout(_wheel, _wheel->start_ms + _tick * RESOLUTION_MS) == RESOLUTION_MS);
+	tw_cancel(_wheel, &anchor.timer);
+	CHECK(tw_next_timeout(_wheel, _wheel->start_ms + _tick * RESOLUTION_MS) == -1);
+	CHECK(!anchor.fired);
+
+	tw_destroy(_wheel);
+
+	TEST_END();
+}